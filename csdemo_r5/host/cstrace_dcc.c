@@ -0,0 +1,127 @@
+/*
+  cstrace_dcc - turn trace read from the DCC back into the frame stream
+
+  Copyright (C) ARM Limited, 2014-2016. All rights reserved.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/*
+  Host side of the DCC transport in trace_dcc.c, standing in for the
+  debugger end of the channel.  Reads the 32-bit words a debugger took
+  from DBGDTRTX, each saved little-endian, from a file or a pipe ("-" for
+  stdin), and writes the frames in their chunks out as the byte stream
+  the UART transport would have sent, for cstrace_recv:
+
+    cstrace_dcc dcc.bin | cstrace_recv -o cstrace.bin /dev/stdin
+
+  Words that are not a chunk header where one is expected are skipped,
+  so a capture may start mid-chunk.  Build with:
+
+    cc -O2 -o cstrace_dcc cstrace_dcc.c
+
+  Usage: cstrace_dcc [-o frames.bin] <word file or ->
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+/* Must match trace_dcc.h and write_uart.h */
+#define TRACE_DCC_CHUNK		0x54440000U
+#define TRACE_DCC_CHUNK_MASK	0xFFFF0000U
+#define UART_TRACE_MAX_PAYLOAD	2048U
+#define UART_TRACE_OVERHEAD	16U
+
+static int read_word(FILE *in, uint32_t *word)
+{
+    unsigned char b[4];
+
+    if (fread(b, 1, 4, in) != 4) {
+	return -1;
+    }
+    *word = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t) b[3] << 24);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static unsigned char frame[UART_TRACE_MAX_PAYLOAD + UART_TRACE_OVERHEAD + 3];
+    char const *out_name = NULL;
+    unsigned long chunks = 0, skipped = 0, truncated = 0;
+    uint32_t word, len, i;
+    FILE *in, *out = stdout;
+    int c;
+
+    while ((c = getopt(argc, argv, "o:")) != -1) {
+	if (c != 'o') {
+	    fprintf(stderr, "usage: cstrace_dcc [-o frames.bin] <word file or ->\n");
+	    return EXIT_FAILURE;
+	}
+	out_name = optarg;
+    }
+    if (optind != argc - 1) {
+	fprintf(stderr, "usage: cstrace_dcc [-o frames.bin] <word file or ->\n");
+	return EXIT_FAILURE;
+    }
+    if (strcmp(argv[optind], "-") == 0) {
+	in = stdin;
+    } else if ((in = fopen(argv[optind], "rb")) == NULL) {
+	perror(argv[optind]);
+	return EXIT_FAILURE;
+    }
+    if (out_name != NULL && (out = fopen(out_name, "wb")) == NULL) {
+	perror(out_name);
+	return EXIT_FAILURE;
+    }
+
+    while (read_word(in, &word) == 0) {
+	len = word & ~TRACE_DCC_CHUNK_MASK;
+	if ((word & TRACE_DCC_CHUNK_MASK) != TRACE_DCC_CHUNK
+	    || len < UART_TRACE_OVERHEAD
+	    || len > UART_TRACE_MAX_PAYLOAD + UART_TRACE_OVERHEAD) {
+	    ++skipped;
+	    continue;
+	}
+	for (i = 0; i < len; i += 4) {
+	    if (read_word(in, &word) != 0) {
+		break;
+	    }
+	    frame[i] = word;
+	    frame[i + 1] = word >> 8;
+	    frame[i + 2] = word >> 16;
+	    frame[i + 3] = word >> 24;
+	}
+	if (i < len) {
+	    ++truncated;
+	    break;
+	}
+	/* Pass the frame on as soon as it is complete, for a live pipe */
+	fwrite(frame, 1, len, out);
+	fflush(out);
+	++chunks;
+    }
+    if (in != stdin) {
+	fclose(in);
+    }
+    if (out != stdout) {
+	fclose(out);
+    }
+    fprintf(stderr, "cstrace_dcc: %lu chunks, %lu words skipped%s\n",
+	    chunks, skipped, truncated ? ", last chunk truncated" : "");
+    return truncated ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* end of cstrace_dcc.c */
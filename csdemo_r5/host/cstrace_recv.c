@@ -0,0 +1,309 @@
+/*
+  cstrace_recv - receive framed trace from the csdemo UART transport
+
+  Copyright (C) ARM Limited, 2014-2016. All rights reserved.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/*
+  Host side of the framed trace transport in write_uart.c.  Reads a serial
+  port (or a capture of one), passes console text through to stdout,
+  checks each frame's length and CRC, reports frames lost or corrupted,
+  and writes the trace from good frames to the output file.  Trace
+  compressed by trace_lz.c on the target is decompressed, unless -r is
+  given.  Stops at the end frame.  Build with:
+
+    cc -O2 -o cstrace_recv cstrace_recv.c trace_unlz.c
+
+  Usage: cstrace_recv [-b baud] [-r] [-o cstrace.bin] <tty or file>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <termios.h>
+
+#include "trace_unlz.h"
+
+/* Must match write_uart.h */
+#define UART_TRACE_MAGIC	0x52545343U	/* "CSTR" */
+#define UART_TRACE_MAX_PAYLOAD	2048U
+#define UART_TRACE_OVERHEAD	16U
+#define UART_TRACE_DEFAULT_BAUD	921600U
+
+static uint32_t crc_table[256];
+
+static void crc_table_init(void)
+{
+    uint32_t i, j, c;
+
+    for (i = 0; i < 256; ++i) {
+	c = i;
+	for (j = 0; j < 8; ++j) {
+	    c = (c & 1) ? (0xEDB88320U ^ (c >> 1)) : (c >> 1);
+	}
+	crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32(uint32_t crc, unsigned char const *p, size_t n)
+{
+    crc = ~crc;
+    while (n-- > 0) {
+	crc = crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t get_le32(unsigned char const *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static speed_t baud_to_speed(unsigned int baud)
+{
+    switch (baud) {
+    case 115200:
+	return B115200;
+    case 230400:
+	return B230400;
+    case 460800:
+	return B460800;
+    case 921600:
+	return B921600;
+#ifdef B1000000
+    case 1000000:
+	return B1000000;
+    case 1500000:
+	return B1500000;
+    case 2000000:
+	return B2000000;
+    case 3000000:
+	return B3000000;
+    case 4000000:
+	return B4000000;
+#endif
+    default:
+	return 0;
+    }
+}
+
+/* Put a tty in raw mode at the baud rate; leave other files alone */
+static int setup_tty(int fd, unsigned int baud)
+{
+    struct termios t;
+    speed_t speed;
+
+    if (!isatty(fd)) {
+	return 0;
+    }
+    speed = baud_to_speed(baud);
+    if (speed == 0) {
+	fprintf(stderr, "cstrace_recv: unsupported baud rate %u\n", baud);
+	return -1;
+    }
+    if (tcgetattr(fd, &t) != 0) {
+	perror("cstrace_recv: tcgetattr");
+	return -1;
+    }
+    cfmakeraw(&t);
+    t.c_cflag |= CLOCAL | CREAD;
+    t.c_cflag &= ~(CSTOPB | CRTSCTS);
+    t.c_cc[VMIN] = 1;
+    t.c_cc[VTIME] = 0;
+    cfsetispeed(&t, speed);
+    cfsetospeed(&t, speed);
+    if (tcsetattr(fd, TCSANOW, &t) != 0) {
+	perror("cstrace_recv: tcsetattr");
+	return -1;
+    }
+    tcflush(fd, TCIFLUSH);
+    return 0;
+}
+
+struct recv_stats {
+    unsigned long frames;
+    unsigned long long bytes;
+    unsigned long lost;
+    unsigned long crc_errors;
+    unsigned long long payload;	/* bytes received, before decompression */
+};
+
+/* Write a frame's payload, decompressing it if the dump is compressed */
+static int write_payload(FILE *out, trace_unlz_t *u, int *compressed,
+			 unsigned char const *p, size_t len,
+			 struct recv_stats *st)
+{
+    if (st->payload == 0 && *compressed < 0) {
+	*compressed = trace_unlz_is_stream(p, len);
+    }
+    st->payload += len;
+    if (*compressed > 0) {
+	if (trace_unlz_write(u, p, len) != 0) {
+	    return -1;
+	}
+	st->bytes = u->out_bytes;
+    } else {
+	fwrite(p, 1, len, out);
+	st->bytes += len;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static unsigned char buf[4 * (UART_TRACE_MAX_PAYLOAD +
+				  UART_TRACE_OVERHEAD)];
+    static trace_unlz_t unlz;
+    char const *out_name = "cstrace.bin";
+    unsigned int baud = UART_TRACE_DEFAULT_BAUD;
+    struct recv_stats st;
+    uint32_t expect_seq = 0, seq, len;
+    size_t have = 0, pos, frame_len;
+    int in, c, done = 0, in_garbage = 0, compressed = -1, bad_stream = 0;
+    FILE *out;
+    ssize_t n;
+
+    while ((c = getopt(argc, argv, "b:o:r")) != -1) {
+	switch (c) {
+	case 'b':
+	    baud = strtoul(optarg, NULL, 0);
+	    break;
+	case 'o':
+	    out_name = optarg;
+	    break;
+	case 'r':
+	    compressed = 0;
+	    break;
+	default:
+	    fprintf(stderr,
+		    "usage: cstrace_recv [-b baud] [-r] [-o cstrace.bin] <tty or file>\n");
+	    return EXIT_FAILURE;
+	}
+    }
+    if (optind != argc - 1) {
+	fprintf(stderr,
+		"usage: cstrace_recv [-b baud] [-r] [-o cstrace.bin] <tty or file>\n");
+	return EXIT_FAILURE;
+    }
+    in = open(argv[optind], O_RDONLY | O_NOCTTY);
+    if (in < 0) {
+	perror(argv[optind]);
+	return EXIT_FAILURE;
+    }
+    if (setup_tty(in, baud) != 0) {
+	return EXIT_FAILURE;
+    }
+    out = fopen(out_name, "wb");
+    if (out == NULL) {
+	perror(out_name);
+	return EXIT_FAILURE;
+    }
+    crc_table_init();
+    memset(&st, 0, sizeof st);
+    trace_unlz_init(&unlz, out);
+
+    while (!done) {
+	n = read(in, buf + have, sizeof buf - have);
+	if (n < 0 && errno == EINTR) {
+	    continue;
+	}
+	if (n <= 0) {
+	    break;
+	}
+	have += n;
+	pos = 0;
+	while (!done && have - pos >= 4) {
+	    if (get_le32(buf + pos) != UART_TRACE_MAGIC) {
+		/* Console text between frames, unless it is the rest of a
+		   damaged frame */
+		if (!in_garbage) {
+		    putchar(buf[pos]);
+		}
+		++pos;
+		continue;
+	    }
+	    if (have - pos < 12) {
+		break;
+	    }
+	    len = get_le32(buf + pos + 8);
+	    if (len > UART_TRACE_MAX_PAYLOAD) {
+		/* Not a frame after all: resynchronize past the magic */
+		pos += 4;
+		in_garbage = 1;
+		continue;
+	    }
+	    frame_len = len + UART_TRACE_OVERHEAD;
+	    if (have - pos < frame_len) {
+		break;
+	    }
+	    if (crc32(0, buf + pos + 4, len + 8) !=
+		get_le32(buf + pos + 12 + len)) {
+		++st.crc_errors;
+		pos += 4;
+		in_garbage = 1;
+		continue;
+	    }
+	    seq = get_le32(buf + pos + 4);
+	    if (seq != expect_seq) {
+		fprintf(stderr,
+			"cstrace_recv: expected frame %u, got %u: %u frames lost\n",
+			expect_seq, seq, seq - expect_seq);
+		st.lost += seq - expect_seq;
+	    }
+	    expect_seq = seq + 1;
+	    in_garbage = 0;
+	    if (len == 0) {
+		done = 1;
+	    } else {
+		if (!bad_stream
+		    && write_payload(out, &unlz, &compressed, buf + pos + 12,
+				     len, &st) != 0) {
+		    fprintf(stderr,
+			    "cstrace_recv: compressed trace is corrupt after frame %u\n",
+			    seq);
+		    bad_stream = 1;
+		}
+		++st.frames;
+	    }
+	    pos += frame_len;
+	}
+	memmove(buf, buf + pos, have - pos);
+	have -= pos;
+    }
+    if (compressed > 0 && !bad_stream && trace_unlz_finish(&unlz) != 0) {
+	fprintf(stderr, "cstrace_recv: compressed trace ends in a partial block\n");
+	bad_stream = 1;
+    }
+    fflush(stdout);
+    fclose(out);
+    close(in);
+    fprintf(stderr,
+	    "cstrace_recv: %llu bytes in %lu frames to %s, %lu lost, %lu CRC errors%s\n",
+	    st.bytes, st.frames, out_name, st.lost, st.crc_errors,
+	    done ? "" : ", no end frame");
+    if (compressed > 0 && st.payload != 0) {
+	fprintf(stderr,
+		"cstrace_recv: decompressed %llu bytes received, %.2fx\n",
+		st.payload, (double) st.bytes / st.payload);
+    }
+    return (done && st.lost == 0 && st.crc_errors == 0 && !bad_stream) ?
+	EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* end of cstrace_recv.c */
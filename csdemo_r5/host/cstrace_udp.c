@@ -0,0 +1,313 @@
+/*
+  cstrace_udp - receive trace streamed over UDP into a DS-5 snapshot
+
+  Copyright (C) ARM Limited, 2014-2016. All rights reserved.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/*
+  Host side of the UDP transport in trace_udp.c.  Listens on a UDP port,
+  puts the datagrams of a session back in order, tells the target which
+  are missing, and writes the files of the session (snapshot.ini, the
+  device .ini files, trace.ini and cstrace.bin) into a snapshot directory
+  for DS-5.  Stops at the end of the session.  Build with:
+
+    cc -O2 -o cstrace_udp cstrace_udp.c
+
+  Usage: cstrace_udp [-p port] [-d snapshot directory]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/* Must match trace_udp.h */
+#define TRACE_UDP_MAGIC		0x44555343U	/* "CSUD" */
+#define TRACE_UDP_STATUS_MAGIC	0x4E555343U	/* "CSUN" */
+#define TRACE_UDP_HEADER	12U
+#define TRACE_UDP_MAX_PAYLOAD	1408U
+#define TRACE_UDP_MAX_NACK	64U
+#define TRACE_UDP_WINDOW	32U
+#define TRACE_UDP_PORT		5555U
+#define TRACE_UDP_DATA		0U
+#define TRACE_UDP_OPEN		1U
+#define TRACE_UDP_END		2U
+
+/* Datagrams held for putting back in order; more than the sender's
+   window, so a resend can always be placed */
+#define REORDER		256U
+#define MAX_FILES	256U
+#define LINGER_MS	500
+
+struct datagram {
+    int have;
+    unsigned int type, file, len;
+    unsigned char data[TRACE_UDP_MAX_PAYLOAD];
+};
+
+static struct datagram reorder[REORDER];
+static FILE *files[MAX_FILES];
+static char names[MAX_FILES][64];
+static char const *dir = "snapshot";
+
+static uint32_t get_le32(unsigned char const *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void put_le32(unsigned char *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static FILE *file_of(unsigned int id)
+{
+    char path[512];
+
+    if (files[id] == NULL) {
+	if (names[id][0] == '\0') {
+	    if (id == 0) {
+		strcpy(names[id], "cstrace.bin");
+	    } else {
+		sprintf(names[id], "file_%u.bin", id);
+	    }
+	}
+	snprintf(path, sizeof path, "%s/%s", dir, names[id]);
+	files[id] = fopen(path, "wb");
+	if (files[id] == NULL) {
+	    perror(path);
+	    exit(EXIT_FAILURE);
+	}
+    }
+    return files[id];
+}
+
+/* Act on a datagram, in order.  Returns non-zero at the end. */
+static int deliver(struct datagram const *d, unsigned long long *bytes)
+{
+    unsigned int len;
+
+    switch (d->type) {
+    case TRACE_UDP_OPEN:
+	len = d->len < sizeof names[0] ? d->len : sizeof names[0] - 1;
+	if (files[d->file] != NULL) {
+	    fclose(files[d->file]);
+	    files[d->file] = NULL;
+	}
+	memcpy(names[d->file], d->data, len);
+	names[d->file][len] = '\0';
+	/* Keep to the snapshot directory */
+	if (strchr(names[d->file], '/') != NULL || names[d->file][0] == '.') {
+	    fprintf(stderr, "cstrace_udp: ignoring file name %s\n", names[d->file]);
+	    names[d->file][0] = '\0';
+	}
+	(void) file_of(d->file);
+	return 0;
+    case TRACE_UDP_DATA:
+	fwrite(d->data, 1, d->len, file_of(d->file));
+	*bytes += d->len;
+	return 0;
+    case TRACE_UDP_END:
+	return 1;
+    default:
+	return 0;
+    }
+}
+
+/* Tell the target how far it has got, and what is missing after that */
+static void send_status(int sock, struct sockaddr_in const *to, uint32_t next,
+			uint32_t highest)
+{
+    unsigned char buf[12 + 4 * TRACE_UDP_MAX_NACK];
+    unsigned int n = 0;
+    uint32_t seq;
+
+    for (seq = next; seq - next < highest - next && n < TRACE_UDP_MAX_NACK;
+	 ++seq) {
+	if (!reorder[seq % REORDER].have) {
+	    put_le32(buf + 12 + 4 * n++, seq);
+	}
+    }
+    put_le32(buf, TRACE_UDP_STATUS_MAGIC);
+    put_le32(buf + 4, next);
+    buf[8] = n;
+    buf[9] = n >> 8;
+    buf[10] = 0;
+    buf[11] = 0;
+    (void) sendto(sock, buf, 12 + 4 * n, 0, (struct sockaddr const *) to,
+		  sizeof *to);
+}
+
+int main(int argc, char **argv)
+{
+    static unsigned char buf[65536];
+    unsigned int port = TRACE_UDP_PORT;
+    struct sockaddr_in addr, from;
+    socklen_t from_len;
+    struct pollfd pfd;
+    uint32_t next = 0, highest = 0, seq;
+    unsigned long datagrams = 0, duplicates = 0, out_of_order = 0;
+    unsigned long since_status = 0;
+    unsigned long long bytes = 0;
+    double start = 0, end_time = 0;
+    struct datagram *d;
+    unsigned int i, len;
+    int sock, c, done = 0, started = 0;
+    ssize_t n;
+    char path[512];
+
+    while ((c = getopt(argc, argv, "p:d:")) != -1) {
+	switch (c) {
+	case 'p':
+	    port = strtoul(optarg, NULL, 0);
+	    break;
+	case 'd':
+	    dir = optarg;
+	    break;
+	default:
+	    fprintf(stderr, "usage: cstrace_udp [-p port] [-d snapshot directory]\n");
+	    return EXIT_FAILURE;
+	}
+    }
+    if (optind != argc) {
+	fprintf(stderr, "usage: cstrace_udp [-p port] [-d snapshot directory]\n");
+	return EXIT_FAILURE;
+    }
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+	perror(dir);
+	return EXIT_FAILURE;
+    }
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+	perror("cstrace_udp: socket");
+	return EXIT_FAILURE;
+    }
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(sock, (struct sockaddr *) &addr, sizeof addr) != 0) {
+	perror("cstrace_udp: bind");
+	return EXIT_FAILURE;
+    }
+    i = 4 << 20;
+    (void) setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &i, sizeof i);
+    fprintf(stderr, "cstrace_udp: listening on port %u, writing to %s/\n",
+	    port, dir);
+
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    /* After the end, answer resends of END for a while, in case the
+       target missed the last status */
+    while (!done || (now() - end_time) * 1000 < LINGER_MS) {
+	if (done && poll(&pfd, 1, LINGER_MS / 10) <= 0) {
+	    continue;
+	}
+	from_len = sizeof from;
+	n = recvfrom(sock, buf, sizeof buf, 0, (struct sockaddr *) &from,
+		     &from_len);
+	if (n < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    perror("cstrace_udp: recvfrom");
+	    break;
+	}
+	if ((size_t) n < TRACE_UDP_HEADER || get_le32(buf) != TRACE_UDP_MAGIC) {
+	    continue;
+	}
+	seq = get_le32(buf + 4);
+	len = buf[10] | (buf[11] << 8);
+	if (len > TRACE_UDP_MAX_PAYLOAD || TRACE_UDP_HEADER + len > (size_t) n) {
+	    continue;
+	}
+	if (!started) {
+	    start = now();
+	    started = 1;
+	}
+	++datagrams;
+	if (seq - next >= REORDER || reorder[seq % REORDER].have) {
+	    /* Already had it: the target missed a status */
+	    ++duplicates;
+	    send_status(sock, &from, next, highest);
+	    continue;
+	}
+	if (seq != next) {
+	    ++out_of_order;
+	}
+	if (seq - next >= highest - next) {
+	    highest = seq + 1;
+	}
+	d = &reorder[seq % REORDER];
+	d->have = 1;
+	d->type = buf[8];
+	d->file = buf[9];
+	d->len = len;
+	memcpy(d->data, buf + TRACE_UDP_HEADER, len);
+	while (!done && reorder[next % REORDER].have) {
+	    d = &reorder[next % REORDER];
+	    done = deliver(d, &bytes);
+	    d->have = 0;
+	    ++next;
+	    ++since_status;
+	}
+	if (done && end_time == 0) {
+	    end_time = now();
+	}
+	if (done || next != highest || since_status >= TRACE_UDP_WINDOW / 4) {
+	    send_status(sock, &from, next, highest);
+	    since_status = 0;
+	}
+    }
+    for (i = 0; i < MAX_FILES; ++i) {
+	if (files[i] != NULL) {
+	    fclose(files[i]);
+	}
+    }
+    close(sock);
+    fprintf(stderr,
+	    "cstrace_udp: %llu bytes of data in %lu datagrams, %lu out of order, %lu duplicates%s\n",
+	    bytes, datagrams, out_of_order, duplicates,
+	    done ? "" : ", no end of session");
+    if (done && end_time > start) {
+	fprintf(stderr, "cstrace_udp: %.1f MB/s\n",
+		bytes / (end_time - start) / 1e6);
+    }
+    snprintf(path, sizeof path, "%s/snapshot.ini", dir);
+    if (done && access(path, F_OK) != 0) {
+	fprintf(stderr, "cstrace_udp: the target sent no snapshot.ini, %s/ holds the trace only\n", dir);
+    }
+    return done ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* end of cstrace_udp.c */
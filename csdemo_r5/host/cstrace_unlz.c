@@ -0,0 +1,86 @@
+/*
+  cstrace_unlz - decompress trace compressed on the target by trace_lz.c
+
+  Copyright (C) ARM Limited, 2014-2016. All rights reserved.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/*
+  For compressed trace captured without cstrace_recv, which decompresses
+  as it receives.  Build with:
+
+    cc -O2 -o cstrace_unlz cstrace_unlz.c trace_unlz.c
+
+  Usage: cstrace_unlz [-o cstrace.bin] <compressed file>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "trace_unlz.h"
+
+int main(int argc, char **argv)
+{
+    static trace_unlz_t u;
+    static unsigned char buf[65536];
+    char const *out_name = "cstrace.bin";
+    FILE *in, *out;
+    size_t n;
+    int c, rc = 0;
+
+    while ((c = getopt(argc, argv, "o:")) != -1) {
+	if (c != 'o') {
+	    fprintf(stderr,
+		    "usage: cstrace_unlz [-o cstrace.bin] <compressed file>\n");
+	    return EXIT_FAILURE;
+	}
+	out_name = optarg;
+    }
+    if (optind != argc - 1) {
+	fprintf(stderr,
+		"usage: cstrace_unlz [-o cstrace.bin] <compressed file>\n");
+	return EXIT_FAILURE;
+    }
+    in = fopen(argv[optind], "rb");
+    if (in == NULL) {
+	perror(argv[optind]);
+	return EXIT_FAILURE;
+    }
+    out = fopen(out_name, "wb");
+    if (out == NULL) {
+	perror(out_name);
+	return EXIT_FAILURE;
+    }
+    trace_unlz_init(&u, out);
+    while (rc == 0 && (n = fread(buf, 1, sizeof buf, in)) > 0) {
+	rc = trace_unlz_write(&u, buf, n);
+    }
+    if (rc == 0) {
+	rc = trace_unlz_finish(&u);
+    }
+    fclose(in);
+    fclose(out);
+    if (rc != 0) {
+	fprintf(stderr, "cstrace_unlz: corrupt stream after %llu bytes\n",
+		u.in_bytes);
+	return EXIT_FAILURE;
+    }
+    fprintf(stderr, "cstrace_unlz: %llu bytes in %lu blocks to %llu bytes of trace, %.2fx\n",
+	    u.in_bytes, u.blocks, u.out_bytes,
+	    u.in_bytes ? (double) u.out_bytes / u.in_bytes : 0.0);
+    return EXIT_SUCCESS;
+}
+
+/* end of cstrace_unlz.c */
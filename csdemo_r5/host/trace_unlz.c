@@ -0,0 +1,204 @@
+/*
+  trace_unlz - undo the trace compression of trace_lz.c on the host
+
+  Copyright (C) ARM Limited, 2014-2016. All rights reserved.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <string.h>
+
+#include "trace_unlz.h"
+
+static unsigned int get_le16(unsigned char const *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+/* Read the rest of a length of 15 or more */
+static int get_length(unsigned char const **ip, unsigned char const *iend,
+		      size_t *len)
+{
+    unsigned char b;
+
+    do {
+	if (*ip >= iend) {
+	    return -1;
+	}
+	b = *(*ip)++;
+	*len += b;
+    } while (b == 255);
+    return 0;
+}
+
+static int lz_decode(unsigned char const *ip, size_t n, unsigned char *dst,
+		     size_t raw)
+{
+    unsigned char const *const iend = ip + n;
+    unsigned char *op = dst;
+    unsigned char *const oend = dst + raw;
+    size_t lit, len, off, i;
+    unsigned char token;
+
+    while (ip < iend) {
+	token = *ip++;
+	lit = token >> 4;
+	if (lit == 15 && get_length(&ip, iend, &lit) != 0) {
+	    return -1;
+	}
+	if (lit > (size_t) (iend - ip) || lit > (size_t) (oend - op)) {
+	    return -1;
+	}
+	memcpy(op, ip, lit);
+	op += lit;
+	ip += lit;
+	if (ip == iend) {
+	    break;
+	}
+	if (iend - ip < 2) {
+	    return -1;
+	}
+	off = get_le16(ip);
+	ip += 2;
+	len = token & 15;
+	if (len == 15 && get_length(&ip, iend, &len) != 0) {
+	    return -1;
+	}
+	len += TRACE_LZ_MIN_MATCH;
+	if (off == 0 || off > (size_t) (op - dst)
+	    || len > (size_t) (oend - op)) {
+	    return -1;
+	}
+	/* Byte by byte, as a match may overlap what it copies */
+	for (i = 0; i < len; ++i) {
+	    op[i] = op[i - off];
+	}
+	op += len;
+    }
+    return (op == oend) ? 0 : -1;
+}
+
+/* Put the flag bytes back at the end of each frame */
+static void frame_unfilter(unsigned char const *src, size_t n,
+			   unsigned char *dst)
+{
+    size_t const n_frames = n / TRACE_LZ_FRAME;
+    unsigned char const *flags = src + n_frames * (TRACE_LZ_FRAME - 1);
+    size_t i;
+
+    for (i = 0; i < n_frames; ++i) {
+	memcpy(dst, src, TRACE_LZ_FRAME - 1);
+	dst[TRACE_LZ_FRAME - 1] = flags[i];
+	src += TRACE_LZ_FRAME - 1;
+	dst += TRACE_LZ_FRAME;
+    }
+}
+
+static int unlz_block(trace_unlz_t *u, unsigned char const *b,
+		      unsigned int flags, size_t raw, size_t stored)
+{
+    unsigned char const *data = b;
+
+    if (flags & TRACE_LZ_FLAG_LZ) {
+	if (lz_decode(b, stored, u->raw, raw) != 0) {
+	    return -1;
+	}
+	data = u->raw;
+    } else if (stored != raw) {
+	return -1;
+    }
+    if (flags & TRACE_LZ_FLAG_FRAMES) {
+	if ((raw % TRACE_LZ_FRAME) != 0) {
+	    return -1;
+	}
+	frame_unfilter(data, raw, u->frames);
+	data = u->frames;
+    }
+    fwrite(data, 1, raw, u->out);
+    ++u->blocks;
+    u->out_bytes += raw;
+    return 0;
+}
+
+int trace_unlz_is_stream(void const *data, size_t n)
+{
+    unsigned char const *p = (unsigned char const *) data;
+
+    return n >= 4
+	&& (get_le16(p) | ((unsigned long) get_le16(p + 2) << 16)) ==
+	TRACE_LZ_MAGIC;
+}
+
+void trace_unlz_init(trace_unlz_t *u, FILE *out)
+{
+    u->out = out;
+    u->started = 0;
+    u->have = 0;
+    u->blocks = 0;
+    u->in_bytes = 0;
+    u->out_bytes = 0;
+}
+
+int trace_unlz_write(trace_unlz_t *u, void const *data, size_t n)
+{
+    unsigned char const *p = (unsigned char const *) data;
+    size_t pos, raw, stored, take;
+
+    u->in_bytes += n;
+    while (n > 0) {
+	take = sizeof u->buf - u->have;
+	if (take > n) {
+	    take = n;
+	}
+	memcpy(u->buf + u->have, p, take);
+	u->have += take;
+	p += take;
+	n -= take;
+	pos = 0;
+	if (!u->started) {
+	    if (u->have < 4) {
+		continue;
+	    }
+	    if (!trace_unlz_is_stream(u->buf, u->have)) {
+		return -1;
+	    }
+	    u->started = 1;
+	    pos = 4;
+	}
+	while (u->have - pos >= TRACE_LZ_HEADER) {
+	    raw = get_le16(u->buf + pos + 1);
+	    stored = get_le16(u->buf + pos + 3);
+	    if (raw == 0 || raw > TRACE_LZ_BLOCK || stored > TRACE_LZ_BLOCK) {
+		return -1;
+	    }
+	    if (u->have - pos < TRACE_LZ_HEADER + stored) {
+		break;
+	    }
+	    if (unlz_block(u, u->buf + pos + TRACE_LZ_HEADER, u->buf[pos],
+			   raw, stored) != 0) {
+		return -1;
+	    }
+	    pos += TRACE_LZ_HEADER + stored;
+	}
+	memmove(u->buf, u->buf + pos, u->have - pos);
+	u->have -= pos;
+    }
+    return 0;
+}
+
+int trace_unlz_finish(trace_unlz_t *u)
+{
+    return (u->have == 0) ? 0 : -1;
+}
+
+/* end of trace_unlz.c */
@@ -0,0 +1,60 @@
+/*
+  trace_unlz - undo the trace compression of trace_lz.c on the host
+
+  Copyright (C) ARM Limited, 2014-2016. All rights reserved.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef _included_trace_unlz_h
+#define _included_trace_unlz_h
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* Must match include/trace_lz.h */
+#define TRACE_LZ_MAGIC		0x5A4C5343U	/* "CSLZ" */
+#define TRACE_LZ_BLOCK		16384U
+#define TRACE_LZ_HEADER		5U
+#define TRACE_LZ_FLAG_LZ	0x01U
+#define TRACE_LZ_FLAG_FRAMES	0x02U
+#define TRACE_LZ_FRAME		16U
+#define TRACE_LZ_MIN_MATCH	4U
+
+typedef struct trace_unlz {
+    FILE *out;			/* where the trace goes */
+    int started;		/* the magic has been seen */
+    size_t have;		/* bytes waiting in buf */
+    unsigned long blocks;
+    unsigned long long in_bytes;	/* compressed bytes, headers included */
+    unsigned long long out_bytes;	/* trace written */
+    unsigned char buf[TRACE_LZ_HEADER + TRACE_LZ_BLOCK];
+    unsigned char raw[TRACE_LZ_BLOCK];
+    unsigned char frames[TRACE_LZ_BLOCK];
+} trace_unlz_t;
+
+/* Non-zero if the data starts a compressed stream */
+int trace_unlz_is_stream(void const *data, size_t n);
+
+void trace_unlz_init(trace_unlz_t *u, FILE *out);
+
+/* Decompress the next part of a stream, writing whole blocks of trace
+   out as they complete.  Returns 0, or -1 if the stream is corrupt. */
+int trace_unlz_write(trace_unlz_t *u, void const *data, size_t n);
+
+/* Returns 0 if the stream ended on a block boundary, else -1 */
+int trace_unlz_finish(trace_unlz_t *u);
+
+#endif				/* _included_trace_unlz_h */
+
+/* end of trace_unlz.h */
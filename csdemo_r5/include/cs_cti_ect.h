@@ -108,6 +108,19 @@ unsigned int cs_cti_trigin_status(cs_device_t cti);
  */
 unsigned int cs_cti_trigout_status(cs_device_t cti);
 
+/** Acknowledge a trigger output, e.g. one used as an interrupt request.
+ * Writes the CTIINTACK register, which clears the output until the
+ * channels driving it are next active.
+ *
+ * Safe to call from an interrupt handler: the register is written
+ * directly, without batching, shadowing or counting.  The CTI must
+ * already be unlocked, as it is once a channel has been configured on it.
+ *
+ * \param cti      Target CTI Device
+ * \param ctiport  Trigger output port number
+ */
+int cs_cti_ack_trigout(cs_device_t cti, unsigned int ctiport);
+
 /**
  *  Program a CTI to something approximating its reset state:
  *
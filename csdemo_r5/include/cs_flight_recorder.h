@@ -0,0 +1,112 @@
+/*!
+ * \file       cs_flight_recorder.h
+ * \brief      CS Access API - triggered snapshots of a trace buffer
+ *
+ * \copyright  Copyright (C) ARM Limited, 2014-2016. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _included_cs_flight_recorder_h
+#define _included_cs_flight_recorder_h
+
+/**
+   \defgroup flightrec Flight recorder
+
+   A trace buffer captures continuously in circular mode.  When a trigger
+   arrives at its TRIGIN, it captures a programmed number of bytes more
+   and stops, so it holds the trace leading up to and just after the
+   trigger.  The snapshot is copied into a ring of snapshots and the
+   buffer is re-armed, so rare events can be caught without shipping
+   trace off-chip continuously.
+
+   Triggers are hardware trigger sources routed through the CTIs, e.g. a
+   CTI input, an STM trigger output or a PMU overflow, and the software
+   trigger cs_flight_recorder_trigger().
+   @{
+*/
+
+/** Header of a snapshot in the snapshot ring.  The trace follows it. */
+typedef struct cs_flight_snapshot {
+    unsigned int seq;		/**< Snapshot number, counting from 0 */
+    unsigned int size;		/**< Bytes of trace following the header */
+    unsigned long long cycles;	/**< Register access backend clock when the snapshot was read, or 0 */
+} cs_flight_snapshot_t;
+
+/** Flight recorder configuration, see cs_flight_recorder_start() */
+typedef struct cs_flight_recorder_config {
+    cs_trigsrc_t const *triggers;	/**< Hardware trigger sources, e.g. from cs_trigsrc() or cs_cti_trigsrc() */
+    unsigned int n_triggers;	/**< Number of hardware trigger sources, 0 for software triggers only */
+    unsigned int post_trigger_bytes;	/**< Trace to capture after the trigger, at most the buffer size */
+    unsigned int max_snapshots;	/**< Stop after this many snapshots, or 0 to keep re-arming */
+    void *store;		/**< Snapshot ring, 8-byte aligned */
+    unsigned int store_size;	/**< Size of the snapshot ring, at least one snapshot */
+} cs_flight_recorder_config_t;
+
+/** Flight recorder state */
+typedef struct cs_flight_recorder {
+    cs_device_t buffer;		/**< The ETB, ETF or ETR capturing trace */
+    cs_trigdst_t trigin;	/**< CTI trigger output driving the buffer's TRIGIN */
+    unsigned int channel;	/**< CTI channel routed to TRIGIN */
+    unsigned int post_trigger_bytes;	/**< Trace captured after each trigger */
+    unsigned int max_snapshots;	/**< Snapshots to take, or 0 for no limit */
+    unsigned char *store;	/**< Snapshot ring */
+    unsigned int slot_size;	/**< Bytes per snapshot, header included */
+    unsigned int n_slots;	/**< Snapshots the ring holds */
+    unsigned int n_snapshots;	/**< Snapshots taken so far */
+    int armed;			/**< Buffer is capturing, waiting for a trigger */
+} cs_flight_recorder_t;
+
+/**
+   Route the triggers to a trace buffer's TRIGIN and arm it.  The buffer
+   must be connected to a CTI in the registration.  An ETR must have been
+   set up with cs_etr_enable() and then disabled, and keeps its buffer.
+
+   \param r       Flight recorder state, initialized by this call
+   \param buffer  The ETB, ETF or ETR
+   \param config  Triggers, post-trigger size and snapshot ring
+*/
+int cs_flight_recorder_start(cs_flight_recorder_t *r, cs_device_t buffer,
+			     cs_flight_recorder_config_t const *config);
+
+/** Trigger the flight recorder from software, e.g. on detecting a latency spike */
+int cs_flight_recorder_trigger(cs_flight_recorder_t *r);
+
+/**
+   Check whether the buffer has stopped after a trigger.  If it has, copy
+   its trace into the next slot of the snapshot ring, overwriting the
+   oldest snapshot when the ring is full, and re-arm the buffer unless
+   max_snapshots have been taken.
+   \return 1 if a snapshot was taken, 0 if not, < 0 on error
+*/
+int cs_flight_recorder_poll(cs_flight_recorder_t *r);
+
+/** Number of snapshots held in the snapshot ring */
+unsigned int cs_flight_recorder_count(cs_flight_recorder_t const *r);
+
+/** Get a snapshot from the snapshot ring, with \a i = 0 the oldest held.
+ *  \return the snapshot header, followed by its trace, or NULL
+ */
+cs_flight_snapshot_t const *cs_flight_recorder_get(cs_flight_recorder_t const *r,
+						   unsigned int i);
+
+/** Disarm the flight recorder: disable the buffer and disconnect its
+ *  TRIGIN from the trigger channel.  Snapshots stay in the ring.
+ */
+int cs_flight_recorder_stop(cs_flight_recorder_t *r);
+
+/** @} */
+
+#endif				/* _included_cs_flight_recorder_h */
+
+/* end of  cs_flight_recorder.h */
@@ -26,9 +26,41 @@
  * @{
  */
 
-/** Initialize the library and start registration */
+/** Register access backends, selected when the library is initialized. */
+typedef enum {
+    CS_ACCESS_DEFAULT,	/**< Simulator if built with CS_SIM, /dev/mem on Linux, otherwise MMIO */
+    CS_ACCESS_MMIO,	/**< Direct memory-mapped access to physical addresses (bare-metal) */
+    CS_ACCESS_DEVMEM,	/**< Mappings of /dev/mem (Linux userspace only) */
+    CS_ACCESS_SIM	/**< Simulated Zynq UltraScale+ CoreSight subsystem (built with CS_SIM) */
+} cs_access_backend_t;
+
+/** Initialize the library and start registration, using the default
+ *  register access backend. */
 int cs_init(void);
 
+/** Initialize the library and start registration, using a specific
+ *  register access backend.
+ *  \param backend  the backend to use for all device and ROM table accesses
+ *  \return 0 on success, or < 0 if the backend is not available in this build
+ */
+int cs_init_backend(cs_access_backend_t backend);
+
+/** Give the library a memory region for its device registry.
+ *
+ *  Devices, ECT channels, STM port tables and lookup tables are allocated
+ *  from this region rather than the heap, and all released at once by
+ *  cs_shutdown().  By default the library uses a static region of
+ *  CS_REGISTRY_ARENA_SIZE bytes (default 32K, enough for about 50 devices),
+ *  placed in section CS_REGISTRY_ARENA_SECTION if that is defined.  A
+ *  region in TCM gives faster register access bookkeeping.  If the region
+ *  fills up, the heap is used.
+ *
+ *  Call this before cs_init(), or after cs_shutdown().
+ *  \param mem   start of the region, or NULL to allocate from the heap only
+ *  \param size  size of the region in bytes
+ */
+int cs_registry_set_memory(void *mem, unsigned int size);
+
 /** Set the default for diagnostic tracing messages from the API
  *  \param n   set to 1 to produce diagnostic messages
  */
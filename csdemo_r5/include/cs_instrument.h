@@ -0,0 +1,100 @@
+/*!
+ * \file       cs_instrument.h
+ * \brief      CS Access API - register access instrumentation.
+ *
+ * \copyright  Copyright (C) ARM Limited, 2014-2016. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _included_cs_instrument_h
+#define _included_cs_instrument_h
+
+#include "cs_types.h"
+
+/** \defgroup instrument Register access instrumentation
+ *
+ *  The library always counts register reads, writes, barriers and wait-loop
+ *  polls for each device (see cs_device_get_access_stats()).  With
+ *  instrumentation enabled it also times register accesses, and keeps the
+ *  same counters for the main trace setup entry points:
+ *  cs_sink_enable(), cs_sink_disable(), cs_etf_enable(), cs_etf_disable(),
+ *  cs_etr_enable(), cs_disable_tpiu(), cs_empty_trace_buffer(),
+ *  cs_get_trace_data(), cs_etf_stream_start(), cs_etf_stream_stop(),
+ *  cs_set_trace_source_id(), cs_trace_enable(),
+ *  cs_trace_disable(), cs_trace_enable_timestamps(),
+ *  cs_trace_enable_cycle_accurate(), cs_paths_enable(), cs_routes_enable(),
+ *  cs_trace_session_start(), cs_trace_session_stop(),
+ *  cs_etm_config_put_ex(), cs_ect_configure() and cs_checkpoint().
+ *
+ *  Counts for an entry point include those of any other entry point it
+ *  calls.  Each entry point also has a histogram of the time taken by its
+ *  calls, in #CS_INSTRUMENT_HIST_BUCKETS buckets that are each four times
+ *  as wide as the one before: bucket 0 counts calls of under 4 ticks,
+ *  bucket i calls of 4^i to 4^(i+1) - 1 ticks, and the last bucket all
+ *  longer calls.  Times are in ticks of the register access backend's clock: the
+ *  XTime global timer on the R5, nanoseconds for /dev/mem, and timestamp
+ *  generator ticks for the simulator.
+ *
+ *  The counters can be printed as a table, or exported as a binary record
+ *  with the following little-endian layout:
+ *
+ *  - header: u32 magic #CS_INSTRUMENT_MAGIC, u8 version, u8 0,
+ *    u16 number of devices, u16 number of entry points, u16 0
+ *  - counters for all devices
+ *  - for each device: u64 physical address, u8 #cs_devtype_t, u8 0,
+ *    u16 part number, counters
+ *  - for each entry point: u32 calls, counters,
+ *    #CS_INSTRUMENT_HIST_BUCKETS x u32 histogram, u8 name length, name
+ *
+ *  where "counters" is u32 bus_reads, bus_writes, reads_saved,
+ *  writes_saved, barriers, wait_iterations, then u64 cycles
+ *  (see #cs_reg_access_stats_t).
+ * @{
+ */
+
+#define CS_INSTRUMENT_MAGIC   0x52495343	/**< "CSIR" */
+#define CS_INSTRUMENT_VERSION 2
+#define CS_INSTRUMENT_HIST_BUCKETS 16	/**< Buckets in an entry point's latency histogram */
+
+/** Called from cs_shutdown() with the binary instrumentation record */
+typedef void (*cs_instrument_export_fn) (void const *record,
+					 unsigned int size);
+
+/** Enable or disable instrumentation.
+ *
+ *  When enabled, cs_shutdown() prints the instrumentation table, and passes
+ *  the binary record to \a export_fn if it is not NULL.  Call this after
+ *  cs_init(), which resets all library state.
+ *
+ *  \param enable     1 to enable timing and per-entry-point counters
+ *  \param export_fn  function to receive the binary record at shutdown, or NULL
+ */
+int cs_instrument_set(int enable, cs_instrument_export_fn export_fn);
+
+/** Print the instrumentation counters as a table */
+void cs_instrument_print(void);
+
+/** Build the binary instrumentation record.
+ *
+ *  \param buf   buffer for the record, or NULL to get the size needed
+ *  \param size  size of the buffer in bytes
+ *  \return size of the record, or < 0 if the buffer is too small
+ */
+int cs_instrument_record(void *buf, unsigned int size);
+
+/** @} */
+
+#endif				/* _included_cs_instrument_h */
+
+/* end of  cs_instrument.h */
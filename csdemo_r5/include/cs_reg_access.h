@@ -132,6 +132,8 @@ int cs_device_wait(cs_device_t dev, unsigned int offset,
  * 
  *   This applies to both the explicit cs_device_wait calls, and implicit library 
  *   functionality such as ETM programming that requires waiting on bits.
+ *   It is only used if the register access backend has no clock; otherwise
+ *   waits are bounded by time (see cs_device_set_wait_timeout()).
  *
  *   Library default is 32.
  *
@@ -139,6 +141,94 @@ int cs_device_wait(cs_device_t dev, unsigned int offset,
  */
 void cs_device_set_wait_repeats(int n_wait_repeat_count);
 
+/**
+ *   Time limit for waiting on bits to change in a register.
+ *
+ *   Applies to the same waits as cs_device_set_wait_repeats(), when the
+ *   register access backend has a clock (the global timer on the R5).
+ *   The delay between register checks starts at a fraction of a microsecond
+ *   and doubles up to 64us, to limit bus traffic while e.g. a formatter
+ *   drains.  The register is always checked once after the time limit.
+ *
+ *   Library default is 1000us.
+ *
+ *   \param timeout_us  time limit in microseconds
+ */
+void cs_device_set_wait_timeout(unsigned int timeout_us);
+
+/**
+ *   Start a batch of register writes.
+ *
+ *   Until the matching cs_reg_batch_commit(), checked register writes made by
+ *   the library or through cs_device_write(), cs_device_set() etc. are queued
+ *   rather than issued.  Repeated writes to the same register are coalesced
+ *   into one.  Reads of a queued register return the queued value.
+ *
+ *   Waits, write-only accesses and lock/unlock operations flush the queue
+ *   before they access the device, so ordering against them is preserved.
+ *
+ *   Batches may be nested; only the outermost commit issues the writes.
+ */
+int cs_reg_batch_begin(void);
+
+/**
+ *   End a batch of register writes started by cs_reg_batch_begin().
+ *
+ *   Issues the queued writes, followed by a single memory barrier.
+ */
+int cs_reg_batch_commit(void);
+
+/** Offset value for cs_device_shadow_invalidate(): invalidate all registers */
+#define CS_REG_SHADOW_ALL 0xFFFFFFFFU
+
+/**
+ *   Enable or disable the shadow register cache for a device.
+ *
+ *   With the shadow enabled, the library keeps a copy of the device's
+ *   configuration registers.  Reads of those registers are served from the
+ *   copy, and writes of the value a register already holds are suppressed,
+ *   so repeated configuration calls cause no bus traffic.  Status, pointer,
+ *   counter and self-clearing registers, and the management registers
+ *   (claim tags, lock, ID) are never shadowed.
+ *
+ *   With diagnostic checking, a register is read back on its first write
+ *   only, rather than on every write.
+ *
+ *   Supported for ETMs, funnels, replicators, trace buffers, TPIUs, CTIs and
+ *   timestamp generators.
+ *
+ *   \param dev     device descriptor
+ *   \param enable  1 to enable the shadow, 0 to disable and discard it
+ *   \return 0 on success, < 0 if the device type can't be shadowed
+ */
+int cs_device_set_shadowing(cs_device_t dev, int enable);
+
+/**
+ *   Discard shadowed register values, so that the next access goes to the
+ *   device.  Needed when registers may have changed other than through this
+ *   library, e.g. after the device was powered down or programmed by an
+ *   external debugger.
+ *
+ *   \param dev     device descriptor
+ *   \param offset  register offset, in bytes, or #CS_REG_SHADOW_ALL
+ */
+int cs_device_shadow_invalidate(cs_device_t dev, unsigned int offset);
+
+/**
+ *   Get register access counters.
+ *
+ *   The counters show how many register accesses reached the device, and
+ *   how many were saved by the shadow cache or a pending register batch.
+ *   Reading and resetting them around an API call gives the cost of the
+ *   call.
+ *
+ *   \param dev     device descriptor, or 0 for totals over all devices
+ *   \param stats   receives the counters
+ *   \param reset   if non-zero, reset the counters after reading them
+ */
+int cs_device_get_access_stats(cs_device_t dev,
+			       cs_reg_access_stats_t * stats, int reset);
+
 /** @} */
 
 #endif				/* _included_cs_reg_access_h */
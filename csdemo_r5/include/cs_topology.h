@@ -69,6 +69,29 @@ int cs_register_romtable(cs_physaddr_t addr);
  */
 cs_device_t cs_device_register(cs_physaddr_t addr);
 
+/** Save the device registry - devices and their static properties, ATB
+ *  connections, CPU affinities and trigger connections - as a binary blob.
+ *  A later session can restore it with cs_registry_load() instead of
+ *  scanning ROM tables and registering the topology again.  The blob is
+ *  only valid for the build of the library that saved it.
+ *  Call this after cs_registration_complete().
+ *  \param buf   buffer for the blob, or NULL to get the size needed
+ *  \param size  size of the buffer in bytes
+ *  \return size of the blob, or < 0 if the buffer is too small
+ */
+int cs_registry_save(void *buf, unsigned int size);
+
+/** Restore a device registry saved by cs_registry_save(), in place of
+ *  registering devices.  Call this after cs_init() and before registering
+ *  any devices; other registration calls (e.g. affinities or connections)
+ *  are then not needed, and cs_registration_complete() completes it.
+ *  The only register accesses are reads of each device's part number, to
+ *  check that the saved topology still matches the hardware.  If it does
+ *  not, or the blob is not valid, nothing is registered.
+ *  \return number of devices restored, or < 0 if the blob can't be used
+ */
+int cs_registry_load(void const *buf, unsigned int size);
+
 /** Exclude a range of physical addresses from ROM table probing.
     This avoids problems when some components are not accessible
     and would cause bus hangs if probed. */
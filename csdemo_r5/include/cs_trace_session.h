@@ -0,0 +1,106 @@
+/*!
+ * \file       cs_trace_session.h
+ * \brief      CS Access API - capturing into several trace sinks at once
+ *
+ * \copyright  Copyright (C) ARM Limited, 2014-2016. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _included_cs_trace_session_h
+#define _included_cs_trace_session_h
+
+/**
+   \defgroup session Multi-sink trace sessions
+
+   A trace session captures trace from several groups of sources into
+   several sinks at the same time, e.g. the A53 cluster into ETF-A53 as a
+   circular flight recorder while the R5s and the STM go through ETF-main
+   to the ETR.  The paths to all the sinks are routed together with
+   cs_routes_enable(), so replicator outputs only pass the trace ids of
+   the sources going to their sink.  ETFs on a path that are not sinks of
+   the session are put in hardware FIFO mode to pass trace on.
+
+   Stopping the session disables the sources, then stops all the sinks
+   together, so their captures end at the same point in the trace.
+   @{
+*/
+
+/** Maximum number of sinks in a session */
+#define CS_SESSION_MAX_SINKS 8
+
+/** Maximum number of ETFs a session enables to pass trace on */
+#define CS_SESSION_MAX_LINKS 4
+
+/** How a sink in a trace session holds its trace */
+typedef enum cs_sink_mode {
+    CS_SINK_MODE_CIRCULAR,	/**< Circular buffer, keeping the latest trace (ETB, ETF, ETR; ignored for a TPIU) */
+    CS_SINK_MODE_SWFIFO,	/**< ETF software FIFO, streamed into a ring by cs_trace_session_poll() */
+    CS_SINK_MODE_HWFIFO		/**< ETF hardware FIFO, passing trace on to a sink further down the path */
+} cs_sink_mode_t;
+
+/** A sink in a trace session, and the sources it captures */
+typedef struct cs_session_sink {
+    cs_device_t sink;		/**< The ETB, ETF, ETR or TPIU */
+    cs_sink_mode_t mode;	/**< How the sink holds trace */
+    cs_device_t const *sources;	/**< Trace sources captured by this sink, with their trace ids set */
+    unsigned int n_sources;	/**< Number of sources, 0 for an ETF in hardware FIFO mode */
+    cs_etr_config_t const *etr;	/**< ETR buffer, or NULL for the defaults from cs_etr_config_init() */
+    cs_etf_stream_t *stream;	/**< Stream state, for an ETF in software FIFO mode */
+    void *ring;			/**< Stream ring, see cs_etf_stream_start() */
+    unsigned int ring_size;	/**< Size of the stream ring in bytes, a power of two */
+    unsigned int watermark;	/**< ETF fill level at which cs_trace_session_poll() drains it */
+} cs_session_sink_t;
+
+/** Trace session state */
+typedef struct cs_trace_session {
+    cs_session_sink_t const *sinks;	/**< The sinks, as passed to cs_trace_session_start() */
+    unsigned int n_sinks;	/**< Number of sinks */
+    cs_device_t links[CS_SESSION_MAX_LINKS];	/**< ETFs enabled by the session to pass trace on */
+    unsigned int n_links;	/**< Number of such ETFs */
+    int running;		/**< Sources are enabled */
+} cs_trace_session_t;
+
+/**
+   Route the sources of each sink to it, enable the sinks in their modes
+   and enable the sources.  Sinks are enabled before the links upstream
+   of them, and the sources last, so no trace is held up.
+
+   \param s        Session state, initialized by this call
+   \param sinks    The sinks; the array must stay in place until the session stops
+   \param n_sinks  Number of sinks, at most #CS_SESSION_MAX_SINKS
+*/
+int cs_trace_session_start(cs_trace_session_t *s,
+			   cs_session_sink_t const *sinks,
+			   unsigned int n_sinks);
+
+/**
+   Drain the sinks in software FIFO mode that have reached their water
+   marks, see cs_etf_stream_poll().
+   \return number of bytes drained, or < 0 on error
+*/
+int cs_trace_session_poll(cs_trace_session_t *s);
+
+/**
+   Stop the session: disable the sources, stop all the sinks together and
+   wait for them to drain, then disable the links.  The trace stays in
+   each sink to be read out as usual, e.g. with cs_get_trace_data(), or
+   in the stream rings.
+*/
+int cs_trace_session_stop(cs_trace_session_t *s);
+
+/** @} */
+
+#endif				/* _included_cs_trace_session_h */
+
+/* end of  cs_trace_session.h */
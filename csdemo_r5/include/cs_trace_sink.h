@@ -39,8 +39,52 @@ int cs_etf_disable(cs_device_t dev);
 /** Check if sink is enabled */
 int cs_sink_is_enabled(cs_device_t dev);
 
+/** ETR trace buffer configuration, see cs_etr_enable() */
+typedef struct cs_etr_config {
+    cs_physaddr_t buffer_addr;	/**< Bus address of the trace buffer in system memory, 4K aligned */
+    unsigned int buffer_size;	/**< Size of the trace buffer in bytes, a multiple of 4 */
+    unsigned int burst_len;	/**< Maximum data transfers per AXI write burst, 1 to 256 */
+    unsigned int cache_prot;	/**< AXI cache and protection attributes, AXICTL[5:0] */
+    void const *sg_table;	/**< Scatter-gather table from cs_etr_sg_table_build(), or NULL for a
+                                     contiguous buffer.  buffer_addr is then the bus address of the table,
+                                     and the table must stay in place while the ETR is in use. */
+} cs_etr_config_t;
+
+/** Size in bytes of the scatter-gather table for a buffer of \a n_pages 4K pages */
+unsigned int cs_etr_sg_table_size(unsigned int n_pages);
+
 /**
-   Enable ETR for storing trace data in system memory using AXI
+   Build an ETR scatter-gather table describing a trace buffer made up of
+   4K pages, which need not be contiguous or in address order.  Trace is
+   written to the pages in the order given.
+
+   \param table       Local address of the table, cs_etr_sg_table_size() bytes
+   \param table_addr  Bus address of the table, 4K aligned
+   \param pages       Bus addresses of the data pages, each 4K aligned
+   \param n_pages     Number of data pages
+*/
+int cs_etr_sg_table_build(void *table, cs_physaddr_t table_addr, cs_physaddr_t const *pages, unsigned int n_pages);
+
+/** Initialize an ETR configuration with the defaults used by
+    cs_etr_axi_enable(): a 512MB buffer at 0x60000000, bursts of 128
+    transfers, cacheable, non-secure and privileged, no scatter-gather. */
+void cs_etr_config_init(cs_etr_config_t *config);
+
+/**
+   Enable an ETR to store trace in a circular buffer in system memory.
+
+   The buffer is not cleared, so enabling does not take longer for a
+   larger buffer.  Only the part of the buffer written since it was
+   enabled is read back, as given by the write pointer and the Full flag.
+
+   \param dev     The ETR
+   \param config  Buffer placement, size and AXI attributes
+*/
+int cs_etr_enable(cs_device_t dev, cs_etr_config_t const *config);
+
+/**
+   Enable ETR for storing trace data in system memory using AXI,
+   with the default configuration from cs_etr_config_init()
 */
 int cs_etr_axi_enable(cs_device_t dev);
 
@@ -54,6 +98,19 @@ int cs_sink_enable(cs_device_t dev);
 */
 int cs_sink_disable(cs_device_t dev);
 
+/**
+   Start disabling a trace sink, without waiting for its formatter to drain.
+   The sink is stopped as by cs_sink_disable(); use cs_sink_disable_poll()
+   to find out when the sequence has completed, doing other work meanwhile.
+*/
+int cs_sink_disable_start(cs_device_t dev);
+
+/**
+   Check whether a sink stopped with cs_sink_disable_start() has drained.
+   \return 1 if the sink has stopped, 0 if it is still draining, < 0 on error
+*/
+int cs_sink_disable_poll(cs_device_t dev);
+
 /** Disable all TPIUs in the system */
 int cs_disable_tpiu(void);
 
@@ -79,9 +136,175 @@ int cs_buffer_has_wrapped(cs_device_t dev);
 /** Get number of bytes that have not yet been destructively read from the buffer */
 int cs_get_buffer_unread_bytes(cs_device_t dev);
 
-/** Retrieve trace data from a buffer device, destructively */
+/** Retrieve trace data from a buffer device, destructively.
+ *
+ *  Reads as much unread trace as fits in the buffer, in whole units of the
+ *  buffer's memory width.  Call again to read the rest, so the trace can be
+ *  read out in chunks through a small buffer.
+ *
+ *  \param dev   The buffer device
+ *  \param buf   Buffer for the trace data, 4-byte aligned
+ *  \param size  Size of the buffer, in bytes
+ *  \return number of bytes read, 0 when there is nothing more to read
+ */
 int cs_get_trace_data(cs_device_t dev, void *buf, unsigned int size);
 
+/** Get the rate at which cs_get_trace_data() has read trace from a buffer
+ *  device since it was last enabled, in kilobytes (1000 bytes) per second.
+ *  Returns 0 if nothing has been read, or there is no clock to time reads.
+ */
+unsigned int cs_get_trace_data_rate(cs_device_t dev);
+
+/** State of an ETF streaming trace into a ring buffer, see cs_etf_stream_start() */
+typedef struct cs_etf_stream {
+    cs_device_t etf;		/**< The ETF being drained */
+    unsigned char *ring;	/**< Ring buffer for the trace, e.g. in OCM or DDR */
+    unsigned int ring_size;	/**< Size of the ring in bytes, a power of two */
+    unsigned int volatile head;	/**< Bytes written to the ring, wrapping at 2^32 */
+    unsigned int volatile tail;	/**< Bytes taken from the ring */
+    unsigned long long drained_bytes;	/**< Trace read out of the ETF */
+    unsigned long long dropped_bytes;	/**< Trace discarded because the ring was full */
+    unsigned int overflows;	/**< Times the ETF was found to have filled up, so trace sources
+                                     may have been held back and lost trace */
+    unsigned int max_level;	/**< Highest ETF fill level seen, in bytes */
+} cs_etf_stream_t;
+
+/**
+   Start streaming trace through an ETF in software FIFO mode, so that
+   trace capture is not limited by the size of the ETF.  The ETF is
+   drained into a ring buffer by cs_etf_stream_poll(), and the trace
+   taken from the ring with cs_etf_stream_read(), or in place with
+   cs_etf_stream_peek() and cs_etf_stream_consume().
+
+   The ring is lock-free with a single producer and a single consumer, so
+   cs_etf_stream_poll() can be called from an interrupt handler, e.g. for
+   the ETF's Full trigger output routed through a CTI, while the trace is
+   consumed in the background.  It reads the ETF directly, without
+   batching, shadowing or counting, so it does not disturb library calls
+   it interrupts; the ETF's counters are brought up to date by
+   cs_etf_stream_stop().  Nothing else should access the ETF until the
+   interrupt is disabled and cs_etf_stream_stop() is called.
+
+   \param s          Stream state, initialized by this call
+   \param dev        The ETF
+   \param ring       Ring buffer, word aligned
+   \param ring_size  Size of the ring in bytes, a power of two
+   \param watermark  ETF fill level in bytes at which cs_etf_stream_poll()
+                     drains it, or 0 to drain on every poll
+*/
+int cs_etf_stream_start(cs_etf_stream_t *s, cs_device_t dev, void *ring, unsigned int ring_size, unsigned int watermark);
+
+/**
+   Drain the ETF into the ring if it has reached the water mark.  Call
+   this often enough that the ETF does not fill up.  If the ring is full,
+   the newest trace is dropped and counted in dropped_bytes.
+   \return number of bytes drained from the ETF
+*/
+int cs_etf_stream_poll(cs_etf_stream_t *s);
+
+/** Take up to \a size bytes of trace from the stream's ring, oldest first.
+ *  \return number of bytes copied
+ */
+unsigned int cs_etf_stream_read(cs_etf_stream_t *s, void *buf, unsigned int size);
+
+/** Get the oldest trace in the stream's ring in place, without copying it.
+ *  The trace stays valid, and is not overwritten, until it is released
+ *  with cs_etf_stream_consume().  Trace that wraps round the end of the
+ *  ring is returned by the next call.
+ *  \return number of contiguous bytes at \a *data
+ */
+unsigned int cs_etf_stream_peek(cs_etf_stream_t *s, void const **data);
+
+/** Release \a size bytes of trace from cs_etf_stream_peek() */
+void cs_etf_stream_consume(cs_etf_stream_t *s, unsigned int size);
+
+/** Flush and stop the ETF, drain the rest of its trace into the ring,
+ *  and disable it.  Trace left in the ring can still be read.
+ */
+int cs_etf_stream_stop(cs_etf_stream_t *s);
+
+/** Number of samples kept by a buffer monitor */
+#define CS_BUFFER_MONITOR_SAMPLES 16
+
+/** A sample of a trace buffer's state, taken while it is capturing */
+typedef struct cs_buffer_sample {
+    unsigned long long time;	/**< When the sample was taken, in ticks of the monitor's clock */
+    unsigned long long written;	/**< Bytes written to the buffer since monitoring started */
+    unsigned int level;		/**< Fill level in bytes, from CBUFLEVEL on a TMC */
+    unsigned int max_level;	/**< Highest fill level since the previous sample, from LBUFLEVEL on a TMC */
+    unsigned int rate;		/**< Bytes per second written since the previous sample, or 0 with no clock */
+    int full;			/**< Full flag: wrapped in circular mode, reached the water mark in FIFO modes */
+} cs_buffer_sample_t;
+
+/** State of a buffer monitor, see cs_buffer_monitor_start() */
+typedef struct cs_buffer_monitor {
+    cs_device_t dev;		/**< The ETB, ETF or ETR being monitored */
+    unsigned long long hz;	/**< Frequency of the clock used for sample times */
+    int use_tsgen;		/**< Sample times are from the timestamp generator, not the register access backend */
+    unsigned long long start_time;	/**< When monitoring started */
+    unsigned int last_offset;	/**< Write pointer at the last sample, as an offset into the buffer */
+    unsigned long long written;	/**< Bytes written since monitoring started */
+    unsigned int peak_rate;	/**< Highest rate seen in any sample, in bytes per second */
+    unsigned int n_samples;	/**< Samples taken; the last #CS_BUFFER_MONITOR_SAMPLES are kept */
+    cs_buffer_sample_t samples[CS_BUFFER_MONITOR_SAMPLES];	/**< Ring of the latest samples */
+} cs_buffer_monitor_t;
+
+/**
+   Start monitoring how fast a trace buffer fills, while it is capturing.
+
+   Sampling only reads the buffer's status, fill level and write pointer
+   registers, so capture is not disturbed.  Sample times come from the
+   system timestamp generator when it is running, else from the register
+   access backend's clock.  The amount written is found from the write
+   pointer, so sample at least once per buffer's worth of trace.
+
+   Reading LBUFLEVEL resets it, so don't monitor an ETF being drained with
+   cs_etf_stream_poll(), whose max_level already tracks the same thing.
+
+   \param m    Monitor state, initialized by this call
+   \param dev  The ETB, ETF or ETR
+*/
+int cs_buffer_monitor_start(cs_buffer_monitor_t *m, cs_device_t dev);
+
+/** Take a sample of the buffer's fill level, write pointer and Full flag,
+ *  and work out the rate at which trace has been written since the last.
+ */
+int cs_buffer_monitor_sample(cs_buffer_monitor_t *m);
+
+/** Get a sample kept by a buffer monitor, with \a i = 0 the oldest kept.
+ *  \return the sample, or NULL
+ */
+cs_buffer_sample_t const *cs_buffer_monitor_get(cs_buffer_monitor_t const *m, unsigned int i);
+
+/** A contiguous piece of trace data in memory */
+typedef struct cs_trace_span {
+    void const *data;	/**< Start of the trace data */
+    unsigned int size;	/**< Size of the trace data, in bytes */
+} cs_trace_span_t;
+
+/** Get the trace captured by an ETR in place, without copying it.
+ *
+ *  The ETR must have stopped, e.g. with cs_sink_disable().  Unread trace
+ *  is described by spans, oldest first: for a contiguous buffer one span,
+ *  or two if the buffer has wrapped; for a scatter-gather buffer up to one
+ *  per page, with adjacent pages merged.  Cached copies of the buffer are
+ *  invalidated, so the spans can be decoded or sent on directly.  They stay
+ *  valid until cs_etr_release_trace_spans().
+ *
+ *  \param dev        The ETR
+ *  \param spans      Array of spans to fill in, or NULL to return the
+ *                    most spans the ETR's buffer can need
+ *  \param max_spans  Size of the array
+ *  \return number of spans, 0 if there is no unread trace, or < 0 on error
+ */
+int cs_etr_get_trace_spans(cs_device_t dev, cs_trace_span_t *spans, unsigned int max_spans);
+
+/** Finish with the spans from cs_etr_get_trace_spans().
+ *  The trace is marked as read, and the ETR moves to the disabled state
+ *  ready to be enabled again.
+ */
+int cs_etr_release_trace_spans(cs_device_t dev);
+
 /** Empty a trace buffer by resetting the write and read pointers.
  *  After this call, cs_get_buffer_unread_bytes() will return zero
  *  and cs_buffer_has_wrapped() will return false.
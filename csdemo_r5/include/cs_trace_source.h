@@ -59,6 +59,51 @@ int cs_trace_enable_cycle_accurate(cs_device_t dev, int enable);
 int cs_replicator_set_filter(cs_device_t dev, unsigned int port,
 			     unsigned int filter);
 
+/**
+ *  Route trace from a set of sources to a sink.
+ *
+ *  Finds each source's path to the sink in the trace bus connections
+ *  registered with cs_atb_register(), and programs the funnels and
+ *  replicators on the paths.  Funnel inputs not on any path are disabled,
+ *  so unrelated sources don't hold up the trace bus.  Programmable
+ *  replicator outputs not on any path discard all trace, and outputs on a
+ *  path discard trace ids not used by its sources.  Registers are only
+ *  written when their value changes.
+ *
+ *  Set the trace source ids first, so that replicators can filter by id.
+ *  Sinks and links such as ETFs on the path are not enabled.
+ *
+ *  \param sources    Trace sources
+ *  \param n_sources  Number of trace sources
+ *  \param sink       Trace sink, or a link such as an ETF
+ *  \return 0 on success, or < 0 if a source has no path to the sink
+ */
+int cs_paths_enable(cs_device_t const *sources, unsigned int n_sources,
+		    cs_device_t sink);
+
+/** Route trace from a single source to a sink, see cs_paths_enable() */
+int cs_path_enable(cs_device_t source, cs_device_t sink);
+
+/** A set of trace sources routed to one sink, see cs_routes_enable() */
+typedef struct cs_trace_route {
+    cs_device_t const *sources;	/**< Trace sources */
+    unsigned int n_sources;	/**< Number of trace sources */
+    cs_device_t sink;		/**< Trace sink, or a link such as an ETF */
+} cs_trace_route_t;
+
+/**
+ *  Route trace from several sets of sources, each to its own sink, at the
+ *  same time.  The funnels and replicators on all the paths are programmed
+ *  together as by cs_paths_enable(), so routing to one sink doesn't undo
+ *  the routing to another, and each replicator output only passes the ids
+ *  of the sources routed through it.
+ *
+ *  \param routes    Sources and sink of each route
+ *  \param n_routes  Number of routes
+ *  \return 0 on success, or < 0 if a source has no path to its sink
+ */
+int cs_routes_enable(cs_trace_route_t const *routes, unsigned int n_routes);
+
 /**
    Get the current global timestamp from the system timestamp generator, if available.
 */
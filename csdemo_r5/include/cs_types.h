@@ -165,6 +165,18 @@ typedef enum {
     CS_REG_WAITBITS_END	/**< End marker. Not a valid operation. */
 } cs_reg_waitbits_op_t;
 
+/** Register access counters for a device, or for the whole library.
+ *  See cs_device_get_access_stats(). */
+typedef struct cs_reg_access_stats {
+    unsigned int bus_reads;	/**< Register reads that accessed the device */
+    unsigned int bus_writes;	/**< Register writes that accessed the device */
+    unsigned int reads_saved;	/**< Register reads served from the shadow cache */
+    unsigned int writes_saved;	/**< Redundant register writes suppressed by the shadow cache */
+    unsigned int barriers;	/**< Memory barriers issued after register writes */
+    unsigned int wait_iterations;	/**< Register polls made while waiting for bits to change */
+    unsigned long long cycles;	/**< Time spent in register accesses, in backend clock ticks, when instrumentation is enabled */
+} cs_reg_access_stats_t;
+
 
 /** Default define to set the size of a number of fixed device tables in the library.
     
@@ -22,6 +22,7 @@
 #define CS_UTIL_CREATE_SNAPSHOT_H
 
 #include "csregistration.h"
+#include "trace_udp.h"
 /** @defgroup cs_lib_snapshot Extract Trace and Create DS-5 Snapshots
     @ingroup cs_lib_utils
 
@@ -95,6 +96,183 @@ void do_dump_config(const struct board *board,
  */
 void do_fetch_trace_etb_uart(cs_device_t etb);
 
+/*!
+ * Sends the trace captured by an ETR out via UART, directly from the
+ * trace buffer in system memory.
+ */
+void do_fetch_trace_etr_uart(cs_device_t etr);
+
+/*!
+ * Sends the trace drained so far by an ETF stream out via UART, directly
+ * from the stream's ring.  Can be called while an interrupt handler is
+ * draining the ETF into the ring.
+ *
+ * @param *s : stream started with cs_etf_stream_start().
+ * @return number of bytes sent.
+ */
+int do_stream_trace_uart(cs_etf_stream_t *s);
+
+/*!
+ * Sends the trace drained so far by an ETF stream over UDP, after
+ * do_udp_trace_start(), directly from the stream's ring.  The ring is
+ * released as the host acknowledges it, so lost datagrams are resent from
+ * it.  do_stream_trace_uart() comes here once UDP is selected.
+ *
+ * @param *s : stream started with cs_etf_stream_start().
+ * @return number of bytes sent, or -1 if the session has failed.
+ */
+int do_stream_trace_udp(cs_etf_stream_t *s);
+
+/*!
+ * Send trace and memory dumps over UDP, through the GEM on the R5 or the
+ * software EMAC model in the simulator, instead of the UART, for
+ * host/cstrace_udp to write into a snapshot directory.  Each dump is
+ * cstrace.bin; the session ends with the dump.  The console stays on the
+ * UART.  This and the other transports, do_sd_trace_start(),
+ * do_uart_trace_start() and do_dcc_trace_start(), each replace the one
+ * selected before, leaving trace on the UART if they fail.
+ *
+ * @param *addr : the target's MAC and IP address, the host's IP address
+ *                and the UDP port, e.g. TRACE_UDP_PORT.
+ * @return 0, or -1 if the Ethernet can't be set up or the host does not
+ *         answer.
+ */
+int do_udp_trace_start(const trace_udp_addr_t *addr);
+
+/*!
+ * Send the snapshot configuration files of do_dump_config(), and the
+ * kernel memory dump if a range is set, over UDP after
+ * do_udp_trace_start().  The trace fetched next completes the snapshot.
+ *
+ * @param *board : pointer to the hardware board structure.
+ * @param *devices : pointer to the devices configured on the board.
+ * @param do_dump_swstim : set none-zero to create SWSTIM snapshot items
+ * @return 0, or -1 if the session has failed.
+ */
+int do_dump_config_udp(const struct board *board,
+		       const struct cs_devices_t *devices,
+		       int do_dump_swstim);
+
+/*!
+ * Write snapshots to the SD card instead of the UART: each call makes a
+ * new directory, snap_000, snap_001 and so on, in the root of the card's
+ * FAT16 or FAT32 volume, to hold the files of do_dump_config_sd() and
+ * the trace fetched next as cstrace.bin.  do_dump_config_uart() then
+ * writes to the card without asking.  A directory holds one snapshot: a
+ * second dump into it is dropped with a message, so call this again
+ * before each snapshot.  In the simulator the card is the
+ * disk image CS_SIM_SD_IMAGE, "sd.img" by default.  The console stays on
+ * the UART.
+ *
+ * @return 0, or -1 if there is no card with a FAT16 or FAT32 volume.
+ */
+int do_sd_trace_start(void);
+
+/*!
+ * Write the snapshot configuration files of do_dump_config(), and the
+ * kernel memory dump if a range is set, to the directory made by
+ * do_sd_trace_start().  The trace fetched next completes the snapshot.
+ *
+ * @param *board : pointer to the hardware board structure.
+ * @param *devices : pointer to the devices configured on the board.
+ * @param do_dump_swstim : set none-zero to create SWSTIM snapshot items
+ * @return 0, or -1 on error.
+ */
+int do_dump_config_sd(const struct board *board,
+		      const struct cs_devices_t *devices,
+		      int do_dump_swstim);
+
+/*!
+ * Copy the trace captured by an ETR, oldest first, into a buffer, e.g. a
+ * transport's staging buffer, with the data mover in trace_dma.c.  Each
+ * piece of the buffer, the second span of a wrapped buffer or the pages
+ * of a scatter-gather buffer, is a descriptor of one DMA job, so the CPU
+ * is free while it runs.  Once it is done, release the spans with
+ * cs_etr_release_trace_spans().
+ *
+ * @param etr : the ETR, disabled.
+ * @param *dst : destination buffer.
+ * @param size : size of the destination buffer.
+ * @param done : called when the copy completes, maybe from an interrupt
+ *               handler, or NULL.
+ * @param *ref : passed to done.
+ * @return number of bytes being copied, or < 0 on error.
+ */
+int do_copy_trace_etr(cs_device_t etr, void *dst, unsigned int size,
+                      void (*done)(void *ref, int status), void *ref);
+
+/*!
+ * Compress trace and memory dumps sent over the UART with trace_lz.c,
+ * for host/cstrace_recv or host/cstrace_unlz to decompress.  After each
+ * dump the compression ratio and throughput are printed.
+ *
+ * @param enable : non-zero to compress.
+ * @param formatted : non-zero if the trace is in 16-byte formatter frames,
+ *                    as from an ETB, ETF or ETR with formatting enabled.
+ */
+void do_trace_compress(int enable, int formatted);
+
+#ifdef ARMR5
+/*!
+ * Switch the console UART to framed trace, sent under interrupts at the
+ * given baud rate (e.g. UART_TRACE_DEFAULT_BAUD).  The fetch functions
+ * above then send trace in CRC-checked frames, ending each dump with an
+ * end frame, for host/cstrace_recv to write to cstrace.bin.  The console
+ * continues at the new rate.
+ *
+ * @param baud : UART baud rate.
+ */
+int do_uart_trace_start(unsigned int baud);
+
+/*!
+ * Send trace through the DCC instead of the UART, in the same frames as
+ * do_uart_trace_start(), for a debugger to read over JTAG and
+ * host/cstrace_dcc to turn back into a stream for host/cstrace_recv.
+ * The console stays on the UART.
+ *
+ * @param timeout : polls of a full DCC before the debugger is taken to be
+ *                  gone and the rest of the dump is dropped, or 0 for
+ *                  TRACE_DCC_DEFAULT_TIMEOUT.
+ * @return 0, or -1 if there is no DCC.
+ */
+int do_dcc_trace_start(unsigned int timeout);
+
+/*!
+ * Move trace and memory dumps with GDMA channel 0 under interrupts,
+ * rather than with the CPU.
+ *
+ * @return 0, or -1 if the channel can't be set up, leaving the CPU to copy.
+ */
+int do_trace_dma_start(void);
+
+/*!
+ * Drain an ETF stream from an interrupt handler on the R5.  The ETF's Full
+ * output, raised at the stream's water mark, is routed through its CTI
+ * to an interrupt at the GIC; the handler drains the ETF into the ring.
+ *
+ * The handler only calls cs_etf_stream_poll() and cs_cti_ack_trigout(),
+ * which go straight to the registers.  It must not call anything else in
+ * the library: it can interrupt a batch, a readout or cs_ect_configure(),
+ * and the library's batch, shadow and counters are not interrupt safe.
+ * Until do_stream_trace_irq_stop(), the ETF and the CTI output belong to
+ * the handler, and the rest of the library can be used as usual.
+ *
+ * @param *s : stream started with cs_etf_stream_start().
+ * @param cti_trigout : CTI trigger output wired to the interrupt.
+ * @param irq_id : GIC interrupt ID of that trigger output.
+ */
+int do_stream_trace_irq_start(cs_etf_stream_t *s, unsigned int cti_trigout,
+			      unsigned int irq_id);
+
+/*!
+ * Disable the interrupt from do_stream_trace_irq_start(), stop the stream
+ * and send the rest of its trace out via UART.
+ *
+ * @return number of bytes sent.
+ */
+int do_stream_trace_irq_stop(void);
+#endif
+
 /*!
  * Fetches trace from configured sinks and saves to files required for the snapshot configuration 
  * dumped above.
@@ -30,9 +30,12 @@
 #include "cs_sw_stim.h"	       /**< SW stimulus - ITM, STM - trace ports */
 #include "cs_trace_sink.h"     /**< Generic trace sinks and buffers programming */
 #include "cs_cti_ect.h"	       /**< handle CTI and ECT programming */
+#include "cs_flight_recorder.h"    /**< triggered snapshots of a trace buffer */
+#include "cs_trace_session.h"     /**< capturing into several trace sinks at once */
 #include "cs_debug_sample.h"   /**< access core debug registers - PC sampling  */
 #include "cs_pmu.h"	       /**< access core PMU registers - event sampling */
 #include "cs_ts_gen.h"	       /**< access CS timestamp generator */
+#include "cs_instrument.h"	       /**< register access instrumentation */
 
 #endif				/* included */
 
@@ -652,7 +652,7 @@ TMC specific registers - see ETB definitions for common register set between ETB
 #define CS_TMC_BUFWM         0x034  /**< Latched buffer water mark register */
 
 #define CS_TMC_RRPHI         0x038  /**< RAM read pointer High register [ETR config only] */
-#define CS_TMC_RWPHI         0x038  /**< RAM write pointer High register [ETR config only] */
+#define CS_TMC_RWPHI         0x03C  /**< RAM write pointer High register [ETR config only] */
 #define CS_TMC_AXICTL        0x110  /**< AXI control register [ETR config only]*/
 #define CS_TMC_DBALO         0x118  /**< Data buffer address low register [ETR config only]*/
 #define CS_TMC_DBAHI         0x11C  /**< Data buffer address high register [ETR config only]*/
@@ -668,7 +668,16 @@ TMC specific registers - see ETB definitions for common register set between ETB
 #define CS_TMC_AXICTL_WRBURSTLEN2 0x100 /* max. of 2  data transfers per burst.*/
 #define CS_TMC_AXICTL_WRBURSTLEN16 0xF00 /* max. of 16 data transfers per burst.*/
 #define CS_TMC_AXICTL_WRBURSTLEN128 0x7F00 /* max. of 218 data transfers per burst.*/
+#define CS_TMC_AXICTL_WRBURSTLEN_MASK 0xFF00 /* write burst length field: max. data transfers per burst - 1 */
 #define CS_TMC_SCATGAT_MODE 0x80 /* scatter gather mode bit*/
+/* Scatter-gather table entries: 4K page address [39:12] in bits [31:4], type in bits [1:0] */
+#define CS_TMC_SG_PAGE_SIZE   4096 /* size of data pages and table pages */
+#define CS_TMC_SG_ENTRY_LAST   0x1 /* last data page of the buffer */
+#define CS_TMC_SG_ENTRY_NORMAL 0x2 /* data page */
+#define CS_TMC_SG_ENTRY_LINK   0x3 /* next table page */
+#define CS_TMC_SG_ENTRY_TYPE_MASK 0x3
+#define CS_TMC_SG_ENTRY(addr, type) ((unsigned int) (((addr) >> 12) << 4) | (type))
+#define CS_TMC_SG_ENTRY_ADDR(entry) ((unsigned long long) ((entry) >> 4) << 12)
 #define CS_TMX_AXICTL_CACHEPROT 0x3F /* cache and protection bits all set to 1 (0b111111) --> cache enabled, non-secure access, privileged access
 /**@}*/
 
@@ -704,6 +713,7 @@ The cross trigger matrix does not have any programmable elements so needs no reg
 /* CTI */
 #define CS_CTICONTROL        0x000     /**< CTI Control Register */
 #define CS_CTICONTROL_GLBEN    0x00000001  /**< CTI CTRL bitfield (#CS_CTICONTROL): Enables or disables the ECT */
+#define CS_CTIINTACK         0x010     /**< CTI Interrupt Acknowledge Register */
 #define CS_CTIAPPSET         0x014     /**< CTI Application Channel Trigger Set Register */
 #define CS_CTIAPPCLEAR       0x018     /**< CTI Application Channel Trigger Clear Register */
 #define CS_CTIAPPPULSE       0x01C     /**< CTI Application Channel Pulse Register */
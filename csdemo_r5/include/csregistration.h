@@ -133,6 +133,22 @@ extern unsigned int cpu_id[LIB_MAX_CPU_DEVICES];
 */
 extern int registration_verbose;
 
+/*! Optional topology cache, e.g. in memory that survives a warm restart.
+
+  If `registration_cache_size` is non-zero, setup_board() first tries to
+  restore the registry from `registration_cache` with cs_registry_load().
+  If that fails, the board is registered as usual and the registry is saved
+  to `registration_cache` with cs_registry_save() for next time.
+*/
+extern void *registration_cache;
+extern unsigned int registration_cache_size;	/**< Size of `registration_cache` in bytes */
+
+/*! Set while a board's `do_registration()` is called with the registry
+  restored from `registration_cache`.  The board should then only look up
+  its devices and fill in the devices structure, not register them.
+*/
+extern int registration_from_cache;
+
 
 /*!
  * Selects named board from the board list and uses this to configure the library.
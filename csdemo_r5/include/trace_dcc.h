@@ -0,0 +1,50 @@
+/*
+ * trace_dcc.h
+ *
+ * Sending trace through the debug communications channel (DCC), for a
+ * debugger to read over JTAG, on boards where the UART is shared with
+ * the console.
+ */
+
+#ifndef INCLUDE_TRACE_DCC_H_
+#define INCLUDE_TRACE_DCC_H_
+
+#include "xil_types.h"
+
+/*
+ * The channel carries the same frames as the UART transport in
+ * write_uart.h, so host/cstrace_recv.c reads them either way.  Each
+ * frame goes as a chunk of 32-bit words written to DBGDTRTX:
+ *
+ *   u32 TRACE_DCC_CHUNK | frame size in bytes, then the frame in words
+ *
+ * the last word padded with zeros, bytes little-endian within words.
+ * A debugger saving the words it reads, little-endian, gives a file
+ * that host/cstrace_dcc.c turns back into the frame stream.
+ */
+#define TRACE_DCC_CHUNK		0x54440000U	/* "DT" in the top half */
+#define TRACE_DCC_CHUNK_MASK	0xFFFF0000U
+
+/* Polls of a full DBGDTRTX before the debugger is taken to be gone */
+#define TRACE_DCC_DEFAULT_TIMEOUT	10000000U
+
+/*
+ * Set up the DCC transport.  Each word waits for the debugger to read
+ * the last one, for up to timeout polls of the DCC status; after that
+ * the transport stops, so a dump without a debugger attached does not
+ * hang.  Returns -1 where there is no DCC, e.g. in the simulator.
+ */
+int trace_dcc_init(u32 timeout);
+
+/* Non-zero once trace_dcc_init() has succeeded and the debugger is
+ * keeping up */
+int trace_dcc_ready(void);
+
+/* Send trace in frames of at most UART_TRACE_MAX_PAYLOAD bytes.
+ * Returns nbytes, or -1 if the transport is not set up or has stopped. */
+int trace_dcc_send(const void *buf, u32 nbytes);
+
+/* Send the end frame.  The next dump counts its frames from 0 again. */
+int trace_dcc_end(void);
+
+#endif /* INCLUDE_TRACE_DCC_H_ */
@@ -0,0 +1,22 @@
+/*
+ * trace_disk_sim.h
+ *
+ * A disk image as the block device for trace_fat.c, for the CS_SIM build,
+ * so snapshots can be written on the host to an image made with, e.g.,
+ * "mkfs.vfat -C sd.img 65536" and read back with mtools or a loop mount.
+ */
+
+#ifndef INCLUDE_TRACE_DISK_SIM_H_
+#define INCLUDE_TRACE_DISK_SIM_H_
+
+#include "xil_types.h"
+#include "trace_fat.h"
+
+/* Open the image for update.  Returns the block device, or NULL. */
+const trace_fat_blkdev_t *trace_disk_sim_init(const char *image);
+
+/* Sector writes, and writes of more than one sector, since opening */
+unsigned int trace_disk_sim_writes(void);
+unsigned int trace_disk_sim_multi_writes(void);
+
+#endif /* INCLUDE_TRACE_DISK_SIM_H_ */
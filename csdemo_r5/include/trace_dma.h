@@ -0,0 +1,61 @@
+/*
+ * trace_dma.h
+ *
+ * Moving trace and memory dumps with a ZDMA channel, so the R5 can keep
+ * managing the trace session while large captures are copied.
+ */
+
+#ifndef INCLUDE_TRACE_DMA_H_
+#define INCLUDE_TRACE_DMA_H_
+
+#include "xil_types.h"
+#include "xscugic.h"
+
+/* Linked-list descriptors handed to the channel at a time.  Longer jobs
+ * are run in batches, the next started when the last one completes. */
+#define TRACE_DMA_MAX_DSCR	32U
+
+/* One piece of memory to copy */
+typedef struct trace_dma_seg {
+  const void *src;
+  void *dst;
+  u32 size;
+} trace_dma_seg_t;
+
+/* Called when a job has completed, with status 0, or < 0 on a DMA error.
+ * Under interrupts it is called from the interrupt handler. */
+typedef void (*trace_dma_done_t)(void *ref, int status);
+
+/*
+ * Set up a ZDMA channel (e.g. XPAR_XZDMA_8_DEVICE_ID, GDMA channel 0) in
+ * linked-list mode.  With a GIC, completions are handled under
+ * interrupts; the GIC must be initialized and exceptions enabled by the
+ * caller.  With gic NULL, trace_dma_poll() or trace_dma_wait() runs jobs
+ * on.  Until this succeeds, jobs are copied by the CPU.
+ */
+int trace_dma_init(u16 device_id, XScuGic *gic, u32 irq_id);
+
+/* Non-zero once trace_dma_init() has succeeded */
+int trace_dma_available(void);
+
+/*
+ * Start copying the segments, which must stay in place until the job
+ * completes.  The data caches are cleaned over the sources and
+ * destinations before the copy and invalidated over the destinations
+ * after it.  Without a channel, the copy is done before returning.
+ * done may be NULL.  Returns 0, or -1 if a job is already running.
+ */
+int trace_dma_copy(const trace_dma_seg_t *segs, u32 n_segs,
+                   trace_dma_done_t done, void *ref);
+
+/* Non-zero while a job is running */
+int trace_dma_busy(void);
+
+/* Without interrupts, check for a completed batch and start the next.
+ * Returns non-zero while the job is still running. */
+int trace_dma_poll(void);
+
+/* Wait for the running job.  Returns its status. */
+int trace_dma_wait(void);
+
+#endif /* INCLUDE_TRACE_DMA_H_ */
@@ -0,0 +1,29 @@
+/*
+ * trace_emac_sim.h
+ *
+ * A software model of the EMAC for trace_udp.c, for the CS_SIM build:
+ * frames sent to the host go out as UDP datagrams on the loopback
+ * interface, so host/cstrace_udp on the same machine receives them, and
+ * its replies come back as received frames.
+ */
+
+#ifndef INCLUDE_TRACE_EMAC_SIM_H_
+#define INCLUDE_TRACE_EMAC_SIM_H_
+
+#include "xil_types.h"
+#include "trace_udp.h"
+
+/*
+ * Set up the model for the addresses given to trace_udp_init(), sending
+ * to the host's port on 127.0.0.1.  The model answers ARP for the host
+ * itself.  To exercise the resends, it loses loss_per_mille of the
+ * datagrams each way, in a repeatable pattern.  Returns the interface,
+ * or NULL on error.
+ */
+const trace_udp_netif_t *trace_emac_sim_init(const trace_udp_addr_t *addr,
+                                             unsigned int loss_per_mille);
+
+/* Datagrams the model has lost, each way */
+unsigned int trace_emac_sim_lost(void);
+
+#endif /* INCLUDE_TRACE_EMAC_SIM_H_ */
@@ -0,0 +1,76 @@
+/*
+ * trace_fat.h
+ *
+ * A small FAT16/FAT32 writer for putting snapshots on an SD card: it
+ * makes a directory in the root and writes files into it one at a time,
+ * in runs of whole clusters with multi-block writes.  Nothing is ever
+ * read back or deleted.  The block device is the SD controller in
+ * trace_sd.c, or a disk image in trace_disk_sim.c.
+ */
+
+#ifndef INCLUDE_TRACE_FAT_H_
+#define INCLUDE_TRACE_FAT_H_
+
+#include "xil_types.h"
+
+#define TRACE_FAT_SECTOR	512U
+/* Data is gathered into a buffer of the largest cluster, 128 sectors, so
+   each write to the card is of whole clusters */
+#define TRACE_FAT_BUF_SIZE	65536U
+/* The most written from the caller's data in one go */
+#define TRACE_FAT_MAX_RUN	(1U << 20)
+
+/* Returned by trace_fat_mkdir() and trace_fat_create() if the name is
+   taken */
+#define TRACE_FAT_EXISTS	(-2)
+
+/*
+ * The block device, in 512 byte sectors.  Buffers are aligned to a cache
+ * line, except for data written from the caller's buffer, which is only
+ * word aligned.
+ */
+typedef struct trace_fat_blkdev {
+  void *ctx;
+  /* Read or write count sectors from lba.  Return 0, or -1 on error. */
+  int (*read)(void *ctx, u32 lba, u32 count, void *buf);
+  int (*write)(void *ctx, u32 lba, u32 count, const void *buf);
+} trace_fat_blkdev_t;
+
+/*
+ * Mount the FAT16 or FAT32 volume in the first FAT partition of the
+ * device, or filling it if there is no partition table.  Returns 0, or
+ * -1 if there is none.
+ */
+int trace_fat_mount(const trace_fat_blkdev_t *dev);
+
+/*
+ * Make a directory in the root, for the files created after it.  The
+ * name must be an 8.3 name.  Returns 0, TRACE_FAT_EXISTS, or -1.
+ */
+int trace_fat_mkdir(const char *name);
+
+/*
+ * Create a file in the directory, with a long name if it is not an 8.3
+ * name, e.g. "kernel_dump.bin".  Only one file is open at a time.
+ * Returns 0, TRACE_FAT_EXISTS if the directory already has a file of that
+ * name, or -1.
+ */
+int trace_fat_create(const char *name);
+
+/*
+ * Append to the file.  Returns nbytes, or -1 on error, once the volume is
+ * full keeping what fitted, to be closed with trace_fat_close().
+ */
+int trace_fat_write(const void *data, u32 nbytes);
+
+/*
+ * Close the file, writing out what is left of it, its directory entry,
+ * the FAT and the free count, so the card can be taken out.  Returns 0,
+ * or -1.
+ */
+int trace_fat_close(void);
+
+/* Size of the file open, or of the last file closed */
+u32 trace_fat_size(void);
+
+#endif /* INCLUDE_TRACE_FAT_H_ */
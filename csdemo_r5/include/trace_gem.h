@@ -0,0 +1,23 @@
+/*
+ * trace_gem.h
+ *
+ * A PS GEM run polled with static buffer descriptor rings, as the network
+ * interface for trace_udp.c.
+ */
+
+#ifndef INCLUDE_TRACE_GEM_H_
+#define INCLUDE_TRACE_GEM_H_
+
+#include "xil_types.h"
+#include "trace_udp.h"
+
+/*
+ * Set up a GEM (e.g. XPAR_XEMACPS_0_DEVICE_ID, GEM3 on the ZCU102) with
+ * the MAC address, at speed 1000, 100 or 10 Mb/s.  The PHY is left to
+ * autonegotiate as the FSBL set it up.  Frames are sent from where they
+ * are, the data caches being cleaned over them first.  Returns the
+ * interface, or NULL on error.
+ */
+const trace_udp_netif_t *trace_gem_init(u16 device_id, const u8 mac[6], u16 speed);
+
+#endif /* INCLUDE_TRACE_GEM_H_ */
@@ -0,0 +1,76 @@
+/*
+ * trace_lz.h
+ *
+ * Streaming compression of trace before it goes off-chip, undone on the
+ * host by host/trace_unlz.c.
+ */
+
+#ifndef INCLUDE_TRACE_LZ_H_
+#define INCLUDE_TRACE_LZ_H_
+
+#include "xil_types.h"
+
+/*
+ * The stream starts with the u32 magic "CSLZ", followed by blocks, each
+ * of up to TRACE_LZ_BLOCK bytes of trace:
+ *
+ *   u8 flags | u16 raw size | u16 stored size | stored bytes
+ *
+ * little-endian.  A block is stored as it is, or LZ compressed, and the
+ * trace in it may have been through the frame filter first.
+ *
+ * LZ compressed data is a list of sequences, each a token byte with the
+ * number of literals in its top four bits and the match length less 4 in
+ * its bottom four, a value of 15 being continued in following bytes of
+ * 255 until one less than 255; then the literals, a u16 offset back
+ * into the block and any match length bytes.  The last sequence has only
+ * literals.
+ *
+ * The frame filter applies to trace from the TMC formatter, in 16-byte
+ * frames each ending in a byte of flags.  It moves the 15 data bytes of
+ * each frame to the start of the block and the flag bytes to the end, so
+ * matches in the trace are not broken up every 16 bytes and the flag
+ * bytes, mostly the same, compress together.
+ */
+#define TRACE_LZ_MAGIC		0x5A4C5343U	/* "CSLZ" */
+#define TRACE_LZ_BLOCK		16384U
+#define TRACE_LZ_HEADER		5U
+#define TRACE_LZ_FLAG_LZ	0x01U	/* the block is LZ compressed */
+#define TRACE_LZ_FLAG_FRAMES	0x02U	/* the block went through the frame filter */
+#define TRACE_LZ_FRAME		16U
+#define TRACE_LZ_MIN_MATCH	4U
+#define TRACE_LZ_HASH_BITS	12U
+
+/* Takes compressed data, e.g. to send it off-chip */
+typedef void (*trace_lz_emit_t)(void *ref, const void *data, u32 nbytes);
+
+typedef struct trace_lz {
+  int frames;				/* trace is in formatter frames */
+  trace_lz_emit_t emit;
+  void *ref;
+  u32 fill;				/* bytes waiting in block */
+  int started;				/* the magic has been emitted */
+  u32 in_bytes;				/* trace compressed */
+  u32 out_bytes;			/* compressed data emitted, headers included */
+  u8 block[TRACE_LZ_BLOCK];
+  u8 filtered[TRACE_LZ_BLOCK];
+  u8 out[TRACE_LZ_HEADER + TRACE_LZ_BLOCK];
+  u16 hash[1U << TRACE_LZ_HASH_BITS];
+} trace_lz_t;
+
+/* Start a stream.  frames is non-zero for trace from a formatter, to
+ * apply the frame filter. */
+void trace_lz_init(trace_lz_t *z, int frames, trace_lz_emit_t emit, void *ref);
+
+/* Compress trace, emitting a block each time TRACE_LZ_BLOCK bytes have
+ * been collected */
+void trace_lz_write(trace_lz_t *z, const void *data, u32 nbytes);
+
+/* Emit any partly filled block, e.g. at the end of a dump */
+void trace_lz_flush(trace_lz_t *z);
+
+/* Compress a block of n bytes of src into dst, of size n.  Returns the
+ * compressed size, or 0 if it is not smaller. */
+u32 trace_lz_compress(u16 *hash, const u8 *src, u32 n, u8 *dst);
+
+#endif /* INCLUDE_TRACE_LZ_H_ */
@@ -0,0 +1,20 @@
+/*
+ * trace_sd.h
+ *
+ * The SD controller, run polled, as the block device for trace_fat.c.
+ */
+
+#ifndef INCLUDE_TRACE_SD_H_
+#define INCLUDE_TRACE_SD_H_
+
+#include "xil_types.h"
+#include "trace_fat.h"
+
+/*
+ * Set up an SD controller (e.g. XPAR_XSDPS_0_DEVICE_ID, SD1 on the
+ * ZCU102) and the card in it, at the fastest bus width and speed both
+ * support.  Returns the block device, or NULL if there is no card.
+ */
+const trace_fat_blkdev_t *trace_sd_init(u16 device_id);
+
+#endif /* INCLUDE_TRACE_SD_H_ */
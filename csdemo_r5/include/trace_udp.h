@@ -0,0 +1,119 @@
+/*
+ * trace_udp.h
+ *
+ * Streaming trace over UDP, with no IP stack: the sender builds its own
+ * Ethernet, IPv4 and UDP headers, sends the trace in place and resends
+ * what the host reports missing.  Read on the host by host/cstrace_udp.c,
+ * which writes a DS-5 snapshot directory.
+ */
+
+#ifndef INCLUDE_TRACE_UDP_H_
+#define INCLUDE_TRACE_UDP_H_
+
+#include "xil_types.h"
+
+/*
+ * Each datagram to the host carries, little-endian:
+ *
+ *   u32 magic "CSUD" | u32 seq | u8 type | u8 file | u16 len | len bytes
+ *
+ * numbered from 0 in each session.  An OPEN datagram names a file of the
+ * snapshot directory, DATA datagrams append to a file, file 0 being
+ * cstrace.bin unless opened with another name, and END ends the session.
+ * The sender leaves the UDP checksum 0, for the GEM's checksum offload to
+ * fill in, so the trace is never read by the CPU on its way out; the
+ * Ethernet FCS covers it either way.
+ *
+ * The host answers with a status datagram:
+ *
+ *   u32 magic "CSUN" | u32 next | u16 n | u16 0 | n x u32 seq
+ *
+ * next being the first datagram not yet received, and the seqs datagrams
+ * after it that are missing.  It sends one whenever it sees a gap, a
+ * datagram it already had, or END, and every TRACE_UDP_WINDOW / 4
+ * datagrams otherwise.  The sender keeps up to TRACE_UDP_WINDOW datagrams
+ * unacknowledged, resending those reported missing, and the oldest if no
+ * status comes within TRACE_UDP_RTO_MS.
+ */
+#define TRACE_UDP_MAGIC		0x44555343U	/* "CSUD" */
+#define TRACE_UDP_STATUS_MAGIC	0x4E555343U	/* "CSUN" */
+#define TRACE_UDP_HEADER	12U
+#define TRACE_UDP_MAX_PAYLOAD	1408U	/* fits a 1500 byte MTU, in formatter frames */
+#define TRACE_UDP_MAX_NACK	64U
+#define TRACE_UDP_WINDOW	32U
+#define TRACE_UDP_RTO_MS	20U
+#define TRACE_UDP_RETRIES	50U	/* timeouts without progress before giving up */
+#define TRACE_UDP_PORT		5555U
+
+#define TRACE_UDP_DATA		0U
+#define TRACE_UDP_OPEN		1U
+#define TRACE_UDP_END		2U
+
+/* Bytes in front of the payload: Ethernet, IPv4, UDP and trace headers */
+#define TRACE_UDP_FRAME_HEADER	(14U + 20U + 8U + TRACE_UDP_HEADER)
+
+/*
+ * The network interface the sender runs on: the GEM in trace_gem.c, or
+ * the software EMAC model in trace_emac_sim.c.
+ */
+typedef struct trace_udp_netif {
+  void *ctx;
+  /* Queue an Ethernet frame of a header followed by a payload, both sent
+   * in place, without the FCS.  Returns 0, or -1 if there is no room. */
+  int (*tx)(void *ctx, const void *hdr, u32 hdr_len, const void *data, u32 len);
+  /* Number of frames sent since the last call, in the order queued */
+  u32 (*tx_done)(void *ctx);
+  /* Copy a received frame into buf.  Returns its length, or 0. */
+  u32 (*rx)(void *ctx, void *buf, u32 size);
+  /* A millisecond clock */
+  u32 (*ms)(void *ctx);
+} trace_udp_netif_t;
+
+/* Addresses, IPs in host order, e.g. 0xC0A80102 for 192.168.1.2 */
+typedef struct trace_udp_addr {
+  u8 mac[6];
+  u32 ip;
+  u32 host_ip;
+  u16 port;			/* the host's port, and the target's */
+} trace_udp_addr_t;
+
+/*
+ * Start a session on a network interface: find the host's MAC address by
+ * ARP, and answer the host's own ARP requests from then on.  Returns -1
+ * if the host does not answer.
+ */
+int trace_udp_init(const trace_udp_netif_t *netif, const trace_udp_addr_t *addr);
+
+/* Non-zero while a session is running */
+int trace_udp_ready(void);
+
+/* Name file, e.g. "device_3.ini".  Returns 0, or -1 on error. */
+int trace_udp_open(u8 file, const char *name);
+
+/*
+ * Queue nbytes to append to file, in datagrams of TRACE_UDP_MAX_PAYLOAD.
+ * The data is sent in place, so must stay unchanged until acknowledged:
+ * trace_udp_acked() has counted it, or trace_udp_flush() has returned.
+ * Waits for room in the window.  Returns nbytes, or -1 if the session
+ * has failed.
+ */
+int trace_udp_write(u8 file, const void *data, u32 nbytes);
+
+/* Check for status from the host and resend as needed.  Returns the
+ * bytes of DATA acknowledged, in order, since the last call or
+ * trace_udp_flush(), or -1 if the session has failed. */
+int trace_udp_acked(void);
+
+/* Wait until everything queued is acknowledged.  Returns 0, or -1. */
+int trace_udp_flush(void);
+
+/* End the session, waiting for the host to acknowledge it.  Returns 0,
+ * or -1. */
+int trace_udp_end(void);
+
+/* Bytes of DATA sent for the first time, and datagrams sent again, in
+ * the session */
+u32 trace_udp_bytes(void);
+u32 trace_udp_resent(void);
+
+#endif /* INCLUDE_TRACE_UDP_H_ */
@@ -8,6 +8,57 @@
 #ifndef INCLUDE_WRITE_UART_H_
 #define INCLUDE_WRITE_UART_H_
 
+#include "xil_types.h"
+#include "xscugic.h"
+
 int write_uchar8 (int32_t fd, unsigned char* buf, int32_t nbytes);
 
+/*
+ * Framed trace transport over a PS UART, read on the host by
+ * host/cstrace_recv.c.  Each frame is, little-endian:
+ *
+ *   u32 magic "CSTR" | u32 seq | u32 len | len bytes of trace | u32 crc
+ *
+ * with the CRC-32 (IEEE 802.3) over seq, len and the trace.  Frames are
+ * numbered from 0, and a frame with len 0 ends the dump.  The receiver
+ * skips any console text between frames.
+ */
+#define UART_TRACE_MAGIC	0x52545343U	/* "CSTR" */
+#define UART_TRACE_MAX_PAYLOAD	2048U
+#define UART_TRACE_OVERHEAD	16U
+#define UART_TRACE_DEFAULT_BAUD	921600U
+
+/*
+ * Set up a UART for framed trace.  With a GIC, frames are sent under
+ * interrupts, the TX FIFO being refilled as it empties while the next
+ * frame is built; the GIC must be initialized and exceptions enabled by
+ * the caller.  With gic NULL, frames are sent polled, filling the FIFO
+ * whenever it has room.  A baud of 0 keeps the driver default (115200).
+ * Console output on the same UART continues at the new rate.
+ */
+int uart_trace_init(u16 device_id, u32 baud, XScuGic *gic, u32 irq_id);
+
+/* Non-zero once uart_trace_init() has succeeded */
+int uart_trace_ready(void);
+
+/* Send trace in frames of at most UART_TRACE_MAX_PAYLOAD bytes.
+ * Returns nbytes, or -1 if the transport is not set up. */
+int uart_trace_send(const void *buf, u32 nbytes);
+
+/* Send the end frame and wait for it to go out.  The next dump counts
+ * its frames from 0 again. */
+int uart_trace_end(void);
+
+/* Wait until all frames queued so far have left the TX FIFO, e.g.
+ * before printing to the console on the same UART */
+void uart_trace_flush(void);
+
+/* Build a frame of len bytes of data, len at most UART_TRACE_MAX_PAYLOAD,
+ * in frame, which must have room for UART_TRACE_OVERHEAD more.  Returns
+ * the frame's size.  Lets other transports send the same frames. */
+u32 uart_trace_build_frame(u8 *frame, u32 seq, const void *data, u32 len);
+
+/* Update a CRC-32 (IEEE 802.3) with nbytes; start with crc = 0 */
+u32 uart_crc32(u32 crc, const void *buf, u32 nbytes);
+
 #endif /* INCLUDE_WRITE_UART_H_ */
@@ -17,13 +17,24 @@
 */
 
 #include "cs_access_cmnfns.h"
+#include "cs_reg_access.h"
+
+#ifdef ARMR5
+#include "xtime_l.h"
+#include "xil_cache.h"
+#endif
 
 /* Declare the global library information structure */
 struct global G;
 
-/* iterations for waiting for bits */
+/* iterations for waiting for bits, if the access backend has no clock */
 static int wait_iterations = 32;
 
+/* time limit for waiting for bits, and the bounds of the delay between polls */
+static unsigned int wait_timeout_us = 1000;
+#define WAIT_BACKOFF_MIN_NS 250
+#define WAIT_BACKOFF_MAX_US 64
+
 #ifdef DIAG
 /*
   Write a diagnostic message.
@@ -132,12 +143,84 @@ struct cs_device *cs_get_device_struct(cs_device_t dev)
     return (struct cs_device *) (dev);
 }
 
+/*
+  Device registry memory.  Devices, address exclusions, ECT channels, STM
+  port tables and the lookup index are carved from one arena, and
+  cs_shutdown() releases them all at once.  The arena is a static buffer of
+  CS_REGISTRY_ARENA_SIZE bytes, which can be placed in a named section (e.g.
+  TCM) with CS_REGISTRY_ARENA_SECTION, or a region given to
+  cs_registry_set_memory().  If it fills up, allocations come from the heap.
+*/
+#ifndef CS_REGISTRY_ARENA_SIZE
+#define CS_REGISTRY_ARENA_SIZE 0x8000
+#endif
+#define ARENA_ALIGN 8
+
+#if CS_REGISTRY_ARENA_SIZE > 0
+static unsigned long long registry_arena[CS_REGISTRY_ARENA_SIZE / ARENA_ALIGN]
+#ifdef CS_REGISTRY_ARENA_SECTION
+    __attribute__ ((section(CS_REGISTRY_ARENA_SECTION)))
+#endif
+    ;
+static unsigned char *arena_base = (unsigned char *) registry_arena;
+static unsigned int arena_size = sizeof registry_arena;
+#else
+static unsigned char *arena_base;
+static unsigned int arena_size;
+#endif
+
+int _cs_set_registry_memory(void *mem, unsigned int size)
+{
+    /* Align the start, and round the size down */
+    unsigned int const skip =
+	(ARENA_ALIGN - ((unsigned long) mem & (ARENA_ALIGN - 1))) &
+	(ARENA_ALIGN - 1);
+    if (mem == NULL || size <= skip) {
+	arena_base = NULL;
+	arena_size = 0;
+    } else {
+	arena_base = (unsigned char *) mem + skip;
+	arena_size = (size - skip) & ~(ARENA_ALIGN - 1);
+    }
+    return 0;
+}
+
+/* Allocate zeroed registry memory */
+void *_cs_alloc(unsigned int size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if (size <= arena_size - G.arena_used) {
+	void *p = arena_base + G.arena_used;
+	G.arena_used += size;
+	memset(p, 0, size);
+	return p;
+    }
+    if (DTRACEG) {
+	diagf("!registry arena full, allocating %u bytes from the heap\n",
+	      size);
+    }
+    return calloc(1, size);
+}
+
+/* Free registry memory.  Arena memory is only released by cs_shutdown(). */
+void _cs_free(void *p)
+{
+    unsigned char *const b = (unsigned char *) p;
+    if (b < arena_base || b >= arena_base + arena_size) {
+	free(p);
+    }
+}
+
+void _cs_arena_release(void)
+{
+    G.arena_used = 0;
+}
+
 struct cs_device *cs_device_new(cs_physaddr_t addr,
 				void volatile *local_addr)
 {
     struct cs_device *d =
-	(struct cs_device *) malloc(sizeof(struct cs_device));
-    memset(d, 0, sizeof(struct cs_device));
+	(struct cs_device *) _cs_alloc(sizeof(struct cs_device));
     /* N.b. phys addr may be CS_NO_PHYS_ADDR, e.g. for non-programmable replicators */
     d->phys_addr = addr;
     d->local_addr = local_addr;
@@ -149,6 +232,8 @@ struct cs_device *cs_device_new(cs_physaddr_t addr,
     d->next = G.device_top;
     G.device_top = d;
     ++G.n_devices;
+    /* Lookups scan the device list until the index is rebuilt */
+    G.indexed = 0;
     return d;
 }
 
@@ -163,12 +248,285 @@ unsigned int volatile *_cs_get_register_address(struct cs_device *d,
 }
 
 
+/*
+  Register access counters, per device and for the library as a whole.
+*/
+#define COUNT(d, field) (++(d)->stats.field, ++G.stats.field)
+
+
+/*
+  Shadow register cache.
+
+  When enabled for a device, the last value read from or written to each
+  configuration register is kept in memory.  Reads are then served from the
+  shadow and writes of the value the register already holds are suppressed,
+  without any bus access.
+
+  Only registers that change solely as a result of our own writes are
+  shadowed.  Status, pointer, counter and self-clearing registers are always
+  accessed on the bus, as is the management region from 0xF00 (integration
+  control, claim tags, lock and ID registers).  Anything else that may
+  change a register behind our back (an external debugger, power-down)
+  needs an explicit cs_device_shadow_invalidate().
+*/
+static int shadow_cacheable(struct cs_device *d, unsigned int off)
+{
+    if (off >= CS_SHADOW_REGS * 4) {
+	return 0;
+    }
+    switch (d->type) {
+    case DEV_ETM:
+	if (CS_ETMVERSION_MAJOR(_cs_etm_version(d)) >= CS_ETMVERSION_ETMv4) {
+	    return !(off == CS_ETMV4_STATR || off == CS_ETMV4_SEQSTR ||
+		     (off >= CS_ETMV4_CNTVR(0) && off <= CS_ETMV4_CNTVR(3))
+		     || (off >= CS_ETMV4_SSCSR(0)
+			 && off <= CS_ETMV4_SSCSR(7))
+		     || off == CS_ETMv4_OSLAR || off == CS_ETMv4_OSLSR
+		     || off == CS_ETMv4_PDSR);
+	}
+	return !(off == CS_ETMSTATUS || off == CS_ETMSQR ||
+		 (off >= CS_ETMCNTVR(0) && off <= CS_ETMCNTVR(3)) ||
+		 off == CS_ETMOSLAR || off == CS_ETMOSLSR
+		 || off == CS_ETMPDSR);
+    case DEV_ETB:
+    case DEV_ETF:
+	return !(off == CS_ETB_STATUS || off == CS_ETB_RAM_DATA ||
+		 off == CS_ETB_RAM_RD_PTR || off == CS_ETB_RAM_WR_PTR ||
+		 off == CS_ETB_RAM_WRITE_DATA || off == CS_TMC_LBUFLEVEL
+		 || off == CS_TMC_CBUFLEVEL || off == CS_TMC_RRPHI
+		 || off == CS_TMC_RWPHI || off == CS_ETB_FLFMT_STATUS
+		 || off == CS_ETB_FLFMT_CTRL);
+    case DEV_TPIU:
+	return !(off == CS_TPIU_FLFMT_STATUS || off == CS_TPIU_FLFMT_CTRL ||
+		 off == CS_TPIU_CUR_TEST_PAT_MODE);
+    case DEV_CTI:
+	return !((off >= CS_CTIINTACK && off <= CS_CTIAPPPULSE) ||
+		 (off >= CS_CTITRIGINSTATUS && off <= CS_CTICHOUTSTATUS));
+    case DEV_TS:
+	return !(off == CS_CNTSR || off == CS_CNTCVL || off == CS_CNTCVU);
+    case DEV_FUNNEL:
+    case DEV_REPLICATOR:
+	return 1;
+    default:
+	return 0;
+    }
+}
+
+static int shadow_is_valid(struct cs_device *d, unsigned int off)
+{
+    unsigned int const r = off / 4;
+    return r < CS_SHADOW_REGS
+	&& (d->shadow->valid[r / 32] & (1U << (r % 32))) != 0;
+}
+
+static void shadow_store(struct cs_device *d, unsigned int off,
+			 unsigned int data)
+{
+    unsigned int const r = off / 4;
+    if (shadow_cacheable(d, off)) {
+	d->shadow->val[r] = data;
+	d->shadow->valid[r / 32] |= 1U << (r % 32);
+    }
+}
+
+void _cs_shadow_invalidate(struct cs_device *d, unsigned int off)
+{
+    unsigned int r;
+    if (d->shadow == NULL) {
+	return;
+    }
+    if (off == CS_REG_SHADOW_ALL) {
+	memset(d->shadow->valid, 0, sizeof d->shadow->valid);
+    } else if ((r = off / 4) < CS_SHADOW_REGS) {
+	d->shadow->valid[r / 32] &= ~(1U << (r % 32));
+    }
+}
+
+int _cs_shadow_enable(struct cs_device *d, int enable)
+{
+    if (!enable) {
+	free(d->shadow);
+	d->shadow = NULL;
+	return 0;
+    }
+    if (d->shadow != NULL) {
+	return 0;
+    }
+    if (cs_device_is_non_mmio(d) || !shadow_cacheable(d, 0)) {
+	return cs_report_device_error(d, "%s registers can't be shadowed",
+				      cs_device_type_name(d));
+    }
+    d->shadow = (struct cs_shadow *) calloc(1, sizeof(struct cs_shadow));
+    if (d->shadow == NULL) {
+	return cs_report_device_error(d, "can't allocate register shadow");
+    }
+    return 0;
+}
+
+
+/*
+  Bus accesses.  Everything that actually reaches a device register goes
+  through these, so they are where the access counters are kept.  With
+  instrumentation enabled, the time spent in each access is added to the
+  device's cycle count.
+*/
+static void count_cycles(struct cs_device *d, unsigned long long t0)
+{
+    unsigned long long const t = G.access->cycles() - t0;
+    d->stats.cycles += t;
+    G.stats.cycles += t;
+}
+
+static unsigned int bus_read32(struct cs_device *d, unsigned int off)
+{
+    unsigned int data;
+    unsigned long long t0;
+    COUNT(d, bus_reads);
+    if (!G.instrument) {
+	return G.access->read32(d->local_addr, off);
+    }
+    t0 = G.access->cycles();
+    data = G.access->read32(d->local_addr, off);
+    count_cycles(d, t0);
+    return data;
+}
+
+static void bus_write32(struct cs_device *d, unsigned int off,
+			unsigned int data)
+{
+    unsigned long long t0;
+    COUNT(d, bus_writes);
+    if (!G.instrument) {
+	G.access->write32(d->local_addr, off, data);
+	return;
+    }
+    t0 = G.access->cycles();
+    G.access->write32(d->local_addr, off, data);
+    count_cycles(d, t0);
+}
+
+/* Barrier following writes to a device, or to several devices if d is NULL */
+static void bus_barrier(struct cs_device *d)
+{
+    if (d != NULL) {
+	COUNT(d, barriers);
+    } else {
+	++G.stats.barriers;
+    }
+    G.access->barrier();
+}
+
+
+/*
+  Register write batching.
+
+  While a batch is open, checked writes (_cs_write etc.) are queued rather
+  than issued.  A later write to a queued register replaces the earlier one
+  and moves to the back of the queue, so the device sees the registers in
+  the order they were last written.  Reads of a queued register return the
+  queued value, so read-modify-write operations compose within a batch.
+
+  Anything that depends on the device having seen the writes - waits,
+  write-only accesses such as lock/unlock and claim tags, and 64-bit
+  writes - flushes the queue first.  The flush issues all queued writes
+  back to back, followed by a single barrier.
+*/
+static int batch_find(struct cs_device *d, unsigned int off)
+{
+    unsigned int i;
+    for (i = 0; i < G.batch_n; ++i) {
+	if (G.batch[i].d == d && G.batch[i].off == off) {
+	    return (int) i;
+	}
+    }
+    return -1;
+}
+
+static void batch_queue(struct cs_device *d, unsigned int off,
+			unsigned int data, char const *oname, int verify)
+{
+    int const i = batch_find(d, off);
+    if (i >= 0) {
+	verify |= G.batch[i].verify;
+	--G.batch_n;
+	memmove(&G.batch[i], &G.batch[i + 1],
+		(G.batch_n - i) * sizeof(struct cs_reg_batch_entry));
+    } else if (G.batch_n == CS_REG_BATCH_MAX) {
+	_cs_batch_flush();
+    }
+    G.batch[G.batch_n].d = d;
+    G.batch[G.batch_n].off = off;
+    G.batch[G.batch_n].data = data;
+    G.batch[G.batch_n].oname = oname;
+    G.batch[G.batch_n].verify = verify;
+    ++G.batch_n;
+}
+
+/*
+  Check a write by reading the register back.  With a shadow, the value
+  read back is what the register holds, so it replaces the shadow.
+*/
+static void write_check(struct cs_device *d, unsigned int off,
+			unsigned int data, char const *oname)
+{
+    unsigned int const ndata = bus_read32(d, off);
+    if (ndata != data) {
+	diagf("!%" CS_PHYSFMT ": write %03X (%s) = %08X now %08X\n",
+	      d->phys_addr, off, oname, data, ndata);
+	if (d->shadow != NULL) {
+	    shadow_store(d, off, ndata);
+	}
+    }
+}
+
+int _cs_batch_flush(void)
+{
+    unsigned int i, n;
+    struct cs_reg_batch_entry *e;
+
+    n = G.batch_n;
+    if (n == 0) {
+	return 0;
+    }
+    G.batch_n = 0;
+    for (i = 0; i < n; ++i) {
+	e = &G.batch[i];
+	bus_write32(e->d, e->off, e->data);
+    }
+    bus_barrier(n == 1 ? G.batch[0].d : NULL);
+    for (i = 0; i < n; ++i) {
+	e = &G.batch[i];
+	if (e->verify) {
+	    write_check(e->d, e->off, e->data, e->oname);
+	}
+    }
+    if (DTRACEG) {
+	diagf("!committed %u batched writes\n", n);
+    }
+    return 0;
+}
+
 unsigned int _cs_read(struct cs_device *d, unsigned int off)
 {
+    int i;
+    unsigned int data;
     assert(d->local_addr != NULL);
     assert((off & 3) == 0);
     assert(off < 4096);
-    return *(unsigned int volatile const *) (d->local_addr + off);
+    if (G.batch_n > 0 && (i = batch_find(d, off)) >= 0) {
+	COUNT(d, reads_saved);
+	return G.batch[i].data;
+    }
+    if (d->shadow != NULL) {
+	if (shadow_is_valid(d, off)) {
+	    COUNT(d, reads_saved);
+	    return d->shadow->val[off / 4];
+	}
+	data = bus_read32(d, off);
+	shadow_store(d, off, data);
+	return data;
+    }
+    return bus_read32(d, off);
 }
 
 unsigned long long _cs_read64(struct cs_device *d, unsigned int off)
@@ -176,7 +534,8 @@ unsigned long long _cs_read64(struct cs_device *d, unsigned int off)
     assert(d->local_addr != NULL);
     assert((off & 7) == 0);
     assert(off < 4096);
-    return *(unsigned long long volatile const *) (d->local_addr + off);
+    COUNT(d, bus_reads);
+    return G.access->read64(d->local_addr, off);
 }
 
 
@@ -184,16 +543,21 @@ unsigned long long _cs_read64(struct cs_device *d, unsigned int off)
   Low-level write, with no read-back.
 
   Example uses:
-  - as part of the implementation of checking writes
   - writing key to lock-registers when locked
   - S/W stimulus ports (usable when device locked)
+  - registers that don't read back what was written
+
+  Since we can't tell what the register now holds, any shadow of it is
+  dropped.
 */
 int _cs_write_wo(struct cs_device *d, unsigned int off, unsigned int data)
 {
     assert(d->local_addr != NULL);
     assert((off & 3) == 0);
     assert(off < 4096);
-    *(unsigned int volatile *) (d->local_addr + off) = data;
+    _cs_batch_flush();
+    _cs_shadow_invalidate(d, off);
+    bus_write32(d, off, data);
     return 0;
 }
 
@@ -203,14 +567,30 @@ int _cs_write64_wo(struct cs_device *d, unsigned int off,
     assert(d->local_addr != NULL);
     assert((off & 7) == 0);
     assert(off < 4096);
-    *(unsigned long long volatile *) (d->local_addr + off) = data;
+    _cs_batch_flush();
+    _cs_shadow_invalidate(d, off);
+    _cs_shadow_invalidate(d, off + 4);
+    COUNT(d, bus_writes);
+    G.access->write64(d->local_addr, off, data);
     return 0;
 }
 
 int _cs_write_traced(struct cs_device *d, unsigned int off,
 		     unsigned int data, char const *oname)
 {
-    unsigned int ndata;
+    int verify = DCHECK(d);
+    if (d->shadow != NULL && shadow_is_valid(d, off)) {
+	if (d->shadow->val[off / 4] == data) {
+	    if (DTRACE(d)) {
+		diagf("!%" CS_PHYSFMT ": write %03X (%s) = %08X suppressed\n",
+		      d->phys_addr, off, oname, data);
+	    }
+	    COUNT(d, writes_saved);
+	    return 0;
+	}
+	/* The register was already checked when it entered the shadow */
+	verify = 0;
+    }
     if (DTRACE(d)) {
 	diagf("!%" CS_PHYSFMT ": write %03X (%s) = %08X\n",
 	      d->phys_addr, off, oname, data);
@@ -221,18 +601,19 @@ int _cs_write_traced(struct cs_device *d, unsigned int off,
 		  d->phys_addr, off, oname);
 	}
     }
-    _cs_write_wo(d, off, data);
-    if (DCHECK(d)) {
-	/* Read the data back */
-	ndata = *(unsigned int volatile *) (d->local_addr + off);
-	if (ndata != data) {
-	    diagf("!%" CS_PHYSFMT ": write %03X (%s) = %08X now %08X\n",
-		  d->phys_addr, off, oname, data, ndata);
-	}
+    if (d->shadow != NULL) {
+	shadow_store(d, off, data);
     }
-#if defined(__arm__) || defined(__aarch64__)
-    __asm__ __volatile__("dmb sy");
-#endif
+    if (G.batch_depth > 0) {
+	batch_queue(d, off, data, oname, verify);
+	return 0;
+    }
+    _cs_batch_flush();
+    bus_write32(d, off, data);
+    if (verify) {
+	write_check(d, off, data, oname);
+    }
+    bus_barrier(d);
     return 0;
 }
 
@@ -253,16 +634,14 @@ int _cs_write64_traced(struct cs_device *d, unsigned int off,
     _cs_write64_wo(d, off, data);
     if (DCHECK(d)) {
 	/* Read the data back */
-	ndata = *(unsigned long long volatile *) (d->local_addr + off);
+	ndata = _cs_read64(d, off);
 	if (ndata != data) {
 	    diagf("!%" CS_PHYSFMT
 		  ": write %03X (%s) = %016llX now %016llX\n",
 		  d->phys_addr, off, oname, data, ndata);
 	}
     }
-#if defined(__arm__) || defined(__aarch64__)
-    __asm__ __volatile__("dmb sy");
-#endif
+    G.access->barrier();
     return 0;
 }
 
@@ -321,18 +700,108 @@ int _cs_isset(struct cs_device *d, unsigned int off, unsigned int bits)
     return (_cs_read(d, off) & bits) == bits;
 }
 
-int _cs_wait(struct cs_device *d, unsigned int off, unsigned int bit)
+/*
+  Read a register that is being polled.  This always goes to the bus, but
+  refreshes the shadow with what it finds.
+*/
+static unsigned int poll_read(struct cs_device *d, unsigned int off)
 {
-    int i;
-    for (i = 0; i < wait_iterations; ++i) {
-	if (_cs_isset(d, off, bit)) {
-	    if (DTRACE(d)) {
-		diagf("!%" CS_PHYSFMT
-		      ": bit %03X.%08X set after %d iterations\n",
-		      d->phys_addr, off, bit, i);
+    unsigned int const data = bus_read32(d, off);
+    if (d->shadow != NULL) {
+	shadow_store(d, off, data);
+    }
+    return data;
+}
+
+static int waitbits_match(unsigned int regval, unsigned int bits,
+			  cs_reg_waitbits_op_t operation, unsigned int pattern)
+{
+    switch (operation) {
+    case CS_REG_WAITBITS_ALL_1:
+	return (regval & bits) == bits;
+    case CS_REG_WAITBITS_ANY_1:
+	return (regval & bits) != 0;
+    case CS_REG_WAITBITS_ALL_0:
+	return (regval & bits) == 0;
+    case CS_REG_WAITBITS_ANY_0:
+	return (regval & bits) != bits;
+    case CS_REG_WAITBITS_PTTRN:
+	return (regval & bits) == (pattern & bits);
+    default:
+	return 0;
+    }
+}
+
+/*
+  Poll a register until its bits satisfy the condition.
+
+  If the access backend has a clock, the wait is bounded by wait_timeout_us
+  and the delay between polls doubles from WAIT_BACKOFF_MIN_NS up to
+  WAIT_BACKOFF_MAX_US, so a slow drain does not saturate the APB with
+  polls.  The register is always polled once more after the deadline.
+  Without a clock the wait is bounded by wait_iterations polls.
+
+  Returns the number of polls made, negated if the condition was not met.
+*/
+static int wait_poll(struct cs_device *d, unsigned int off, unsigned int bits,
+		     cs_reg_waitbits_op_t operation, unsigned int pattern,
+		     unsigned int *p_last_val)
+{
+    unsigned long long const hz = G.access->cycles_hz;
+    unsigned long long now, deadline, until, backoff, backoff_max;
+    unsigned int regval = 0;
+    int i, done = 0;
+
+    _cs_batch_flush();
+    if (hz == 0) {
+	for (i = 1; i <= wait_iterations && !done; ++i) {
+	    COUNT(d, wait_iterations);
+	    regval = poll_read(d, off);
+	    done = waitbits_match(regval, bits, operation, pattern);
+	}
+	--i;
+    } else {
+	now = G.access->cycles();
+	deadline = now + hz * wait_timeout_us / 1000000;
+	backoff = hz * WAIT_BACKOFF_MIN_NS / 1000000000;
+	backoff_max = hz * WAIT_BACKOFF_MAX_US / 1000000;
+	if (backoff == 0) {
+	    backoff = 1;
+	}
+	for (i = 1;; ++i) {
+	    COUNT(d, wait_iterations);
+	    regval = poll_read(d, off);
+	    done = waitbits_match(regval, bits, operation, pattern);
+	    if (done || now >= deadline) {
+		break;
 	    }
-	    return 0;
+	    until = now + backoff;
+	    if (until > deadline) {
+		until = deadline;
+	    }
+	    do {
+		now = G.access->cycles();
+	    } while (now < until);
+	    if (backoff < backoff_max) {
+		backoff *= 2;
+	    }
+	}
+    }
+    if (p_last_val) {
+	*p_last_val = regval;
+    }
+    return done ? i : -i;
+}
+
+int _cs_wait(struct cs_device *d, unsigned int off, unsigned int bit)
+{
+    int const n = wait_poll(d, off, bit, CS_REG_WAITBITS_ALL_1, 0, NULL);
+    if (n > 0) {
+	if (DTRACE(d)) {
+	    diagf("!%" CS_PHYSFMT ": bit %03X.%08X set after %d polls\n",
+		  d->phys_addr, off, bit, n);
 	}
+	return 0;
     }
     return cs_report_device_error(d, "bit %03X.%08X did not set",
 				  off, bit);
@@ -340,16 +809,14 @@ int _cs_wait(struct cs_device *d, unsigned int off, unsigned int bit)
 
 int _cs_waitnot(struct cs_device *d, unsigned int off, unsigned int bit)
 {
-    int i;
-    for (i = 0; i < wait_iterations; ++i) {
-	if (!_cs_isset(d, off, bit)) {
-	    if (DTRACE(d)) {
-		diagf("!%" CS_PHYSFMT
-		      ": bit %03X.%08X clear after %d iterations\n",
-		      d->phys_addr, off, bit, i);
-	    }
-	    return 0;
+    int const n = wait_poll(d, off, bit, CS_REG_WAITBITS_ANY_0, 0, NULL);
+    if (n > 0) {
+	if (DTRACE(d)) {
+	    diagf("!%" CS_PHYSFMT
+		  ": bit %03X.%08X clear after %d polls\n",
+		  d->phys_addr, off, bit, n);
 	}
+	return 0;
     }
     return cs_report_device_error(d, "bit %03X.%08X did not clear",
 				  off, bit);
@@ -360,12 +827,16 @@ void _cs_set_wait_iterations(int iterations)
     wait_iterations = iterations;
 }
 
+void _cs_set_wait_timeout(unsigned int timeout_us)
+{
+    wait_timeout_us = timeout_us;
+}
+
 int _cs_waitbits(struct cs_device *d, unsigned int off, unsigned int bits,
 		 cs_reg_waitbits_op_t operation, unsigned int pattern,
 		 unsigned int *p_last_val)
 {
-    unsigned int regval = 0;
-    int ret = -1, i;
+    int n;
 
     static char *err_msgs[] = {
 	"waitbits(CS_REG_WAITBITS_ALL_1): all bits %03X.%08X failed to be set\n",
@@ -375,87 +846,23 @@ int _cs_waitbits(struct cs_device *d, unsigned int off, unsigned int bits,
 	"waitbits(CS_REG_WAITBITS_PTTRN): bits %03X.%08X failed to match pattern %08X\n"
     };
 
-    for (i = 0; i < wait_iterations; ++i) {
-	regval = _cs_read(d, off);
-	switch (operation) {
-	case CS_REG_WAITBITS_ALL_1:
-	    if ((regval & bits) == bits) {
-		if (DTRACE(d)) {
-		    diagf("!%" CS_PHYSFMT
-			  ": bits %03X.%08X set after %d iterations\n",
-			  d->phys_addr, off, bits, i);
-		}
-		ret = 0;
-	    }
-	    break;
-
-	case CS_REG_WAITBITS_ANY_1:
-	    /* any bits set */
-	    if ((regval & bits) != 0) {
-		if (DTRACE(d)) {
-		    diagf("!%" CS_PHYSFMT
-			  ": bits %03X.%08X any set after %d iterations\n",
-			  d->phys_addr, off, bits, i);
-		}
-		ret = 0;
-	    }
-	    break;
-
-	case CS_REG_WAITBITS_ALL_0:
-	    /* all bits clear */
-	    if ((regval & bits) == 0) {
-		if (DTRACE(d)) {
-		    diagf("!%" CS_PHYSFMT
-			  ": bits %03X.%08X clear after %d iterations\n",
-			  d->phys_addr, off, bits, i);
-		}
-		ret = 0;
-	    }
-	    break;
-
-	case CS_REG_WAITBITS_ANY_0:
-	    /* any bits clear */
-	    if ((regval & bits) != bits) {
-		if (DTRACE(d)) {
-		    diagf("!%" CS_PHYSFMT
-			  ": bits %03X.%08X any clear after %d iterations\n",
-			  d->phys_addr, off, bits, i);
-		}
-		ret = 0;
-		break;
-	    }
-
-	case CS_REG_WAITBITS_PTTRN:
-	    /* any bits clear */
-	    if ((regval & bits) == (pattern & bits)) {
-		if (DTRACE(d)) {
-		    diagf("!%" CS_PHYSFMT
-			  ": bits %03X.%08X matched pattern %08X after %d iterations\n",
-			  d->phys_addr, off, bits, pattern, i);
-		}
-		ret = 0;
-		break;
-	    }
+    n = wait_poll(d, off, bits, operation, pattern, p_last_val);
+    if (n > 0) {
+	if (DTRACE(d)) {
+	    diagf("!%" CS_PHYSFMT
+		  ": bits %03X.%08X matched (op %d, pattern %08X) after %d polls\n",
+		  d->phys_addr, off, bits, operation, pattern, n);
 	}
-
-	if (ret == 0)
-	    break;
-
+	return 0;
     }
 
-    /* return last value if required */
-    if (p_last_val)
-	*p_last_val = regval;
-
     /* if we didn't find a match need to report this */
-    if (ret != 0) {
-	if (operation == CS_REG_WAITBITS_PTTRN)
-	    cs_report_device_error(d, err_msgs[operation - 1], off, bits,
-				   pattern);
-	else
-	    cs_report_device_error(d, err_msgs[operation - 1], off, bits);
-    }
-    return ret;
+    if (operation == CS_REG_WAITBITS_PTTRN)
+	cs_report_device_error(d, err_msgs[operation - 1], off, bits,
+			       pattern);
+    else
+	cs_report_device_error(d, err_msgs[operation - 1], off, bits);
+    return -1;
 }
 
 int _cs_claim(struct cs_device *d, unsigned int bit)
@@ -525,20 +932,254 @@ void _cs_lock(struct cs_device *d)
 */
 void *io_map(cs_physaddr_t addr, unsigned int size, int writable)
 {
-    void *localv;
-    cs_physaddr_t addr_to_map = addr;	/* may be rounded down to phys page size */
     assert(size > 0);
     assert((addr % 4096) == 0);
+    assert(G.access != NULL);
+    return G.access->map(addr, size, writable);
+}
 
-    localv = (void *) addr_to_map;
 
-    return localv;
+void io_unmap(void *addr, unsigned int size)
+{
+    G.access->unmap(addr, size);
 }
 
 
-void io_unmap(void *addr, unsigned int size)
+/*
+  Order all preceding device accesses before any subsequent ones.
+*/
+void _cs_barrier(void)
+{
+    bus_barrier(NULL);
+}
+
+
+/*
+  Current value of the backend's free-running clock.
+*/
+unsigned long long _cs_cycles(void)
+{
+    return G.access->cycles();
+}
+
+
+/* ---------- Memory-mapped I/O backend ------------- */
+
+/*
+  The default for bare-metal targets: physical addresses are directly
+  accessible (flat mapping, or an MPU region set up by the platform code).
+*/
+static int mmio_open(void)
+{
+    return 0;
+}
+
+static void mmio_close(void)
+{
+}
+
+static void *mmio_map(cs_physaddr_t addr, unsigned int size, int writable)
+{
+    return (void *) addr;
+}
+
+static void mmio_unmap(void *local, unsigned int size)
+{
+}
+
+static unsigned int mmio_read32(void volatile const *local,
+				unsigned int off)
+{
+    return *(unsigned int volatile const *) ((unsigned char volatile const
+					      *) local + off);
+}
+
+static unsigned long long mmio_read64(void volatile const *local,
+				      unsigned int off)
+{
+    return *(unsigned long long volatile const *) ((unsigned char volatile
+						    const *) local + off);
+}
+
+static void mmio_write32(void volatile *local, unsigned int off,
+			 unsigned int data)
+{
+    *(unsigned int volatile *) ((unsigned char volatile *) local + off) =
+	data;
+}
+
+static void mmio_write64(void volatile *local, unsigned int off,
+			 unsigned long long data)
+{
+    *(unsigned long long volatile *) ((unsigned char volatile *) local +
+				      off) = data;
+}
+
+static void mmio_barrier(void)
+{
+#if defined(__arm__) || defined(__aarch64__)
+    __asm__ __volatile__("dmb sy");
+#endif
+}
+
+/*
+  On the R5 the standalone BSP's global timer (XTime) is the 32-bit TTC
+  sleep timer, running at COUNTS_PER_SECOND.  It is extended to 64 bits
+  here; it wraps every few tens of seconds, and is read far more often
+  than that while it matters.
+*/
+#if defined(ARMR5) && defined(SLEEP_TIMER_BASEADDR)
+#define MMIO_CYCLES_HZ COUNTS_PER_SECOND
+#else
+#define MMIO_CYCLES_HZ 0
+#endif
+
+static unsigned long long mmio_cycles(void)
+{
+#if defined(ARMR5) && defined(SLEEP_TIMER_BASEADDR)
+    static unsigned long long high;
+    static XTime last;
+    XTime t;
+    XTime_GetTime(&t);
+    if (sizeof(XTime) < 8 && t < last) {
+	high += 0x100000000ULL;
+    }
+    last = t;
+    return high + t;
+#else
+    return 0;
+#endif
+}
+
+/*
+  Trace written to system memory by the ETR bypasses the R5's data cache,
+  so cached lines of the buffer must be discarded before reading it.
+*/
+static void mmio_invalidate(void const *local, unsigned int size)
 {
+#ifdef ARMR5
+    Xil_DCacheInvalidateRange((INTPTR) local, size);
+#endif
+}
+
+/* Tables the CPU writes for the ETR, e.g. scatter-gather tables */
+static void mmio_clean(void const *local, unsigned int size)
+{
+#ifdef ARMR5
+    Xil_DCacheFlushRange((INTPTR) local, size);
+#endif
+}
+
+struct cs_access_ops const cs_access_mmio = {
+    "mmio",
+    mmio_open,
+    mmio_close,
+    mmio_map,
+    mmio_unmap,
+    mmio_read32,
+    mmio_read64,
+    mmio_write32,
+    mmio_write64,
+    mmio_barrier,
+    mmio_cycles,
+    MMIO_CYCLES_HZ,
+    mmio_invalidate,
+    mmio_clean
+};
+
+
+#ifdef __linux__
+/* ---------- /dev/mem backend ------------- */
+
+/*
+  For running as a Linux userspace device driver, e.g. on the A53 cluster.
+  Register accesses are the same as for MMIO, only the mapping differs.
+*/
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <time.h>
+
+static int devmem_open(void)
+{
+    G.mem_fd = open("/dev/mem", O_RDWR | O_SYNC);
+    if (G.mem_fd < 0) {
+	G.mem_fd = 0;
+	return cs_report_error("can't open /dev/mem: %s", strerror(errno));
+    }
+    return 0;
+}
+
+static void devmem_close(void)
+{
+    if (G.mem_fd > 0) {
+	close(G.mem_fd);
+    }
+    G.mem_fd = 0;
+}
 
+static void *devmem_map(cs_physaddr_t addr, unsigned int size, int writable)
+{
+    void *localv;
+    unsigned long const pagesize = (unsigned long) sysconf(_SC_PAGESIZE);
+    cs_physaddr_t addr_to_map = addr & ~(cs_physaddr_t) (pagesize - 1);
+    unsigned int const adj = (unsigned int) (addr - addr_to_map);
+
+    localv = mmap(0, size + adj, (writable ? PROT_WRITE : 0) | PROT_READ,
+		  MAP_SHARED, G.mem_fd, addr_to_map);
+    if (localv == MAP_FAILED) {
+	cs_report_error("can't map %" CS_PHYSFMT ": %s", addr,
+			strerror(errno));
+	return NULL;
+    }
+    return (unsigned char *) localv + adj;
+}
+
+static void devmem_unmap(void *local, unsigned int size)
+{
+    unsigned long const pagesize = (unsigned long) sysconf(_SC_PAGESIZE);
+    unsigned long const adj = (unsigned long) local & (pagesize - 1);
+    munmap((unsigned char *) local - adj, size + adj);
 }
 
+static void devmem_barrier(void)
+{
+    __sync_synchronize();
+}
+
+/* Nanoseconds */
+static unsigned long long devmem_cycles(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* /dev/mem is opened with O_SYNC, so mappings of memory are uncached */
+static void devmem_invalidate(void const *local, unsigned int size)
+{
+}
+
+static void devmem_clean(void const *local, unsigned int size)
+{
+}
+
+struct cs_access_ops const cs_access_devmem = {
+    "devmem",
+    devmem_open,
+    devmem_close,
+    devmem_map,
+    devmem_unmap,
+    mmio_read32,
+    mmio_read64,
+    mmio_write32,
+    mmio_write64,
+    devmem_barrier,
+    devmem_cycles,
+    1000000000ULL,
+    devmem_invalidate,
+    devmem_clean
+};
+#endif				/* __linux__ */
+
 /* end of cs_access_cmnfns.c */
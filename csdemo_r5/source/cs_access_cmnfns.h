@@ -27,6 +27,7 @@
 #include "cs_etmv4_types.h"
 #include "cs_stm_types.h"
 #include "cs_ts_gen.h"
+#include "cs_instrument.h"
 
 #include "csregisters.h"
 
@@ -93,6 +94,10 @@ struct cs_device_ops {
 struct cs_device {
     /* Next device in global list - no particular order */
     struct cs_device *next;
+    /* Next device affine to the same CPU, and of the same type, in the
+       lookup index built by cs_registration_complete() */
+    struct cs_device *cpu_next;
+    struct cs_device *type_next;
 
     struct cs_device_ops ops;
 
@@ -113,6 +118,8 @@ struct cs_device {
     int diag_tracing:1;		  /**< Diagnostic messages for actions on this device */
 #endif				/* DIAG */
     unsigned int n_api_errors;
+    struct cs_shadow *shadow;	  /**< Shadow register cache, or NULL when not enabled */
+    cs_reg_access_stats_t stats;  /**< Register access counters */
 
     /* Trace bus topology */
     unsigned int n_in_ports;
@@ -172,6 +179,14 @@ struct cs_device {
                have other RAM sizes and a RAM width register. */
 #define ETB_WIDTH_SCALE_SHIFT 2
             int pointer_scale_shift:4;
+            unsigned int read_bytes;	/* Bytes read out since the buffer was enabled */
+            unsigned long long read_cycles;	/* Time spent reading them, in backend clock ticks */
+            unsigned int const *sg_table;	/* ETR scatter-gather table, or NULL for a contiguous buffer */
+            unsigned int sg_n_pages;
+            unsigned int sg_hint[2];	/* Pages of the last RRP and RWP lookups, where the next search starts */
+            void **etr_maps;	/* Mappings of the ETR buffer while trace spans are in use */
+            unsigned int etr_n_maps;
+            unsigned int etr_map_size;
             struct tmc_props {
                 /* Use the CS_TMC_CONFIG_TYPE_XYZ macros to interpret the config_type field */
                 unsigned int config_type:2;	/* Build-time TMC configuration (ETR, ETF, ETB) */
@@ -197,6 +212,85 @@ struct cs_device {
 
 #define IS_V8(dev) (dev->v.debug.debug_arch == 0x8)
 
+/*
+  Shadow copy of a device's configuration registers, covering the
+  programmable region below the integration and management registers.
+  valid[] has one bit per register.
+*/
+#define CS_SHADOW_REGS (0xF00 / 4)
+
+struct cs_shadow {
+    unsigned int valid[(CS_SHADOW_REGS + 31) / 32];
+    unsigned int val[CS_SHADOW_REGS];
+};
+
+/*
+  Register access backend.
+
+  All accesses to device registers and ROM tables go through one of these,
+  so that the library can run against real memory-mapped hardware, against
+  /dev/mem from a Linux userspace process, or against a simulated SoC on a
+  development host.  The backend is chosen by cs_init_backend().
+
+  'local' is always an address previously returned by map().
+*/
+struct cs_access_ops {
+    char const *name;
+    int (*open) (void);
+    void (*close) (void);
+    void *(*map) (cs_physaddr_t addr, unsigned int size, int writable);
+    void (*unmap) (void *local, unsigned int size);
+    unsigned int (*read32) (void volatile const *local, unsigned int off);
+    unsigned long long (*read64) (void volatile const *local,
+                                  unsigned int off);
+    void (*write32) (void volatile *local, unsigned int off,
+                     unsigned int data);
+    void (*write64) (void volatile *local, unsigned int off,
+                     unsigned long long data);
+    void (*barrier) (void);
+    unsigned long long (*cycles) (void);	/* free-running clock, for instrumentation and timed waits */
+    unsigned long long cycles_hz;	/* frequency of cycles(), or 0 if there is no clock */
+    void (*invalidate) (void const *local, unsigned int size);	/* discard cached copies of memory written by a bus master */
+    void (*clean) (void const *local, unsigned int size);	/* write back cached data for a bus master to read */
+};
+
+/*
+  A register write queued between cs_reg_batch_begin() and
+  cs_reg_batch_commit().  Writes to the same device register are coalesced,
+  so the queue holds at most one entry per (device, offset).
+*/
+#define CS_REG_BATCH_MAX 128
+
+struct cs_reg_batch_entry {
+    struct cs_device *d;
+    unsigned int off;
+    unsigned int data;
+    char const *oname;
+    int verify;			/* Read back after the write */
+};
+
+/*
+  Counters for one public API entry point.  Entry points register
+  themselves in G.api_top on first call.  stats.cycles is the total time
+  spent in the entry point, not just in register accesses, and hist the
+  distribution of the time taken by each call.
+*/
+struct cs_api_stats {
+    char const *name;
+    struct cs_api_stats *next;
+    unsigned int calls;
+    cs_reg_access_stats_t stats;
+    unsigned int hist[CS_INSTRUMENT_HIST_BUCKETS];
+    int registered;
+};
+
+/* Records the state on entry to an instrumented API function */
+struct cs_api_probe {
+    struct cs_api_stats *api;
+    cs_reg_access_stats_t start;
+    unsigned long long t0;
+};
+
 /*
   We maintain a list of addresses not to be probed, to avoid bus lockups.
 */
@@ -215,6 +309,7 @@ struct addr_exclude {
 */
 struct global {
     struct cs_device *device_top;
+    struct cs_access_ops const *access;	/**< Register access backend */
 #ifdef UNIX_USERSPACE
     int mem_fd;			   /**< File handle for the memory mapped I/O */
 #endif				/* UNIX_USERSPACE */
@@ -231,6 +326,20 @@ struct global {
     int phys_addr_lpae:1;	/* 1 if built with LPAE */
     int virt_addr_64bit:1;	/* 1 if built with 64 bit virtual addresses */
     int devaff0_used:1;		/* Non-zero DEVAFF0 has been seen */
+    cs_reg_access_stats_t stats;	/**< Register access counters, all devices */
+    int instrument:1;		/**< Time register accesses and API calls */
+    struct cs_api_stats *api_top;	/**< Instrumented API entry points called so far */
+    void (*instrument_export) (void const *record, unsigned int size);
+    unsigned int batch_depth;	/**< Nesting depth of cs_reg_batch_begin() */
+    unsigned int batch_n;	/**< Number of queued writes */
+    struct cs_reg_batch_entry batch[CS_REG_BATCH_MAX];
+    unsigned int arena_used;	/**< Bytes allocated from the registry arena */
+    int indexed:1;		/**< The lookup index below is valid */
+    struct cs_device **addr_index;	/**< MMIO devices sorted by physical address */
+    unsigned int n_addr_index;
+    struct cs_device **cpu_top;	/**< Devices affine to each CPU */
+    unsigned int n_cpu_top;
+    struct cs_device *type_top[DEV_MAX];	/**< Devices of each type */
 };
 
 /**
@@ -335,6 +444,10 @@ extern int cs_report_error(char const *fmt, ...);
 extern int cs_report_device_error(struct cs_device *d, char const *fmt,
                                   ...);
 extern struct cs_device *cs_get_device_struct(cs_device_t dev);
+extern int _cs_set_registry_memory(void *mem, unsigned int size);
+extern void *_cs_alloc(unsigned int size);
+extern void _cs_free(void *p);
+extern void _cs_arena_release(void);
 extern struct cs_device *cs_device_new(cs_physaddr_t addr,
                                        void volatile *local_addr);
 
@@ -367,6 +480,7 @@ extern int _cs_clear(struct cs_device *d, unsigned int off,
 extern int _cs_isset(struct cs_device *d, unsigned int off,
                      unsigned int bits);
 extern void _cs_set_wait_iterations(int iterations);
+extern void _cs_set_wait_timeout(unsigned int timeout_us);
 extern int _cs_wait(struct cs_device *d, unsigned int off,
                     unsigned int bit);
 extern int _cs_waitnot(struct cs_device *d, unsigned int off,
@@ -383,10 +497,27 @@ extern void _cs_lock(struct cs_device *d);
 
 extern void *io_map(cs_physaddr_t addr, unsigned int size, int writable);
 extern void io_unmap(void *addr, unsigned int size);
+extern void _cs_barrier(void);
+extern int _cs_batch_flush(void);
+extern int _cs_shadow_enable(struct cs_device *d, int enable);
+extern void _cs_shadow_invalidate(struct cs_device *d, unsigned int off);
+
+extern struct cs_access_ops const cs_access_mmio;
+#ifdef __linux__
+extern struct cs_access_ops const cs_access_devmem;
+#endif				/* __linux__ */
+
+extern unsigned long long _cs_cycles(void);
 
 #define _cs_write(d, off, data) _cs_write_traced(d, off, data, #off)
 #define _cs_write64(d, off, data) _cs_write64_traced(d, off, data, #off)
 
+/* Non API fns in cs_topology.c */
+extern void _cs_index_free(void);
+extern struct cs_device *_cs_device_first_of_type(cs_devtype_t type);
+extern struct cs_device *_cs_device_next_of_type(struct cs_device *d);
+extern void _cs_stm_device_unregister(struct cs_device *d);
+
 /* Non API fns in cs_sw_stim.c */
 extern unsigned int cs_stm_get_ext_ports_size(struct cs_device *d);
 extern int _cs_swstim_trace_enable(struct cs_device *d);
@@ -394,6 +525,14 @@ extern int _cs_swstim_trace_disable(struct cs_device *d);
 extern int _cs_swstim_set_trace_id(struct cs_device *d, cs_atid_t id);
 extern int _cs_stm_config_static_init(struct cs_device *d);
 
+/* Non API fns in cs_trace_source.c */
+extern int _cs_path_links(struct cs_device *src, struct cs_device *sink,
+			  struct cs_device **links, unsigned int max_links);
+
+/* Non API fns in cs_trace_sink.c */
+extern void _cs_etr_rewind(struct cs_device *d);
+extern int _cs_sink_disable_wait(struct cs_device *d);
+
 /* Non API fns in cs_etm.c */
 extern unsigned int _cs_etm_version(struct cs_device *d);
 extern int _cs_etm_enable_programming(struct cs_device *d);
@@ -403,6 +542,16 @@ extern int _cs_etm_static_config_init(struct cs_device *d);
 /* none API fns in cs_ts_gen.c */
 extern int _cs_tsgen_enable(struct cs_device *d, int enable);
 
+/* Non API fns in cs_instrument.c */
+extern void _cs_api_enter(struct cs_api_probe *p, struct cs_api_stats *api);
+extern int _cs_api_exit(struct cs_api_probe *p, int rc);
+extern void _cs_instrument_report(void);
+
+#ifdef CS_SIM
+/* Non API fns in cs_sim.c */
+extern struct cs_access_ops const cs_access_sim;
+#endif				/* CS_SIM */
+
 
 #endif				/* _included_cs_access_cmnfns_h */
 
@@ -18,6 +18,7 @@
 
 #include "cs_access_cmnfns.h"
 #include "cs_cti_ect.h"
+#include "cs_reg_access.h"
 
 /* ---------- Local functions ------------- */
 /**
@@ -230,6 +231,21 @@ unsigned int cs_cti_trigout_status(cs_device_t cti)
     return _cs_read(d, CS_CTITRIGOUTSTATUS);
 }
 
+int cs_cti_ack_trigout(cs_device_t cti, unsigned int ctiport)
+{
+    struct cs_device *d = DEV(cti);
+    assert(d->type == DEV_CTI);
+    assert(ctiport < d->v.cti.n_triggers);
+
+    /* Called from interrupt handlers, so straight to the register,
+       leaving the batch, shadow and counters to the interrupted code.
+       INTACK is write-only, so there is no shadow to invalidate. */
+    G.access->write32(d->local_addr, CS_CTIINTACK, (1U << ctiport));
+    /* The output must drop before the interrupt is ended */
+    G.access->barrier();
+    return 0;
+}
+
 int cs_cti_reset(cs_device_t cti)
 {
     int rc;
@@ -255,11 +271,10 @@ int cs_cti_reset(cs_device_t cti)
 void cs_cti_diag(void)
 {
     struct cs_device *d;
-    for (d = G.device_top; d != NULL; d = d->next) {
+    for (d = _cs_device_first_of_type(DEV_CTI); d != NULL;
+         d = _cs_device_next_of_type(d)) {
         unsigned int sin, sout, cact, cgate, cin, cout;
         unsigned int i, j;
-        if (d->type != DEV_CTI)
-            continue;
         diagf("CTI at %" CS_PHYSFMT "", d->phys_addr);
         if (d->affine_cpu != CS_CPU_UNKNOWN && d->affine_cpu != CS_NO_CPU) {
             diagf(" (cpu #%u)", d->affine_cpu);
@@ -415,10 +430,9 @@ int cs_cti_connect_trigdst(cs_trigdst_t dst, cs_device_t dev,
 cs_trigsrc_t cs_trigsrc(cs_device_t dev, unsigned int devportid)
 {
     struct cs_device *d;
-    for (d = G.device_top; d != NULL; d = d->next) {
+    for (d = _cs_device_first_of_type(DEV_CTI); d != NULL;
+         d = _cs_device_next_of_type(d)) {
         unsigned int i;
-        if (d->type != DEV_CTI)
-            continue;
         for (i = 0; i < d->v.cti.n_triggers; ++i) {
             if (d->v.cti.src[i].dev == DEV(dev)
                 && d->v.cti.src[i].devportid == devportid) {
@@ -437,10 +451,9 @@ cs_trigsrc_t cs_trigsrc(cs_device_t dev, unsigned int devportid)
 cs_trigdst_t cs_trigdst(cs_device_t dev, unsigned int devportid)
 {
     struct cs_device *d;
-    for (d = G.device_top; d != NULL; d = d->next) {
+    for (d = _cs_device_first_of_type(DEV_CTI); d != NULL;
+         d = _cs_device_next_of_type(d)) {
         unsigned int i;
-        if (d->type != DEV_CTI)
-            continue;
         /* Check all outbound triggers */
         for (i = 0; i < d->v.cti.n_triggers; ++i) {
             if (d->v.cti.dst[i].dev == DEV(dev)
@@ -470,9 +483,8 @@ cs_trigdst_t cs_trigdst(cs_device_t dev, unsigned int devportid)
 cs_channel_t cs_ect_get_channel(void)
 {
     struct cs_channel *c =
-        (struct cs_channel *) malloc(sizeof(struct cs_channel));
+        (struct cs_channel *) _cs_alloc(sizeof(struct cs_channel));
     assert(c != NULL);
-    memset(c, 0, sizeof(struct cs_channel));
     return c;
 }
 
@@ -519,7 +531,7 @@ int cs_ect_diag(cs_channel_t chan)
     return 0;
 }
 
-int cs_ect_configure(cs_channel_t chandesc)
+static int _cs_ect_configure(cs_channel_t chandesc)
 {
     unsigned int i;
     unsigned int channo;
@@ -586,9 +598,8 @@ int cs_ect_configure(cs_channel_t chandesc)
                 cs_report_error("all channels are in use by these CTIs");
         }
         /* Scan all CTIs in the system */
-        for (d = G.device_top; d != NULL; d = d->next) {
-            if (d->type != DEV_CTI)
-                continue;
+        for (d = _cs_device_first_of_type(DEV_CTI); d != NULL;
+             d = _cs_device_next_of_type(d)) {
             chans &= ~cs_cti_used_global_channels(DEVDESC(d));
         }
         if (chans == 0) {
@@ -597,7 +608,8 @@ int cs_ect_configure(cs_channel_t chandesc)
         channo = chans & (0U - chans);
     }
 
-    /* Program the requested sources and destinations */
+    /* Program the requested sources and destinations, as one batch */
+    cs_reg_batch_begin();
     for (i = 0; i < c->n_src; ++i) {
         _cs_set(DEV(c->sources[i].cti), CS_CTIINEN(c->sources[i].ctiport),
                 channo);
@@ -609,16 +621,24 @@ int cs_ect_configure(cs_channel_t chandesc)
     for (i = 0; i < c->n_cti; ++i) {
         cs_cti_enable(DEVDESC(c->ctis[i]));
     }
-    return 0;
+    return cs_reg_batch_commit();
+}
+
+static struct cs_api_stats api_ect_configure = { "cs_ect_configure" };
+
+int cs_ect_configure(cs_channel_t chandesc)
+{
+    struct cs_api_probe p;
+    _cs_api_enter(&p, &api_ect_configure);
+    return _cs_api_exit(&p, _cs_ect_configure(chandesc));
 }
 
 int cs_ect_reset(void)
 {
     int rc = 0;
     struct cs_device *d;
-    for (d = G.device_top; d != NULL; d = d->next) {
-        if (d->type != DEV_CTI)
-            continue;
+    for (d = _cs_device_first_of_type(DEV_CTI); d != NULL;
+         d = _cs_device_next_of_type(d)) {
         rc = cs_cti_reset(DEVDESC(d));
         if (rc != 0)
             break;
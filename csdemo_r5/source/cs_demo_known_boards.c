@@ -22,13 +22,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-static int do_registration_zynqus(struct cs_devices_t *devices) {
-	enum {
-		A53_0, A53_1, A53_2, A53_3, R5_0, R5_1
-	};
+enum {
+	A53_0, A53_1, A53_2, A53_3, R5_0, R5_1
+};
+
+/* Register the devices and their connections. Skipped when the registry
+   has been restored from the topology cache. */
+static void register_zynqus_topology(void) {
 	cs_device_t rep, etr, etf_a53, etf_main, fun_main, fun_a53, fun_r5, stm, tpiu;
 	cs_device_t cti0;//, cti1, cti2, cti0_a53, cti1_a53, cti2_a53, cti3_a53, cti0_r5, cti1_r5;
-	int i;
 
 	if (registration_verbose)
 		printf("CSDEMO: Registering CoreSight devices...\n");
@@ -102,27 +104,6 @@ static int do_registration_zynqus(struct cs_devices_t *devices) {
 	cs_atb_register(rep, 0, etr, 0);
 	cs_atb_register(rep, 1, tpiu, 0);
 
-	/* populate the devices structure */
-	// etm/ptm registered in do_configure_trace()
-	devices->itm = stm;
-	devices->etf_a53 = etf_a53;
-	devices->tpiu = tpiu;
-	devices->etf_main = etf_main; /* core output through main etf */
-	devices->etr = etr;
-	devices->fnl_a53 = fun_a53;
-	devices->fnl_main = fun_main;
-	devices->fnl_r5 = fun_r5;
-
-
-	// TBD: STM, FTM, CTI
-	/* STM needs to init master address and master 0 by default
-	All Juno cores see a single master @ 0, but other select bits
-	ensure different cores and security options result in different
-	master IDs in output.
-	*/
-	cs_stm_config_master(stm, 0, 0xF8000000);
-	cs_stm_select_master(stm, 0);
-
 	/* Connect system CTI to devices */
 	cti0 = cs_device_register(0xFE990000);
 	cs_cti_connect_trigsrc(etf_main, CS_TRIGOUT_ETB_FULL, cs_cti_trigsrc(cti0, 0));
@@ -151,7 +132,36 @@ static int do_registration_zynqus(struct cs_devices_t *devices) {
 	CS_TRIGIN_STM_HWEVENT_2); /* rising edge */
 	cs_cti_connect_trigdst(cs_cti_trigdst(cti0, 5), stm,
 	CS_TRIGIN_STM_HWEVENT_3); /* falling edge */
+}
 
+static int do_registration_zynqus(struct cs_devices_t *devices) {
+	cs_device_t stm;
+	int i;
+
+	if (!registration_from_cache)
+		register_zynqus_topology();
+
+	/* populate the devices structure */
+	// etm/ptm registered in do_configure_trace()
+	stm = cs_device_get(0xFE9C0000);
+	devices->itm = stm;
+	devices->etf_a53 = cs_device_get(0xFE940000);
+	devices->tpiu = cs_device_get(0xFE980000);
+	devices->etf_main = cs_device_get(0xFE950000); /* core output through main etf */
+	devices->etr = cs_device_get(0xFE970000);
+	devices->fnl_a53 = cs_device_get(0xFE920000);
+	devices->fnl_main = cs_device_get(0xFE930000);
+	devices->fnl_r5 = cs_device_get(0xFE910000);
+
+
+	// TBD: STM, FTM, CTI
+	/* STM needs to init master address and master 0 by default
+	All Juno cores see a single master @ 0, but other select bits
+	ensure different cores and security options result in different
+	master IDs in output.
+	*/
+	cs_stm_config_master(stm, 0, 0xF8000000);
+	cs_stm_select_master(stm, 0);
 
 	/* primary part number from Main ID Register (MIDR) */
 	for (i = 0; i < 4; i++)
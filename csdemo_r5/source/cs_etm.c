@@ -670,7 +670,7 @@ int cs_etm_config_get_ex(cs_device_t dev, void *etm_config)
 }
 
 /* top level API - diverts to arch appropriate impl */
-int cs_etm_config_put_ex(cs_device_t dev, void *etm_config)
+static int _cs_etm_config_put_ex(cs_device_t dev, void *etm_config)
 {
     struct cs_device *d = DEV(dev);
     unsigned int etm_version;
@@ -692,6 +692,15 @@ int cs_etm_config_put_ex(cs_device_t dev, void *etm_config)
     return rc;
 }
 
+static struct cs_api_stats api_etm_config_put_ex = { "cs_etm_config_put_ex" };
+
+int cs_etm_config_put_ex(cs_device_t dev, void *etm_config)
+{
+    struct cs_api_probe p;
+    _cs_api_enter(&p, &api_etm_config_put_ex);
+    return _cs_api_exit(&p, _cs_etm_config_put_ex(dev, etm_config));
+}
+
 #ifndef UNIX_KERNEL
 /* top level API - diverts to arch appropriate impl */
 int cs_etm_config_print_ex(cs_device_t dev, void *etm_config)
@@ -24,6 +24,7 @@
 
 /* internal lib etmv4 and common */
 #include "cs_access_cmnfns.h"
+#include "cs_reg_access.h"
 #include "cs_etm_v4.h"
 
 /*create a bitmask for bitwidth n (n 1 -> 31) */
@@ -322,6 +323,9 @@ int _cs_etm_v4_config_put(struct cs_device *d, cs_etmv4_config_t * c)
 
     _cs_etm_enable_programming(d);
 
+    /* Queue the register writes and issue them with a single barrier */
+    cs_reg_batch_begin();
+
     /* general configuration */
     if (c->flags & CS_ETMC_CONFIG) {
         _cs_write(d, CS_ETMV4_CONFIGR, c->configr.reg);
@@ -541,6 +545,7 @@ int _cs_etm_v4_config_put(struct cs_device *d, cs_etmv4_config_t * c)
             }
         }
     }
+    rc = cs_reg_batch_commit();
     return rc;
 }
 
@@ -0,0 +1,261 @@
+/*
+  Coresight Access Library - API - flight recorder snapshots of a trace buffer
+
+  Copyright (C) ARM Limited, 2014-2016. All rights reserved.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "cs_access_cmnfns.h"
+#include "cs_trace_sink.h"
+#include "cs_cti_ect.h"
+#include "cs_topology.h"
+#include "cs_flight_recorder.h"
+
+/* ---------- Local functions ------------- */
+
+/*
+  Start the buffer capturing in circular mode.  A trigger on TRIGIN starts
+  the trigger counter, and when that expires a trigger is inserted in the
+  trace and the formatter stops, leaving the buffer holding the trace up
+  to and after the trigger.
+*/
+static int flight_recorder_arm(cs_flight_recorder_t * r)
+{
+    struct cs_device *d = DEV(r->buffer);
+    unsigned int ffcr;
+    int rc;
+
+    rc = cs_empty_trace_buffer(r->buffer);
+    if (rc != 0) {
+	return rc;
+    }
+    if (d->v.etb.is_tmc_device) {
+	if (d->v.etb.tmc.config_type == CS_TMC_CONFIG_TYPE_ETR) {
+	    _cs_etr_rewind(d);
+	}
+	_cs_write(d, CS_TMC_MODE, CS_TMC_MODE_CIRCULAR);
+    }
+    d->v.etb.currently_reading = 0;
+    d->v.etb.finished_reading = 0;
+    d->v.etb.read_bytes = 0;
+    d->v.etb.read_cycles = 0;
+    cs_set_buffer_trigger_counter(r->buffer, r->post_trigger_bytes);
+    ffcr = CS_ETB_FLFMT_CTRL_EnFTC | CS_ETB_FLFMT_CTRL_EnTI |
+	CS_ETB_FLFMT_CTRL_TrigIn | CS_ETB_FLFMT_CTRL_TrigEvt |
+	CS_ETB_FLFMT_CTRL_StopTrig;
+    if (d->v.etb.is_tmc_device) {
+	/* Also stop on a flush, so cs_sink_disable() can stop it */
+	ffcr |= CS_ETB_FLFMT_CTRL_StopFl;
+    }
+    _cs_write(d, CS_ETB_FLFMT_CTRL, ffcr);
+    r->armed = 1;
+    return _cs_write(d, CS_ETB_CTRL, CS_ETB_CTRL_TraceCaptEn);
+}
+
+/*
+  Route the trigger sources to the buffer's TRIGIN.  With hardware sources
+  the ECT picks the channel; with software triggers only, use a channel
+  local to the CTI that drives TRIGIN.
+*/
+static int flight_recorder_route(cs_flight_recorder_t * r,
+				 cs_flight_recorder_config_t const *config)
+{
+    struct cs_device *cti = DEV(r->trigin.cti);
+    unsigned int before, chans;
+    unsigned int i;
+    cs_channel_t chan;
+
+    _cs_unlock(cti);
+    before = _cs_read(cti, CS_CTIOUTEN(r->trigin.ctiport));
+    if (config->n_triggers > 0) {
+	chan = cs_ect_get_channel();
+	for (i = 0; i < config->n_triggers; ++i) {
+	    if (cs_ect_add_trigsrc(chan, config->triggers[i]) != 0) {
+		return cs_report_error("too many flight recorder triggers");
+	    }
+	}
+	if (cs_ect_add_trigdst(chan, r->trigin) != 0
+	    || cs_ect_configure(chan) != 0) {
+	    return cs_report_error("can't route flight recorder triggers");
+	}
+	chans = _cs_read(cti, CS_CTIOUTEN(r->trigin.ctiport)) & ~before;
+    } else {
+	chans = (~cs_cti_used_channels(r->trigin.cti)) & CTI_CHANNEL_MASK;
+	if (chans == 0) {
+	    return cs_report_device_error(cti, "all channels are in use");
+	}
+	chans &= 0U - chans;
+	/* Gate off the channel, to make it local to this CTI */
+	_cs_clear(cti, CS_CTIGATE, chans);
+	_cs_write(cti, CS_CTIOUTEN(r->trigin.ctiport), before | chans);
+	cs_cti_enable(r->trigin.cti);
+    }
+    if (chans == 0) {
+	return cs_report_device_error(cti, "no channel routed to TRIGIN");
+    }
+    for (r->channel = 0; !(chans & (1U << r->channel)); ++r->channel);
+    return 0;
+}
+
+/* ========== API functions ================ */
+
+static int _cs_flight_recorder_start(cs_flight_recorder_t * r,
+				     cs_device_t buffer,
+				     cs_flight_recorder_config_t const
+				     *config)
+{
+    struct cs_device *d = DEV(buffer);
+    unsigned int slot_size;
+    int rc;
+
+    assert(cs_device_has_class(buffer, CS_DEVCLASS_BUFFER));
+    memset(r, 0, sizeof *r);
+    r->buffer = buffer;
+    if (config->post_trigger_bytes > d->v.etb.buffer_size_bytes) {
+	return cs_report_device_error(d,
+				      "post-trigger size %u is more than the %u byte buffer",
+				      config->post_trigger_bytes,
+				      d->v.etb.buffer_size_bytes);
+    }
+    /* A slot holds the header and a full buffer, rounded to 8 bytes */
+    slot_size =
+	(sizeof(cs_flight_snapshot_t) + d->v.etb.buffer_size_bytes +
+	 7) & ~7U;
+    if (config->store_size < slot_size
+	|| ((unsigned long) config->store & 7) != 0) {
+	return cs_report_device_error(d,
+				      "snapshot ring must be 8-byte aligned and hold a %u byte snapshot",
+				      slot_size);
+    }
+    r->trigin = cs_trigdst(buffer, CS_TRIGIN_ETB_TRIGIN);
+    if (r->trigin.cti == CS_ERRDESC) {
+	return cs_report_device_error(d, "TRIGIN is not connected to a CTI");
+    }
+    if (_cs_isset(d, CS_ETB_CTRL, CS_ETB_CTRL_TraceCaptEn)) {
+	return cs_report_device_error(d, "buffer is already enabled");
+    }
+    r->post_trigger_bytes = config->post_trigger_bytes;
+    r->max_snapshots = config->max_snapshots;
+    r->store = (unsigned char *) config->store;
+    r->slot_size = slot_size;
+    r->n_slots = config->store_size / slot_size;
+    rc = flight_recorder_route(r, config);
+    if (rc != 0) {
+	return rc;
+    }
+    return flight_recorder_arm(r);
+}
+
+static struct cs_api_stats api_flight_recorder_start =
+    { "cs_flight_recorder_start" };
+
+int cs_flight_recorder_start(cs_flight_recorder_t * r, cs_device_t buffer,
+			     cs_flight_recorder_config_t const *config)
+{
+    struct cs_api_probe p;
+    _cs_api_enter(&p, &api_flight_recorder_start);
+    return _cs_api_exit(&p, _cs_flight_recorder_start(r, buffer, config));
+}
+
+int cs_flight_recorder_trigger(cs_flight_recorder_t * r)
+{
+    return cs_cti_pulse_channel(r->trigin.cti, r->channel);
+}
+
+static int _cs_flight_recorder_poll(cs_flight_recorder_t * r)
+{
+    struct cs_device *d = DEV(r->buffer);
+    cs_flight_snapshot_t *snap;
+    unsigned char *trace;
+    unsigned int size = 0;
+    int n;
+
+    /* The buffer is ready (acquisition complete, for an ETB) once the
+       formatter has stopped after the trigger */
+    if (!r->armed || !_cs_isset(d, CS_ETB_STATUS, CS_TMC_STATUS_TMCReady)) {
+	return 0;
+    }
+    r->armed = 0;
+    snap = (cs_flight_snapshot_t *) (r->store +
+				     (r->n_snapshots % r->n_slots) *
+				     r->slot_size);
+    trace = (unsigned char *) (snap + 1);
+    while ((n = cs_get_trace_data(r->buffer, trace + size,
+				  d->v.etb.buffer_size_bytes - size)) > 0) {
+	size += n;
+    }
+    if (n < 0) {
+	return n;
+    }
+    snap->seq = r->n_snapshots++;
+    snap->size = size;
+    snap->cycles = (G.access->cycles_hz != 0) ? _cs_cycles() : 0;
+    if (!d->v.etb.is_tmc_device) {
+	_cs_clear(d, CS_ETB_CTRL, CS_ETB_CTRL_TraceCaptEn);
+    }
+    if (DTRACE(d)) {
+	diagf("!flight recorder snapshot %u: %u bytes\n", snap->seq, size);
+    }
+    if (r->max_snapshots == 0 || r->n_snapshots < r->max_snapshots) {
+	n = flight_recorder_arm(r);
+	if (n != 0) {
+	    return n;
+	}
+    }
+    return 1;
+}
+
+static struct cs_api_stats api_flight_recorder_poll =
+    { "cs_flight_recorder_poll" };
+
+int cs_flight_recorder_poll(cs_flight_recorder_t * r)
+{
+    struct cs_api_probe p;
+    _cs_api_enter(&p, &api_flight_recorder_poll);
+    return _cs_api_exit(&p, _cs_flight_recorder_poll(r));
+}
+
+unsigned int cs_flight_recorder_count(cs_flight_recorder_t const *r)
+{
+    return (r->n_snapshots < r->n_slots) ? r->n_snapshots : r->n_slots;
+}
+
+cs_flight_snapshot_t const *cs_flight_recorder_get(cs_flight_recorder_t
+						   const *r, unsigned int i)
+{
+    unsigned int const held = cs_flight_recorder_count(r);
+
+    if (i >= held) {
+	return NULL;
+    }
+    i = (r->n_snapshots - held + i) % r->n_slots;
+    return (cs_flight_snapshot_t const *) (r->store + i * r->slot_size);
+}
+
+int cs_flight_recorder_stop(cs_flight_recorder_t * r)
+{
+    struct cs_device *cti = DEV(r->trigin.cti);
+    int rc = 0;
+
+    if (r->armed) {
+	rc = cs_sink_disable(r->buffer);
+	_cs_clear(DEV(r->buffer), CS_ETB_CTRL, CS_ETB_CTRL_TraceCaptEn);
+	r->armed = 0;
+    }
+    _cs_unlock(cti);
+    _cs_clear(cti, CS_CTIOUTEN(r->trigin.ctiport), 1U << r->channel);
+    return rc;
+}
+
+/* end of cs_flight_recorder.c */
@@ -28,8 +28,47 @@
 /* *** init and management API *** */
 int cs_init(void)
 {
-    memset(&G, 0, sizeof(struct global));
+    return cs_init_backend(CS_ACCESS_DEFAULT);
+}
+
+int cs_init_backend(cs_access_backend_t backend)
+{
+    struct cs_access_ops const *access;
+
+    switch (backend) {
+    case CS_ACCESS_DEFAULT:
+#if defined(CS_SIM)
+        access = &cs_access_sim;
+#elif defined(__linux__)
+        access = &cs_access_devmem;
+#else
+        access = &cs_access_mmio;
+#endif
+        break;
+    case CS_ACCESS_MMIO:
+        access = &cs_access_mmio;
+        break;
+#ifdef __linux__
+    case CS_ACCESS_DEVMEM:
+        access = &cs_access_devmem;
+        break;
+#endif				/* __linux__ */
+#ifdef CS_SIM
+    case CS_ACCESS_SIM:
+        access = &cs_access_sim;
+        break;
+#endif				/* CS_SIM */
+    default:
+        return cs_report_error("register access backend %d not built",
+                               (int) backend);
+    }
 
+    memset(&G, 0, sizeof(struct global));
+    G.access = access;
+    if (G.access->open() != 0) {
+        return cs_report_error("can't open %s register access",
+                               G.access->name);
+    }
 
     G.init_called = 1;
     G.registration_open = 1;
@@ -66,6 +105,15 @@ int cs_diag_set(int n)
 }
 
 
+int cs_registry_set_memory(void *mem, unsigned int size)
+{
+    if (G.init_called || G.device_top != NULL) {
+        return cs_report_error("registry memory must be set before cs_init()");
+    }
+    return _cs_set_registry_memory(mem, size);
+}
+
+
 /*
   Call this when the library is unloaded.  This doesn't generally disable
   all trace devices, but it may lock them.
@@ -75,26 +123,27 @@ int cs_shutdown(void)
     if (G.init_called) {
         /* Do anything that needs memory-mapped access */
         cs_checkpoint();
-#ifdef UNIX_USERSPACE
         /* Now remove memory-mapped access */
-        close(G.mem_fd);
-        G.mem_fd = 0;
-#endif				/* UNIX_USERSPACE */
+        G.access->close();
         G.init_called = 0;
         G.registration_open = 0;
     }
+    _cs_instrument_report();
+    _cs_index_free();
     while (G.device_top != NULL) {
         struct cs_device *d = G.device_top;
         G.device_top = d->next;
         if (d->ops.unregister)
             d->ops.unregister(d);
-        free(d);
+        free(d->shadow);
+        _cs_free(d);
     }
     while (G.exclusions != NULL) {
         struct addr_exclude *a = G.exclusions;
         G.exclusions = a->next;
-        free(a);
+        _cs_free(a);
     }
+    _cs_arena_release();
     return 0;
 }
 
@@ -124,15 +173,19 @@ unsigned int cs_error_count(void)
 /*
   Device programming
 */
+static struct cs_api_stats api_checkpoint = { "cs_checkpoint" };
+
 int cs_checkpoint(void)
 {
     struct cs_device *d;
+    struct cs_api_probe p;
+    _cs_api_enter(&p, &api_checkpoint);
     for (d = G.device_top; d != NULL; d = d->next) {
         if (!cs_device_is_non_mmio(d) && !d->is_permanently_unlocked) {
             _cs_lock(d);
         }
     }
-    return 0;
+    return _cs_api_exit(&p, 0);
 }
 
 unsigned short cs_library_version()
@@ -0,0 +1,269 @@
+/*
+  Coresight Access Library - API - register access instrumentation
+
+  Copyright (C) ARM Limited, 2014-2016. All rights reserved.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "cs_access_cmnfns.h"
+#include "cs_instrument.h"
+
+/* Sizes of the binary record elements */
+#define REC_HEADER_SIZE   12
+#define REC_COUNTERS_SIZE 32
+#define REC_DEVICE_SIZE   (12 + REC_COUNTERS_SIZE)
+#define REC_API_SIZE      (4 + REC_COUNTERS_SIZE + 4 * CS_INSTRUMENT_HIST_BUCKETS + 1)
+
+/* ---------- Local functions ------------- */
+
+static void stats_add_delta(cs_reg_access_stats_t * to,
+			    cs_reg_access_stats_t const *now,
+			    cs_reg_access_stats_t const *start)
+{
+    to->bus_reads += now->bus_reads - start->bus_reads;
+    to->bus_writes += now->bus_writes - start->bus_writes;
+    to->reads_saved += now->reads_saved - start->reads_saved;
+    to->writes_saved += now->writes_saved - start->writes_saved;
+    to->barriers += now->barriers - start->barriers;
+    to->wait_iterations += now->wait_iterations - start->wait_iterations;
+}
+
+/* Bucket i holds times of 4^i to 4^(i+1) - 1 ticks */
+static unsigned int hist_bucket(unsigned long long t)
+{
+    unsigned int i = 0;
+
+    while (t >= 4 && i < CS_INSTRUMENT_HIST_BUCKETS - 1) {
+	t >>= 2;
+	++i;
+    }
+    return i;
+}
+
+static unsigned char *put16(unsigned char *p, unsigned int v)
+{
+    p[0] = (unsigned char) v;
+    p[1] = (unsigned char) (v >> 8);
+    return p + 2;
+}
+
+static unsigned char *put32(unsigned char *p, unsigned int v)
+{
+    p = put16(p, v & 0xFFFF);
+    return put16(p, v >> 16);
+}
+
+static unsigned char *put64(unsigned char *p, unsigned long long v)
+{
+    p = put32(p, (unsigned int) v);
+    return put32(p, (unsigned int) (v >> 32));
+}
+
+static unsigned char *put_counters(unsigned char *p,
+				   cs_reg_access_stats_t const *s)
+{
+    p = put32(p, s->bus_reads);
+    p = put32(p, s->bus_writes);
+    p = put32(p, s->reads_saved);
+    p = put32(p, s->writes_saved);
+    p = put32(p, s->barriers);
+    p = put32(p, s->wait_iterations);
+    return put64(p, s->cycles);
+}
+
+static void print_counters(char const *name, unsigned int calls,
+			   cs_reg_access_stats_t const *s)
+{
+    printf("%-30s %6u %7u %7u %7u %7u %6u %7u %12llu\n", name, calls,
+	   s->bus_reads, s->bus_writes, s->reads_saved, s->writes_saved,
+	   s->barriers, s->wait_iterations, s->cycles);
+}
+
+static void print_hist(struct cs_api_stats const *api)
+{
+    unsigned int i;
+
+    printf("%-30s", "  latency (ticks)");
+    for (i = 0; i < CS_INSTRUMENT_HIST_BUCKETS; ++i) {
+	if (api->hist[i] != 0) {
+	    printf(" %s%llu:%u", i == CS_INSTRUMENT_HIST_BUCKETS - 1 ? ">=" : "<",
+		   i == CS_INSTRUMENT_HIST_BUCKETS - 1 ? 1ULL << (2 * i) :
+		   1ULL << (2 * i + 2), api->hist[i]);
+	}
+    }
+    printf("\n");
+}
+
+
+/* ---------- Non API functions ------------- */
+
+/*
+  Instrumented API entry points bracket their work with these.
+  Nothing is recorded unless instrumentation is enabled.
+*/
+void _cs_api_enter(struct cs_api_probe *p, struct cs_api_stats *api)
+{
+    if (!G.instrument) {
+	p->api = NULL;
+	return;
+    }
+    if (!api->registered) {
+	api->registered = 1;
+	api->next = G.api_top;
+	G.api_top = api;
+    }
+    p->api = api;
+    p->start = G.stats;
+    p->t0 = _cs_cycles();
+}
+
+int _cs_api_exit(struct cs_api_probe *p, int rc)
+{
+    if (p->api != NULL) {
+	unsigned long long const t = _cs_cycles() - p->t0;
+	++p->api->calls;
+	stats_add_delta(&p->api->stats, &G.stats, &p->start);
+	p->api->stats.cycles += t;
+	++p->api->hist[hist_bucket(t)];
+    }
+    return rc;
+}
+
+/*
+  Called from cs_shutdown(), while the devices are still registered.
+  Entry points are unregistered and their counters cleared, so that a
+  later cs_init() starts afresh.
+*/
+void _cs_instrument_report(void)
+{
+    struct cs_api_stats *api;
+
+    if (G.instrument) {
+	cs_instrument_print();
+	if (G.instrument_export != NULL) {
+	    int const size = cs_instrument_record(NULL, 0);
+	    void *rec = malloc(size);
+	    if (rec != NULL) {
+		cs_instrument_record(rec, size);
+		G.instrument_export(rec, size);
+		free(rec);
+	    }
+	}
+    }
+    while (G.api_top != NULL) {
+	api = G.api_top;
+	G.api_top = api->next;
+	api->next = NULL;
+	api->registered = 0;
+	api->calls = 0;
+	memset(&api->stats, 0, sizeof(cs_reg_access_stats_t));
+	memset(api->hist, 0, sizeof api->hist);
+    }
+}
+
+
+/* ========== API functions ================ */
+
+int cs_instrument_set(int enable, cs_instrument_export_fn export_fn)
+{
+    G.instrument = (enable != 0);
+    G.instrument_export = export_fn;
+    return 0;
+}
+
+void cs_instrument_print(void)
+{
+    struct cs_device *d;
+    struct cs_api_stats *api;
+    char name[32];
+
+    printf("CSAL register access (cycles in %s clock ticks):\n",
+	   G.access->name);
+    printf("%-30s %6s %7s %7s %7s %7s %6s %7s %12s\n", "", "calls",
+	   "reads", "writes", "rsaved", "wsaved", "bars", "waits", "cycles");
+    for (d = G.device_top; d != NULL; d = d->next) {
+	if (cs_device_is_non_mmio(d)) {
+	    continue;
+	}
+	sprintf(name, "%" CS_PHYSFMT " %s", d->phys_addr,
+		cs_device_type_name(d));
+	print_counters(name, 0, &d->stats);
+    }
+    print_counters("all devices", 0, &G.stats);
+    for (api = G.api_top; api != NULL; api = api->next) {
+	print_counters(api->name, api->calls, &api->stats);
+	print_hist(api);
+    }
+}
+
+int cs_instrument_record(void *buf, unsigned int size)
+{
+    struct cs_device *d;
+    struct cs_api_stats *api;
+    unsigned int n_devices = 0, n_api = 0, needed, len, i;
+    unsigned char *p;
+
+    needed = REC_HEADER_SIZE + REC_COUNTERS_SIZE;
+    for (d = G.device_top; d != NULL; d = d->next) {
+	if (!cs_device_is_non_mmio(d)) {
+	    ++n_devices;
+	    needed += REC_DEVICE_SIZE;
+	}
+    }
+    for (api = G.api_top; api != NULL; api = api->next) {
+	++n_api;
+	needed += REC_API_SIZE + strlen(api->name);
+    }
+    if (buf == NULL) {
+	return (int) needed;
+    }
+    if (size < needed) {
+	return cs_report_error("instrumentation record needs %u bytes",
+			       needed);
+    }
+
+    p = (unsigned char *) buf;
+    p = put32(p, CS_INSTRUMENT_MAGIC);
+    *p++ = CS_INSTRUMENT_VERSION;
+    *p++ = 0;
+    p = put16(p, n_devices);
+    p = put16(p, n_api);
+    p = put16(p, 0);
+    p = put_counters(p, &G.stats);
+    for (d = G.device_top; d != NULL; d = d->next) {
+	if (cs_device_is_non_mmio(d)) {
+	    continue;
+	}
+	p = put64(p, d->phys_addr);
+	*p++ = (unsigned char) d->type;
+	*p++ = 0;
+	p = put16(p, d->part_number);
+	p = put_counters(p, &d->stats);
+    }
+    for (api = G.api_top; api != NULL; api = api->next) {
+	len = strlen(api->name);
+	p = put32(p, api->calls);
+	p = put_counters(p, &api->stats);
+	for (i = 0; i < CS_INSTRUMENT_HIST_BUCKETS; ++i) {
+	    p = put32(p, api->hist[i]);
+	}
+	*p++ = (unsigned char) len;
+	memcpy(p, api->name, len);
+	p += len;
+    }
+    assert((unsigned int) (p - (unsigned char *) buf) == needed);
+    return (int) needed;
+}
+
+/* end of cs_instrument.c */
@@ -79,6 +79,53 @@ void cs_device_set_wait_repeats(int n_wait_repeat_count)
     _cs_set_wait_iterations(n_wait_repeat_count);
 }
 
+void cs_device_set_wait_timeout(unsigned int timeout_us)
+{
+    _cs_set_wait_timeout(timeout_us);
+}
+
+int cs_reg_batch_begin(void)
+{
+    ++G.batch_depth;
+    return 0;
+}
+
+int cs_reg_batch_commit(void)
+{
+    if (G.batch_depth == 0) {
+        return cs_report_error("register batch commit without begin");
+    }
+    if (--G.batch_depth > 0) {
+        return 0;
+    }
+    return _cs_batch_flush();
+}
+
+int cs_device_set_shadowing(cs_device_t dev, int enable)
+{
+    return _cs_shadow_enable(DEV(dev), enable);
+}
+
+int cs_device_shadow_invalidate(cs_device_t dev, unsigned int offset)
+{
+    _cs_shadow_invalidate(DEV(dev), offset);
+    return 0;
+}
+
+int cs_device_get_access_stats(cs_device_t dev,
+                               cs_reg_access_stats_t * stats, int reset)
+{
+    cs_reg_access_stats_t *s =
+        (dev == ERRDESC) ? &G.stats : &DEV(dev)->stats;
+
+    assert(stats != NULL);
+    *stats = *s;
+    if (reset) {
+        memset(s, 0, sizeof(cs_reg_access_stats_t));
+    }
+    return 0;
+}
+
 cs_physaddr_t cs_device_address(cs_device_t dev)
 {
     struct cs_device *d = DEV(dev);
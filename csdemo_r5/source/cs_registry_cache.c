@@ -0,0 +1,473 @@
+/*
+  Coresight Access Library - API - saving and restoring the device registry
+
+  Copyright (C) ARM Limited, 2014-2016. All rights reserved.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "cs_access_cmnfns.h"
+#include "cs_topology.h"
+
+/*
+  The saved registry is a header followed by one record per device, in the
+  order of the global device list.  Fields are in the target's byte order,
+  and static configurations that are read from ID registers (ETM, STM and
+  timestamp generator) are saved as raw structures, so the header records
+  their sizes: a blob is only usable by the build that saved it.  Devices
+  refer to each other by their index in the blob.
+*/
+#define REG_CACHE_MAGIC   0x43545343	/* "CSTC" */
+#define REG_CACHE_VERSION 1
+#define REG_CACHE_NO_DEV  0xFFFF
+
+struct reg_cache_header {
+    unsigned int magic;
+    unsigned short version;
+    unsigned short n_devices;
+    unsigned int size;		/* Total size of the blob */
+    unsigned int checksum;	/* FNV-1a of the device records */
+    unsigned short etm_sc_size;
+    unsigned short etm_sc_ex_size;
+    unsigned short stm_sc_size;
+    unsigned short ts_config_size;
+};
+
+/* A cursor over the blob.  When saving with buf == NULL, it just counts. */
+struct blob {
+    unsigned char *buf;
+    unsigned int size;
+    unsigned int pos;
+};
+
+/* ---------- Local functions ------------- */
+
+static unsigned int fnv1a(unsigned char const *p, unsigned int n)
+{
+    unsigned int h = 0x811C9DC5;
+    while (n-- > 0) {
+	h = (h ^ *p++) * 0x01000193;
+    }
+    return h;
+}
+
+static void put(struct blob *b, void const *v, unsigned int n)
+{
+    if (b->buf != NULL && b->pos + n <= b->size) {
+	memcpy(b->buf + b->pos, v, n);
+    }
+    b->pos += n;
+}
+
+static void put8(struct blob *b, unsigned char v)
+{
+    put(b, &v, 1);
+}
+
+static void put16(struct blob *b, unsigned short v)
+{
+    put(b, &v, 2);
+}
+
+static void put32(struct blob *b, unsigned int v)
+{
+    put(b, &v, 4);
+}
+
+static void put64(struct blob *b, unsigned long long v)
+{
+    put(b, &v, 8);
+}
+
+/* Reading past the end zero-fills, and is detected by pos > size */
+static void get(struct blob *b, void *v, unsigned int n)
+{
+    if (b->pos + n <= b->size) {
+	memcpy(v, b->buf + b->pos, n);
+    } else {
+	memset(v, 0, n);
+    }
+    b->pos += n;
+}
+
+static unsigned char get8(struct blob *b)
+{
+    unsigned char v;
+    get(b, &v, 1);
+    return v;
+}
+
+static unsigned short get16(struct blob *b)
+{
+    unsigned short v;
+    get(b, &v, 2);
+    return v;
+}
+
+static unsigned int get32(struct blob *b)
+{
+    unsigned int v;
+    get(b, &v, 4);
+    return v;
+}
+
+static unsigned long long get64(struct blob *b)
+{
+    unsigned long long v;
+    get(b, &v, 8);
+    return v;
+}
+
+static unsigned short dev_index(struct cs_device *d)
+{
+    unsigned short i = 0;
+    struct cs_device *e;
+    if (d == NULL) {
+	return REG_CACHE_NO_DEV;
+    }
+    for (e = G.device_top; e != d; e = e->next) {
+	++i;
+    }
+    return i;
+}
+
+static struct cs_device *dev_at(struct cs_device **devs, unsigned int n,
+				unsigned short i)
+{
+    return (i < n) ? devs[i] : NULL;
+}
+
+static void save_device(struct blob *b, struct cs_device *d)
+{
+    unsigned int i;
+
+    put64(b, d->phys_addr);
+    put8(b, (unsigned char) d->type);
+    put8(b, d->devtype_from_id);
+    put16(b, d->part_number);
+    put32(b, d->devclass);
+    put32(b, d->devaff0);
+    put32(b, (unsigned int) d->affine_cpu);
+    put32(b, d->power_domain);
+    put8(b, d->is_permanently_unlocked != 0);
+    put8(b, d->n_in_ports);
+    put8(b, d->n_out_ports);
+    put8(b, 0);
+    for (i = 0; i < d->n_in_ports; ++i) {
+	put16(b, dev_index(d->ins[i]));
+	put8(b, d->from_out_port[i]);
+    }
+    for (i = 0; i < d->n_out_ports; ++i) {
+	put16(b, dev_index(d->outs[i]));
+	put8(b, d->to_in_port[i]);
+    }
+
+    if (d->devclass & CS_DEVCLASS_PMU) {
+	put32(b, d->v.pmu.cfgr);
+	put32(b, d->v.pmu.n_counters);
+	put8(b, d->v.pmu.map_scale);
+    }
+    switch (d->type) {
+    case DEV_CPU_DEBUG:
+	put32(b, d->v.debug.didr);
+	put32(b, d->v.debug.devid);
+	put32(b, d->v.debug.pcsamplereg);
+	put32(b, d->v.debug.debug_arch);
+	put16(b, dev_index(d->v.debug.pmu));
+	put16(b, dev_index(d->v.debug.etm));
+	put16(b, dev_index(d->v.debug.cti));
+	break;
+    case DEV_CTI:
+	put8(b, d->v.cti.n_triggers);
+	put8(b, d->v.cti.n_channels);
+	for (i = 0; i < CTI_MAX_IN_PORTS; ++i) {
+	    put16(b, dev_index(d->v.cti.src[i].dev));
+	    put32(b, d->v.cti.src[i].devportid);
+	}
+	for (i = 0; i < CTI_MAX_OUT_PORTS; ++i) {
+	    put16(b, dev_index(d->v.cti.dst[i].dev));
+	    put32(b, d->v.cti.dst[i].devportid);
+	}
+	break;
+    case DEV_ETM:
+	put32(b, d->v.etm.etmidr);
+	put(b, &d->v.etm.sc, sizeof d->v.etm.sc);
+	put(b, &d->v.etm.sc_ex, sizeof d->v.etm.sc_ex);
+	break;
+    case DEV_ETB:
+    case DEV_ETF:
+	put32(b, d->v.etb.buffer_size_bytes);
+	put8(b, d->v.etb.is_tmc_device != 0);
+	put8(b, (unsigned char) d->v.etb.pointer_scale_shift);
+	put8(b, d->v.etb.tmc.config_type);
+	put8(b, d->v.etb.tmc.memory_width);
+	break;
+    case DEV_ITM:
+	put32(b, d->v.itm.n_ports);
+	break;
+    case DEV_STM:
+	put32(b, d->v.stm.n_ports);
+	put32(b, d->v.stm.n_masters);
+	put8(b, d->v.stm.basic_ports != 0);
+	put8(b, d->v.stm.ext_ports != NULL);
+	put(b, &d->v.stm.s_config, sizeof d->v.stm.s_config);
+	break;
+    case DEV_TS:
+	put(b, &d->v.ts.config, sizeof d->v.ts.config);
+	break;
+    default:
+	break;
+    }
+}
+
+/*
+  Restore one device from its record, and check that the hardware at its
+  address still has the same part number.
+*/
+static int load_device(struct blob *b, struct cs_device *d,
+		       struct cs_device **devs, unsigned int n)
+{
+    unsigned int i;
+    unsigned int pidr;
+
+    d->phys_addr = get64(b);
+    d->type = (cs_devtype_t) get8(b);
+    d->devtype_from_id = get8(b);
+    d->part_number = get16(b);
+    d->devclass = get32(b);
+    d->devaff0 = get32(b);
+    d->affine_cpu = (cs_cpu_t) get32(b);
+    d->power_domain = get32(b);
+    d->is_permanently_unlocked = (get8(b) != 0);
+    d->is_unlocked = d->is_permanently_unlocked;
+    d->n_in_ports = get8(b);
+    d->n_out_ports = get8(b);
+    (void) get8(b);
+    if (b->pos > b->size || d->type >= DEV_MAX
+	|| d->n_in_ports > CS_MAX_IN_PORTS
+	|| d->n_out_ports > CS_MAX_OUT_PORTS) {
+	return -1;
+    }
+    for (i = 0; i < d->n_in_ports; ++i) {
+	d->ins[i] = dev_at(devs, n, get16(b));
+	d->from_out_port[i] = get8(b);
+    }
+    for (i = 0; i < d->n_out_ports; ++i) {
+	d->outs[i] = dev_at(devs, n, get16(b));
+	d->to_in_port[i] = get8(b);
+    }
+
+    if (d->devclass & CS_DEVCLASS_PMU) {
+	d->v.pmu.cfgr = get32(b);
+	d->v.pmu.n_counters = get32(b);
+	d->v.pmu.map_scale = get8(b);
+    }
+    switch (d->type) {
+    case DEV_CPU_DEBUG:
+	d->v.debug.didr = get32(b);
+	d->v.debug.devid = get32(b);
+	d->v.debug.pcsamplereg = get32(b);
+	d->v.debug.debug_arch = get32(b);
+	d->v.debug.pmu = dev_at(devs, n, get16(b));
+	d->v.debug.etm = dev_at(devs, n, get16(b));
+	d->v.debug.cti = dev_at(devs, n, get16(b));
+	break;
+    case DEV_CTI:
+	d->v.cti.n_triggers = get8(b);
+	d->v.cti.n_channels = get8(b);
+	for (i = 0; i < CTI_MAX_IN_PORTS; ++i) {
+	    d->v.cti.src[i].dev = dev_at(devs, n, get16(b));
+	    d->v.cti.src[i].devportid = get32(b);
+	}
+	for (i = 0; i < CTI_MAX_OUT_PORTS; ++i) {
+	    d->v.cti.dst[i].dev = dev_at(devs, n, get16(b));
+	    d->v.cti.dst[i].devportid = get32(b);
+	}
+	break;
+    case DEV_ETM:
+	d->v.etm.etmidr = get32(b);
+	get(b, &d->v.etm.sc, sizeof d->v.etm.sc);
+	get(b, &d->v.etm.sc_ex, sizeof d->v.etm.sc_ex);
+	break;
+    case DEV_ETB:
+    case DEV_ETF:
+	d->v.etb.buffer_size_bytes = get32(b);
+	d->v.etb.is_tmc_device = (get8(b) != 0);
+	d->v.etb.pointer_scale_shift = (signed char) get8(b);
+	d->v.etb.tmc.config_type = get8(b);
+	d->v.etb.tmc.memory_width = get8(b);
+	break;
+    case DEV_ITM:
+	d->v.itm.n_ports = get32(b);
+	break;
+    case DEV_STM:
+	d->v.stm.n_ports = get32(b);
+	d->v.stm.n_masters = get32(b);
+	d->v.stm.basic_ports = (get8(b) != 0);
+	i = get8(b);
+	get(b, &d->v.stm.s_config, sizeof d->v.stm.s_config);
+	d->ops.unregister = _cs_stm_device_unregister;
+	if (i && b->pos <= b->size) {
+	    d->v.stm.ext_ports =
+		(unsigned char **) _cs_alloc(sizeof(unsigned char *) *
+					     d->v.stm.n_masters);
+	}
+	break;
+    case DEV_TS:
+	get(b, &d->v.ts.config, sizeof d->v.ts.config);
+	G.timestamp_device = d;
+	break;
+    default:
+	break;
+    }
+    if (b->pos > b->size) {
+	return -1;
+    }
+    if (d->devaff0 != 0) {
+	G.devaff0_used = 1;
+    }
+
+    if (cs_device_is_non_mmio(d)) {
+	return 0;
+    }
+    d->local_addr = (unsigned char *) io_map(d->phys_addr, 4096, 1);
+    if (d->local_addr == NULL) {
+	return -1;
+    }
+    pidr = ((_cs_read(d, CS_PIDR1) & 0xF) << 8) |
+	(_cs_read(d, CS_PIDR0) & 0xFF);
+    if (pidr != d->part_number) {
+	diagf("!topology cache: part %03X at %" CS_PHYSFMT
+	      ", expected %03X\n", pidr, d->phys_addr, d->part_number);
+	return -1;
+    }
+    return 0;
+}
+
+/* Remove all devices, after a failed load */
+static void unload_devices(void)
+{
+    while (G.device_top != NULL) {
+	struct cs_device *d = G.device_top;
+	G.device_top = d->next;
+	if (d->local_addr != NULL) {
+	    io_unmap((void *) d->local_addr, 4096);
+	}
+	if (d->type == DEV_STM) {
+	    _cs_free(d->v.stm.ext_ports);
+	}
+	_cs_free(d);
+    }
+    G.n_devices = 0;
+    G.timestamp_device = NULL;
+    G.devaff0_used = 0;
+}
+
+
+/* ========== API functions ================ */
+
+int cs_registry_save(void *buf, unsigned int size)
+{
+    struct reg_cache_header h;
+    struct cs_device *d;
+    struct blob b;
+
+    memset(&h, 0, sizeof h);
+    h.magic = REG_CACHE_MAGIC;
+    h.version = REG_CACHE_VERSION;
+    h.etm_sc_size = sizeof(cs_etm_static_config_t);
+    h.etm_sc_ex_size = sizeof(((struct cs_device *) 0)->v.etm.sc_ex);
+    h.stm_sc_size = sizeof(stm_static_config_t);
+    h.ts_config_size = sizeof(cs_ts_gen_config_t);
+
+    b.buf = (buf != NULL && size >= sizeof h) ? (unsigned char *) buf : NULL;
+    b.size = size;
+    b.pos = sizeof h;
+    for (d = G.device_top; d != NULL; d = d->next) {
+	++h.n_devices;
+	save_device(&b, d);
+    }
+    h.size = b.pos;
+    if (buf == NULL) {
+	return (int) h.size;
+    }
+    if (size < h.size) {
+	return cs_report_error("topology cache needs %u bytes", h.size);
+    }
+    h.checksum = fnv1a(b.buf + sizeof h, h.size - sizeof h);
+    memcpy(buf, &h, sizeof h);
+    return (int) h.size;
+}
+
+int cs_registry_load(void const *buf, unsigned int size)
+{
+    struct reg_cache_header h;
+    struct cs_device **devs;
+    struct blob b;
+    unsigned int i, arena_used;
+
+    assert(G.registration_open);
+    if (G.device_top != NULL) {
+	return cs_report_error("topology cache must be loaded before "
+			       "registering devices");
+    }
+    if (buf == NULL || size < sizeof h) {
+	return -1;
+    }
+    memcpy(&h, buf, sizeof h);
+    if (h.magic != REG_CACHE_MAGIC || h.version != REG_CACHE_VERSION
+	|| h.size < sizeof h || h.size > size
+	|| h.etm_sc_size != sizeof(cs_etm_static_config_t)
+	|| h.etm_sc_ex_size != sizeof(((struct cs_device *) 0)->v.etm.sc_ex)
+	|| h.stm_sc_size != sizeof(stm_static_config_t)
+	|| h.ts_config_size != sizeof(cs_ts_gen_config_t)
+	|| h.checksum != fnv1a((unsigned char const *) buf + sizeof h,
+			       h.size - sizeof h)) {
+	diagf("!topology cache: not valid for this build\n");
+	return -1;
+    }
+
+    /* Create the devices first, so that records can refer to later ones.
+       cs_device_new() adds to the front of the list, so create them in
+       reverse to get the saved order.  The index is only needed while
+       loading, so it comes from the heap rather than the arena, which
+       can't give space back; a failed load gives back what it took from
+       the arena by rewinding it. */
+    devs = (struct cs_device **) malloc(h.n_devices *
+					sizeof(struct cs_device *));
+    if (devs == NULL) {
+	return -1;
+    }
+    arena_used = G.arena_used;
+    for (i = h.n_devices; i > 0; --i) {
+	devs[i - 1] = cs_device_new(CS_NO_PHYS_ADDR, NULL);
+    }
+    b.buf = (unsigned char *) buf;
+    b.size = h.size;
+    b.pos = sizeof h;
+    for (i = 0; i < h.n_devices; ++i) {
+	if (load_device(&b, devs[i], devs, h.n_devices) != 0) {
+	    unload_devices();
+	    G.arena_used = arena_used;
+	    free(devs);
+	    return -1;
+	}
+    }
+    free(devs);
+    if (DTRACEG) {
+	diagf("!topology cache: restored %u devices\n", h.n_devices);
+    }
+    return h.n_devices;
+}
+
+/* end of cs_registry_cache.c */
@@ -0,0 +1,1052 @@
+/*
+  Coresight Access Library - simulated register access backend
+
+  A behavioural model of the Zynq UltraScale+ MPSoC CoreSight subsystem,
+  for building, benchmarking and regression-testing the library and the
+  demos on a development host without a board in the loop.  Select it by
+  building with CS_SIM defined and calling cs_init() or
+  cs_init_backend(CS_ACCESS_SIM).
+
+  Modelled:
+  - ROM tables at 0xFE800000 (system), 0xFEBE0000 (R5) and 0xFEC00000 (A53),
+    with CIDR/PIDR/DEVTYPE/DEVID values so that the normal ROM table scan
+    discovers and classifies every component
+  - the software lock (LAR/LSR) and claim tags on every component; writes
+    to a locked component are ignored, as on the real hardware
+  - ETMv4 (A53) and ETMv3.5 (R5) programming/idle status, OS lock, trace ID
+  - STM enable and trace ID, with a zero-reading stimulus area
+  - funnels (port enables), the programmable replicator (ID filters)
+  - the TMC as ETF (circular buffer, s/w FIFO and h/w FIFO modes), as ETR
+    (circular buffer into simulated system memory) and the TPIU formatter
+  - the timestamp generator, counting simulated time
+  - CTIs, PMUs and CPU debug as plain register files, except that CTI
+    application pulses drive the trigger outputs wired to TMC TRIGIN
+  - TMC triggers: the trigger counter and stopping on a trigger event
+
+  Time advances by a fixed amount on every register access.  On each access
+  every enabled trace source emits one 16-byte formatted frame, which is
+  routed along the simulated ATB to whichever sinks are reachable through
+  enabled funnel ports and replicator filters.  This makes the behaviour
+  deterministic: the same sequence of API calls produces the same trace.
+
+  Any physical address that is not a simulated component (e.g. an ETR
+  buffer in DDR or the STM stimulus area) is backed by zero-filled host
+  memory on first mapping.
+
+  Copyright (C) ARM Limited, 2014-2016. All rights reserved.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "cs_access_cmnfns.h"
+
+#ifdef CS_SIM
+
+/* Simulated timestamp counter frequency and its advance per register access */
+#define SIM_TS_FREQ             100000000
+#define SIM_TS_TICKS_PER_ACCESS 10
+
+/* Bytes of payload carried in each simulated formatted frame */
+#define SIM_FRAME_BYTES 16
+
+enum sim_kind {
+    SIM_ROM,
+    SIM_CPU_DEBUG,
+    SIM_PMU,
+    SIM_CTI,
+    SIM_ETMV3,
+    SIM_ETMV4,
+    SIM_STM,
+    SIM_FUNNEL,
+    SIM_REPLICATOR,
+    SIM_ETF,
+    SIM_ETR,
+    SIM_TPIU,
+    SIM_TSGEN
+};
+
+/* Static description of a simulated component */
+struct sim_desc {
+    cs_physaddr_t addr;
+    cs_physaddr_t rom;		/* ROM table listing this component, 0 for the top ROM table */
+    enum sim_kind kind;
+    unsigned short part;
+    unsigned char devtype;
+    unsigned int devid;
+};
+
+/* Static description of an ATB connection */
+struct sim_link {
+    cs_physaddr_t from;
+    unsigned char from_port;
+    cs_physaddr_t to;
+    unsigned char to_port;
+};
+
+#define ZU_ROM      0xFE800000
+#define ZU_R5_ROM   0xFEBE0000
+#define ZU_A53_ROM  0xFEC00000
+#define ZU_A53(n, off) (0xFEC00000 + (n) * 0x100000 + (off))
+
+/* TMC DEVID: [10:8] memory width (4 = 128 bits), [7:6] configuration type */
+#define ZU_TMC_DEVID(type) ((4 << 8) | ((type) << 6))
+/* CTI DEVID: [19:16] channels, [15:8] triggers */
+#define ZU_CTI_DEVID ((4 << 16) | (8 << 8))
+
+static struct sim_desc const sim_soc[] = {
+    {ZU_ROM, 0, SIM_ROM, 0x4C7, 0x00, 0},
+    {0xFE900000, ZU_ROM, SIM_TSGEN, 0x101, 0x00, 0},
+    {0xFE910000, ZU_ROM, SIM_FUNNEL, 0x908, 0x12, 0x3},
+    {0xFE920000, ZU_ROM, SIM_FUNNEL, 0x908, 0x12, 0x4},
+    {0xFE930000, ZU_ROM, SIM_FUNNEL, 0x908, 0x12, 0x4},
+    {0xFE940000, ZU_ROM, SIM_ETF, 0x961, 0x32,
+     ZU_TMC_DEVID(CS_TMC_CONFIG_TYPE_ETF)},
+    {0xFE950000, ZU_ROM, SIM_ETF, 0x961, 0x32,
+     ZU_TMC_DEVID(CS_TMC_CONFIG_TYPE_ETF)},
+    {0xFE960000, ZU_ROM, SIM_REPLICATOR, 0x909, 0x22, 0x2},
+    {0xFE970000, ZU_ROM, SIM_ETR, 0x961, 0x21,
+     ZU_TMC_DEVID(CS_TMC_CONFIG_TYPE_ETR)},
+    {0xFE980000, ZU_ROM, SIM_TPIU, 0x912, 0x11, 0xA0},
+    {0xFE990000, ZU_ROM, SIM_CTI, 0x906, 0x14, ZU_CTI_DEVID},
+    {0xFE9A0000, ZU_ROM, SIM_CTI, 0x906, 0x14, ZU_CTI_DEVID},
+    {0xFE9B0000, ZU_ROM, SIM_CTI, 0x906, 0x14, ZU_CTI_DEVID},
+    {0xFE9C0000, ZU_ROM, SIM_STM, 0x963, 0x63, 0x10000},
+    /* Cortex-R5 cluster */
+    {ZU_R5_ROM, ZU_ROM, SIM_ROM, 0x4C7, 0x00, 0},
+    {0xFEBF0000, ZU_R5_ROM, SIM_CPU_DEBUG, 0xC15, 0x15, 0},
+    {0xFEBF2000, ZU_R5_ROM, SIM_CPU_DEBUG, 0xC15, 0x15, 0},
+    {0xFEBF8000, ZU_R5_ROM, SIM_CTI, 0x906, 0x14, ZU_CTI_DEVID},
+    {0xFEBF9000, ZU_R5_ROM, SIM_CTI, 0x906, 0x14, ZU_CTI_DEVID},
+    {0xFEBFC000, ZU_R5_ROM, SIM_ETMV3, 0x955, 0x13, 0},
+    {0xFEBFD000, ZU_R5_ROM, SIM_ETMV3, 0x955, 0x13, 0},
+    /* Cortex-A53 cluster */
+    {ZU_A53_ROM, ZU_ROM, SIM_ROM, 0x4A1, 0x00, 0},
+#define ZU_A53_CORE(n) \
+    {ZU_A53(n, 0x10000), ZU_A53_ROM, SIM_CPU_DEBUG, 0xD03, 0x15, 0}, \
+    {ZU_A53(n, 0x20000), ZU_A53_ROM, SIM_CTI, 0x9A8, 0x14, ZU_CTI_DEVID}, \
+    {ZU_A53(n, 0x30000), ZU_A53_ROM, SIM_PMU, 0x9D3, 0x16, 0}, \
+    {ZU_A53(n, 0x40000), ZU_A53_ROM, SIM_ETMV4, 0x95D, 0x13, 0}
+    ZU_A53_CORE(0),
+    ZU_A53_CORE(1),
+    ZU_A53_CORE(2),
+    ZU_A53_CORE(3),
+#undef ZU_A53_CORE
+};
+
+#define SIM_N_DEVICES (sizeof sim_soc / sizeof sim_soc[0])
+
+static struct sim_link const sim_atb[] = {
+    {0xFEBFC000, 0, 0xFE910000, 0},
+    {0xFEBFD000, 0, 0xFE910000, 1},
+    {ZU_A53(0, 0x40000), 0, 0xFE920000, 0},
+    {ZU_A53(1, 0x40000), 0, 0xFE920000, 1},
+    {ZU_A53(2, 0x40000), 0, 0xFE920000, 2},
+    {ZU_A53(3, 0x40000), 0, 0xFE920000, 3},
+    {0xFE920000, 0, 0xFE940000, 0},
+    {0xFE910000, 0, 0xFE930000, 1},
+    {0xFE940000, 0, 0xFE930000, 2},
+    {0xFE9C0000, 0, 0xFE930000, 3},
+    {0xFE930000, 0, 0xFE950000, 0},
+    {0xFE950000, 0, 0xFE960000, 0},
+    {0xFE960000, 0, 0xFE970000, 0},
+    {0xFE960000, 1, 0xFE980000, 0},
+};
+
+#define SIM_N_LINKS (sizeof sim_atb / sizeof sim_atb[0])
+
+/* Dynamic state of a simulated component */
+struct sim_device {
+    unsigned int regs[1024];	/* register file - must be first, the mapping points here */
+    struct sim_desc const *desc;
+    int locked;
+    unsigned int claim;
+    struct sim_device *outs[2];
+    unsigned char out_port[2];
+    unsigned int seq;		/* running payload counter for trace sources */
+
+    /* TMC state.  Pointers and levels are byte offsets into the buffer. */
+    unsigned char *ram;
+    unsigned int ram_size;
+    unsigned int rwp;
+    unsigned int rrp;
+    unsigned int level;
+    unsigned int lbuflevel;
+    cs_physaddr_t dba;
+    unsigned int sg_n;		/* ETR scatter-gather data pages, or 0 when contiguous */
+    unsigned char **sg_mem;
+    unsigned long long *sg_addr;
+    int capturing;
+    int stopped;
+    int full;
+    int triggered;
+    unsigned int trig_left;	/* bytes to capture after the trigger */
+
+    /* TPIU and h/w FIFO accounting */
+    unsigned long long bytes_out;
+
+    /* Timestamp generator */
+    unsigned long long count;
+};
+
+/* Host memory standing in for system memory, e.g. ETR buffers */
+struct sim_region {
+    struct sim_region *next;
+    cs_physaddr_t addr;
+    unsigned long size;
+    unsigned char *mem;
+};
+
+static struct sim_device *sim_dev;
+static unsigned long long sim_time;	/* in timestamp counter ticks */
+static struct sim_region *sim_regions;
+
+#define R(sd, off) ((sd)->regs[(off) / 4])
+
+
+/* ---------- Simulated system memory ------------- */
+
+static unsigned char *sim_memory(cs_physaddr_t addr, unsigned long size)
+{
+    struct sim_region *r;
+    for (r = sim_regions; r != NULL; r = r->next) {
+        if (r->addr <= addr && addr + size <= r->addr + r->size) {
+            return r->mem + (addr - r->addr);
+        }
+    }
+    r = (struct sim_region *) malloc(sizeof(struct sim_region));
+    if (r == NULL) {
+        return NULL;
+    }
+    r->mem = (unsigned char *) calloc(1, size);
+    if (r->mem == NULL) {
+        free(r);
+        return NULL;
+    }
+    r->addr = addr;
+    r->size = size;
+    r->next = sim_regions;
+    sim_regions = r;
+    return r->mem;
+}
+
+
+/* ---------- Component lookup ------------- */
+
+static struct sim_device *sim_find(cs_physaddr_t addr)
+{
+    unsigned int i;
+    for (i = 0; i < SIM_N_DEVICES; ++i) {
+        if (sim_soc[i].addr == addr) {
+            return &sim_dev[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+  Map a local address back to its simulated component, or NULL if it
+  refers to simulated system memory.
+*/
+static struct sim_device *sim_device_of(void volatile const *local)
+{
+    unsigned long const diff =
+        (unsigned long) local - (unsigned long) sim_dev;
+    if (sim_dev == NULL || diff >= SIM_N_DEVICES * sizeof(struct sim_device)) {
+        return NULL;
+    }
+    assert(diff % sizeof(struct sim_device) == 0);
+    return &sim_dev[diff / sizeof(struct sim_device)];
+}
+
+
+/* ---------- Trace generation and routing ------------- */
+
+static void sim_atb_push(struct sim_device *sd, unsigned int port,
+                         unsigned int atid, unsigned char const *frame);
+
+/* Host memory for a buffer offset, which must not cross a 4K page */
+static unsigned char *sim_tmc_mem(struct sim_device *sd, unsigned int off)
+{
+    if (sd->sg_n != 0) {
+        return sd->sg_mem[off / CS_TMC_SG_PAGE_SIZE] + (off % CS_TMC_SG_PAGE_SIZE);
+    }
+    return sd->ram + off;
+}
+
+static void sim_tmc_store(struct sim_device *sd, unsigned char const *frame)
+{
+    unsigned int const mode = R(sd, CS_TMC_MODE) & 3;
+    if (sd->ram == NULL || sd->ram_size == 0) {
+        return;
+    }
+    if (mode == CS_TMC_MODE_SWFIFO && sd->level + SIM_FRAME_BYTES > sd->ram_size) {
+        /* A real TMC would apply back-pressure; the model drops the frame */
+        return;
+    }
+    memcpy(sim_tmc_mem(sd, sd->rwp), frame, SIM_FRAME_BYTES);
+    sd->rwp += SIM_FRAME_BYTES;
+    if (sd->rwp >= sd->ram_size) {
+        sd->rwp = 0;
+        sd->full = 1;
+    }
+    sd->level += SIM_FRAME_BYTES;
+    if (sd->level > sd->ram_size) {
+        sd->level = sd->ram_size;
+    }
+    if (sd->level > sd->lbuflevel) {
+        sd->lbuflevel = sd->level;
+    }
+    if (sd->triggered && sd->trig_left > 0) {
+        sd->trig_left -= (sd->trig_left < SIM_FRAME_BYTES) ?
+            sd->trig_left : SIM_FRAME_BYTES;
+        if (sd->trig_left == 0 &&
+            (R(sd, CS_ETB_FLFMT_CTRL) & CS_ETB_FLFMT_CTRL_StopTrig)) {
+            sd->stopped = 1;
+        }
+    }
+}
+
+/* A trigger on TRIGIN: start the trigger counter */
+static void sim_tmc_trigin(struct sim_device *sd)
+{
+    if (!sd->capturing || sd->stopped || sd->triggered ||
+        !(R(sd, CS_ETB_FLFMT_CTRL) & CS_ETB_FLFMT_CTRL_TrigIn)) {
+        return;
+    }
+    sd->triggered = 1;
+    sd->trig_left = R(sd, CS_ETB_TRIGGER_COUNT) * 4;
+    if (sd->trig_left == 0 &&
+        (R(sd, CS_ETB_FLFMT_CTRL) & CS_ETB_FLFMT_CTRL_StopTrig)) {
+        sd->stopped = 1;
+    }
+}
+
+static void sim_atb_push(struct sim_device *sd, unsigned int port,
+                         unsigned int atid, unsigned char const *frame)
+{
+    unsigned int i;
+    switch (sd->desc->kind) {
+    case SIM_FUNNEL:
+        if (R(sd, CS_FUNNEL_CTRL) & (1U << port)) {
+            sim_atb_push(sd->outs[0], sd->out_port[0], atid, frame);
+        }
+        break;
+    case SIM_REPLICATOR:
+        for (i = 0; i < 2; ++i) {
+            if (sd->outs[i] != NULL &&
+                !(R(sd, CS_REPLICATOR_IDFILTER(i)) & (1U << (atid >> 4)))) {
+                sim_atb_push(sd->outs[i], sd->out_port[i], atid, frame);
+            }
+        }
+        break;
+    case SIM_ETF:
+    case SIM_ETR:
+        if (!sd->capturing || sd->stopped) {
+            break;
+        }
+        if (sd->desc->kind == SIM_ETF &&
+            (R(sd, CS_TMC_MODE) & 3) == CS_TMC_MODE_HWFIFO) {
+            sd->bytes_out += SIM_FRAME_BYTES;
+            sim_atb_push(sd->outs[0], sd->out_port[0], atid, frame);
+        } else {
+            sim_tmc_store(sd, frame);
+        }
+        break;
+    case SIM_TPIU:
+        if (!sd->stopped) {
+            sd->bytes_out += SIM_FRAME_BYTES;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/* Return the trace ID of an enabled trace source, or 0 if it isn't tracing */
+static unsigned int sim_source_atid(struct sim_device *sd)
+{
+    switch (sd->desc->kind) {
+    case SIM_ETMV4:
+        if (R(sd, CS_ETMV4_PRGCTLR) & CS_ETMV4_PRGCTLR_en) {
+            return R(sd, CS_ETMV4_TRACEIDR) & 0x7F;
+        }
+        break;
+    case SIM_ETMV3:
+        if (!(R(sd, CS_ETMCR) & (CS_ETMCR_ProgBit | CS_ETMCR_PowerDown))) {
+            return R(sd, CS_ETMTRACEIDR) & 0x7F;
+        }
+        break;
+    case SIM_STM:
+        if (R(sd, CS_STM_TCSR) & CS_STM_TCSR_EN) {
+            return (R(sd, CS_STM_TCSR) >> 16) & 0x7F;
+        }
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
+/*
+  Advance simulated time by one register access.
+*/
+static void sim_tick(void)
+{
+    unsigned int i, j;
+    sim_time += SIM_TS_TICKS_PER_ACCESS;
+    for (i = 0; i < SIM_N_DEVICES; ++i) {
+        struct sim_device *sd = &sim_dev[i];
+        unsigned int atid;
+        if (sd->desc->kind == SIM_TSGEN) {
+            if (R(sd, CS_CNTCR) & CS_CNTCR_ENA) {
+                sd->count += SIM_TS_TICKS_PER_ACCESS;
+            }
+            continue;
+        }
+        atid = sim_source_atid(sd);
+        if (atid != 0 && sd->outs[0] != NULL) {
+            /* One frame: an ID byte, then payload from a running counter */
+            unsigned char frame[SIM_FRAME_BYTES];
+            frame[0] = (unsigned char) ((atid << 1) | 1);
+            for (j = 1; j < SIM_FRAME_BYTES - 1; ++j) {
+                frame[j] = (unsigned char) (sd->seq++ & 0xFE);
+            }
+            frame[SIM_FRAME_BYTES - 1] = 0;
+            sim_atb_push(sd->outs[0], sd->out_port[0], atid, frame);
+        }
+    }
+}
+
+
+/* ---------- TMC (ETF/ETR) register behaviour ------------- */
+
+/* Recompute the fill level after software has moved a pointer */
+static void sim_tmc_relevel(struct sim_device *sd)
+{
+    if (sd->ram_size == 0) {
+        sd->level = 0;
+    } else if (sd->rrp == sd->rwp) {
+        sd->level = sd->full ? sd->ram_size : 0;
+    } else {
+        sd->level = (sd->rwp + sd->ram_size - sd->rrp) % sd->ram_size;
+    }
+}
+
+/* Convert a programmed pointer into a buffer offset */
+static unsigned int sim_tmc_offset(struct sim_device *sd,
+                                   unsigned long long ptr)
+{
+    unsigned int i;
+    if (sd->sg_n != 0) {
+        /* Scatter-gather pointers are bus addresses within a data page */
+        for (i = 0; i < sd->sg_n; ++i) {
+            if (ptr >= sd->sg_addr[i] && ptr < sd->sg_addr[i] + CS_TMC_SG_PAGE_SIZE) {
+                return i * CS_TMC_SG_PAGE_SIZE + (unsigned int) (ptr - sd->sg_addr[i]);
+            }
+        }
+        return 0;
+    }
+    if (sd->desc->kind == SIM_ETR) {
+        /* ETR pointers are bus addresses within the buffer */
+        if (ptr < sd->dba || ptr >= sd->dba + sd->ram_size) {
+            return 0;
+        }
+        ptr -= sd->dba;
+    }
+    return sd->ram_size ? (unsigned int) (ptr % sd->ram_size) & ~3U : 0;
+}
+
+/*
+  Walk an ETR scatter-gather table to find the data pages, as the TMC
+  does when it is enabled.  Table pages are linked, and the last data
+  page is marked.
+*/
+static void sim_tmc_sg_load(struct sim_device *sd)
+{
+    unsigned int const max_pages = sd->ram_size / CS_TMC_SG_PAGE_SIZE;
+    unsigned int const *table;
+    unsigned int i = 0, e;
+
+    free(sd->sg_mem);
+    free(sd->sg_addr);
+    sd->sg_n = 0;
+    sd->sg_mem = (unsigned char **) calloc(max_pages + 1, sizeof(unsigned char *));
+    sd->sg_addr = (unsigned long long *) calloc(max_pages + 1, sizeof(unsigned long long));
+    table = (unsigned int const *) sim_memory(sd->dba, CS_TMC_SG_PAGE_SIZE);
+    while (table != NULL && sd->sg_mem != NULL && sd->sg_addr != NULL && sd->sg_n < max_pages) {
+        e = table[i++];
+        if ((e & CS_TMC_SG_ENTRY_TYPE_MASK) == CS_TMC_SG_ENTRY_LINK) {
+            table = (unsigned int const *) sim_memory(CS_TMC_SG_ENTRY_ADDR(e), CS_TMC_SG_PAGE_SIZE);
+            i = 0;
+            continue;
+        }
+        if ((e & CS_TMC_SG_ENTRY_TYPE_MASK) == 0 || i > CS_TMC_SG_PAGE_SIZE / 4) {
+            break;
+        }
+        sd->sg_addr[sd->sg_n] = CS_TMC_SG_ENTRY_ADDR(e);
+        sd->sg_mem[sd->sg_n] = sim_memory(sd->sg_addr[sd->sg_n], CS_TMC_SG_PAGE_SIZE);
+        ++sd->sg_n;
+        if ((e & CS_TMC_SG_ENTRY_TYPE_MASK) == CS_TMC_SG_ENTRY_LAST) {
+            break;
+        }
+    }
+    if (sd->sg_n == 0) {
+        diagf("!sim: empty ETR scatter-gather table\n");
+    }
+    sd->ram_size = sd->sg_n * CS_TMC_SG_PAGE_SIZE;
+    sd->ram = (sd->sg_n != 0) ? sd->sg_mem[0] : NULL;
+}
+
+static void sim_tmc_enable(struct sim_device *sd)
+{
+    if (sd->desc->kind == SIM_ETR && (R(sd, CS_TMC_AXICTL) & CS_TMC_SCATGAT_MODE)) {
+        sd->dba = ((cs_physaddr_t) R(sd, CS_TMC_DBAHI) << 32) |
+            R(sd, CS_TMC_DBALO);
+        sd->ram_size = R(sd, CS_ETB_RAM_DEPTH) * 4;
+        sim_tmc_sg_load(sd);
+        if (sd->rwp >= sd->ram_size) {
+            sd->rwp = 0;
+        }
+    } else if (sd->desc->kind == SIM_ETR) {
+        sd->sg_n = 0;
+        sd->dba = ((cs_physaddr_t) R(sd, CS_TMC_DBAHI) << 32) |
+            R(sd, CS_TMC_DBALO);
+        sd->ram_size = R(sd, CS_ETB_RAM_DEPTH) * 4;
+        sd->ram = sim_memory(sd->dba, sd->ram_size);
+        if (sd->ram == NULL) {
+            diagf("!sim: no host memory for %u byte ETR buffer\n",
+                  sd->ram_size);
+            sd->ram_size = 0;
+        }
+        if (sd->rwp >= sd->ram_size) {
+            sd->rwp = 0;
+        }
+    }
+    sd->capturing = 1;
+    sd->stopped = 0;
+    sd->full = 0;
+    sd->triggered = 0;
+    sd->lbuflevel = 0;
+    sd->rrp = sd->rwp;
+    sd->level = 0;
+}
+
+static unsigned int sim_tmc_read(struct sim_device *sd, unsigned int off)
+{
+    unsigned int v;
+    unsigned long long addr;
+    switch (off) {
+    case CS_ETB_STATUS:
+        v = 0;
+        if ((R(sd, CS_TMC_MODE) & 3) != CS_TMC_MODE_CIRCULAR) {
+            /* In the FIFO modes, Full means the water mark was reached */
+            if (sd->level >= R(sd, CS_TMC_BUFWM) * 4)
+                v |= CS_ETB_STATUS_Full;
+        } else if (sd->full)
+            v |= CS_ETB_STATUS_Full;
+        if (sd->triggered)
+            v |= CS_ETB_STATUS_Triggered;
+        if (!sd->capturing || sd->stopped)
+            v |= CS_TMC_STATUS_TMCReady | CS_ETB_STATUS_FtEmpty;
+        if (sd->level == 0)
+            v |= CS_TMC_STATUS_Empty;
+        return v;
+    case CS_ETB_RAM_DATA:
+        if (sd->level == 0 || sd->ram == NULL) {
+            return 0xFFFFFFFF;
+        }
+        memcpy(&v, sim_tmc_mem(sd, sd->rrp), 4);
+        sd->rrp = (sd->rrp + 4) % sd->ram_size;
+        sd->level -= 4;
+        return v;
+    case CS_ETB_RAM_RD_PTR:
+    case CS_ETB_RAM_WR_PTR:
+    case 0x038:		/* RRPHI */
+    case 0x03C:		/* RWPHI */
+        addr = ((off == CS_ETB_RAM_RD_PTR || off == 0x038) ? sd->rrp : sd->rwp);
+        if (sd->sg_n != 0) {
+            addr = sd->sg_addr[addr / CS_TMC_SG_PAGE_SIZE] + addr % CS_TMC_SG_PAGE_SIZE;
+        } else if (sd->desc->kind == SIM_ETR) {
+            addr += sd->dba;
+        }
+        return (off >= 0x038) ? (unsigned int) (addr >> 32) : (unsigned int) addr;
+    case CS_TMC_CBUFLEVEL:
+        return sd->level / 4;
+    case CS_TMC_LBUFLEVEL:
+        v = sd->lbuflevel / 4;
+        sd->lbuflevel = sd->level;
+        return v;
+    case CS_ETB_FLFMT_STATUS:
+        return (!sd->capturing || sd->stopped) ? CS_ETB_FLFMT_STATUS_FtStopped : 0;
+    default:
+        return R(sd, off);
+    }
+}
+
+static void sim_tmc_write(struct sim_device *sd, unsigned int off,
+                          unsigned int data)
+{
+    switch (off) {
+    case CS_ETB_RAM_DEPTH:
+        if (sd->desc->kind == SIM_ETR) {
+            R(sd, off) = data;
+        }
+        break;
+    case CS_ETB_CTRL:
+        if ((data & CS_ETB_CTRL_TraceCaptEn) && !sd->capturing) {
+            sim_tmc_enable(sd);
+        } else if (!(data & CS_ETB_CTRL_TraceCaptEn)) {
+            sd->capturing = 0;
+        }
+        R(sd, off) = data & CS_ETB_CTRL_TraceCaptEn;
+        break;
+    case CS_ETB_RAM_RD_PTR:
+        sd->rrp = sim_tmc_offset(sd, data);
+        sim_tmc_relevel(sd);
+        break;
+    case CS_ETB_RAM_WR_PTR:
+        sd->rwp = sim_tmc_offset(sd, data);
+        sim_tmc_relevel(sd);
+        break;
+    case 0x038:		/* RRPHI */
+    case 0x03C:		/* RWPHI */
+        break;
+    case CS_ETB_RAM_WRITE_DATA:
+        if (sd->ram != NULL && sd->ram_size != 0) {
+            memcpy(sim_tmc_mem(sd, sd->rwp), &data, 4);
+            sd->rwp += 4;
+            if (sd->rwp >= sd->ram_size) {
+                sd->rwp = 0;
+                sd->full = 1;
+            }
+            sim_tmc_relevel(sd);
+        }
+        break;
+    case CS_ETB_FLFMT_CTRL:
+        if ((data & CS_ETB_FLFMT_CTRL_FOnMan) && sd->capturing &&
+            (data & CS_ETB_FLFMT_CTRL_StopFl)) {
+            /* Flush completes at once */
+            sd->stopped = 1;
+        }
+        /* FOnMan reads as zero once the flush has completed */
+        R(sd, off) = data & ~CS_ETB_FLFMT_CTRL_FOnMan;
+        break;
+    case CS_TMC_MODE:
+        if (!sd->capturing) {
+            R(sd, off) = data & 3;
+        }
+        break;
+    case CS_ETB_STATUS:
+    case CS_ETB_RAM_DATA:
+    case CS_TMC_CBUFLEVEL:
+    case CS_TMC_LBUFLEVEL:
+    case CS_ETB_FLFMT_STATUS:
+        break;
+    default:
+        R(sd, off) = data;
+        break;
+    }
+}
+
+
+/* ---------- Other component register behaviour ------------- */
+
+/* CTI trigger outputs wired to a TMC TRIGIN, as in the board registration */
+static struct {
+    cs_physaddr_t cti;
+    unsigned char port;
+    cs_physaddr_t to;
+} const sim_trigs[] = {
+    {0xFE990000, 6, 0xFE950000},
+};
+
+/* Application pulse on CTI channels: fire the trigger outputs they enable */
+static void sim_cti_pulse(struct sim_device *sd, unsigned int channels)
+{
+    unsigned int i;
+    for (i = 0; i < sizeof sim_trigs / sizeof sim_trigs[0]; ++i) {
+        if (sim_trigs[i].cti == sd->desc->addr &&
+            (R(sd, CS_CTIOUTEN(sim_trigs[i].port)) & channels)) {
+            sim_tmc_trigin(sim_find(sim_trigs[i].to));
+        }
+    }
+}
+
+static unsigned int sim_read(struct sim_device *sd, unsigned int off)
+{
+    switch (off) {
+    case CS_LSR:
+        return (sd->desc->kind == SIM_ROM || sd->desc->kind == SIM_TSGEN) ?
+            0 : (sd->locked ? 3 : 1);
+    case CS_CLAIMSET:
+        return 0xFF;
+    case CS_CLAIMCLR:
+        return sd->claim;
+    }
+    switch (sd->desc->kind) {
+    case SIM_ETF:
+    case SIM_ETR:
+        return sim_tmc_read(sd, off);
+    case SIM_ETMV4:
+        if (off == CS_ETMV4_STATR) {
+            return CS_ETMV4_STATR_pmstable |
+                ((R(sd, CS_ETMV4_PRGCTLR) & CS_ETMV4_PRGCTLR_en) ? 0 :
+                 CS_ETMV4_STATR_idle);
+        }
+        break;
+    case SIM_ETMV3:
+        if (off == CS_ETMSTATUS) {
+            return (R(sd, CS_ETMCR) & CS_ETMCR_ProgBit) ? CS_ETMSR_ProgBit : 0;
+        }
+        break;
+    case SIM_TPIU:
+        if (off == CS_TPIU_FLFMT_STATUS) {
+            return sd->stopped ? CS_TPIU_FLFMT_STATUS_FtStopped : 0;
+        }
+        break;
+    case SIM_TSGEN:
+        if (off == CS_CNTCVL) {
+            return (unsigned int) sd->count;
+        } else if (off == CS_CNTCVU) {
+            return (unsigned int) (sd->count >> 32);
+        }
+        break;
+    default:
+        break;
+    }
+    return R(sd, off);
+}
+
+static void sim_write(struct sim_device *sd, unsigned int off,
+                      unsigned int data)
+{
+    if (sd->desc->kind == SIM_ROM) {
+        return;
+    }
+    if (off == CS_LAR) {
+        sd->locked = (data != CS_KEY);
+        return;
+    }
+    if (sd->locked) {
+        /* Writes to a locked component are ignored */
+        return;
+    }
+    if (off == CS_CLAIMSET) {
+        sd->claim |= data & 0xFF;
+        return;
+    } else if (off == CS_CLAIMCLR) {
+        sd->claim &= ~data;
+        return;
+    } else if (off >= 0xFC0) {
+        /* Identification registers are read-only */
+        return;
+    }
+    switch (sd->desc->kind) {
+    case SIM_ETF:
+    case SIM_ETR:
+        sim_tmc_write(sd, off, data);
+        return;
+    case SIM_ETMV4:
+        if (off == CS_ETMv4_OSLAR) {
+            R(sd, CS_ETMv4_OSLSR) = (data & 1) ? 0xA : 0x8;
+            return;
+        } else if ((off >= CS_ETMv4_IDR8 && off <= CS_ETMv4_IDR13) ||
+                   (off >= CS_ETMv4_IDR0 && off <= CS_ETMv4_IDR7) ||
+                   off == CS_ETMV4_STATR || off == CS_ETMv4_OSLSR ||
+                   off == CS_ETMv4_PDSR) {
+            return;
+        }
+        break;
+    case SIM_ETMV3:
+        if (off == CS_ETMSTATUS || off == CS_ETMIDR || off == CS_ETMCCR ||
+            off == CS_ETMSCR || off == CS_ETMCCER) {
+            return;
+        }
+        break;
+    case SIM_TPIU:
+        if (off == CS_TPIU_FLFMT_CTRL) {
+            if (data & CS_TPIU_FLFMT_CTRL_FOnMan) {
+                if (data & CS_TPIU_FLFMT_CTRL_StopFl) {
+                    sd->stopped = 1;
+                }
+            } else if (data & CS_TPIU_FLFMT_CTRL_EnFTC) {
+                sd->stopped = 0;
+            }
+            R(sd, off) = data & ~CS_TPIU_FLFMT_CTRL_FOnMan;
+            return;
+        } else if (off == CS_TPIU_FLFMT_STATUS) {
+            return;
+        }
+        break;
+    case SIM_CTI:
+        if (off == CS_CTIAPPPULSE) {
+            if (R(sd, CS_CTICONTROL) & CS_CTICONTROL_GLBEN) {
+                sim_cti_pulse(sd, data);
+            }
+            return;
+        }
+        break;
+    case SIM_TSGEN:
+        if (off == CS_CNTCVL && !(R(sd, CS_CNTCR) & CS_CNTCR_ENA)) {
+            sd->count = (sd->count & ~0xFFFFFFFFULL) | data;
+            return;
+        } else if (off == CS_CNTCVU && !(R(sd, CS_CNTCR) & CS_CNTCR_ENA)) {
+            sd->count = (sd->count & 0xFFFFFFFFULL) |
+                ((unsigned long long) data << 32);
+            return;
+        } else if (off == CS_CNTSR || off == CS_CNTFID0) {
+            return;
+        }
+        break;
+    default:
+        break;
+    }
+    R(sd, off) = data;
+}
+
+
+/* ---------- Reset state ------------- */
+
+static void sim_reset_device(struct sim_device *sd)
+{
+    struct sim_desc const *desc = sd->desc;
+    unsigned int i, n;
+
+    memset(sd->regs, 0, sizeof sd->regs);
+    sd->locked = (desc->kind != SIM_ROM && desc->kind != SIM_TSGEN);
+
+    /* Identification */
+    R(sd, CS_CIDR0) = 0x0D;
+    R(sd, CS_CIDR1) = (desc->kind == SIM_ROM) ? (CS_CLASS_ROMTABLE << 4) :
+        (desc->kind == SIM_TSGEN) ? (CS_CLASS_PRIMECELL << 4) :
+        (CS_CLASS_CORESIGHT << 4);
+    R(sd, CS_CIDR2) = 0x05;
+    R(sd, CS_CIDR3) = 0xB1;
+    R(sd, CS_PIDR0) = desc->part & 0xFF;
+    R(sd, CS_PIDR1) = 0xB0 | ((desc->part >> 8) & 0xF);
+    R(sd, CS_PIDR2) = 0x1B;
+    R(sd, CS_PIDR4) = 0x04;
+    R(sd, CS_DEVTYPE) = desc->devtype;
+    R(sd, CS_DEVID) = desc->devid;
+
+    switch (desc->kind) {
+    case SIM_ROM:
+        /* Entries: 4K-aligned offset, "32-bit format" and "present" */
+        for (i = 0, n = 0; i < SIM_N_DEVICES; ++i) {
+            if (sim_soc[i].rom == desc->addr) {
+                R(sd, n * 4) = (unsigned int)
+                    ((sim_soc[i].addr - desc->addr) & 0xFFFFF000) | 0x3;
+                ++n;
+            }
+        }
+        break;
+    case SIM_ETF:
+        R(sd, CS_ETB_RAM_DEPTH) = (desc->addr == 0xFE950000) ? 0x800 : 0x400;
+        sd->ram_size = R(sd, CS_ETB_RAM_DEPTH) * 4;
+        sd->ram = (unsigned char *) calloc(1, sd->ram_size);
+        break;
+    case SIM_ETR:
+        R(sd, CS_ETB_RAM_DEPTH) = 0x400;
+        break;
+    case SIM_TPIU:
+        R(sd, CS_TPIU_SUP_TEST_PAT_MODE) = 0x3000F;
+        sd->stopped = 1;
+        break;
+    case SIM_FUNNEL:
+        R(sd, CS_FUNNEL_CTRL) = 0x300;
+        break;
+    case SIM_ETMV4:
+        /* Cortex-A53 ETM r0p4 */
+        R(sd, CS_ETMv4_IDR0) = 0x28000EA1;
+        R(sd, CS_ETMv4_IDR1) = 0x4100F403;
+        R(sd, CS_ETMv4_IDR2) = 0x00000488;
+        R(sd, CS_ETMv4_IDR3) = 0x0D7B0004;
+        R(sd, CS_ETMv4_IDR4) = 0x11170004;
+        R(sd, CS_ETMv4_IDR5) = 0x28C7081E;
+        R(sd, CS_ETMv4_OSLSR) = 0xA;
+        R(sd, CS_ETMv4_PDSR) = CS_ETMv4_PDSR_PowerUp | CS_ETMv4_PDSR_StickyPowerUp;
+        break;
+    case SIM_ETMV3:
+        /* ETM-R5: ETMv3.5 */
+        R(sd, CS_ETMIDR) = 0x4114F253;
+        R(sd, CS_ETMCCR) = 0x8D294024;
+        R(sd, CS_ETMSCR) = 0x00020D09;
+        R(sd, CS_ETMCCER) = 0x34C01AC2;
+        R(sd, CS_ETMCR) = CS_ETMCR_ProgBit | CS_ETMCR_PowerDown | 0x10;
+        break;
+    case SIM_STM:
+        R(sd, CS_STM_FEAT1R) = 0x00656080;
+        R(sd, CS_STM_FEAT2R) = 0x00024CF5;	/* both basic and extended ports */
+        R(sd, CS_STM_FEAT3R) = 0x0000007F;	/* 128 masters */
+        break;
+    case SIM_PMU:
+        R(sd, CS_PMCFGR) = 0x00003F06;
+        R(sd, CS_PMCR) = 0x41033000;
+        break;
+    case SIM_TSGEN:
+        R(sd, CS_CNTFID0) = SIM_TS_FREQ;
+        sd->count = 0;
+        break;
+    default:
+        break;
+    }
+}
+
+
+/* ---------- Backend operations ------------- */
+
+static int sim_open(void)
+{
+    unsigned int i;
+
+    sim_time = 0;
+    sim_dev = (struct sim_device *) calloc(SIM_N_DEVICES,
+                                           sizeof(struct sim_device));
+    if (sim_dev == NULL) {
+        return -1;
+    }
+    for (i = 0; i < SIM_N_DEVICES; ++i) {
+        sim_dev[i].desc = &sim_soc[i];
+        sim_reset_device(&sim_dev[i]);
+    }
+    for (i = 0; i < SIM_N_LINKS; ++i) {
+        struct sim_device *from = sim_find(sim_atb[i].from);
+        struct sim_device *to = sim_find(sim_atb[i].to);
+        assert(from != NULL && to != NULL);
+        from->outs[sim_atb[i].from_port] = to;
+        from->out_port[sim_atb[i].from_port] = sim_atb[i].to_port;
+    }
+    if (DTRACEG) {
+        diagf("!sim: Zynq UltraScale+ CoreSight model, %u components\n",
+              (unsigned int) SIM_N_DEVICES);
+    }
+    return 0;
+}
+
+static void sim_close(void)
+{
+    unsigned int i;
+    if (sim_dev != NULL) {
+        for (i = 0; i < SIM_N_DEVICES; ++i) {
+            if (sim_dev[i].desc->kind == SIM_ETF) {
+                free(sim_dev[i].ram);
+            }
+            free(sim_dev[i].sg_mem);
+            free(sim_dev[i].sg_addr);
+        }
+        free(sim_dev);
+        sim_dev = NULL;
+    }
+    while (sim_regions != NULL) {
+        struct sim_region *r = sim_regions;
+        sim_regions = r->next;
+        free(r->mem);
+        free(r);
+    }
+}
+
+static void *sim_map(cs_physaddr_t addr, unsigned int size, int writable)
+{
+    struct sim_device *sd = (size <= 4096) ? sim_find(addr) : NULL;
+    if (sd != NULL) {
+        return sd->regs;
+    }
+    /* Not a component - system memory, or an unpopulated CoreSight page
+       which will read as zero and so not be recognized. */
+    return sim_memory(addr, size);
+}
+
+static void sim_unmap(void *local, unsigned int size)
+{
+    /* Everything is released by sim_close() */
+}
+
+static unsigned int sim_read32(void volatile const *local, unsigned int off)
+{
+    struct sim_device *sd = sim_device_of(local);
+    if (sd == NULL) {
+        return *(unsigned int const *) ((unsigned char const *) local + off);
+    }
+    sim_tick();
+    return sim_read(sd, off);
+}
+
+static unsigned long long sim_read64(void volatile const *local,
+                                     unsigned int off)
+{
+    unsigned long long lo = sim_read32(local, off);
+    return lo | ((unsigned long long) sim_read32(local, off + 4) << 32);
+}
+
+static void sim_write32(void volatile *local, unsigned int off,
+                        unsigned int data)
+{
+    struct sim_device *sd = sim_device_of(local);
+    if (sd == NULL) {
+        *(unsigned int *) ((unsigned char *) local + off) = data;
+        return;
+    }
+    sim_tick();
+    sim_write(sd, off, data);
+}
+
+static void sim_write64(void volatile *local, unsigned int off,
+                        unsigned long long data)
+{
+    sim_write32(local, off, (unsigned int) data);
+    sim_write32(local, off + 4, (unsigned int) (data >> 32));
+}
+
+static void sim_barrier(void)
+{
+}
+
+/*
+  Simulated time, at the timestamp counter frequency.  Reading the clock
+  takes a tick, so that timed waits make progress between polls.
+*/
+static unsigned long long sim_cycles(void)
+{
+    return ++sim_time;
+}
+
+static void sim_invalidate(void const *local, unsigned int size)
+{
+    /* Simulated system memory is host memory */
+}
+
+static void sim_clean(void const *local, unsigned int size)
+{
+    /* Simulated system memory is host memory */
+}
+
+struct cs_access_ops const cs_access_sim = {
+    "sim",
+    sim_open,
+    sim_close,
+    sim_map,
+    sim_unmap,
+    sim_read32,
+    sim_read64,
+    sim_write32,
+    sim_write64,
+    sim_barrier,
+    sim_cycles,
+    SIM_TS_FREQ,
+    sim_invalidate,
+    sim_clean
+};
+
+#endif				/* CS_SIM */
+
+/* end of cs_sim.c */
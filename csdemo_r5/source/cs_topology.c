@@ -29,7 +29,7 @@ static int cs_scan_romtable(cs_physaddr_t rom_addr, void const *tabv);
 static unsigned int raw_read(unsigned char const *local,
                              unsigned int offset)
 {
-    return *(unsigned int const volatile *) (local + offset);
+    return G.access->read32(local, offset);
 }
 
 static int cs_addr_is_excluded(cs_physaddr_t addr)
@@ -43,7 +43,7 @@ static int cs_addr_is_excluded(cs_physaddr_t addr)
     return 0;
 }
 
-static void cs_stm_device_unregister(struct cs_device *d)
+void _cs_stm_device_unregister(struct cs_device *d)
 {
     assert(d->type == DEV_STM);
 
@@ -54,7 +54,7 @@ static void cs_stm_device_unregister(struct cs_device *d)
                 io_unmap(d->v.stm.ext_ports, cs_stm_get_ext_ports_size(d));
             }
         }
-        free(d->v.stm.ext_ports);
+        _cs_free(d->v.stm.ext_ports);
     }
 }
 
@@ -259,7 +259,7 @@ static cs_device_t cs_device_or_romtable_register(cs_physaddr_t addr)
                 /* STM */
                 d->type = DEV_STM;
                 d->devclass |= CS_DEVCLASS_SWSTIM;
-                d->ops.unregister = cs_stm_device_unregister;
+                d->ops.unregister = _cs_stm_device_unregister;
                 d->v.stm.n_ports = devid & 0x1FFFF;
                 _cs_stm_config_static_init(d);
                 d->v.stm.n_masters =
@@ -284,10 +284,8 @@ static cs_device_t cs_device_or_romtable_register(cs_physaddr_t addr)
                 case 0x1:
                     /* Allocate the array of pointers to the port ranges */
                     d->v.stm.ext_ports =
-                        (unsigned char **) malloc(sizeof(unsigned char *) *
-                                                  d->v.stm.n_masters);
-                    memset(d->v.stm.ext_ports, 0,
-                           sizeof(unsigned char *) * d->v.stm.n_masters);
+                        (unsigned char **) _cs_alloc(sizeof(unsigned char *) *
+                                                     d->v.stm.n_masters);
                     d->v.stm.current_master = 0;
                     break;
                 }
@@ -586,6 +584,21 @@ static cs_device_t cs_device_or_romtable_register(cs_physaddr_t addr)
 static struct cs_device *cs_device_find(cs_physaddr_t addr)
 {
     struct cs_device *d;
+    if (G.indexed && addr != CS_NO_PHYS_ADDR) {
+        unsigned int lo = 0, hi = G.n_addr_index;
+        while (lo < hi) {
+            unsigned int const mid = lo + (hi - lo) / 2;
+            d = G.addr_index[mid];
+            if (d->phys_addr == addr) {
+                return d;
+            } else if (d->phys_addr < addr) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return NULL;
+    }
     for (d = G.device_top; d != NULL; d = d->next) {
         if (d->phys_addr == addr) {
             break;
@@ -606,14 +619,13 @@ static void cs_set_default_power_domain(cs_power_domain_t pd)
 static int cs_scan_romtable(cs_physaddr_t rom_addr, void const *tabv)
 {
     unsigned int i;
-    unsigned int const *tab = (unsigned int const *) tabv;
 
     if (DTRACEG) {
         diagf("!Scanning ROM table at %" CS_PHYSFMT " (mapped to %p)\n",
               rom_addr, tabv);
     }
     assert(G.registration_open);
-    if (CS_CLASS_OF(tab[CS_CIDR1 / 4]) != CS_CLASS_ROMTABLE) {
+    if (CS_CLASS_OF(G.access->read32(tabv, CS_CIDR1)) != CS_CLASS_ROMTABLE) {
         return cs_report_error("page at %" CS_PHYSFMT
                                " is not a CoreSight ROM table", rom_addr);
     }
@@ -621,7 +633,7 @@ static int cs_scan_romtable(cs_physaddr_t rom_addr, void const *tabv)
        the next 4-byte boundary, until a value of 0x00000000 is read which
        is the final entry." */
     for (i = 0; i <= (0xEFC / 4); ++i) {
-        unsigned int entry = tab[i];
+        unsigned int entry = G.access->read32(tabv, i * 4);
         if (entry == 0x00000000) {
             break;
         }
@@ -729,7 +741,7 @@ cs_device_t cs_device_register(cs_physaddr_t addr)
 int cs_exclude_range(cs_physaddr_t from, cs_physaddr_t to)
 {
     struct addr_exclude *a =
-        (struct addr_exclude *) malloc(sizeof(struct addr_exclude));
+        (struct addr_exclude *) _cs_alloc(sizeof(struct addr_exclude));
     if (a == NULL) {
         return -1;
     }
@@ -817,9 +829,92 @@ cs_device_t cs_atb_add_replicator(unsigned int n_outports)
     return DEVDESC(d);
 }
 
+static int cs_device_compare_addr(void const *a, void const *b)
+{
+    cs_physaddr_t const pa = (*(struct cs_device * const *) a)->phys_addr;
+    cs_physaddr_t const pb = (*(struct cs_device * const *) b)->phys_addr;
+    return (pa < pb) ? -1 : (pa > pb);
+}
+
+void _cs_index_free(void)
+{
+    _cs_free(G.addr_index);
+    G.addr_index = NULL;
+    G.n_addr_index = 0;
+    _cs_free(G.cpu_top);
+    G.cpu_top = NULL;
+    G.n_cpu_top = 0;
+    memset(G.type_top, 0, sizeof G.type_top);
+    G.indexed = 0;
+}
+
+/*
+  Build the lookup index: MMIO devices sorted by physical address, and
+  lists of the devices affine to each CPU and of each type.  The lists
+  keep the order of the global device list, so that lookups find the same
+  device as a scan of the global list would.  If memory is short, lookups
+  carry on scanning the global list.
+*/
+static void cs_index_devices(void)
+{
+    struct cs_device *d;
+    struct cs_device **cpu_tail;
+    struct cs_device *type_tail[DEV_MAX];
+    unsigned int n_addr = 0, n_cpu = 0;
+
+    _cs_index_free();
+    for (d = G.device_top; d != NULL; d = d->next) {
+        if (!cs_device_is_non_mmio(d)) {
+            ++n_addr;
+        }
+        if (d->affine_cpu >= 0 && (unsigned int) d->affine_cpu >= n_cpu) {
+            n_cpu = d->affine_cpu + 1;
+        }
+    }
+    G.addr_index =
+        (struct cs_device **) _cs_alloc((n_addr + 1) *
+                                        sizeof(struct cs_device *));
+    /* List heads, followed by the list tails while building */
+    G.cpu_top =
+        (struct cs_device **) _cs_alloc(2 * (n_cpu + 1) *
+                                        sizeof(struct cs_device *));
+    if (G.addr_index == NULL || G.cpu_top == NULL) {
+        _cs_index_free();
+        return;
+    }
+    cpu_tail = G.cpu_top + n_cpu + 1;
+    G.n_cpu_top = n_cpu;
+    memset(type_tail, 0, sizeof type_tail);
+    for (d = G.device_top; d != NULL; d = d->next) {
+        if (!cs_device_is_non_mmio(d)) {
+            G.addr_index[G.n_addr_index++] = d;
+        }
+        d->cpu_next = NULL;
+        if (d->affine_cpu >= 0) {
+            if (cpu_tail[d->affine_cpu] != NULL) {
+                cpu_tail[d->affine_cpu]->cpu_next = d;
+            } else {
+                G.cpu_top[d->affine_cpu] = d;
+            }
+            cpu_tail[d->affine_cpu] = d;
+        }
+        d->type_next = NULL;
+        if (type_tail[d->type] != NULL) {
+            type_tail[d->type]->type_next = d;
+        } else {
+            G.type_top[d->type] = d;
+        }
+        type_tail[d->type] = d;
+    }
+    qsort(G.addr_index, G.n_addr_index, sizeof(struct cs_device *),
+          cs_device_compare_addr);
+    G.indexed = 1;
+}
+
 int cs_registration_complete(void)
 {
     G.registration_open = 0;
+    cs_index_devices();
     return 0;
 }
 
@@ -833,6 +928,31 @@ int cs_registration_completed(void)
 
 /*  ========= topology iteration group =========== */
 
+/*
+  Iterate over the devices of one type, in the order of the global list.
+*/
+struct cs_device *_cs_device_first_of_type(cs_devtype_t type)
+{
+    struct cs_device *d;
+    if (G.indexed) {
+        return G.type_top[type];
+    }
+    for (d = G.device_top; d != NULL && d->type != type; d = d->next) {
+    }
+    return d;
+}
+
+struct cs_device *_cs_device_next_of_type(struct cs_device *d)
+{
+    cs_devtype_t const type = d->type;
+    if (G.indexed) {
+        return d->type_next;
+    }
+    for (d = d->next; d != NULL && d->type != type; d = d->next) {
+    }
+    return d;
+}
+
 cs_device_t cs_device_first(void)
 {
     return DEVDESC(G.device_top);
@@ -917,9 +1037,18 @@ cs_cpu_t cs_device_get_affinity(cs_device_t dev)
 cs_device_t cs_cpu_get_device(cs_cpu_t cpu, unsigned int cls)
 {
     struct cs_device *d;
-    for (d = G.device_top; d != NULL; d = d->next) {
-        if (d->affine_cpu == cpu && (d->devclass & cls) == cls) {
-            break;
+    if (G.indexed && cpu >= 0) {
+        d = ((unsigned int) cpu < G.n_cpu_top) ? G.cpu_top[cpu] : NULL;
+        for (; d != NULL; d = d->cpu_next) {
+            if ((d->devclass & cls) == cls) {
+                break;
+            }
+        }
+    } else {
+        for (d = G.device_top; d != NULL; d = d->next) {
+            if (d->affine_cpu == cpu && (d->devclass & cls) == cls) {
+                break;
+            }
         }
     }
     if (d != NULL) {
@@ -0,0 +1,315 @@
+/*
+  Coresight Access Library - API - capturing into several trace sinks at once
+
+  Copyright (C) ARM Limited, 2014-2016. All rights reserved.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "cs_access_cmnfns.h"
+#include "cs_trace_source.h"
+#include "cs_trace_sink.h"
+#include "cs_topology.h"
+#include "cs_trace_session.h"
+
+#define SESSION_MAX_PATH 16	/* Links between a source and its sink */
+
+/* ---------- Local functions ------------- */
+
+static int session_sink_find(cs_trace_session_t const *s,
+			     struct cs_device *d)
+{
+    unsigned int i;
+
+    for (i = 0; i < s->n_sinks; ++i) {
+	if (DEV(s->sinks[i].sink) == d) {
+	    return i;
+	}
+    }
+    return -1;
+}
+
+/* Check that the sink can operate in the requested mode */
+static int session_sink_check(cs_session_sink_t const *k)
+{
+    struct cs_device *d = DEV(k->sink);
+
+    if (!cs_device_has_class(k->sink, CS_DEVCLASS_SINK)) {
+	return cs_report_device_error(d, "not a trace sink");
+    }
+    if (k->mode == CS_SINK_MODE_CIRCULAR) {
+	if (k->n_sources == 0) {
+	    return cs_report_device_error(d, "no sources for this sink");
+	}
+	return 0;
+    }
+    if (d->type != DEV_ETF) {
+	return cs_report_device_error(d, "only an ETF can be a FIFO");
+    }
+    if (k->mode == CS_SINK_MODE_SWFIFO) {
+	if (k->n_sources == 0 || k->stream == NULL) {
+	    return cs_report_device_error(d,
+					  "software FIFO needs sources and a stream");
+	}
+    } else if (k->n_sources != 0) {
+	return cs_report_device_error(d,
+				      "ETF in hardware FIFO mode passes trace on - route the sources to the sink downstream");
+    }
+    return 0;
+}
+
+/*
+  Find the ETFs on the path from a source to its sink.  Those that are
+  sinks of the session must pass trace on; the others are enabled in
+  hardware FIFO mode.
+*/
+static int session_path_links(cs_trace_session_t * s, cs_device_t source,
+			      cs_device_t sink)
+{
+    struct cs_device *path[SESSION_MAX_PATH];
+    unsigned int i, j;
+    int k, n;
+
+    n = _cs_path_links(DEV(source), DEV(sink), path, SESSION_MAX_PATH);
+    if (n < 0) {
+	return cs_report_device_error(DEV(source),
+				      "no trace path to %" CS_PHYSFMT,
+				      DEV(sink)->phys_addr);
+    }
+    for (i = 0; i < (unsigned int) n; ++i) {
+	if (path[i]->type != DEV_ETF) {
+	    continue;
+	}
+	k = session_sink_find(s, path[i]);
+	if (k >= 0) {
+	    if (s->sinks[k].mode != CS_SINK_MODE_HWFIFO) {
+		return cs_report_device_error(path[i],
+					      "ETF on the path to %"
+					      CS_PHYSFMT
+					      " must be in hardware FIFO mode",
+					      DEV(sink)->phys_addr);
+	    }
+	    continue;
+	}
+	for (j = 0; j < s->n_links && DEV(s->links[j]) != path[i]; ++j);
+	if (j == s->n_links) {
+	    if (s->n_links == CS_SESSION_MAX_LINKS) {
+		return cs_report_device_error(path[i],
+					      "too many ETFs on trace paths");
+	    }
+	    s->links[s->n_links++] = DEVDESC(path[i]);
+	}
+    }
+    return 0;
+}
+
+static int session_sink_enable(cs_session_sink_t const *k)
+{
+    struct cs_device *d = DEV(k->sink);
+    cs_etr_config_t config;
+
+    switch (k->mode) {
+    case CS_SINK_MODE_SWFIFO:
+	return cs_etf_stream_start(k->stream, k->sink, k->ring, k->ring_size,
+				   k->watermark);
+    case CS_SINK_MODE_HWFIFO:
+	return cs_etf_enable(k->sink);
+    default:
+	break;
+    }
+    if (d->type == DEV_ETB && d->v.etb.is_tmc_device
+	&& d->v.etb.tmc.config_type == CS_TMC_CONFIG_TYPE_ETR) {
+	if (k->etr == NULL) {
+	    cs_etr_config_init(&config);
+	}
+	return cs_etr_enable(k->sink, (k->etr != NULL) ? k->etr : &config);
+    }
+    if (d->type == DEV_ETF) {
+	/* The ETF may have been left in a FIFO mode */
+	_cs_unlock(d);
+	_cs_write(d, CS_TMC_MODE, CS_TMC_MODE_CIRCULAR);
+    }
+    return cs_sink_enable(k->sink);
+}
+
+/* Enable or disable the sources of all the sinks */
+static int session_sources_enable(cs_trace_session_t * s, int enable)
+{
+    unsigned int i, j;
+    int rc, first_rc = 0;
+
+    for (i = 0; i < s->n_sinks; ++i) {
+	for (j = 0; j < s->sinks[i].n_sources; ++j) {
+	    rc = enable ? cs_trace_enable(s->sinks[i].sources[j]) :
+		cs_trace_disable(s->sinks[i].sources[j]);
+	    if (rc != 0 && first_rc == 0) {
+		first_rc = rc;
+	    }
+	}
+    }
+    return first_rc;
+}
+
+/* ========== API functions ================ */
+
+static int _cs_trace_session_start(cs_trace_session_t * s,
+				   cs_session_sink_t const *sinks,
+				   unsigned int n_sinks)
+{
+    cs_trace_route_t routes[CS_SESSION_MAX_SINKS];
+    unsigned int i, j;
+    int rc;
+
+    memset(s, 0, sizeof *s);
+    if (n_sinks == 0 || n_sinks > CS_SESSION_MAX_SINKS) {
+	return cs_report_error("trace session needs 1 to %u sinks",
+			       CS_SESSION_MAX_SINKS);
+    }
+    s->sinks = sinks;
+    s->n_sinks = n_sinks;
+    for (i = 0; i < n_sinks; ++i) {
+	rc = session_sink_check(&sinks[i]);
+	if (rc != 0) {
+	    return rc;
+	}
+	if (session_sink_find(s, DEV(sinks[i].sink)) != (int) i) {
+	    return cs_report_device_error(DEV(sinks[i].sink),
+					  "sink is in the session twice");
+	}
+	for (j = 0; j < sinks[i].n_sources; ++j) {
+	    rc = session_path_links(s, sinks[i].sources[j], sinks[i].sink);
+	    if (rc != 0) {
+		return rc;
+	    }
+	}
+	routes[i].sources = sinks[i].sources;
+	routes[i].n_sources = sinks[i].n_sources;
+	routes[i].sink = sinks[i].sink;
+    }
+    rc = cs_routes_enable(routes, n_sinks);
+    if (rc != 0) {
+	return rc;
+    }
+    /* Enable the sinks that hold trace before the ETFs that pass it on
+       to them, downstream first, then the sources */
+    for (i = 0; i < n_sinks && rc == 0; ++i) {
+	if (sinks[i].mode != CS_SINK_MODE_HWFIFO) {
+	    rc = session_sink_enable(&sinks[i]);
+	}
+    }
+    for (i = 0; i < n_sinks && rc == 0; ++i) {
+	if (sinks[i].mode == CS_SINK_MODE_HWFIFO) {
+	    rc = session_sink_enable(&sinks[i]);
+	}
+    }
+    for (i = s->n_links; i > 0 && rc == 0; --i) {
+	rc = cs_etf_enable(s->links[i - 1]);
+    }
+    if (rc != 0) {
+	return rc;
+    }
+    s->running = 1;
+    return session_sources_enable(s, 1);
+}
+
+static struct cs_api_stats api_trace_session_start =
+    { "cs_trace_session_start" };
+
+int cs_trace_session_start(cs_trace_session_t * s,
+			   cs_session_sink_t const *sinks,
+			   unsigned int n_sinks)
+{
+    struct cs_api_probe p;
+    _cs_api_enter(&p, &api_trace_session_start);
+    return _cs_api_exit(&p, _cs_trace_session_start(s, sinks, n_sinks));
+}
+
+int cs_trace_session_poll(cs_trace_session_t * s)
+{
+    unsigned int i;
+    int rc, total = 0;
+
+    for (i = 0; i < s->n_sinks; ++i) {
+	if (s->sinks[i].mode == CS_SINK_MODE_SWFIFO) {
+	    rc = cs_etf_stream_poll(s->sinks[i].stream);
+	    if (rc < 0) {
+		return rc;
+	    }
+	    total += rc;
+	}
+    }
+    return total;
+}
+
+static int _cs_trace_session_stop(cs_trace_session_t * s)
+{
+    cs_session_sink_t const *k;
+    unsigned int i;
+    int rc, first_rc;
+
+    first_rc = session_sources_enable(s, 0);
+    s->running = 0;
+    /* Start stopping all the buffers and ports together, so that their
+       captures end at the same point, then drain the streams while the
+       others flush */
+    for (i = 0; i < s->n_sinks; ++i) {
+	k = &s->sinks[i];
+	if (k->mode == CS_SINK_MODE_CIRCULAR) {
+	    rc = cs_sink_disable_start(k->sink);
+	    if (rc != 0 && first_rc == 0) {
+		first_rc = rc;
+	    }
+	}
+    }
+    for (i = 0; i < s->n_sinks; ++i) {
+	k = &s->sinks[i];
+	if (k->mode == CS_SINK_MODE_SWFIFO) {
+	    rc = cs_etf_stream_stop(k->stream);
+	} else if (k->mode == CS_SINK_MODE_CIRCULAR) {
+	    rc = _cs_sink_disable_wait(DEV(k->sink));
+	} else {
+	    continue;
+	}
+	if (rc != 0 && first_rc == 0) {
+	    first_rc = rc;
+	}
+    }
+    /* Only now stop the ETFs passing trace on */
+    for (i = 0; i < s->n_sinks; ++i) {
+	if (s->sinks[i].mode == CS_SINK_MODE_HWFIFO) {
+	    rc = cs_etf_disable(s->sinks[i].sink);
+	    if (rc != 0 && first_rc == 0) {
+		first_rc = rc;
+	    }
+	}
+    }
+    for (i = 0; i < s->n_links; ++i) {
+	rc = cs_etf_disable(s->links[i]);
+	if (rc != 0 && first_rc == 0) {
+	    first_rc = rc;
+	}
+    }
+    return first_rc;
+}
+
+static struct cs_api_stats api_trace_session_stop =
+    { "cs_trace_session_stop" };
+
+int cs_trace_session_stop(cs_trace_session_t * s)
+{
+    struct cs_api_probe p;
+    _cs_api_enter(&p, &api_trace_session_stop);
+    return _cs_api_exit(&p, _cs_trace_session_stop(s));
+}
+
+/* end of cs_trace_session.c */
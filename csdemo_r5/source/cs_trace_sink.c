@@ -19,7 +19,22 @@
 #include "cs_access_cmnfns.h"
 #include "cs_trace_sink.h"
 #include "cs_topology.h"
+#include "cs_reg_access.h"
+#include "cs_trace_source.h"
+#include "cs_ts_gen.h"
+#ifdef __linux__
+#include <unistd.h>
+#else
 #include <sleep.h>
+#endif
+
+/* ETR scatter-gather table layout: each 4K table page has a link to the
+ next table page in its last entry */
+#define SG_ENTRIES_PER_TABLE_PAGE (CS_TMC_SG_PAGE_SIZE / 4)
+#define SG_DATA_PER_TABLE_PAGE (SG_ENTRIES_PER_TABLE_PAGE - 1)
+
+static unsigned long long etr_sg_page(struct cs_device *d, unsigned int i);
+static unsigned int etr_buffer_offset(struct cs_device *d, unsigned int off_lo, unsigned int off_hi);
 
 /* ---------- Local functions ------------- */
 
@@ -40,7 +55,7 @@ int cs_tpiu_pattern_test(cs_device_t dev) {
 	}
 }
 
-int cs_etf_enable(cs_device_t dev) {
+static int _cs_etf_enable(cs_device_t dev) {
 	struct cs_device *d = DEV(dev);
 	unsigned int current_TMC_mode;
 	unsigned int new_TMC_mode;
@@ -50,6 +65,9 @@ int cs_etf_enable(cs_device_t dev) {
 	if (d->type == DEV_ETF) {
 		unsigned int ffcr, pscr;
 		d->v.etb.currently_reading = 0;
+		d->v.etb.finished_reading = 0;
+		d->v.etb.read_bytes = 0;
+		d->v.etb.read_cycles = 0;
 		if (_cs_isset(d, CS_ETB_CTRL, CS_ETB_CTRL_TraceCaptEn)) {
 			printf("CSETF: ETF is already running");
 			return -1;
@@ -95,7 +113,15 @@ int cs_etf_enable(cs_device_t dev) {
 	}
 }
 
-int cs_etf_disable(cs_device_t dev) {
+static struct cs_api_stats api_etf_enable = { "cs_etf_enable" };
+
+int cs_etf_enable(cs_device_t dev) {
+	struct cs_api_probe p;
+	_cs_api_enter(&p, &api_etf_enable);
+	return _cs_api_exit(&p, _cs_etf_enable(dev));
+}
+
+static int _cs_etf_disable(cs_device_t dev) {
 	struct cs_device *d = DEV(dev);
 	assert(cs_device_has_class(dev, CS_DEVCLASS_SINK));
 
@@ -130,6 +156,14 @@ int cs_etf_disable(cs_device_t dev) {
 	}
 }
 
+static struct cs_api_stats api_etf_disable = { "cs_etf_disable" };
+
+int cs_etf_disable(cs_device_t dev) {
+	struct cs_api_probe p;
+	_cs_api_enter(&p, &api_etf_disable);
+	return _cs_api_exit(&p, _cs_etf_disable(dev));
+}
+
 int cs_sink_is_enabled(cs_device_t dev) {
 	struct cs_device *d = DEV(dev);
 	assert(cs_device_has_class(dev, CS_DEVCLASS_SINK));
@@ -140,39 +174,83 @@ int cs_sink_is_enabled(cs_device_t dev) {
 	}
 }
 
-int cs_etr_axi_enable(cs_device_t dev) {
+void cs_etr_config_init(cs_etr_config_t *config) {
+	config->buffer_addr = 0x60000000;
+	config->buffer_size = 0x20000000;	/* 512MB */
+	config->burst_len = 128;
+	config->cache_prot = CS_TMX_AXICTL_CACHEPROT;
+	config->sg_table = NULL;
+}
+
+/*
+ Point the ETR's write and read pointers at the start of its buffer.  They
+ are bus addresses: in scatter-gather mode, in the first data page.
+ */
+void _cs_etr_rewind(struct cs_device *d) {
+	unsigned long long start;
+
+	if (d->v.etb.sg_table != NULL) {
+		start = etr_sg_page(d, 0);
+	} else {
+		start = ((unsigned long long) _cs_read(d, CS_TMC_DBAHI) << 32) | _cs_read(d, CS_TMC_DBALO);
+	}
+	_cs_write(d, CS_ETB_RAM_WR_PTR, (unsigned int) start);
+	_cs_write(d, CS_TMC_RWPHI, (unsigned int) (start >> 32));
+	_cs_write(d, CS_ETB_RAM_RD_PTR, (unsigned int) start);
+	_cs_write(d, CS_TMC_RRPHI, (unsigned int) (start >> 32));
+}
+
+static int _cs_etr_enable(cs_device_t dev, cs_etr_config_t const *config) {
 	int rc;
 	struct cs_device *d = DEV(dev);
+	unsigned long long const dba = config->buffer_addr;
+	int const sg = (config->sg_table != NULL);
 	assert(cs_device_has_class(dev, CS_DEVCLASS_SINK));
 
 	_cs_unlock(d);
 	if (d->type == DEV_ETB || d->type == DEV_ETF) {
 
 		d->v.etb.currently_reading = 0;
+		d->v.etb.finished_reading = 0;
+		d->v.etb.read_bytes = 0;
+		d->v.etb.read_cycles = 0;
 		if (_cs_isset(d, CS_ETB_CTRL, CS_ETB_CTRL_TraceCaptEn)) {
 			return cs_report_device_error(d, "buffer is already enabled");
 		}
+		if (config->buffer_size == 0 || (config->buffer_size & 3) != 0 || (dba & 0xFFF) != 0) {
+			return cs_report_device_error(d, "ETR buffer must be 4K aligned and a multiple of 4 bytes");
+		}
+		if (sg && (config->buffer_size & (CS_TMC_SG_PAGE_SIZE - 1)) != 0) {
+			return cs_report_device_error(d, "scatter-gather ETR buffer must be a multiple of 4K");
+		}
+		if (config->burst_len < 1 || config->burst_len > 256) {
+			return cs_report_device_error(d, "AXI burst length %u out of range", config->burst_len);
+		}
 		/* "The RAM Write Pointer Register must be programmed before trace
 				 capture is enabled." */
 		rc = cs_empty_trace_buffer(dev);
 		if (rc != 0) {
 			return rc;
 		}
-		/* RAM DEPTH (RSZ) = 512MB --> 32-Bit-word:0x8000000*/
-		_cs_write(d, CS_ETB_RAM_DEPTH, 0x8000000);
+		/* RAM DEPTH (RSZ) is in 32-bit words */
+		_cs_write(d, CS_ETB_RAM_DEPTH, config->buffer_size >> 2);
+		d->v.etb.buffer_size_bytes = config->buffer_size;
 		/* set TMC mode to Circular Buffer*/
 		_cs_write(d, CS_TMC_MODE, CS_TMC_MODE_CIRCULAR);
-		/* AXI Control
-		 max. of 2  data transfers per burst.
-		 scatter-gather mode disabled.
-		 cache enabled on writes & reads, non-secure access, privileged access.
-		 */
-		_cs_clear(d, CS_TMC_AXICTL, CS_TMC_SCATGAT_MODE);
-		_cs_set(d, CS_TMC_AXICTL, CS_TMC_AXICTL_WRBURSTLEN128 | CS_TMX_AXICTL_CACHEPROT);
-		/* set 32-Bit address to locate trace buffer in system memory*/
-		_cs_write(d, CS_TMC_DBALO, 0x60000000);
-		/* set high part of the address of the trace buffer in system memory*/
-		_cs_write(d, CS_TMC_DBAHI, 0x00);
+		/* AXI Control: write burst length, scatter-gather mode,
+		 cache and protection attributes. */
+		_cs_write_mask(d, CS_TMC_AXICTL, CS_TMC_AXICTL_WRBURSTLEN_MASK | CS_TMC_SCATGAT_MODE | CS_TMX_AXICTL_CACHEPROT,
+				((config->burst_len - 1) << 8) | (sg ? CS_TMC_SCATGAT_MODE : 0) | (config->cache_prot & CS_TMX_AXICTL_CACHEPROT));
+		/* locate the trace buffer, or its scatter-gather table, in system memory */
+		_cs_write(d, CS_TMC_DBALO, (unsigned int) dba);
+		_cs_write(d, CS_TMC_DBAHI, (unsigned int) (dba >> 32));
+		d->v.etb.sg_table = (unsigned int const *) config->sg_table;
+		d->v.etb.sg_n_pages = sg ? config->buffer_size / CS_TMC_SG_PAGE_SIZE : 0;
+		d->v.etb.sg_hint[0] = 0;
+		d->v.etb.sg_hint[1] = 0;
+		/* The buffer is not cleared: RWP and the Full flag say how much of it
+		 holds trace, so starting a capture does not depend on its size. */
+		_cs_etr_rewind(d);
 
 		/* periodic synchronization register: period=2^PSCOUNT     0xA => 1024Bytes   */
 		_cs_write(d, CS_ETB_PSCR, 0x0);
@@ -196,7 +274,21 @@ int cs_etr_axi_enable(cs_device_t dev) {
 	}
 }
 
-int cs_sink_enable(cs_device_t dev) {
+static struct cs_api_stats api_etr_enable = { "cs_etr_enable" };
+
+int cs_etr_enable(cs_device_t dev, cs_etr_config_t const *config) {
+	struct cs_api_probe p;
+	_cs_api_enter(&p, &api_etr_enable);
+	return _cs_api_exit(&p, _cs_etr_enable(dev, config));
+}
+
+int cs_etr_axi_enable(cs_device_t dev) {
+	cs_etr_config_t config;
+	cs_etr_config_init(&config);
+	return cs_etr_enable(dev, &config);
+}
+
+static int _cs_sink_enable(cs_device_t dev) {
 	int rc;
 	struct cs_device *d = DEV(dev);
 	assert(cs_device_has_class(dev, CS_DEVCLASS_SINK));
@@ -205,6 +297,9 @@ int cs_sink_enable(cs_device_t dev) {
 	if (d->type == DEV_ETB || d->type == DEV_ETF) {
 		unsigned int flfmt, pscr;
 		d->v.etb.currently_reading = 0;
+		d->v.etb.finished_reading = 0;
+		d->v.etb.read_bytes = 0;
+		d->v.etb.read_cycles = 0;
 		if (_cs_isset(d, CS_ETB_CTRL, CS_ETB_CTRL_TraceCaptEn)) {
 			//return cs_report_device_error(d, "buffer is already enabled");
 			return 0;
@@ -215,6 +310,8 @@ int cs_sink_enable(cs_device_t dev) {
 		if (rc != 0) {
 			return rc;
 		}
+		/* Issue the configuration and enable as one batch of writes */
+		cs_reg_batch_begin();
 		/* periodic synchronization register: period=2^PSCOUNT     0xA => 1024Bytes   */
 		pscr = 0x0;
 		_cs_write(d, CS_ETB_PSCR, pscr);
@@ -233,7 +330,8 @@ int cs_sink_enable(cs_device_t dev) {
 			flfmt |= CS_ETB_FLFMT_CTRL_StopFl;
 		}
 		_cs_set(d, CS_ETB_FLFMT_CTRL, flfmt);
-		return _cs_write(d, CS_ETB_CTRL, CS_ETB_CTRL_TraceCaptEn);
+		_cs_write(d, CS_ETB_CTRL, CS_ETB_CTRL_TraceCaptEn);
+		return cs_reg_batch_commit();
 	} else if (d->type == DEV_TPIU) {
 		unsigned int ffcr, fscr;
 		/* check if formatter is stopped */
@@ -241,6 +339,7 @@ int cs_sink_enable(cs_device_t dev) {
 		if (rc != 0) {
 			return rc;
 		}
+		cs_reg_batch_begin();
 		/* enable traceclock from PL (not from PS clock controller) */
 		_cs_set(d, CS_TPIU_EXTCTL_OUT_PORT, CS_TPIU_EXTCTL_OP_TCLK);
 		/* formatter synchronization counter*/
@@ -252,7 +351,8 @@ int cs_sink_enable(cs_device_t dev) {
 		//ffcr |= CS_TPIU_FLFMT_CTRL_EnFCont; /* enable continuous formatting, embed in trigger packets, indicate null cycles using sync packets */
 		ffcr = 0x0;
 		ffcr |= CS_TPIU_FLFMT_CTRL_EnFTC; /* enable formatting */
-		rc = _cs_write(d, CS_TPIU_FLFMT_CTRL, ffcr);
+		_cs_write(d, CS_TPIU_FLFMT_CTRL, ffcr);
+		rc = cs_reg_batch_commit();
 		if (rc != 0) {
 			return rc;
 		}
@@ -267,12 +367,27 @@ int cs_sink_enable(cs_device_t dev) {
 	}
 }
 
-int cs_sink_disable(cs_device_t dev) {
-	int rc;
-	struct cs_device *d = DEV(dev);
+static struct cs_api_stats api_sink_enable = { "cs_sink_enable" };
 
-	assert(cs_device_has_class(dev, CS_DEVCLASS_SINK));
+int cs_sink_enable(cs_device_t dev) {
+	struct cs_api_probe p;
+	_cs_api_enter(&p, &api_sink_enable);
+	return _cs_api_exit(&p, _cs_sink_enable(dev));
+}
+
+/*
+ True if a sink is a TMC that is capturing.  Such a TMC is stopped with a
+ manual flush, and stays enabled (TraceCaptEn set) until read-out completes.
+ */
+static int sink_is_capturing_tmc(struct cs_device *d) {
+	return d->v.etb.is_tmc_device && _cs_isset(d, CS_ETB_CTRL, CS_ETB_CTRL_TraceCaptEn);
+}
 
+/*
+ Start the stop sequence for a sink, without waiting for the formatter to
+ drain.
+ */
+static int sink_disable_start(struct cs_device *d) {
 	_cs_unlock(d);
 	if (d->type == DEV_TPIU) {
 		/* TPIU */
@@ -280,60 +395,122 @@ int cs_sink_disable(cs_device_t dev) {
 		/* When we request a flush via FOnMan, the FOnMan reads back as 1 while the
 		 flush is in progress, then goes to 0.  So don't try to read back. */
 		_cs_set_wo(d, CS_TPIU_FLFMT_CTRL, CS_TPIU_FLFMT_CTRL_FOnMan);
-		/* This is the indicator that the flush sequence has completed. */
-		return _cs_wait(d, CS_TPIU_FLFMT_STATUS,
-		CS_TPIU_FLFMT_STATUS_FtStopped);
+		return 0;
 	} else if (d->type == DEV_SWO) {
 		/* SWO */
 		/* Stopping and flushing the SWO is not supported */
 		return -1;
 	} else if (d->type == DEV_ETB || d->type == DEV_ETF) {
 		/* ETB or TMC */
-		if (d->v.etb.is_tmc_device && _cs_isset(d, CS_ETB_CTRL, CS_ETB_CTRL_TraceCaptEn)) {
+		if (sink_is_capturing_tmc(d)) {
 			/* Manual Flush to go via Stopping to Stopped */
 			_cs_set_wo(d, CS_ETB_FLFMT_CTRL, CS_ETB_FLFMT_CTRL_FOnMan);
 			/* Now in Stopping */
-			/* [TMC 2.2.2] "6. Wait until TMCReady is equal to one.  This indicates
-			 that the trace session is over." */
-			_cs_wait(d, CS_ETB_STATUS, CS_TMC_STATUS_TMCReady);
-			/* Now in Stopped. */
-			/* The TMC is still enabled, i.e. TraceCaptEn is set.
-			 It will be disabled when we complete read-out. */
 			return 0;
 		}
 		/* "Disable trace capture" by unsetting TraceCaptEn */
-		rc = _cs_write(d, CS_ETB_CTRL, 0x0);
-		if (rc)
-			return rc;
-		/* Wait for formatter to flush */
-		rc = _cs_wait(d, CS_ETB_STATUS, CS_ETB_STATUS_FtEmpty);
-		if (rc)
-			return rc;
-		/* After FtEmpty: "Formatter pipeline is empty. All data is stored to RAM." */
-		/* "Capture is fully disabled, or complete, when FtStopped goes high" */
-		rc = _cs_wait(d, CS_ETB_FLFMT_STATUS,
-		CS_ETB_FLFMT_STATUS_FtStopped);
+		return _cs_write(d, CS_ETB_CTRL, 0x0);
+	} else {
+		return -1;
+	}
+}
+
+/*
+ Wait for a sink whose stop sequence has been started to drain.
+ */
+int _cs_sink_disable_wait(struct cs_device *d) {
+	int rc;
+
+	if (d->type == DEV_TPIU) {
+		/* This is the indicator that the flush sequence has completed. */
+		return _cs_wait(d, CS_TPIU_FLFMT_STATUS,
+		CS_TPIU_FLFMT_STATUS_FtStopped);
+	}
+	if (sink_is_capturing_tmc(d)) {
+		/* [TMC 2.2.2] "6. Wait until TMCReady is equal to one.  This indicates
+		 that the trace session is over." */
+		_cs_wait(d, CS_ETB_STATUS, CS_TMC_STATUS_TMCReady);
+		/* Now in Stopped. */
+		/* The TMC is still enabled, i.e. TraceCaptEn is set.
+		 It will be disabled when we complete read-out. */
+		return 0;
+	}
+	/* Wait for formatter to flush */
+	rc = _cs_wait(d, CS_ETB_STATUS, CS_ETB_STATUS_FtEmpty);
+	if (rc)
 		return rc;
+	/* After FtEmpty: "Formatter pipeline is empty. All data is stored to RAM." */
+	/* "Capture is fully disabled, or complete, when FtStopped goes high" */
+	rc = _cs_wait(d, CS_ETB_FLFMT_STATUS,
+	CS_ETB_FLFMT_STATUS_FtStopped);
+	return rc;
+}
+
+static int _cs_sink_disable(cs_device_t dev) {
+	int rc;
+	struct cs_device *d = DEV(dev);
+
+	assert(cs_device_has_class(dev, CS_DEVCLASS_SINK));
+
+	rc = sink_disable_start(d);
+	if (rc)
+		return rc;
+	return _cs_sink_disable_wait(d);
+}
+
+static struct cs_api_stats api_sink_disable = { "cs_sink_disable" };
+
+int cs_sink_disable(cs_device_t dev) {
+	struct cs_api_probe p;
+	_cs_api_enter(&p, &api_sink_disable);
+	return _cs_api_exit(&p, _cs_sink_disable(dev));
+}
+
+int cs_sink_disable_start(cs_device_t dev) {
+	assert(cs_device_has_class(dev, CS_DEVCLASS_SINK));
+	return sink_disable_start(DEV(dev));
+}
+
+int cs_sink_disable_poll(cs_device_t dev) {
+	struct cs_device *d = DEV(dev);
+
+	assert(cs_device_has_class(dev, CS_DEVCLASS_SINK));
+
+	_cs_unlock(d);
+	if (d->type == DEV_TPIU) {
+		return _cs_isset(d, CS_TPIU_FLFMT_STATUS, CS_TPIU_FLFMT_STATUS_FtStopped);
+	} else if (d->type == DEV_ETB || d->type == DEV_ETF) {
+		if (sink_is_capturing_tmc(d)) {
+			return _cs_isset(d, CS_ETB_STATUS, CS_TMC_STATUS_TMCReady);
+		}
+		return _cs_isset(d, CS_ETB_STATUS, CS_ETB_STATUS_FtEmpty)
+				&& _cs_isset(d, CS_ETB_FLFMT_STATUS, CS_ETB_FLFMT_STATUS_FtStopped);
 	} else {
 		return -1;
 	}
 }
 
-int cs_disable_tpiu(void) {
+static int _cs_disable_tpiu(void) {
 	int rc = 0;
 	struct cs_device *d;
 
-	for (d = G.device_top; d != NULL; d = d->next) {
-		if (d->type == DEV_TPIU) {
-			rc = cs_sink_disable(DEVDESC(d));
-			if (rc != 0)
-				break;
-		}
-		/* Note that we don't disable SWOs (because we can't) */
+	for (d = _cs_device_first_of_type(DEV_TPIU); d != NULL; d = _cs_device_next_of_type(d)) {
+		rc = cs_sink_disable(DEVDESC(d));
+		if (rc != 0)
+			break;
 	}
+	/* Note that we don't disable SWOs (because we can't) */
 	return rc;
 }
 
+static struct cs_api_stats api_disable_tpiu = { "cs_disable_tpiu" };
+
+int cs_disable_tpiu(void) {
+	struct cs_api_probe p;
+	_cs_api_enter(&p, &api_disable_tpiu);
+	return _cs_api_exit(&p, _cs_disable_tpiu());
+}
+
 int cs_get_buffer_size_bytes(cs_device_t dev) {
 	struct cs_device *d = DEV(dev);
 	assert(cs_device_has_class(dev, CS_DEVCLASS_BUFFER));
@@ -373,6 +550,11 @@ int cs_get_buffer_unread_bytes(cs_device_t dev) {
 		 to read the full buffer contents
 		 */
 		unread = d->v.etb.buffer_size_bytes;
+	} else if (d->v.etb.sg_table != NULL) {
+		/* Scatter-gather pages need not be in address order */
+		unsigned int const rd = etr_buffer_offset(d, CS_ETB_RAM_RD_PTR, CS_TMC_RRPHI);
+		unsigned int const wr = etr_buffer_offset(d, CS_ETB_RAM_WR_PTR, CS_TMC_RWPHI);
+		unread = (wr + d->v.etb.buffer_size_bytes - rd) % d->v.etb.buffer_size_bytes;
 	} else {
 		/* Either the trace never wrapped, or we're in the middle of reading */
 		unsigned int const shift = d->v.etb.pointer_scale_shift;
@@ -387,17 +569,83 @@ int cs_get_buffer_unread_bytes(cs_device_t dev) {
 	return unread;
 }
 
-int cs_get_trace_data(cs_device_t dev, void *buf, unsigned int size) {
+/*
+ Stream whole memory-width units from the RAM Read Data register into the
+ caller's buffer.  Consecutive reads of the same device register are
+ ordered, so no barrier is needed between them.
+ [TMC] 3.3.3: "When the memory width given in the DEVID register is greater than
+ 32 bits, multiple reads to this register must be performed together to read a
+ full memory width of data. For example, if the memory width is 128 bits,
+ then reads from this register must be performed four at a time.
+ When a full memory width of data has been read, the RAM Read Pointer is
+ incremented to the next memory word."
+ */
+static void buffer_read_units(struct cs_device *d, unsigned int *op, unsigned int n_units, unsigned int unit_words) {
+	unsigned int (*const read32)(void volatile const *, unsigned int) = G.access->read32;
+	void volatile const *local = d->local_addr;
+
+	switch (unit_words) {
+	case 8:
+		while (n_units-- > 0) {
+			op[0] = read32(local, CS_ETB_RAM_DATA);
+			op[1] = read32(local, CS_ETB_RAM_DATA);
+			op[2] = read32(local, CS_ETB_RAM_DATA);
+			op[3] = read32(local, CS_ETB_RAM_DATA);
+			op[4] = read32(local, CS_ETB_RAM_DATA);
+			op[5] = read32(local, CS_ETB_RAM_DATA);
+			op[6] = read32(local, CS_ETB_RAM_DATA);
+			op[7] = read32(local, CS_ETB_RAM_DATA);
+			op += 8;
+		}
+		break;
+	case 4:
+		while (n_units-- > 0) {
+			op[0] = read32(local, CS_ETB_RAM_DATA);
+			op[1] = read32(local, CS_ETB_RAM_DATA);
+			op[2] = read32(local, CS_ETB_RAM_DATA);
+			op[3] = read32(local, CS_ETB_RAM_DATA);
+			op += 4;
+		}
+		break;
+	case 2:
+		while (n_units-- > 0) {
+			op[0] = read32(local, CS_ETB_RAM_DATA);
+			op[1] = read32(local, CS_ETB_RAM_DATA);
+			op += 2;
+		}
+		break;
+	default:
+		for (; n_units >= 4; n_units -= 4) {
+			op[0] = read32(local, CS_ETB_RAM_DATA);
+			op[1] = read32(local, CS_ETB_RAM_DATA);
+			op[2] = read32(local, CS_ETB_RAM_DATA);
+			op[3] = read32(local, CS_ETB_RAM_DATA);
+			op += 4;
+		}
+		while (n_units-- > 0) {
+			*op++ = read32(local, CS_ETB_RAM_DATA);
+		}
+		break;
+	}
+}
+
+/* Words in a unit of the buffer's memory width */
+static unsigned int buffer_unit_words(struct cs_device *d) {
+	if (d->v.etb.is_tmc_device && d->v.etb.tmc.memory_width > 2) {
+		return 1U << (d->v.etb.tmc.memory_width - 2);
+	}
+	return 1; /* 32-bit words */
+}
+
+static int _cs_get_trace_data(cs_device_t dev, void *buf, unsigned int size) {
 	struct cs_device *d = DEV(dev);
-	unsigned int *op;
-	int bytes_read = 0;
 	int unread;
-	unsigned int volatile *etb_read_reg;
-	unsigned int to_read, words_left_to_read;
+	unsigned int to_read, unit_words;
+	unsigned long long t0 = 0;
 
 	assert(cs_device_has_class(dev, CS_DEVCLASS_BUFFER));
 
-	/* The buffer into which the user wants to read trace, must be 8-byte aligned. */
+	/* The buffer into which the user wants to read trace, must be 4-byte aligned. */
 	assert(((unsigned long ) buf & 3) == 0);
 
 	_cs_unlock(d);
@@ -413,6 +661,9 @@ int cs_get_trace_data(cs_device_t dev, void *buf, unsigned int size) {
 		/* When the buffer has wrapped, the best we can do is start reading
 		 from the last unwritten byte... */
 		_cs_write(d, CS_ETB_RAM_RD_PTR, _cs_read(d, CS_ETB_RAM_WR_PTR));
+		if (d->v.etb.is_tmc_device && d->v.etb.tmc.config_type == CS_TMC_CONFIG_TYPE_ETR) {
+			_cs_write(d, CS_TMC_RRPHI, _cs_read(d, CS_TMC_RWPHI));
+		}
 		unread = cs_get_buffer_size_bytes(dev);
 	} else {
 		unread = cs_get_buffer_unread_bytes(dev);
@@ -422,10 +673,7 @@ int cs_get_trace_data(cs_device_t dev, void *buf, unsigned int size) {
 			_cs_write(d, CS_ETB_RAM_RD_PTR, 0);
 		}
 	}
-	d->v.etb.currently_reading = 1;
 
-	/* Read data into the user's buffer */
-	op = (unsigned int *) buf;
 	if (DTRACE(d)) {
 		diagf("!ctrl=%08X status=%08X flstatus=%08X readptr=%08X writeptr=%08X unread=%04X\n", _cs_read(d, CS_ETB_CTRL), _cs_read(d, CS_ETB_STATUS),
 				_cs_read(d, CS_ETB_FLFMT_STATUS), _cs_read(d,
@@ -437,67 +685,44 @@ int cs_get_trace_data(cs_device_t dev, void *buf, unsigned int size) {
 	 - no more than the amount of unread data currently in the ETB
 	 - no more than the buffer size provided by the user
 	 - rounded down to a multiple of the ETB memory width (see note about TMC below)
-	 - (perhaps) rounded down to a multiple of CoreSight formatted frames
+	 The rest is read by the next call, so trace can be read out in chunks
+	 through a small buffer.
 	 */
 	to_read = unread;
 	if (to_read > size) {
 		to_read = size;
 	}
 	/* Round down to ETB/TMC memory size */
-	if (d->v.etb.is_tmc_device) {
-		to_read &= ~((1U << d->v.etb.tmc.memory_width) - 1);
-	} else {
-		to_read &= ~3; /* round down to 32-bit words */
-	}
-
-	words_left_to_read = to_read >> 2;
-
-	/* For speed, we get the memory-mapped address of the RAM Read Data Register,
-	 and repeatedly read directly from that location. */
-	/* [TMC] 3.3.3: "When the memory width given in the DEVID register is greater than
-	 32 bits, multiple reads to this register must be performed together to read a
-	 full memory width of data. For example, if the memory width is 128 bits,
-	 then reads from this register must be performed four at a time.
-	 When a full memory width of data has been read, the RAM Read Pointer is
-	 incremented to the next memory word." */
-	etb_read_reg = _cs_get_register_address(d, CS_ETB_RAM_DATA);
-	int xx = 0; /* TBD and following lines */
-	if (0) {
-		fprintf(stderr, "TraceCaptEn=%u TMCReady=%u Empty=%u CBUFLEVEL=0x%x\n", _cs_isset(d, CS_ETB_CTRL, CS_ETB_CTRL_TraceCaptEn),
-				_cs_isset(d, CS_ETB_STATUS, CS_TMC_STATUS_TMCReady), _cs_isset(d, CS_ETB_STATUS, CS_TMC_STATUS_Empty), _cs_read(d, CS_TMC_CBUFLEVEL));
-	}
-	while (words_left_to_read > 0) {
-		unsigned int data = *etb_read_reg;
-		//printf("%u: read %08x, read ptr now %08x\n", xx/4, data, _cs_read(d, CS_ETB_RAM_RD_PTR));
-		__asm__ __volatile__("dsb sy");
-		/* TBD */
-		++xx; /* TBD */
-		if (data != 0xFFFFFFFF) {
-			*op++ = data;
-		} else {
-			/* "3.11.3... "A constant output of 1s corresponds to a synchronization
-			 output in the formatter protocol that is not applicable to the ETB,
-			 and so can be used to indicate a read error, when formatting is enabled."
-			 Our code at note #1 above fixes one case where we saw this; we now
-			 don't expect to ever see it.
-			 */
-			if (DTRACE(d)) {
-				diagf("  read all 1s (%08X): readptr=%08X\n", data, _cs_read(d, CS_ETB_RAM_RD_PTR));
-			}
-			*op++ = data;
-		}
-		/* Reading the RAM data register will have triggered a RAM access cycle
-		 so we don't need to write the RAM read pointer register again here. */
-		--words_left_to_read;
+	unit_words = buffer_unit_words(d);
+	to_read &= ~(unit_words * 4 - 1);
+	if (to_read == 0 && unread != 0) {
+		/* The caller's buffer is smaller than a memory width unit */
+		return 0;
+	}
+	d->v.etb.currently_reading = 1;
+
+	/* Reading the RAM data register triggers a RAM access cycle for the
+	 next word, so we don't need to write the RAM read pointer register
+	 again.  For speed, read through the access backend, bypassing the
+	 checks in _cs_read(). */
+	if (G.access->cycles_hz != 0) {
+		t0 = _cs_cycles();
+	}
+	buffer_read_units(d, (unsigned int *) buf, to_read / (unit_words * 4), unit_words);
+	if (G.access->cycles_hz != 0) {
+		d->v.etb.read_cycles += _cs_cycles() - t0;
 	}
-	bytes_read += to_read;
+	d->v.etb.read_bytes += to_read;
+	d->stats.bus_reads += to_read / 4;
+	G.stats.bus_reads += to_read / 4;
+
 	unread -= to_read;
 	if (unread == 0) {
 		d->v.etb.finished_reading = 1;
 		if (d->v.etb.is_tmc_device) {
 			/* The TMC spec says that once we've read all the data in the buffer,
 			 subsequent reads will read 0xFFFFFFFF. */
-			unsigned int checkff = *etb_read_reg;
+			unsigned int checkff = _cs_read(d, CS_ETB_RAM_DATA);
 			if (checkff != 0xFFFFFFFF) {
 				diagf("  TMC ETB read 0x%08X, expected 0xFFFFFFFF\n", checkff);
 			}
@@ -505,7 +730,497 @@ int cs_get_trace_data(cs_device_t dev, void *buf, unsigned int size) {
 			_cs_clear(d, CS_ETB_CTRL, CS_ETB_CTRL_TraceCaptEn);
 		}
 	}
-	return bytes_read;
+	return to_read;
+}
+
+static struct cs_api_stats api_get_trace_data = { "cs_get_trace_data" };
+
+int cs_get_trace_data(cs_device_t dev, void *buf, unsigned int size) {
+	struct cs_api_probe p;
+	_cs_api_enter(&p, &api_get_trace_data);
+	return _cs_api_exit(&p, _cs_get_trace_data(dev, buf, size));
+}
+
+unsigned int cs_get_trace_data_rate(cs_device_t dev) {
+	struct cs_device *d = DEV(dev);
+	assert(cs_device_has_class(dev, CS_DEVCLASS_BUFFER));
+	if (d->v.etb.read_cycles == 0) {
+		return 0;
+	}
+	return (unsigned int) ((unsigned long long) d->v.etb.read_bytes * G.access->cycles_hz / 1000 / d->v.etb.read_cycles);
+}
+
+static int _cs_etf_stream_start(cs_etf_stream_t *s, cs_device_t dev, void *ring, unsigned int ring_size, unsigned int watermark) {
+	struct cs_device *d = DEV(dev);
+	unsigned int const unit_bytes = buffer_unit_words(d) * 4;
+	assert(cs_device_has_class(dev, CS_DEVCLASS_SINK));
+
+	if (d->type != DEV_ETF) {
+		return cs_report_device_error(d, "trace streaming needs an ETF");
+	}
+	if (ring_size < unit_bytes || (ring_size & (ring_size - 1)) != 0 || ((unsigned long) ring & 3) != 0) {
+		return cs_report_device_error(d, "stream ring must be word aligned, and a power of two of at least %u bytes", unit_bytes);
+	}
+	if (watermark >= d->v.etb.buffer_size_bytes) {
+		return cs_report_device_error(d, "water mark %u is not less than the %u byte buffer", watermark, d->v.etb.buffer_size_bytes);
+	}
+	_cs_unlock(d);
+	if (_cs_isset(d, CS_ETB_CTRL, CS_ETB_CTRL_TraceCaptEn)) {
+		return cs_report_device_error(d, "buffer is already enabled");
+	}
+	if (_cs_wait(d, CS_ETB_STATUS, CS_TMC_STATUS_TMCReady) != 0) {
+		return -1;
+	}
+	memset(s, 0, sizeof *s);
+	s->etf = dev;
+	s->ring = (unsigned char *) ring;
+	s->ring_size = ring_size;
+	d->v.etb.currently_reading = 0;
+	d->v.etb.finished_reading = 0;
+	d->v.etb.read_bytes = 0;
+	d->v.etb.read_cycles = 0;
+
+	/* In software FIFO mode trace is held in the ETF until it is read
+	 out through the RAM Read Data register, while capture continues. */
+	_cs_write(d, CS_TMC_MODE, CS_TMC_MODE_SWFIFO);
+	/* In the FIFO modes the Full flag is set when the fill level
+	 reaches the water mark, which is in 32-bit words. */
+	_cs_write(d, CS_TMC_BUFWM, watermark >> 2);
+	_cs_write(d, CS_ETB_PSCR, 0x0);
+	/* Formatting is always enabled in FIFO mode.  Stop on a flush, so that
+	 the end of the trace can be drained before the ETF is disabled. */
+	_cs_write(d, CS_ETB_FLFMT_CTRL, CS_ETB_FLFMT_CTRL_EnFTC | CS_ETB_FLFMT_CTRL_EnTI | CS_ETB_FLFMT_CTRL_StopFl);
+	return _cs_write(d, CS_ETB_CTRL, CS_ETB_CTRL_TraceCaptEn);
+}
+
+static struct cs_api_stats api_etf_stream_start = { "cs_etf_stream_start" };
+
+int cs_etf_stream_start(cs_etf_stream_t *s, cs_device_t dev, void *ring, unsigned int ring_size, unsigned int watermark) {
+	struct cs_api_probe p;
+	_cs_api_enter(&p, &api_etf_stream_start);
+	return _cs_api_exit(&p, _cs_etf_stream_start(s, dev, ring, ring_size, watermark));
+}
+
+/*
+ Move everything in the ETF into the stream ring.  When the ring is full
+ the ETF is still drained, so that capture is not held up, and the newest
+ trace is dropped.
+
+ This may run in an interrupt handler, so it goes straight to the
+ registers through the backend: it must not touch the batch, the shadow
+ or the counters that the interrupted code may be in the middle of.  The
+ stream counts what is drained, and the device's counters are brought up
+ to date when the stream stops.
+ */
+static unsigned int etf_stream_drain(cs_etf_stream_t *s, struct cs_device *d) {
+	unsigned int (*const read32)(void volatile const *, unsigned int) = G.access->read32;
+	unsigned int const unit_words = buffer_unit_words(d);
+	unsigned int const unit_bytes = unit_words * 4;
+	unsigned int scratch[8];
+	unsigned int level, latched, total, room, off, n;
+
+	/* The latched level is the highest since it was last read: if it
+	 reached the buffer size, the ETF has held back trace and the
+	 sources may have overflowed. */
+	latched = read32(d->local_addr, CS_TMC_LBUFLEVEL) << 2;
+	if (latched > s->max_level) {
+		s->max_level = latched;
+	}
+	if (latched >= d->v.etb.buffer_size_bytes) {
+		++s->overflows;
+	}
+	level = (read32(d->local_addr, CS_TMC_CBUFLEVEL) << 2) & ~(unit_bytes - 1);
+	total = level;
+	while (level > 0) {
+		room = s->ring_size - (s->head - s->tail);
+		off = s->head & (s->ring_size - 1);
+		n = level;
+		if (n > room) {
+			n = room;
+		}
+		if (n > s->ring_size - off) {
+			n = s->ring_size - off;
+		}
+		n &= ~(unit_bytes - 1);
+		if (n == 0) {
+			n = (level < sizeof scratch) ? level : sizeof scratch;
+			buffer_read_units(d, scratch, n / unit_bytes, unit_words);
+			s->dropped_bytes += n;
+		} else {
+			buffer_read_units(d, (unsigned int *) (s->ring + off), n / unit_bytes, unit_words);
+			/* The trace must be in the ring before the consumer sees it */
+			G.access->barrier();
+			s->head += n;
+		}
+		level -= n;
+	}
+	s->drained_bytes += total;
+	return total;
+}
+
+int cs_etf_stream_poll(cs_etf_stream_t *s) {
+	struct cs_device *d = DEV(s->etf);
+
+	/* One register read when the ETF is below the water mark */
+	if (!(G.access->read32(d->local_addr, CS_ETB_STATUS) & CS_ETB_STATUS_Full)) {
+		return 0;
+	}
+	return (int) etf_stream_drain(s, d);
+}
+
+/*
+ The ring is a single-producer, single-consumer queue: only the drain
+ (which may run in an interrupt handler) moves the head, and only the
+ consumer moves the tail.
+ */
+unsigned int cs_etf_stream_peek(cs_etf_stream_t *s, void const **data) {
+	unsigned int const off = s->tail & (s->ring_size - 1);
+	unsigned int size = s->head - s->tail;
+
+	if (size > s->ring_size - off) {
+		size = s->ring_size - off;
+	}
+	*data = s->ring + off;
+	return size;
+}
+
+void cs_etf_stream_consume(cs_etf_stream_t *s, unsigned int size) {
+	/* Finish with the trace before the drain can overwrite it */
+	G.access->barrier();
+	s->tail += size;
+}
+
+unsigned int cs_etf_stream_read(cs_etf_stream_t *s, void *buf, unsigned int size) {
+	void const *data;
+	unsigned int n, done = 0;
+
+	while (done < size && (n = cs_etf_stream_peek(s, &data)) > 0) {
+		if (n > size - done) {
+			n = size - done;
+		}
+		memcpy((unsigned char *) buf + done, data, n);
+		cs_etf_stream_consume(s, n);
+		done += n;
+	}
+	return done;
+}
+
+static int _cs_etf_stream_stop(cs_etf_stream_t *s) {
+	struct cs_device *d = DEV(s->etf);
+	int rc = 0;
+
+	_cs_unlock(d);
+	_cs_set(d, CS_ETB_FLFMT_CTRL, CS_ETB_FLFMT_CTRL_StopFl | CS_ETB_FLFMT_CTRL_FOnMan);
+	/* The flush can't complete while the ETF is full, so keep draining
+	 while trace arrives.  Once there is nothing to drain, the flush only
+	 needs time, so wait for it with a bound, in case the path is stalled.
+	 Then drain what is left. */
+	while (!_cs_isset(d, CS_ETB_STATUS, CS_TMC_STATUS_TMCReady)) {
+		if (etf_stream_drain(s, d) == 0) {
+			rc = _cs_wait(d, CS_ETB_STATUS, CS_TMC_STATUS_TMCReady);
+			break;
+		}
+	}
+	etf_stream_drain(s, d);
+	d->v.etb.finished_reading = 1;
+	d->v.etb.read_bytes += (unsigned int) s->drained_bytes;
+	d->stats.bus_reads += (unsigned int) (s->drained_bytes / 4);
+	G.stats.bus_reads += (unsigned int) (s->drained_bytes / 4);
+	if (DTRACE(d)) {
+		diagf("!ETF stream: %llu bytes, %llu dropped, %u overflows, max level %u\n", s->drained_bytes, s->dropped_bytes, s->overflows, s->max_level);
+	}
+	if (_cs_clear(d, CS_ETB_CTRL, CS_ETB_CTRL_TraceCaptEn) != 0) {
+		rc = -1;
+	}
+	return rc;
+}
+
+static struct cs_api_stats api_etf_stream_stop = { "cs_etf_stream_stop" };
+
+int cs_etf_stream_stop(cs_etf_stream_t *s) {
+	struct cs_api_probe p;
+	_cs_api_enter(&p, &api_etf_stream_stop);
+	return _cs_api_exit(&p, _cs_etf_stream_stop(s));
+}
+
+/*
+ Write pointer of a buffer as a byte offset into the buffer.
+ */
+static unsigned int buffer_write_offset(struct cs_device *d) {
+	if (d->v.etb.is_tmc_device && d->v.etb.tmc.config_type == CS_TMC_CONFIG_TYPE_ETR) {
+		return etr_buffer_offset(d, CS_ETB_RAM_WR_PTR, CS_TMC_RWPHI);
+	}
+	return _cs_read(d, CS_ETB_RAM_WR_PTR) << d->v.etb.pointer_scale_shift;
+}
+
+static unsigned long long buffer_monitor_time(cs_buffer_monitor_t const *m) {
+	unsigned long long t;
+
+	if (m->use_tsgen && cs_get_global_timestamp(&t) == 0) {
+		return t;
+	}
+	return (G.access->cycles_hz != 0) ? _cs_cycles() : 0;
+}
+
+int cs_buffer_monitor_start(cs_buffer_monitor_t *m, cs_device_t dev) {
+	struct cs_device *d = DEV(dev);
+	struct cs_device *ts = G.timestamp_device;
+	uint32_t freq;
+	assert(cs_device_has_class(dev, CS_DEVCLASS_BUFFER));
+
+	memset(m, 0, sizeof *m);
+	m->dev = dev;
+	/* The timestamp generator is only usable if it is counting, and
+	 its frequency is known, which needs the control interface. */
+	if (ts != NULL && cs_tsgen_get_freq_id(DEVDESC(ts), &freq) == 0 && freq != 0 && _cs_isset(ts, CS_CNTCR, CS_CNTCR_ENA)) {
+		m->use_tsgen = 1;
+		m->hz = freq;
+	} else {
+		m->hz = G.access->cycles_hz;
+	}
+	m->start_time = buffer_monitor_time(m);
+	m->last_offset = buffer_write_offset(d);
+	return 0;
+}
+
+int cs_buffer_monitor_sample(cs_buffer_monitor_t *m) {
+	struct cs_device *d = DEV(m->dev);
+	unsigned int const size = d->v.etb.buffer_size_bytes;
+	cs_buffer_sample_t *smp = &m->samples[m->n_samples % CS_BUFFER_MONITOR_SAMPLES];
+	unsigned long long prev_time, prev_written;
+	unsigned int status, off;
+
+	if (m->n_samples > 0) {
+		cs_buffer_sample_t const *prev = &m->samples[(m->n_samples - 1) % CS_BUFFER_MONITOR_SAMPLES];
+		prev_time = prev->time;
+		prev_written = prev->written;
+	} else {
+		prev_time = m->start_time;
+		prev_written = 0;
+	}
+	status = _cs_read(d, CS_ETB_STATUS);
+	off = buffer_write_offset(d);
+	smp->time = buffer_monitor_time(m);
+	smp->full = (status & CS_ETB_STATUS_Full) != 0;
+	if (d->v.etb.is_tmc_device) {
+		/* The fill levels are in 32-bit words */
+		smp->level = _cs_read(d, CS_TMC_CBUFLEVEL) << 2;
+		smp->max_level = _cs_read(d, CS_TMC_LBUFLEVEL) << 2;
+	} else {
+		smp->level = smp->full ? size : off;
+		smp->max_level = smp->level;
+	}
+	if (size != 0 && off < size) {
+		m->written += (off + size - m->last_offset) % size;
+		m->last_offset = off;
+	}
+	smp->written = m->written;
+	if (m->hz != 0 && smp->time > prev_time) {
+		smp->rate = (unsigned int) ((smp->written - prev_written) * m->hz / (smp->time - prev_time));
+	} else {
+		smp->rate = 0;
+	}
+	if (smp->rate > m->peak_rate) {
+		m->peak_rate = smp->rate;
+	}
+	++m->n_samples;
+	return 0;
+}
+
+cs_buffer_sample_t const *cs_buffer_monitor_get(cs_buffer_monitor_t const *m, unsigned int i) {
+	unsigned int const held = (m->n_samples < CS_BUFFER_MONITOR_SAMPLES) ? m->n_samples : CS_BUFFER_MONITOR_SAMPLES;
+
+	if (i >= held) {
+		return NULL;
+	}
+	return &m->samples[(m->n_samples - held + i) % CS_BUFFER_MONITOR_SAMPLES];
+}
+
+/* Bus address of a data page of an ETR scatter-gather buffer */
+static unsigned long long etr_sg_page(struct cs_device *d, unsigned int i) {
+	unsigned int const e = d->v.etb.sg_table[(i / SG_DATA_PER_TABLE_PAGE) * SG_ENTRIES_PER_TABLE_PAGE + i % SG_DATA_PER_TABLE_PAGE];
+	return CS_TMC_SG_ENTRY_ADDR(e);
+}
+
+/* Read a 64-bit ETR pointer, as an offset into the trace buffer */
+static unsigned int etr_buffer_offset(struct cs_device *d, unsigned int off_lo, unsigned int off_hi) {
+	unsigned long long const ptr = ((unsigned long long) _cs_read(d, off_hi) << 32) | _cs_read(d, off_lo);
+	unsigned long long page;
+	unsigned int i, n, *hint;
+
+	if (d->v.etb.sg_table != NULL) {
+		/* Scatter-gather pointers are bus addresses within a data page.
+		 The pointers only move forward, wrapping round, so search from
+		 the page each was last found in, which is nearly always it or
+		 the next one. */
+		hint = &d->v.etb.sg_hint[off_lo == CS_ETB_RAM_WR_PTR];
+		i = (*hint < d->v.etb.sg_n_pages) ? *hint : 0;
+		for (n = 0; n < d->v.etb.sg_n_pages; ++n) {
+			page = etr_sg_page(d, i);
+			if (ptr >= page && ptr < page + CS_TMC_SG_PAGE_SIZE) {
+				*hint = i;
+				return i * CS_TMC_SG_PAGE_SIZE + (unsigned int) (ptr - page);
+			}
+			if (++i == d->v.etb.sg_n_pages) {
+				i = 0;
+			}
+		}
+		return d->v.etb.buffer_size_bytes;
+	}
+	return (unsigned int) (ptr - (((unsigned long long) _cs_read(d, CS_TMC_DBAHI) << 32) | _cs_read(d, CS_TMC_DBALO)));
+}
+
+/* Map a page of a scatter-gather buffer, or all of a contiguous buffer */
+static unsigned char const *etr_segment(struct cs_device *d, unsigned int seg) {
+	cs_physaddr_t addr;
+
+	if (d->v.etb.etr_maps[seg] == NULL) {
+		if (d->v.etb.sg_table != NULL) {
+			addr = (cs_physaddr_t) etr_sg_page(d, seg);
+		} else {
+			addr = (cs_physaddr_t) (((unsigned long long) _cs_read(d, CS_TMC_DBAHI) << 32) | _cs_read(d, CS_TMC_DBALO));
+		}
+		d->v.etb.etr_maps[seg] = G.access->map(addr, d->v.etb.etr_map_size, 0);
+	}
+	return (unsigned char const *) d->v.etb.etr_maps[seg];
+}
+
+/* Add a span, merging it with the previous one if they are adjacent */
+static int etr_span_add(cs_trace_span_t *spans, unsigned int max_spans, int n, unsigned char const *data, unsigned int size) {
+	if (n > 0 && (unsigned char const *) spans[n - 1].data + spans[n - 1].size == data) {
+		spans[n - 1].size += size;
+		return n;
+	}
+	if ((unsigned int) n == max_spans) {
+		return -1;
+	}
+	spans[n].data = data;
+	spans[n].size = size;
+	return n + 1;
+}
+
+int cs_etr_get_trace_spans(cs_device_t dev, cs_trace_span_t *spans, unsigned int max_spans) {
+	struct cs_device *d = DEV(dev);
+	unsigned int size, seg_size, n_segs, start, len, off, chunk;
+	unsigned char const *local;
+	int n = 0;
+
+	assert(cs_device_has_class(dev, CS_DEVCLASS_BUFFER));
+	if (!d->v.etb.is_tmc_device || d->v.etb.tmc.config_type != CS_TMC_CONFIG_TYPE_ETR) {
+		return cs_report_device_error(d, "not an ETR");
+	}
+	if (spans == NULL) {
+		/* A wrapped contiguous buffer needs two spans; at worst, a
+		 scatter-gather buffer needs one per page, and one more if wrapped. */
+		return (d->v.etb.sg_table != NULL) ? d->v.etb.sg_n_pages + 1 : 2;
+	}
+	_cs_unlock(d);
+	if (!_cs_isset(d, CS_ETB_STATUS, CS_TMC_STATUS_TMCReady)) {
+		return cs_report_device_error(d, "ETR is still capturing");
+	}
+	if (d->v.etb.finished_reading) {
+		return 0;
+	}
+	size = _cs_read(d, CS_ETB_RAM_DEPTH) << 2;
+	start = etr_buffer_offset(d, CS_ETB_RAM_RD_PTR, CS_TMC_RRPHI);
+	off = etr_buffer_offset(d, CS_ETB_RAM_WR_PTR, CS_TMC_RWPHI);
+	if (size == 0 || start >= size || off >= size) {
+		return cs_report_device_error(d, "ETR pointers outside the trace buffer");
+	}
+	if (!d->v.etb.currently_reading && cs_buffer_has_wrapped(dev)) {
+		/* The oldest trace is just past the write pointer */
+		start = off;
+		len = size;
+	} else {
+		len = (off + size - start) % size;
+	}
+	if (len == 0) {
+		return 0;
+	}
+
+	seg_size = (d->v.etb.sg_table != NULL) ? CS_TMC_SG_PAGE_SIZE : size;
+	n_segs = size / seg_size;
+	if (d->v.etb.etr_maps == NULL) {
+		d->v.etb.etr_maps = (void **) calloc(n_segs, sizeof(void *));
+		if (d->v.etb.etr_maps == NULL) {
+			return cs_report_device_error(d, "can't allocate ETR buffer mappings");
+		}
+		d->v.etb.etr_n_maps = n_segs;
+		d->v.etb.etr_map_size = seg_size;
+	}
+
+	/* Walk the buffer from the oldest trace, a page at a time for a
+	 scatter-gather buffer, wrapping at the end of the buffer */
+	for (off = start; len > 0; off = (off + chunk) % size) {
+		chunk = seg_size - off % seg_size;
+		if (chunk > len) {
+			chunk = len;
+		}
+		local = etr_segment(d, off / seg_size);
+		if (local == NULL) {
+			return cs_report_device_error(d, "can't map ETR buffer");
+		}
+		local += off % seg_size;
+		G.access->invalidate(local, chunk);
+		n = etr_span_add(spans, max_spans, n, local, chunk);
+		if (n < 0) {
+			return cs_report_device_error(d, "more than %u ETR trace spans", max_spans);
+		}
+		len -= chunk;
+	}
+	d->v.etb.currently_reading = 1;
+	if (DTRACE(d)) {
+		diagf("!ETR trace spans: %d\n", n);
+	}
+	return n;
+}
+
+int cs_etr_release_trace_spans(cs_device_t dev) {
+	struct cs_device *d = DEV(dev);
+	unsigned int i;
+
+	assert(cs_device_has_class(dev, CS_DEVCLASS_BUFFER));
+	if (d->v.etb.etr_maps == NULL) {
+		return 0;
+	}
+	for (i = 0; i < d->v.etb.etr_n_maps; ++i) {
+		if (d->v.etb.etr_maps[i] != NULL) {
+			G.access->unmap(d->v.etb.etr_maps[i], d->v.etb.etr_map_size);
+		}
+	}
+	free(d->v.etb.etr_maps);
+	d->v.etb.etr_maps = NULL;
+	_cs_unlock(d);
+	/* The read pointer is not moved, so mark the whole buffer as read */
+	d->v.etb.finished_reading = 1;
+	/* Now we can move from Stopped to Disabled. */
+	return _cs_clear(d, CS_ETB_CTRL, CS_ETB_CTRL_TraceCaptEn);
+}
+
+unsigned int cs_etr_sg_table_size(unsigned int n_pages) {
+	return (n_pages + SG_DATA_PER_TABLE_PAGE - 1) / SG_DATA_PER_TABLE_PAGE * CS_TMC_SG_PAGE_SIZE;
+}
+
+int cs_etr_sg_table_build(void *table, cs_physaddr_t table_addr, cs_physaddr_t const *pages, unsigned int n_pages) {
+	unsigned int *e = (unsigned int *) table;
+	unsigned int i;
+
+	if (n_pages == 0 || (table_addr & (CS_TMC_SG_PAGE_SIZE - 1)) != 0) {
+		return cs_report_error("scatter-gather table must be 4K aligned, with at least one page");
+	}
+	for (i = 0; i < n_pages; ++i) {
+		if ((pages[i] & (CS_TMC_SG_PAGE_SIZE - 1)) != 0) {
+			return cs_report_error("scatter-gather page %" CS_PHYSFMT " is not 4K aligned", pages[i]);
+		}
+		if (i > 0 && i % SG_DATA_PER_TABLE_PAGE == 0) {
+			/* The last entry of a full table page links to the next one */
+			*e++ = CS_TMC_SG_ENTRY((unsigned long long) table_addr + (i / SG_DATA_PER_TABLE_PAGE) * CS_TMC_SG_PAGE_SIZE, CS_TMC_SG_ENTRY_LINK);
+		}
+		*e++ = CS_TMC_SG_ENTRY((unsigned long long) pages[i], (i == n_pages - 1) ? CS_TMC_SG_ENTRY_LAST : CS_TMC_SG_ENTRY_NORMAL);
+	}
+	/* The ETR reads the table from memory */
+	G.access->clean(table, (unsigned int) ((unsigned char *) e - (unsigned char *) table));
+	return 0;
 }
 
 /*
@@ -514,7 +1229,7 @@ int cs_get_trace_data(cs_device_t dev, void *buf, unsigned int size) {
  This could be done before the first capture, or after retrieving
  data from the buffer.
  */
-int cs_empty_trace_buffer(cs_device_t dev) {
+static int _cs_empty_trace_buffer(cs_device_t dev) {
 	int rc;
 	struct cs_device *d = DEV(dev);
 	assert(cs_device_has_class(dev, CS_DEVCLASS_BUFFER));
@@ -577,22 +1292,107 @@ int cs_empty_trace_buffer(cs_device_t dev) {
 	return rc;
 }
 
+static struct cs_api_stats api_empty_trace_buffer = { "cs_empty_trace_buffer" };
+
+int cs_empty_trace_buffer(cs_device_t dev) {
+	struct cs_api_probe p;
+	_cs_api_enter(&p, &api_empty_trace_buffer);
+	return _cs_api_exit(&p, _cs_empty_trace_buffer(dev));
+}
+
+/*
+ Write whole words to the RAM Write Data register, the counterpart of
+ buffer_read_units().  Each write only stores a word and advances the
+ write pointer, so the writes are issued back to back without a barrier
+ or diagnostics between them, and one barrier at the end.  With ip NULL,
+ every word is fill.
+ */
+static void buffer_write_words(struct cs_device *d, unsigned int const *ip, unsigned int n_words, unsigned int fill) {
+	void (*const write32)(void volatile *, unsigned int, unsigned int) = G.access->write32;
+	void volatile *local = d->local_addr;
+	unsigned int const total = n_words;
+
+	_cs_batch_flush();
+	if (ip == NULL) {
+		for (; n_words >= 4; n_words -= 4) {
+			write32(local, CS_ETB_RAM_WRITE_DATA, fill);
+			write32(local, CS_ETB_RAM_WRITE_DATA, fill);
+			write32(local, CS_ETB_RAM_WRITE_DATA, fill);
+			write32(local, CS_ETB_RAM_WRITE_DATA, fill);
+		}
+		while (n_words-- > 0) {
+			write32(local, CS_ETB_RAM_WRITE_DATA, fill);
+		}
+	} else {
+		for (; n_words >= 4; n_words -= 4) {
+			write32(local, CS_ETB_RAM_WRITE_DATA, ip[0]);
+			write32(local, CS_ETB_RAM_WRITE_DATA, ip[1]);
+			write32(local, CS_ETB_RAM_WRITE_DATA, ip[2]);
+			write32(local, CS_ETB_RAM_WRITE_DATA, ip[3]);
+			ip += 4;
+		}
+		while (n_words-- > 0) {
+			write32(local, CS_ETB_RAM_WRITE_DATA, *ip++);
+		}
+	}
+	d->stats.bus_writes += total;
+	G.stats.bus_writes += total;
+	_cs_barrier();
+}
+
+/*
+ Fill an ETR's buffer in system memory directly, rather than sending each
+ word through the RAM Write Data register and across the ETR's AXI port.
+ */
+static int etr_buffer_fill(struct cs_device *d, unsigned int data) {
+	unsigned int const sg = (d->v.etb.sg_table != NULL);
+	unsigned int const n_segs = sg ? d->v.etb.sg_n_pages : 1;
+	unsigned int const seg_size = sg ? CS_TMC_SG_PAGE_SIZE : d->v.etb.buffer_size_bytes;
+	unsigned int seg, i;
+	cs_physaddr_t addr;
+	unsigned int *p;
+
+	for (seg = 0; seg < n_segs; ++seg) {
+		if (sg) {
+			addr = (cs_physaddr_t) etr_sg_page(d, seg);
+		} else {
+			addr = (cs_physaddr_t) (((unsigned long long) _cs_read(d, CS_TMC_DBAHI) << 32) | _cs_read(d, CS_TMC_DBALO));
+		}
+		p = (unsigned int *) G.access->map(addr, seg_size, 1);
+		if (p == NULL) {
+			return cs_report_device_error(d, "can't map the trace buffer at %" CS_PHYSFMT, addr);
+		}
+		for (i = 0; i < seg_size / 4; ++i) {
+			p[i] = data;
+		}
+		/* Write the fill back to memory, where the ETR will read it */
+		G.access->clean(p, seg_size);
+		G.access->unmap(p, seg_size);
+	}
+	return 0;
+}
+
 int cs_clear_trace_buffer(cs_device_t dev, unsigned int data) {
 	int rc;
-	unsigned int i;
 	struct cs_device *d = DEV(dev);
-	unsigned int size_words;
 
 	assert(cs_device_has_class(dev, CS_DEVCLASS_BUFFER));
 	_cs_unlock(d);
+	if (d->v.etb.is_tmc_device && d->v.etb.tmc.config_type == CS_TMC_CONFIG_TYPE_ETR) {
+		rc = etr_buffer_fill(d, data);
+		if (rc != 0) {
+			return rc;
+		}
+		rc = cs_empty_trace_buffer(dev);
+		/* Leave the pointers at the start of the buffer in memory */
+		_cs_etr_rewind(d);
+		return rc;
+	}
 	rc = _cs_write(d, CS_ETB_RAM_WR_PTR, 0);
 	if (rc != 0) {
 		return rc;
 	}
-	size_words = d->v.etb.buffer_size_bytes >> 2;
-	for (i = 0; i < size_words; ++i) {
-		_cs_write(d, CS_ETB_RAM_WRITE_DATA, data);
-	}
+	buffer_write_words(d, NULL, d->v.etb.buffer_size_bytes >> 2, data);
 	/* The write-pointer should have wrapped */
 	assert(_cs_read(d, CS_ETB_RAM_WR_PTR) == 0);
 	/* Now reset the counters so that the buffer appears as empty. */
@@ -602,7 +1402,6 @@ int cs_clear_trace_buffer(cs_device_t dev, unsigned int data) {
 /* This is a back door into ETB - not normally expected to be used */
 int cs_insert_trace_data(cs_device_t dev, void const *buf, unsigned int size) {
 	struct cs_device *d = DEV(dev);
-	unsigned int const *ip = (unsigned int const *) buf;
 	unsigned int optr, nptr;
 
 	assert(cs_device_has_class(dev, CS_DEVCLASS_BUFFER));
@@ -615,16 +1414,12 @@ int cs_insert_trace_data(cs_device_t dev, void const *buf, unsigned int size) {
 				_cs_read(d, CS_ETB_FLFMT_STATUS), _cs_read(d, CS_ETB_RAM_WR_PTR));
 	}
 	optr = _cs_read(d, CS_ETB_RAM_WR_PTR);
-	while (size > 0) {
-		unsigned int data = *ip++;
-		_cs_write(d, CS_ETB_RAM_WRITE_DATA, data);
-		size -= 4;
-		/* As a diagnostic check, check that the write-pointer has incremented */
-		if (0) {
-			nptr = _cs_read(d, CS_ETB_RAM_WR_PTR);
-			if (optr == nptr) {
-				return cs_report_device_error(d, "failed to increment write-pointer");
-			}
+	buffer_write_words(d, (unsigned int const *) buf, size >> 2, 0);
+	/* As a diagnostic check, check once that the write-pointer has moved */
+	if (DCHECK(d) && size > 0 && size % d->v.etb.buffer_size_bytes != 0) {
+		nptr = _cs_read(d, CS_ETB_RAM_WR_PTR);
+		if (optr == nptr) {
+			return cs_report_device_error(d, "failed to increment write-pointer");
 		}
 	}
 	return 0;
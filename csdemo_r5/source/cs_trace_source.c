@@ -67,9 +67,179 @@ int _cs_path_enable(struct cs_device *d, int enabled)
     return rc;
 }
 
+/*
+  Trace path routing.  A path is found by a depth-first search of the
+  ATB graph from the source; the funnels and replicators on all paths
+  are then collected into a plan, so that each is programmed once.
+*/
+#define PATH_MAX_HOPS  16	/* Longest source to sink path */
+#define PATH_MAX_LINKS 16	/* Funnels and replicators on all paths */
+
+struct path_link {
+    struct cs_device *d;
+    unsigned int in_mask;	/* Funnel inputs used */
+    unsigned int out_mask;	/* Replicator outputs used */
+    unsigned int keep[2];	/* Replicator ID groups passed on each output */
+};
+
+struct path_plan {
+    unsigned int n_links;
+    struct path_link links[PATH_MAX_LINKS];
+};
+
+static int path_find(struct cs_device *d, struct cs_device *sink,
+                     struct cs_device **hops, unsigned char *ports,
+                     unsigned int depth)
+{
+    unsigned int n;
+    int len;
+
+    if (d == sink) {
+        return depth;
+    }
+    if (depth == PATH_MAX_HOPS) {
+        return -1;
+    }
+    for (n = 0; n < d->n_out_ports; ++n) {
+        if (d->outs[n] != NULL) {
+            hops[depth] = d;
+            ports[depth] = n;
+            len = path_find(d->outs[n], sink, hops, ports, depth + 1);
+            if (len >= 0) {
+                return len;
+            }
+        }
+    }
+    return -1;
+}
+
+static struct path_link *path_link_get(struct path_plan *plan,
+                                       struct cs_device *d)
+{
+    unsigned int i;
+
+    for (i = 0; i < plan->n_links; ++i) {
+        if (plan->links[i].d == d) {
+            return &plan->links[i];
+        }
+    }
+    if (plan->n_links == PATH_MAX_LINKS) {
+        return NULL;
+    }
+    memset(&plan->links[i], 0, sizeof(struct path_link));
+    plan->links[i].d = d;
+    ++plan->n_links;
+    return &plan->links[i];
+}
+
+/*
+  Get the devices on the path from a source to a sink, not including the
+  source and sink themselves.  Returns the number of devices, or < 0 if
+  there is no path.
+*/
+int _cs_path_links(struct cs_device *src, struct cs_device *sink,
+                   struct cs_device **links, unsigned int max_links)
+{
+    struct cs_device *hops[PATH_MAX_HOPS];
+    unsigned char ports[PATH_MAX_HOPS];
+    int i, len;
+
+    len = path_find(src, sink, hops, ports, 0);
+    if (len <= 0) {
+        return -1;
+    }
+    for (i = 1; i < len && (unsigned int) (i - 1) < max_links; ++i) {
+        links[i - 1] = hops[i];
+    }
+    return i - 1;
+}
+
+/* Add the path from a source to the sink to the plan */
+static int path_plan_add(struct path_plan *plan, struct cs_device *src,
+                         struct cs_device *sink)
+{
+    struct cs_device *hops[PATH_MAX_HOPS];
+    unsigned char ports[PATH_MAX_HOPS];
+    struct path_link *link;
+    unsigned int keep;
+    cs_atid_t id;
+    int i, len;
+
+    len = path_find(src, sink, hops, ports, 0);
+    if (len <= 0) {
+        return cs_report_device_error(src, "no trace path to %" CS_PHYSFMT,
+                                      sink->phys_addr);
+    }
+    /* Without a valid trace id, replicators can't filter this source */
+    id = cs_get_trace_source_id(src);
+    keep = cs_atid_is_valid(id) ? (1U << (id >> 4)) : 0xFF;
+    for (i = 0; i < len; ++i) {
+        struct cs_device *od = hops[i]->outs[ports[i]];
+        if (cs_device_is_replicator(hops[i])) {
+            link = path_link_get(plan, hops[i]);
+            if (link == NULL) {
+                break;
+            }
+            link->out_mask |= (1U << ports[i]);
+            if (ports[i] <= 1) {
+                link->keep[ports[i]] |= keep;
+            }
+        }
+        if (cs_device_is_funnel(od)) {
+            link = path_link_get(plan, od);
+            if (link == NULL) {
+                break;
+            }
+            link->in_mask |= (1U << hops[i]->to_in_port[ports[i]]);
+        }
+    }
+    if (i < len) {
+        return cs_report_device_error(src, "too many links on trace paths");
+    }
+    return 0;
+}
+
+/* Program the funnels and replicators on the planned paths */
+static int path_plan_apply(struct path_plan const *plan)
+{
+    unsigned int i, port, filter;
+    int rc = 0;
+
+    for (i = 0; i < plan->n_links && rc == 0; ++i) {
+        struct path_link const *link = &plan->links[i];
+        struct cs_device *d = link->d;
+        if (cs_device_is_non_mmio(d)) {
+            continue;
+        }
+        _cs_unlock(d);
+        if (cs_device_is_funnel(d)) {
+            if (DTRACE(d)) {
+                diagf("!funnel %" CS_PHYSFMT " inputs %02X\n", d->phys_addr,
+                      link->in_mask);
+            }
+            rc = _cs_set_mask(d, CS_FUNNEL_CTRL,
+                              (1U << CS_FUNNEL_MAX_PORTS) - 1,
+                              link->in_mask);
+        } else {
+            for (port = 0; port <= 1 && rc == 0; ++port) {
+                /* A 1 bit discards a group of 16 ids */
+                filter = (link->out_mask & (1U << port)) ?
+                    (~link->keep[port] & 0xFF) : 0xFF;
+                if (DTRACE(d)) {
+                    diagf("!replicator %" CS_PHYSFMT " port %u filter %02X\n",
+                          d->phys_addr, port, filter);
+                }
+                rc = _cs_set_mask(d, CS_REPLICATOR_IDFILTER(port), 0xFF,
+                                  filter);
+            }
+        }
+    }
+    return rc;
+}
+
 /* ========== API functions ================ */
 
-int cs_set_trace_source_id(cs_device_t dev, cs_atid_t id)
+static int _cs_set_trace_source_id(cs_device_t dev, cs_atid_t id)
 {
     int rc;
     struct cs_device *d = DEV(dev);
@@ -101,6 +271,17 @@ int cs_set_trace_source_id(cs_device_t dev, cs_atid_t id)
     return 0;
 }
 
+static struct cs_api_stats api_set_trace_source_id = {
+    "cs_set_trace_source_id"
+};
+
+int cs_set_trace_source_id(cs_device_t dev, cs_atid_t id)
+{
+    struct cs_api_probe p;
+    _cs_api_enter(&p, &api_set_trace_source_id);
+    return _cs_api_exit(&p, _cs_set_trace_source_id(dev, id));
+}
+
 cs_atid_t cs_get_trace_source_id(cs_device_t dev)
 {
     cs_atid_t id = (cs_atid_t) (-1);
@@ -127,7 +308,7 @@ cs_atid_t cs_get_trace_source_id(cs_device_t dev)
 //#define AUTO_PATH
 //#endif
 
-int cs_trace_enable(cs_device_t dev)
+static int _cs_trace_enable(cs_device_t dev)
 {
     int rc;
     struct cs_device *d = DEV(dev);
@@ -156,6 +337,15 @@ int cs_trace_enable(cs_device_t dev)
     return 0;
 }
 
+static struct cs_api_stats api_trace_enable = { "cs_trace_enable" };
+
+int cs_trace_enable(cs_device_t dev)
+{
+    struct cs_api_probe p;
+    _cs_api_enter(&p, &api_trace_enable);
+    return _cs_api_exit(&p, _cs_trace_enable(dev));
+}
+
 int cs_trace_is_enabled(cs_device_t dev)
 {
     int is_enabled = 0;
@@ -172,7 +362,7 @@ int cs_trace_is_enabled(cs_device_t dev)
     return is_enabled;
 }
 
-int cs_trace_disable(cs_device_t dev)
+static int _cs_trace_disable(cs_device_t dev)
 {
     struct cs_device *d = DEV(dev);
 
@@ -211,8 +401,17 @@ int cs_trace_disable(cs_device_t dev)
     return _cs_path_enable(d, /*enabled= */ 0);
 }
 
+static struct cs_api_stats api_trace_disable = { "cs_trace_disable" };
 
-int cs_trace_enable_timestamps(cs_device_t dev, int enabled)
+int cs_trace_disable(cs_device_t dev)
+{
+    struct cs_api_probe p;
+    _cs_api_enter(&p, &api_trace_disable);
+    return _cs_api_exit(&p, _cs_trace_disable(dev));
+}
+
+
+static int _cs_trace_enable_timestamps(cs_device_t dev, int enabled)
 {
     struct cs_device *d = DEV(dev);
     if (d->type == DEV_ITM) {
@@ -243,8 +442,19 @@ int cs_trace_enable_timestamps(cs_device_t dev, int enabled)
     }
 }
 
+static struct cs_api_stats api_trace_enable_timestamps = {
+    "cs_trace_enable_timestamps"
+};
+
+int cs_trace_enable_timestamps(cs_device_t dev, int enabled)
+{
+    struct cs_api_probe p;
+    _cs_api_enter(&p, &api_trace_enable_timestamps);
+    return _cs_api_exit(&p, _cs_trace_enable_timestamps(dev, enabled));
+}
+
 /** Enable or disable cycle accurate tracing on a trace source */
-int cs_trace_enable_cycle_accurate(cs_device_t dev, int enable)
+static int _cs_trace_enable_cycle_accurate(cs_device_t dev, int enable)
 {
     struct cs_device *d = DEV(dev);
     if (d->type == DEV_ETM) {
@@ -269,6 +479,17 @@ int cs_trace_enable_cycle_accurate(cs_device_t dev, int enable)
     }
 }
 
+static struct cs_api_stats api_trace_enable_cycle_accurate = {
+    "cs_trace_enable_cycle_accurate"
+};
+
+int cs_trace_enable_cycle_accurate(cs_device_t dev, int enable)
+{
+    struct cs_api_probe p;
+    _cs_api_enter(&p, &api_trace_enable_cycle_accurate);
+    return _cs_api_exit(&p, _cs_trace_enable_cycle_accurate(dev, enable));
+}
+
 
 int cs_replicator_set_filter(cs_device_t dev, unsigned int outport,
                              unsigned int filter)
@@ -286,4 +507,55 @@ int cs_replicator_set_filter(cs_device_t dev, unsigned int outport,
 }
 
 
+static int _cs_routes_enable(cs_trace_route_t const *routes,
+                             unsigned int n_routes)
+{
+    struct path_plan plan;
+    unsigned int i, r;
+    int rc;
+
+    plan.n_links = 0;
+    for (r = 0; r < n_routes; ++r) {
+        for (i = 0; i < routes[r].n_sources; ++i) {
+            assert(cs_device_has_class(routes[r].sources[i],
+                                       CS_DEVCLASS_SOURCE));
+            rc = path_plan_add(&plan, DEV(routes[r].sources[i]),
+                               DEV(routes[r].sink));
+            if (rc != 0) {
+                return rc;
+            }
+        }
+    }
+    return path_plan_apply(&plan);
+}
+
+static struct cs_api_stats api_paths_enable = { "cs_paths_enable" };
+
+int cs_paths_enable(cs_device_t const *sources, unsigned int n_sources,
+                    cs_device_t sink)
+{
+    struct cs_api_probe p;
+    cs_trace_route_t route;
+
+    route.sources = sources;
+    route.n_sources = n_sources;
+    route.sink = sink;
+    _cs_api_enter(&p, &api_paths_enable);
+    return _cs_api_exit(&p, _cs_routes_enable(&route, 1));
+}
+
+static struct cs_api_stats api_routes_enable = { "cs_routes_enable" };
+
+int cs_routes_enable(cs_trace_route_t const *routes, unsigned int n_routes)
+{
+    struct cs_api_probe p;
+    _cs_api_enter(&p, &api_routes_enable);
+    return _cs_api_exit(&p, _cs_routes_enable(routes, n_routes));
+}
+
+int cs_path_enable(cs_device_t source, cs_device_t sink)
+{
+    return cs_paths_enable(&source, 1, sink);
+}
+
 /* end of cs_trace_source.c */
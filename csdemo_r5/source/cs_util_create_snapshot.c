@@ -33,12 +33,32 @@
 #include <errno.h>
 #include <assert.h>
 #include <stdarg.h>
+#include <time.h>
 
 #include "csregisters.h"
 #include "csaccess.h"
 #include "cs_utility.h"
 
 #include "write_uart.h"
+#include "trace_dma.h"
+#include "trace_lz.h"
+#include "trace_dcc.h"
+#include "trace_udp.h"
+#include "trace_fat.h"
+#ifdef CS_SIM
+#include "trace_emac_sim.h"
+#include "trace_disk_sim.h"
+#elif defined(ARMR5)
+#include "trace_gem.h"
+#include "trace_sd.h"
+#endif
+
+#ifdef ARMR5
+#include "xtime_l.h"
+#include "xparameters.h"
+#include "xscugic.h"
+#include "xil_exception.h"
+#endif
 
 
 #define INVALID_ADDRESS 1	/* never a valid address */
@@ -176,34 +196,688 @@ int dump_kernel_memory(char const *fn, unsigned long start,
     return err;
 }
 
+/* Trace is compressed before it is sent once do_trace_compress() has
+   enabled it.  Time spent sending is left out of the compression time. */
+static trace_lz_t trace_lz;
+static int trace_compress;
+static int trace_compress_formatted;
+
+#ifdef ARMR5
+typedef XTime util_time_t;
+#define UTIL_TICKS_PER_SEC COUNTS_PER_SECOND
+static util_time_t util_time(void)
+{
+    XTime t;
+    XTime_GetTime(&t);
+    return t;
+}
+#else
+typedef clock_t util_time_t;
+#define UTIL_TICKS_PER_SEC CLOCKS_PER_SEC
+static util_time_t util_time(void)
+{
+    return clock();
+}
+#endif
+
+static unsigned long long trace_lz_ticks;	/* compressing, sending included */
+static unsigned long long trace_lz_send_ticks;	/* sending */
+
+/* Trace goes through the DCC once do_dcc_trace_start() has selected it,
+   and no longer to the UART even if the debugger stops reading */
+static int trace_via_dcc;
+
+/* Trace goes over UDP once do_udp_trace_start() has selected it, a session
+   for each dump */
+static int trace_via_udp;
+static const trace_udp_netif_t *udp_netif;
+static trace_udp_addr_t udp_addr;
+
+/* The stream being sent by do_stream_trace_udp(), and how much of its ring
+   the session has sent and the host not yet acknowledged */
+static cs_etf_stream_t *udp_stream;
+static unsigned int udp_in_flight;
+
+/* Let the host have what is still in flight of the stream last sent, as
+   its acknowledgements must not release the next stream's ring */
+static int udp_stream_reset(cs_etf_stream_t *s)
+{
+    int rc = 0;
+
+    if (udp_in_flight != 0 && trace_udp_ready()) {
+        rc = trace_udp_flush();
+    }
+    udp_stream = s;
+    udp_in_flight = 0;
+    return rc;
+}
+
+static int udp_session(void)
+{
+    if (trace_udp_ready()) {
+        return 0;
+    }
+    /* Nothing sent in an earlier session is still in flight */
+    (void) udp_stream_reset(NULL);
+    if (trace_udp_init(udp_netif, &udp_addr) != 0) {
+        printf("CSUTIL: no answer from the host, is cstrace_udp running?\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* Snapshots go to a new directory on the SD card once do_sd_trace_start()
+   has selected it, the dump being cstrace.bin.  A directory holds one
+   snapshot, so a second dump into it is dropped. */
+static int trace_via_sd;
+static int sd_file_open;
+static int sd_trace_dropped;
+static char sd_dir[16];
+
+#ifndef CS_SIM_SD_IMAGE
+#define CS_SIM_SD_IMAGE "sd.img"
+#endif
+
+/* Selecting a transport drops the one selected before, leaving the
+   trace on the UART until the new one is set up */
+static void trace_via_uart(void)
+{
+    trace_via_sd = 0;
+    trace_via_udp = 0;
+    trace_via_dcc = 0;
+}
+
+/* Write to the SD card, or send over UDP or the DCC, whichever was
+   selected last, else over the UART, in CRC-checked frames once
+   do_uart_trace_start() has set up the framed transport, else as raw
+   bytes */
+static void uart_send(void const *data, unsigned int n)
+{
+    if (trace_via_sd) {
+        if (sd_trace_dropped) {
+            return;
+        }
+        if (!sd_file_open) {
+            int rc;
+
+            rc = trace_fat_create("cstrace.bin");
+            if (rc == TRACE_FAT_EXISTS) {
+                printf("\nCSUTIL: %s already has a trace, call do_sd_trace_start() for the next snapshot\n",
+                       sd_dir);
+            } else if (rc != 0) {
+                printf("\nCSUTIL: can't create %s/cstrace.bin on the SD card\n",
+                       sd_dir);
+            }
+            if (rc != 0) {
+                sd_trace_dropped = 1;
+                return;
+            }
+            sd_file_open = 1;
+        }
+        if (trace_fat_write(data, n) < 0) {
+            printf("\nCSUTIL: can't write %s/cstrace.bin on the SD card, dropping the rest of the trace\n",
+                   sd_dir);
+            sd_trace_dropped = 1;
+        }
+    } else if (trace_via_udp) {
+        /* Sent in place: the data may change once this returns */
+        if (udp_session() == 0 && trace_udp_write(0, data, n) >= 0) {
+            (void) trace_udp_flush();
+        }
+    } else if (trace_via_dcc) {
+        (void) trace_dcc_send(data, n);
+    } else if (uart_trace_ready()) {
+        uart_trace_send(data, n);
+    } else {
+        write_uchar8(0, (unsigned char *) data, n);
+    }
+}
+
+static void trace_lz_emit(void *ref, void const *data, u32 n)
+{
+    util_time_t t0 = util_time();
+
+    (void) ref;
+    uart_send(data, n);
+    trace_lz_send_ticks += (util_time_t) (util_time() - t0);
+}
+
+/* The files of a snapshot are left as DS-5 reads them */
+static int trace_compressing(void)
+{
+    return trace_compress && !trace_via_sd && !trace_via_udp;
+}
+
+/* Send trace over the UART, compressed if do_trace_compress() enabled it */
+static void uart_write_trace(void const *data, unsigned int n)
+{
+    util_time_t t0;
+
+    if (!trace_compressing()) {
+        uart_send(data, n);
+        return;
+    }
+    t0 = util_time();
+    trace_lz_write(&trace_lz, data, n);
+    trace_lz_ticks += (util_time_t) (util_time() - t0);
+}
+
+/* Report how well the dump compressed, and start a new stream for the
+   next one */
+static void trace_compress_report(void)
+{
+    unsigned long long ticks = trace_lz_ticks - trace_lz_send_ticks;
+    unsigned long long kbps = 0;
+
+    if (trace_lz.in_bytes != 0) {
+        if (ticks != 0) {
+            kbps = (unsigned long long) trace_lz.in_bytes *
+                UTIL_TICKS_PER_SEC / 1000 / ticks;
+        }
+        printf("\nCSUTIL: compressed %u bytes of trace to %u, %u.%02ux, at %llu KB/s\n",
+               (unsigned int) trace_lz.in_bytes,
+               (unsigned int) trace_lz.out_bytes,
+               (unsigned int) (trace_lz.in_bytes / trace_lz.out_bytes),
+               (unsigned int) ((unsigned long long) trace_lz.in_bytes * 100 /
+                               trace_lz.out_bytes % 100), kbps);
+    }
+    trace_lz_init(&trace_lz, trace_compress_formatted, trace_lz_emit, NULL);
+    trace_lz_ticks = 0;
+    trace_lz_send_ticks = 0;
+}
+
+/* Tell the host receiver the dump is complete */
+static void uart_end_trace(void)
+{
+    util_time_t t0;
+    int rc;
+
+    if (trace_compressing()) {
+        t0 = util_time();
+        trace_lz_flush(&trace_lz);
+        trace_lz_ticks += (util_time_t) (util_time() - t0);
+    }
+    if (trace_via_sd) {
+        if (sd_file_open) {
+            sd_file_open = 0;
+            if (trace_fat_close() != 0) {
+                printf("\nCSUTIL: failed to write the trace to the SD card\n");
+            } else if (sd_trace_dropped) {
+                printf("\nCSUTIL: %s/cstrace.bin holds only the first %u bytes of the trace\n",
+                       sd_dir, (unsigned int) trace_fat_size());
+            } else {
+                printf("\nCSUTIL: wrote %u bytes of trace to %s/cstrace.bin\n",
+                       (unsigned int) trace_fat_size(), sd_dir);
+            }
+        }
+        sd_trace_dropped = 0;
+    } else if (trace_via_udp) {
+        if (udp_session() == 0) {
+            rc = trace_udp_end();
+            (void) udp_stream_reset(NULL);
+            if (rc != 0) {
+                printf("\nCSUTIL: the host stopped answering, trace is incomplete\n");
+            } else {
+                printf("\nCSUTIL: sent %u bytes over UDP, %u datagrams resent\n",
+                       (unsigned int) trace_udp_bytes(),
+                       (unsigned int) trace_udp_resent());
+            }
+        }
+    } else if (trace_via_dcc) {
+        if (trace_dcc_end() != 0) {
+            printf("\nCSUTIL: the debugger stopped reading the DCC, trace is incomplete\n");
+        }
+    } else if (uart_trace_ready()) {
+        uart_trace_end();
+    }
+    if (trace_compressing()) {
+        trace_compress_report();
+    }
+}
+
+void do_trace_compress(int enable, int formatted)
+{
+    trace_compress = enable;
+    trace_compress_formatted = formatted;
+    trace_compress_report();
+}
+
+/* Memory is moved into a pair of staging buffers, one being filled by DMA
+   while the other is sent */
+#define DUMP_STAGING_SIZE 16384
+
 int dump_kernel_memory_uart(unsigned long start,
                        unsigned long end)
 {
-	char c;
+    static unsigned char staging[2][DUMP_STAGING_SIZE]
+        __attribute__ ((aligned(64)));
+    trace_dma_seg_t seg[2];
+    unsigned long addr = start;
+    unsigned int n, next_n, cur = 0;
     int err = 0;
-    unsigned char *local;
-    unsigned long size = end - start;
-
-    local = (unsigned char *) start;
 
-	printf("Memory dump from %#016lx to %#016lx:\n", start, end);
-	for(int i=0; i<size;i++) {
-		write(0, *local, size);
-	}
-	printf("\n");
+    printf("Memory dump from %#016lx to %#016lx:\n", start, end);
+    n = (end - addr < DUMP_STAGING_SIZE) ? end - addr : DUMP_STAGING_SIZE;
+    if (n > 0) {
+        seg[0].src = (void const *) addr;
+        seg[0].dst = staging[0];
+        seg[0].size = n;
+        trace_dma_copy(&seg[0], 1, NULL, NULL);
+    }
+    while (n > 0) {
+        if (trace_dma_wait() != 0) {
+            err = 1;
+            break;
+        }
+        addr += n;
+        next_n = (end - addr < DUMP_STAGING_SIZE) ? end - addr :
+            DUMP_STAGING_SIZE;
+        if (next_n > 0) {
+            seg[cur ^ 1].src = (void const *) addr;
+            seg[cur ^ 1].dst = staging[cur ^ 1];
+            seg[cur ^ 1].size = next_n;
+            trace_dma_copy(&seg[cur ^ 1], 1, NULL, NULL);
+        }
+        uart_write_trace(staging[cur], n);
+        cur ^= 1;
+        n = next_n;
+    }
+    uart_end_trace();
+    printf("\n");
     return err;
 }
 
+/* Trace is read out through a fixed staging buffer, a chunk at a time */
+#define FETCH_CHUNK_SIZE 4096
+
 void do_fetch_trace_etb_uart(cs_device_t etb)
 {
-    int len, n;
-    FILE *fd = 0;
-    len = cs_get_buffer_unread_bytes(etb);
-    unsigned char *buf = (unsigned char *) malloc(len);
-    n = cs_get_trace_data(etb, buf, len);
-    write_uchar8((int32_t) fd, buf, n); // fd is ignored in function write
+    static unsigned int chunk[FETCH_CHUNK_SIZE / sizeof(unsigned int)];
+    int n, total = 0;
+    unsigned int rate;
+
+    while ((n = cs_get_trace_data(etb, chunk, sizeof chunk)) > 0) {
+        uart_write_trace(chunk, n);
+        total += n;
+    }
+    uart_end_trace();
+    rate = cs_get_trace_data_rate(etb);
+    if (registration_verbose) {
+        printf("\nCSUTIL: read %d bytes of trace at %u.%03u MB/s\n", total,
+               rate / 1000, rate % 1000);
+    }
+}
+
+void do_fetch_trace_etr_uart(cs_device_t etr)
+{
+    cs_trace_span_t *spans;
+    int i, n, total = 0;
+
+    /* A scatter-gather buffer can need a span per page */
+    n = cs_etr_get_trace_spans(etr, NULL, 0);
+    if (n <= 0) {
+        return;
+    }
+    spans = (cs_trace_span_t *) malloc(n * sizeof(cs_trace_span_t));
+    if (spans == NULL) {
+        printf("CSUTIL: can't allocate %d trace spans\n", n);
+        return;
+    }
+    n = cs_etr_get_trace_spans(etr, spans, n);
+    for (i = 0; i < n; ++i) {
+        uart_write_trace(spans[i].data, spans[i].size);
+        total += spans[i].size;
+    }
+    uart_end_trace();
+    cs_etr_release_trace_spans(etr);
+    free(spans);
+    if (registration_verbose) {
+        printf("\nCSUTIL: sent %d bytes of trace from the ETR buffer\n", total);
+    }
+}
+
+/* The ETR copy in progress */
+static trace_dma_seg_t *etr_copy_segs;
+
+int do_copy_trace_etr(cs_device_t etr, void *dst, unsigned int size,
+                      void (*done)(void *ref, int status), void *ref)
+{
+    cs_trace_span_t *spans;
+    unsigned char *p = (unsigned char *) dst;
+    int i, n, total = 0;
+
+    if (trace_dma_busy()) {
+        printf("CSUTIL: a DMA copy is already running\n");
+        return -1;
+    }
+    n = cs_etr_get_trace_spans(etr, NULL, 0);
+    if (n <= 0) {
+        return n;
+    }
+    spans = (cs_trace_span_t *) malloc(n * sizeof(cs_trace_span_t));
+    free(etr_copy_segs);
+    etr_copy_segs = (trace_dma_seg_t *) malloc(n * sizeof(trace_dma_seg_t));
+    if (spans == NULL || etr_copy_segs == NULL) {
+        printf("CSUTIL: can't allocate %d trace spans\n", n);
+        free(spans);
+        return -1;
+    }
+    /* The oldest trace first, so a wrapped buffer is copied in order */
+    n = cs_etr_get_trace_spans(etr, spans, n);
+    for (i = 0; i < n && (unsigned int) total < size; ++i) {
+        etr_copy_segs[i].src = spans[i].data;
+        etr_copy_segs[i].dst = p + total;
+        etr_copy_segs[i].size = spans[i].size;
+        if (etr_copy_segs[i].size > size - total) {
+            etr_copy_segs[i].size = size - total;
+        }
+        total += etr_copy_segs[i].size;
+    }
+    free(spans);
+    if (n < 0) {
+        return n;
+    }
+    if (trace_dma_copy(etr_copy_segs, i, done, ref) != 0) {
+        return -1;
+    }
+    return total;
 }
 
+int do_stream_trace_udp(cs_etf_stream_t *s)
+{
+    void const *data;
+    unsigned int n;
+    int acked, total = 0;
+
+    if (!trace_via_udp || udp_session() != 0) {
+        return -1;
+    }
+    /* Nothing is in flight from a stream other than the one last sent,
+       nor from this one if it has been restarted since, leaving its ring
+       holding less than was in flight */
+    if ((s != udp_stream || s->head - s->tail < udp_in_flight)
+        && udp_stream_reset(s) != 0) {
+        return -1;
+    }
+    /* The ring is released as the host acknowledges it, so the trace is
+       sent from it in place and can be resent from it */
+    for (;;) {
+        if ((acked = trace_udp_acked()) < 0) {
+            udp_in_flight = 0;
+            return -1;
+        }
+        cs_etf_stream_consume(s, acked);
+        udp_in_flight -= acked;
+        n = cs_etf_stream_peek(s, &data);
+        if (n > udp_in_flight) {
+            n -= udp_in_flight;
+            if (n > TRACE_UDP_WINDOW * TRACE_UDP_MAX_PAYLOAD / 4) {
+                n = TRACE_UDP_WINDOW * TRACE_UDP_MAX_PAYLOAD / 4;
+            }
+            if (trace_udp_write(0, (unsigned char const *) data + udp_in_flight, n) < 0) {
+                udp_in_flight = 0;
+                return -1;
+            }
+            udp_in_flight += n;
+            total += n;
+        } else if (s->head - s->tail == udp_in_flight) {
+            break;
+        } else {
+            /* The rest wraps round the end of the ring, which peek only
+               returns once the trace before the end is released */
+            if (trace_udp_flush() != 0) {
+                udp_in_flight = 0;
+                return -1;
+            }
+            cs_etf_stream_consume(s, udp_in_flight);
+            udp_in_flight = 0;
+        }
+    }
+    return total;
+}
+
+int do_stream_trace_uart(cs_etf_stream_t *s)
+{
+    void const *data;
+    unsigned int n;
+    int total = 0;
+
+    if (trace_via_udp) {
+        return do_stream_trace_udp(s);
+    }
+    /* Send the trace a contiguous piece of the ring at a time, in place,
+       while the drain refills the rest of the ring */
+    while ((n = cs_etf_stream_peek(s, &data)) > 0) {
+        uart_write_trace(data, n);
+        cs_etf_stream_consume(s, n);
+        total += n;
+    }
+    return total;
+}
+
+int do_udp_trace_start(const trace_udp_addr_t *addr)
+{
+#ifdef CS_SIM
+    udp_netif = trace_emac_sim_init(addr, 0);
+#elif defined(ARMR5)
+    udp_netif = trace_gem_init(XPAR_XEMACPS_0_DEVICE_ID, addr->mac, 1000);
+#else
+    udp_netif = NULL;
+#endif
+    trace_via_uart();
+    if (udp_netif == NULL) {
+        printf("CSUTIL: can't set up the Ethernet, trace stays on the UART\n");
+        return -1;
+    }
+    udp_addr = *addr;
+    printf("CSUTIL: sending trace over UDP to %u.%u.%u.%u port %u - start cstrace_udp\n",
+           (unsigned int) (addr->host_ip >> 24),
+           (unsigned int) (addr->host_ip >> 16) & 0xFF,
+           (unsigned int) (addr->host_ip >> 8) & 0xFF,
+           (unsigned int) addr->host_ip & 0xFF, (unsigned int) addr->port);
+    trace_via_udp = 1;
+    return udp_session();
+}
+
+int do_sd_trace_start(void)
+{
+    const trace_fat_blkdev_t *dev;
+    int i, rc = -1;
+
+#ifdef CS_SIM
+    dev = trace_disk_sim_init(CS_SIM_SD_IMAGE);
+#elif defined(ARMR5)
+    dev = trace_sd_init(XPAR_XSDPS_0_DEVICE_ID);
+#else
+    dev = NULL;
+#endif
+    trace_via_uart();
+    if (dev == NULL || trace_fat_mount(dev) != 0) {
+        printf("CSUTIL: no FAT16/FAT32 SD card, trace stays on the UART\n");
+        return -1;
+    }
+    /* A new directory for each snapshot */
+    for (i = 0; i < 1000; ++i) {
+        sprintf(sd_dir, "snap_%03d", i);
+        if ((rc = trace_fat_mkdir(sd_dir)) != TRACE_FAT_EXISTS) {
+            break;
+        }
+    }
+    if (rc != 0) {
+        printf("CSUTIL: can't make a snapshot directory on the SD card\n");
+        return -1;
+    }
+    printf("CSUTIL: writing the snapshot to %s on the SD card\n", sd_dir);
+    trace_via_sd = 1;
+    sd_file_open = 0;
+    sd_trace_dropped = 0;
+    return 0;
+}
+
+#ifdef ARMR5
+static XScuGic util_gic;
+static int util_gic_ready;
+static cs_etf_stream_t *stream_irq_stream;
+static cs_trigdst_t stream_irq_dst;
+static unsigned int stream_irq_id;
+/* The cross trigger channel from the ETF to the interrupt.  It is routed
+   on the first start and kept for later ones, as the library has no way
+   to give a channel back. */
+static cs_channel_t stream_irq_chan;
+static int stream_irq_routed;
+
+static void stream_irq_handler(void *ref)
+{
+    cs_etf_stream_t *s = (cs_etf_stream_t *) ref;
+
+    /* Drain below the water mark before acknowledging, so that the
+       ETF's Full output has dropped and the interrupt is not raised again.
+       Only these two calls are safe here: they don't touch the batch,
+       shadow or counters of the code that was interrupted. */
+    cs_etf_stream_poll(s);
+    cs_cti_ack_trigout(stream_irq_dst.cti, stream_irq_dst.ctiport);
+}
+
+/* Set up the GIC and enable interrupts, once for all the utilities */
+static XScuGic *util_gic_get(void)
+{
+    XScuGic_Config *config;
+
+    if (util_gic_ready) {
+        return &util_gic;
+    }
+    config = XScuGic_LookupConfig(XPAR_SCUGIC_0_DEVICE_ID);
+    if (config == NULL
+        || XScuGic_CfgInitialize(&util_gic, config,
+                                 config->CpuBaseAddress) != XST_SUCCESS) {
+        printf("CSUTIL: can't initialize the interrupt controller\n");
+        return NULL;
+    }
+    Xil_ExceptionInit();
+    Xil_ExceptionRegisterHandler(XIL_EXCEPTION_ID_INT,
+                                 (Xil_ExceptionHandler)
+                                 XScuGic_InterruptHandler, &util_gic);
+    Xil_ExceptionEnable();
+    util_gic_ready = 1;
+    return &util_gic;
+}
+
+int do_uart_trace_start(unsigned int baud)
+{
+    XScuGic *gic = util_gic_get();
+
+    trace_via_uart();
+    if (gic == NULL) {
+        return -1;
+    }
+    printf("CSUTIL: sending framed trace at %u baud - start cstrace_recv\n",
+           baud);
+    if (uart_trace_init(XPAR_XUARTPS_1_DEVICE_ID, baud, gic,
+                        XPAR_XUARTPS_1_INTR) != 0) {
+        printf("CSUTIL: can't set up the UART for framed trace\n");
+        return -1;
+    }
+    return 0;
+}
+
+int do_dcc_trace_start(unsigned int timeout)
+{
+    trace_via_uart();
+    if (trace_dcc_init(timeout) != 0) {
+        printf("CSUTIL: no DCC, trace stays on the UART\n");
+        return -1;
+    }
+    printf("CSUTIL: sending framed trace through the DCC - read it with the debugger\n");
+    trace_via_dcc = 1;
+    return 0;
+}
+
+int do_trace_dma_start(void)
+{
+    XScuGic *gic = util_gic_get();
+
+    if (gic == NULL
+        || trace_dma_init(XPAR_XZDMA_8_DEVICE_ID, gic,
+                          XPAR_XZDMAPS_0_INTR) != 0) {
+        printf("CSUTIL: can't set up ZDMA, copying with the CPU\n");
+        return -1;
+    }
+    return 0;
+}
+
+int do_stream_trace_irq_start(cs_etf_stream_t *s, unsigned int cti_trigout,
+                              unsigned int irq_id)
+{
+    XScuGic *gic;
+    cs_trigsrc_t src;
+    cs_trigdst_t dst;
+
+    /* Route the ETF's Full output through its CTI to the interrupt */
+    src = cs_trigsrc(s->etf, CS_TRIGOUT_ETB_FULL);
+    dst = cs_cti_trigdst(src.cti, cti_trigout);
+    if (stream_irq_routed) {
+        if (dst.cti != stream_irq_dst.cti
+            || dst.ctiport != stream_irq_dst.ctiport) {
+            printf("CSUTIL: the ETF Full trigger is already routed to CTI output %u\n",
+                   stream_irq_dst.ctiport);
+            return -1;
+        }
+    } else {
+        if (stream_irq_chan == NULL) {
+            stream_irq_chan = cs_ect_get_channel();
+        }
+        if (cs_ect_add_trigsrc(stream_irq_chan, src) != 0
+            || cs_ect_add_trigdst(stream_irq_chan, dst) != 0
+            || cs_ect_configure(stream_irq_chan) != 0) {
+            printf("CSUTIL: can't route the ETF Full trigger to CTI output %u\n",
+                   cti_trigout);
+            return -1;
+        }
+        stream_irq_dst = dst;
+        stream_irq_routed = 1;
+    }
+
+    gic = util_gic_get();
+    if (gic == NULL) {
+        return -1;
+    }
+    if (XScuGic_Connect(gic, irq_id,
+                        (Xil_InterruptHandler) stream_irq_handler,
+                        s) != XST_SUCCESS) {
+        printf("CSUTIL: can't connect interrupt %u\n", irq_id);
+        return -1;
+    }
+    /* The CTI output is a level, held until acknowledged */
+    XScuGic_SetPriorityTriggerType(gic, irq_id, 0xA0, 0x1);
+    if (trace_via_udp) {
+        (void) udp_stream_reset(s);
+    }
+    stream_irq_stream = s;
+    stream_irq_id = irq_id;
+    XScuGic_Enable(gic, irq_id);
+    return 0;
+}
+
+int do_stream_trace_irq_stop(void)
+{
+    int total;
+
+    XScuGic_Disable(&util_gic, stream_irq_id);
+    XScuGic_Disconnect(&util_gic, stream_irq_id);
+    cs_cti_ack_trigout(stream_irq_dst.cti, stream_irq_dst.ctiport);
+    cs_etf_stream_stop(stream_irq_stream);
+    total = do_stream_trace_uart(stream_irq_stream);
+    uart_end_trace();
+    if (registration_verbose) {
+        printf("\nCSUTIL: streamed %llu bytes of trace, %llu dropped, %u ETF overflows\n",
+               stream_irq_stream->drained_bytes,
+               stream_irq_stream->dropped_bytes,
+               stream_irq_stream->overflows);
+    }
+    return total;
+}
+#endif
+
 static void do_fetch_trace_etb(cs_device_t etb, char const *name,
                                char const *file_name)
 {
@@ -227,7 +901,6 @@ static void do_fetch_trace_etb(cs_device_t etb, char const *name,
     } else if (n < len) {
         fprintf(stderr, "** got incomplete trace, %d < %d\n", n, len);
     } else {
-        FILE *fd = 0;
         int i;
         int todo = n;
         if (todo > 256) {
@@ -246,7 +919,8 @@ static void do_fetch_trace_etb(cs_device_t etb, char const *name,
         }
 
         printf("CSDEMO: writing raw trace data to uart...\n");
-        write_uchar8((int32_t) fd, buf, n); // fd is ignored in function write
+        uart_write_trace(buf, n);
+        uart_end_trace();
         printf("\nCSDEMO: finished writing raw trace data...\n");
 //        fd = fopen(file_name, "wb");
 //        if (!fd) {
@@ -279,6 +953,12 @@ void do_dump_config_uart(const struct board *board, const struct cs_devices_t *d
 	int dumped_kernel;
 	int separate_itm_buffer;
 
+	// Straight to the card, with nothing to copy by hand
+	if (trace_via_sd) {
+		(void) do_dump_config_sd(board, devices, do_dump_swstim);
+		return;
+	}
+
 #ifdef CS_VA64BIT
 	aarch64 = 1;
 	CPSR_VAL = 0x1C5;
@@ -558,6 +1238,243 @@ void do_dump_config(const struct board *board,
         printf("CSUTIL: Created trace configuration export files\n");
 }
 
+/* The .ini files are built a file at a time in one buffer, and handed to
+   a transport that is done with the buffer once it returns */
+static char snap_text[8192];
+static unsigned int snap_text_len;
+
+static void snap_printf(char const *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(snap_text + snap_text_len, sizeof snap_text - snap_text_len,
+                  fmt, ap);
+    va_end(ap);
+    if (n > 0) {
+        snap_text_len += n;
+        if (snap_text_len >= sizeof snap_text) {
+            snap_text_len = sizeof snap_text - 1;
+        }
+    }
+}
+
+static int udp_send_file(char const *name, void const *data,
+                         unsigned int len)
+{
+    /* File 0 is kept for cstrace.bin, so each file in turn is file 1 */
+    if (trace_udp_open(1, name) != 0 || trace_udp_write(1, data, len) < 0
+        || trace_udp_flush() != 0) {
+        printf("CSUTIL: failed to send %s\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+typedef int (*snap_send_t)(char const *name, void const *data,
+                           unsigned int len);
+
+static int snap_send_text(snap_send_t send, char const *name)
+{
+    int rc = send(name, snap_text, snap_text_len);
+
+    snap_text_len = 0;
+    return rc;
+}
+
+/* The files of do_dump_config(), the memory dump sent from where it is,
+   and snapshot.ini last, so the snapshot is whole once it is there and
+   the trace follows */
+static int dump_config_files(const struct board *board,
+                             const struct cs_devices_t *devices,
+                             int do_dump_swstim, snap_send_t send)
+{
+    int i, n, index = 0;
+    int aarch64;
+    unsigned int CPSR_VAL, SCTLR_EL1_val;
+    int dumped_kernel = 0;
+    int separate_itm_buffer;
+    char fname[20];
+    char ptm_names[LIB_MAX_CPU_DEVICES][32];
+    char itm_name[32];
+
+#ifdef CS_VA64BIT
+    aarch64 = 1;
+    CPSR_VAL = 0x1C5;
+    SCTLR_EL1_val = 0x1007;	/* fake value to let debugger figure memory endianness (little in this case) */
+#else
+    aarch64 = 0;
+    CPSR_VAL = 0x1D3;
+    SCTLR_EL1_val = 0;		/* not really used here */
+#endif
+
+    if (snapshot_trace_start_address != INVALID_ADDRESS
+        && snapshot_trace_end_address > snapshot_trace_start_address) {
+        if (send("kernel_dump.bin",
+                          (void const *) snapshot_trace_start_address,
+                          snapshot_trace_end_address -
+                          snapshot_trace_start_address) != 0) {
+            return -1;
+        }
+        dumped_kernel = 1;
+    }
+
+    // CPU state
+    for (i = 0; i < board->n_cpu; ++i) {
+        snap_printf("[device]\n");
+        snap_printf("name=cpu_%u\n", i);
+        snap_printf("class=core\n");
+        snap_printf("type=%s\n\n", get_core_name(devices->cpu_id[i]));
+        snap_printf("[regs]\n");
+        if (aarch64) {
+            snap_printf("PC(size:64)=0x%lX\n", snapshot_trace_start_address);
+            snap_printf("SP(size:64)=0\n");
+            snap_printf("SCTLR_EL1=0x%X\n", SCTLR_EL1_val);
+        } else {
+            snap_printf("R15=0x%lX\n", snapshot_trace_start_address);
+            snap_printf("R13=0\n");
+        }
+        snap_printf("CPSR=0x%X\n", CPSR_VAL);
+        if (dumped_kernel) {
+            snap_printf("\n[dump1]\n");
+            snap_printf("file=kernel_dump.bin\n");
+            snap_printf("address=0x%08lX\n", snapshot_trace_start_address);
+            snap_printf("length=0x%08lX\n\n",
+                       snapshot_trace_end_address -
+                       snapshot_trace_start_address);
+        }
+        sprintf(fname, "cpu_%u.ini", i);
+        if (snap_send_text(send, fname) != 0) {
+            return -1;
+        }
+    }
+
+    // CPU PTMs, numbered after the CPUs
+    for (i = 0; i < board->n_cpu; ++i) {
+        n = cs_get_trace_metadata(CS_METADATA_INI, devices->etm[i],
+                                  board->n_cpu + i, snap_text,
+                                  sizeof snap_text, ptm_names[i], 32);
+        snap_text_len = (n > 0 && n < (int) sizeof snap_text) ? n : 0;
+        sprintf(fname, "device_%d.ini", board->n_cpu + i);
+        if (snap_send_text(send, fname) != 0) {
+            return -1;
+        }
+    }
+
+    // ITM/STM
+    if (do_dump_swstim) {
+        n = cs_get_trace_metadata(CS_METADATA_INI, devices->itm,
+                                  2 * board->n_cpu, snap_text,
+                                  sizeof snap_text, itm_name, 32);
+        snap_text_len = (n > 0 && n < (int) sizeof snap_text) ? n : 0;
+        sprintf(fname, "device_%d.ini", 2 * board->n_cpu);
+        if (snap_send_text(send, fname) != 0) {
+            return -1;
+        }
+    }
+
+    // Assumes single ETB for all cores
+    separate_itm_buffer = (devices->itm_etb != NULL && do_dump_swstim);
+    snap_printf("[trace_buffers]\n");
+    snap_printf("buffers=buffer0%s\n\n", separate_itm_buffer ? ",buffer1" : "");
+    snap_printf("[buffer0]\n");
+    snap_printf("name=ETB_0\n");
+    snap_printf("file=cstrace.bin\n");
+    snap_printf("format=coresight\n\n");
+    if (separate_itm_buffer) {
+        snap_printf("[buffer1]\n");
+        snap_printf("name=ETB_1\n");
+        snap_printf("file=cstraceitm.bin\n");
+        snap_printf("format=coresight\n\n");
+    }
+    snap_printf("[source_buffers]\n");
+    for (i = 0; i < board->n_cpu; ++i) {
+        snap_printf("%s=ETB_0\n", ptm_names[i]);
+    }
+    if (do_dump_swstim) {
+        snap_printf("%s=%s\n", itm_name, separate_itm_buffer ? "ETB_1" : "ETB_0");
+    }
+    snap_printf("\n[core_trace_sources]\n");
+    for (i = 0; i < board->n_cpu; ++i) {
+        snap_printf("cpu_%d=%s\n", i, ptm_names[i]);
+    }
+    if (snap_send_text(send, "trace.ini") != 0) {
+        return -1;
+    }
+
+    // Top level contents file
+    snap_printf("[snapshot]\n");
+    snap_printf("version=1.0\n\n");
+    snap_printf("[device_list]\n");
+    for (i = 0; i < board->n_cpu; ++i) {
+        snap_printf("device%u=cpu_%u.ini\n", index, i);
+        index++;
+    }
+    for (i = 0; i < board->n_cpu; ++i) {
+        snap_printf("device%d=device_%d.ini\n", index, index);
+        index++;
+    }
+    if (do_dump_swstim) {
+        snap_printf("device%d=device_%d.ini\n", index, index);
+        index++;
+    }
+    snap_printf("\n\n[trace]\n");
+    snap_printf("metadata=trace.ini\n");
+    return snap_send_text(send, "snapshot.ini");
+}
+
+int do_dump_config_udp(const struct board *board,
+                       const struct cs_devices_t *devices,
+                       int do_dump_swstim)
+{
+    if (!trace_via_udp || udp_session() != 0
+        || dump_config_files(board, devices, do_dump_swstim,
+                             udp_send_file) != 0) {
+        return -1;
+    }
+    if (registration_verbose)
+        printf("CSUTIL: Sent the trace configuration files over UDP\n");
+    return 0;
+}
+
+static int sd_send_file(char const *name, void const *data,
+                        unsigned int len)
+{
+    int rc = trace_fat_create(name);
+
+    if (rc == TRACE_FAT_EXISTS) {
+        printf("CSUTIL: %s already has %s, call do_sd_trace_start() for the next snapshot\n",
+               sd_dir, name);
+        return -1;
+    }
+    if (rc == 0) {
+        /* Closed even if the card is full, to keep the volume whole */
+        rc = trace_fat_write(data, len) < 0;
+        rc = (trace_fat_close() != 0) || rc;
+    }
+    if (rc != 0) {
+        printf("CSUTIL: failed to write %s to the SD card\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+int do_dump_config_sd(const struct board *board,
+                      const struct cs_devices_t *devices,
+                      int do_dump_swstim)
+{
+    if (!trace_via_sd
+        || dump_config_files(board, devices, do_dump_swstim,
+                             sd_send_file) != 0) {
+        return -1;
+    }
+    if (registration_verbose)
+        printf("CSUTIL: Wrote the trace configuration files to %s\n",
+               sd_dir);
+    return 0;
+}
+
 void do_fetch_trace(const struct cs_devices_t *devices, int do_dump_swstim)
 {
 	if (devices->etf_a53 != NULL) {
@@ -270,6 +270,16 @@ static int do_config_etmv4(int n_core) {
 	return 0;
 }
 
+int cs_manual_path_enable() {
+	/*
+	 * enable the funnel ports from ETM0 to the main ETF:
+	 * ETM0 -> Port0 @ A53-Funnel -> ETF4K -> Port2 @ MAIN-Funnel
+	 */
+	printf("CSDEMO: Enable Path: ETM0 -> ETF8K\n");
+	return cs_path_enable(cs_cpu_get_device(0, CS_DEVCLASS_SOURCE),
+			devices.etf_main);
+}
+
 static int do_configure_trace(const struct board *board) {
 	int i, r;
 	printf("*******************************************************\n");
@@ -329,6 +339,17 @@ static int do_configure_trace(const struct board *board) {
 	cs_checkpoint();
 	/*********************************************************/
 
+	/*********************************************************/
+	/* CORESIGHT LINKS - Route the path to the sink */
+	/*
+	 * After the source IDs are set, as the replicator ID filters are
+	 * taken from them
+	 */
+	if (cs_manual_path_enable() < 0) {
+		return -1;
+	}
+	/*********************************************************/
+
 	/*********************************************************/
 	/* CORESIGHT SINKS - Enable ETFs and TPIU*/
 	/*********************************************************/
@@ -408,57 +429,26 @@ static int do_configure_trace(const struct board *board) {
 
 /* if we have set up stop on flush, manual flush and wait for stop */
 static void cs_etf_flush_and_wait_stop() {
-	unsigned int ffcr_val, ffsr_val;
-	// ETF4K [ETF]
-	printf("CSDEMO: Flushing ETB and waiting for formatter stop\n");
-	ffcr_val = cs_device_read(devices.etf_main, CS_ETB_FLFMT_CTRL);
-	ffcr_val |= CS_ETB_FLFMT_CTRL_FOnMan;
-	cs_device_write(devices.etf_main, CS_ETB_FLFMT_CTRL, ffcr_val);
-	if (cs_device_wait(devices.etf_main, CS_ETB_FLFMT_STATUS, CS_ETB_FLFMT_STATUS_FtStopped, CS_REG_WAITBITS_ALL_1, 0, &ffsr_val) == 0) {
-		if (verbose)
-			printf("CSDEMO: ETB collection stopped\n");
-	} else {
-		if (verbose)
-			printf("CSDEMO: ETB FFSR=0x%08X\n", ffsr_val);
-		printf("CSDEMO: Warning ETB collection not stopped on flush on trigger\n");
-	}
+	unsigned int polls = 0;
+	int rc;
 	// ETF8K [ETB]
 	printf("CSDEMO: Flushing ETB and waiting for formatter stop\n");
-	ffcr_val = cs_device_read(devices.etf_main, CS_ETB_FLFMT_CTRL);
-	ffcr_val |= CS_ETB_FLFMT_CTRL_FOnMan; // set FLushMan bit: manually generate a flush of the system. [If TraceCaptEn= 0, writes to FlushMan are ignored.]
-	cs_device_write(devices.etf_main, CS_ETB_FLFMT_CTRL, ffcr_val);
-	if (cs_device_wait(devices.etf_main, CS_ETB_FLFMT_STATUS, CS_ETB_FLFMT_STATUS_FtStopped, CS_REG_WAITBITS_ALL_1, 0, &ffsr_val) == 0) {
+	rc = cs_sink_disable_start(devices.etf_main);
+	/* Other work can be done here while the formatter drains */
+	while (rc == 0 && polls < 100000) {
+		rc = cs_sink_disable_poll(devices.etf_main);
+		++polls;
+	}
+	if (rc > 0) {
 		if (verbose)
-			printf("CSDEMO: ETB collection stopped\n");
+			printf("CSDEMO: ETB collection stopped after %u polls\n", polls);
 	} else {
 		if (verbose)
-			printf("CSDEMO: ETB FFSR=0x%08X\n", ffsr_val);
+			printf("CSDEMO: ETB FFSR=0x%08X\n", cs_device_read(devices.etf_main, CS_ETB_FLFMT_STATUS));
 		printf("CSDEMO: Warning ETB collection not stopped on flush on trigger\n");
 	}
 }
 
-int cs_manual_path_enable() {
-	int rc;
-	unsigned int fnl_ctrl;
-	/*
-	 * enable slave port 0 in Funnel FNL-A53
-	 */
-	printf("CSDEMO: Enable Path: ETM0 -> Port0 @ A53-Funnel \n");
-	fnl_ctrl = cs_device_read(devices.fnl_a53, CS_FUNNEL_CTRL);
-	fnl_ctrl |= CS_FUNNEL_EnSLV0;
-	rc = cs_device_write(devices.fnl_a53, CS_FUNNEL_CTRL, fnl_ctrl);
-
-	/*
-	 * enable slave port 2 in Funnel FNL-MAIN
-	 */
-	printf("CSDEMO: Enable Path: ETF4K -> Port2 @ MAIN-Funnel \n");
-	fnl_ctrl = cs_device_read(devices.fnl_main, CS_FUNNEL_CTRL);
-	fnl_ctrl |= CS_FUNNEL_EnSLV2;
-	rc = cs_device_write(devices.fnl_main, CS_FUNNEL_CTRL, fnl_ctrl);
-
-	return rc;
-}
-
 int main(int argc, char **argv) {
 
     init_platform();
@@ -517,11 +507,6 @@ int main(int argc, char **argv) {
 	/*****************************************************************/
 	/* Configuration of all CoreSight Devices */
 	/*****************************************************************/
-	/* Enable Slave Ports of Funnel Devices */
-	if (cs_manual_path_enable() < 0) {
-		return -1;
-	}
-
 	if (do_configure_trace(board) < 0) {
 		return EXIT_FAILURE;
 	}
@@ -365,31 +365,22 @@ static int do_configure_trace(const struct board *board) {
 
 /* if we have set up stop on flush, manual flush and wait for stop */
 static void cs_etf_flush_and_wait_stop() {
-	unsigned int ffcr_val, ffsr_val;
-	// ETF4K [ETF]
-	printf("CSDEMO: Flushing ETB and waiting for formatter stop\n");
-	ffcr_val = cs_device_read(devices.etf_main, CS_ETB_FLFMT_CTRL);
-	ffcr_val |= CS_ETB_FLFMT_CTRL_FOnMan;
-	cs_device_write(devices.etf_main, CS_ETB_FLFMT_CTRL, ffcr_val);
-	if (cs_device_wait(devices.etf_main, CS_ETB_FLFMT_STATUS, CS_ETB_FLFMT_STATUS_FtStopped, CS_REG_WAITBITS_ALL_1, 0, &ffsr_val) == 0) {
-		if (verbose)
-			printf("CSDEMO: ETB collection stopped\n");
-	} else {
-		if (verbose)
-			printf("CSDEMO: ETB FFSR=0x%08X\n", ffsr_val);
-		printf("CSDEMO: Warning ETB collection not stopped on flush on trigger\n");
-	}
+	unsigned int polls = 0;
+	int rc;
 	// ETF8K [ETB]
 	printf("CSDEMO: Flushing ETB and waiting for formatter stop\n");
-	ffcr_val = cs_device_read(devices.etf_main, CS_ETB_FLFMT_CTRL);
-	ffcr_val |= CS_ETB_FLFMT_CTRL_FOnMan; // set FLushMan bit: manually generate a flush of the system. [If TraceCaptEn= 0, writes to FlushMan are ignored.]
-	cs_device_write(devices.etf_main, CS_ETB_FLFMT_CTRL, ffcr_val);
-	if (cs_device_wait(devices.etf_main, CS_ETB_FLFMT_STATUS, CS_ETB_FLFMT_STATUS_FtStopped, CS_REG_WAITBITS_ALL_1, 0, &ffsr_val) == 0) {
+	rc = cs_sink_disable_start(devices.etf_main);
+	/* Other work can be done here while the formatter drains */
+	while (rc == 0 && polls < 100000) {
+		rc = cs_sink_disable_poll(devices.etf_main);
+		++polls;
+	}
+	if (rc > 0) {
 		if (verbose)
-			printf("CSDEMO: ETB collection stopped\n");
+			printf("CSDEMO: ETB collection stopped after %u polls\n", polls);
 	} else {
 		if (verbose)
-			printf("CSDEMO: ETB FFSR=0x%08X\n", ffsr_val);
+			printf("CSDEMO: ETB FFSR=0x%08X\n", cs_device_read(devices.etf_main, CS_ETB_FLFMT_STATUS));
 		printf("CSDEMO: Warning ETB collection not stopped on flush on trigger\n");
 	}
 }
@@ -56,6 +56,7 @@
 #include "csregisters.h"
 
 #include "cs_trace_metadata.h"
+#include "write_uart.h"
 
 #include <sched.h>		/* for CPU_* family, requires glibc 2.6 or later */
 #include <unistd.h>		/* for usleep() */
@@ -86,6 +87,10 @@
 #define KERNEL_TRACE_SIZE 0x7000000//0x700000
 #define ALL_CPUS -1
 
+/* ETR trace buffer in DDR */
+#define ETR_BUFFER_ADDR 0x60000000
+#define ETR_BUFFER_SIZE 0x20000000
+
 static struct cs_devices_t devices;
 
 /* command line options */
@@ -96,6 +101,7 @@ static bool verbose;
 static bool trace_timestamps;
 static bool trace_cycle_accurate;
 static bool run_tpiu_pattern_test;
+static bool uart_framed;
 
 #define BOARD_NAME_LEN 256
 static char board_name[BOARD_NAME_LEN];
@@ -270,8 +276,20 @@ static int do_config_etmv4(int n_core) {
 	return 0;
 }
 
+int cs_manual_path_enable() {
+	/*
+	 * enable the funnel ports and replicator output from ETM0 to the ETR:
+	 * ETM0 -> Port0 @ A53-Funnel -> ETF4K -> Port2 @ MAIN-Funnel
+	 * -> ETF8K -> Port0 @ Replicator
+	 */
+	printf("CSDEMO: Enable Path: ETM0 -> ETR\n");
+	return cs_path_enable(cs_cpu_get_device(0, CS_DEVCLASS_SOURCE),
+			devices.etr);
+}
+
 static int do_configure_trace(const struct board *board) {
 	int i, r;
+	cs_etr_config_t etr_config;
 	printf("*******************************************************\n");
 	printf("CSDEMO: Configuring trace...\n");
 	printf("*******************************************************\n");
@@ -329,6 +347,17 @@ static int do_configure_trace(const struct board *board) {
 	cs_checkpoint();
 	/*********************************************************/
 
+	/*********************************************************/
+	/* CORESIGHT LINKS - Route the path to the sink */
+	/*
+	 * After the source IDs are set, as the replicator ID filters are
+	 * taken from them
+	 */
+	if (cs_manual_path_enable() < 0) {
+		return -1;
+	}
+	/*********************************************************/
+
 	/*********************************************************/
 	/* CORESIGHT SINKS - Enable ETFs and TPIU*/
 	/*********************************************************/
@@ -336,7 +365,10 @@ static int do_configure_trace(const struct board *board) {
 	 *  Enable ETR device for use in Circular Buffer mode
 	 */
 	printf("CSDEMO: Enabling AXI Interface of ETR...\n");
-	if (cs_etr_axi_enable(devices.etr) != 0) {
+	cs_etr_config_init(&etr_config);
+	etr_config.buffer_addr = ETR_BUFFER_ADDR;
+	etr_config.buffer_size = ETR_BUFFER_SIZE;
+	if (cs_etr_enable(devices.etr, &etr_config) != 0) {
 		printf("CSDEMO: Could not enable AXI Interface of ETR - not running demo\n");
 		return -1;
 	}
@@ -408,57 +440,26 @@ static int do_configure_trace(const struct board *board) {
 
 /* if we have set up stop on flush, manual flush and wait for stop */
 static void cs_etf_flush_and_wait_stop() {
-	unsigned int ffcr_val, ffsr_val;
-	// ETF4K [ETF]
-	printf("CSDEMO: Flushing ETB and waiting for formatter stop\n");
-	ffcr_val = cs_device_read(devices.etf_main, CS_ETB_FLFMT_CTRL);
-	ffcr_val |= CS_ETB_FLFMT_CTRL_FOnMan;
-	cs_device_write(devices.etf_main, CS_ETB_FLFMT_CTRL, ffcr_val);
-	if (cs_device_wait(devices.etf_main, CS_ETB_FLFMT_STATUS, CS_ETB_FLFMT_STATUS_FtStopped, CS_REG_WAITBITS_ALL_1, 0, &ffsr_val) == 0) {
-		if (verbose)
-			printf("CSDEMO: ETB collection stopped\n");
-	} else {
-		if (verbose)
-			printf("CSDEMO: ETB FFSR=0x%08X\n", ffsr_val);
-		printf("CSDEMO: Warning ETB collection not stopped on flush on trigger\n");
-	}
+	unsigned int polls = 0;
+	int rc;
 	// ETF8K [ETB]
 	printf("CSDEMO: Flushing ETB and waiting for formatter stop\n");
-	ffcr_val = cs_device_read(devices.etf_main, CS_ETB_FLFMT_CTRL);
-	ffcr_val |= CS_ETB_FLFMT_CTRL_FOnMan; // set FLushMan bit: manually generate a flush of the system. [If TraceCaptEn= 0, writes to FlushMan are ignored.]
-	cs_device_write(devices.etf_main, CS_ETB_FLFMT_CTRL, ffcr_val);
-	if (cs_device_wait(devices.etf_main, CS_ETB_FLFMT_STATUS, CS_ETB_FLFMT_STATUS_FtStopped, CS_REG_WAITBITS_ALL_1, 0, &ffsr_val) == 0) {
+	rc = cs_sink_disable_start(devices.etf_main);
+	/* Other work can be done here while the formatter drains */
+	while (rc == 0 && polls < 100000) {
+		rc = cs_sink_disable_poll(devices.etf_main);
+		++polls;
+	}
+	if (rc > 0) {
 		if (verbose)
-			printf("CSDEMO: ETB collection stopped\n");
+			printf("CSDEMO: ETB collection stopped after %u polls\n", polls);
 	} else {
 		if (verbose)
-			printf("CSDEMO: ETB FFSR=0x%08X\n", ffsr_val);
+			printf("CSDEMO: ETB FFSR=0x%08X\n", cs_device_read(devices.etf_main, CS_ETB_FLFMT_STATUS));
 		printf("CSDEMO: Warning ETB collection not stopped on flush on trigger\n");
 	}
 }
 
-int cs_manual_path_enable() {
-	int rc;
-	unsigned int fnl_ctrl;
-	/*
-	 * enable slave port 0 in Funnel FNL-A53
-	 */
-	printf("CSDEMO: Enable Path: ETM0 -> Port0 @ A53-Funnel \n");
-	fnl_ctrl = cs_device_read(devices.fnl_a53, CS_FUNNEL_CTRL);
-	fnl_ctrl |= CS_FUNNEL_EnSLV0;
-	rc = cs_device_write(devices.fnl_a53, CS_FUNNEL_CTRL, fnl_ctrl);
-
-	/*
-	 * enable slave port 2 in Funnel FNL-MAIN
-	 */
-	printf("CSDEMO: Enable Path: ETF4K -> Port2 @ MAIN-Funnel \n");
-	fnl_ctrl = cs_device_read(devices.fnl_main, CS_FUNNEL_CTRL);
-	fnl_ctrl |= CS_FUNNEL_EnSLV2;
-	rc = cs_device_write(devices.fnl_main, CS_FUNNEL_CTRL, fnl_ctrl);
-
-	return rc;
-}
-
 int main(int argc, char **argv) {
 
     init_platform();
@@ -480,6 +481,7 @@ int main(int argc, char **argv) {
 	verbose = true;
 	pause_mode = 0;
 	run_tpiu_pattern_test = false;
+	uart_framed = false;	// true: send the trace in frames for host/cstrace_recv
 	if(!full) {
 		o_trace_start_address = 0x000000000001030;
 		o_trace_end_address = 0x000000000001144;
@@ -514,20 +516,9 @@ int main(int argc, char **argv) {
 	}
 	/*****************************************************************/
 
-	/*****************************************************************/
-	/* Initialize trace buffer in system memory */
-	/*****************************************************************/
-	memset((char *) 0x60000000, 0, 0x20000000);
-	/*****************************************************************/
-
 	/*****************************************************************/
 	/* Configuration of all CoreSight Devices */
 	/*****************************************************************/
-	/* Enable Slave Ports of Funnel Devices */
-	if (cs_manual_path_enable() < 0) {
-		return -1;
-	}
-
 	if (do_configure_trace(board) < 0) {
 		return EXIT_FAILURE;
 	}
@@ -578,7 +569,17 @@ int main(int argc, char **argv) {
 	 * Enable fetch of trace data (Output via UART)
 	 */
 	fetch_trace_option();
-	do_fetch_trace_etb_uart(devices.etr);
+#ifdef ARMR5
+	if (uart_framed) {
+		/* Send the trace in CRC-checked frames at a high baud rate, read
+		 * on the host with host/cstrace_recv */
+		do_uart_trace_start(UART_TRACE_DEFAULT_BAUD);
+	}
+#endif
+	/* Formatted ETR trace compresses several times over, cutting the
+	 * time on the UART to match */
+	do_trace_compress(1, 1);
+	do_fetch_trace_etr_uart(devices.etr);
 
 	cs_shutdown();
 
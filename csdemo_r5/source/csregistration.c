@@ -33,6 +33,10 @@ unsigned int cpu_id[LIB_MAX_CPU_DEVICES];
 
 int registration_verbose = 1;
 
+void *registration_cache;
+unsigned int registration_cache_size;
+int registration_from_cache;
+
 #ifndef BAREMETAL
 static const struct board *do_probe_board(const struct board *board_list)
 {
@@ -100,6 +104,15 @@ static int do_registration(const struct board *board,
     /* clear the devices structure */
     memset(devices, 0, sizeof(struct cs_devices_t));
 
+    registration_from_cache = 0;
+    if (registration_cache_size != 0
+        && cs_registry_load(registration_cache,
+                            registration_cache_size) > 0) {
+        registration_from_cache = 1;
+        if (registration_verbose)
+            printf("CSREG: Restored devices from topology cache\n");
+    }
+
     if (board->do_registration(devices) != 0) {
         if (registration_verbose)
             printf("CSREG: Failed to register board '%s'\n",
@@ -119,6 +132,14 @@ static int do_registration(const struct board *board,
             printf("CSREG: Errors recorded during registration\n");
         return -1;
     }
+    if (!registration_from_cache && registration_cache_size != 0) {
+        int size = cs_registry_save(NULL, 0);
+        if (size <= (int) registration_cache_size) {
+            cs_registry_save(registration_cache, registration_cache_size);
+        } else if (registration_verbose) {
+            printf("CSREG: Topology cache needs %d bytes\n", size);
+        }
+    }
     if (registration_verbose)
         printf("CSREG: Registration complete.\n");
     return 0;
@@ -0,0 +1,142 @@
+/*
+ * trace_dcc.c
+ *
+ * Framed trace over the DCC, a word at a time, waiting on the DCC status
+ * for the debugger to take each word.
+ */
+#include <string.h>
+#include "write_uart.h"
+#include "trace_dcc.h"
+
+#if defined(__arm__) || defined(__aarch64__)
+#define TRACE_DCC_PRESENT 1
+#else
+#define TRACE_DCC_PRESENT 0
+#endif
+
+/* DBGDTRTX still holds a word the debugger has not read */
+#define DCC_STATUS_TXFULL	(1U << 29)
+
+static int trace_dcc_is_ready;
+static u32 trace_dcc_timeout;
+static u32 trace_dcc_seq;
+static u8 trace_dcc_frame[UART_TRACE_MAX_PAYLOAD + UART_TRACE_OVERHEAD + 3U]
+  __attribute__ ((aligned(4)));
+
+#if TRACE_DCC_PRESENT
+static inline u32 dcc_status(void)
+{
+  u32 status;
+
+#ifdef __aarch64__
+  __asm__ __volatile__("mrs %0, mdccsr_el0" : "=r" (status));
+#else
+  __asm__ __volatile__("mrc p14, 0, %0, c0, c1, 0" : "=r" (status) : : "cc");
+#endif
+  return status;
+}
+
+static inline void dcc_put(u32 word)
+{
+#ifdef __aarch64__
+  __asm__ __volatile__("msr dbgdtrtx_el0, %0" : : "r" ((u64) word));
+#else
+  __asm__ __volatile__("mcr p14, 0, %0, c0, c5, 0" : : "r" (word));
+#endif
+}
+#endif
+
+/* Write a word once the debugger has read the last one.  Gives up and
+   stops the transport if it does not within the timeout. */
+static int dcc_write(u32 word)
+{
+#if TRACE_DCC_PRESENT
+  u32 polls = 0;
+
+  while (dcc_status() & DCC_STATUS_TXFULL) {
+    if (++polls >= trace_dcc_timeout) {
+      trace_dcc_is_ready = 0;
+      return -1;
+    }
+  }
+  dcc_put(word);
+  return 0;
+#else
+  (void) word;
+  return -1;
+#endif
+}
+
+static int dcc_chunk(const u8 *data, u32 len)
+{
+  u32 i, word;
+
+  if (dcc_write(TRACE_DCC_CHUNK | len) != 0) {
+    return -1;
+  }
+  for (i = 0; i < len; i += 4U) {
+    word = (u32) data[i] | ((u32) data[i + 1] << 8) |
+      ((u32) data[i + 2] << 16) | ((u32) data[i + 3] << 24);
+    if (dcc_write(word) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int dcc_frame(const u8 *data, u32 len)
+{
+  u32 size;
+
+  size = uart_trace_build_frame(trace_dcc_frame, trace_dcc_seq++, data, len);
+  memset(trace_dcc_frame + size, 0, 3U);
+  return dcc_chunk(trace_dcc_frame, size);
+}
+
+int trace_dcc_init(u32 timeout)
+{
+  trace_dcc_is_ready = 0;
+  if (!TRACE_DCC_PRESENT) {
+    return -1;
+  }
+  trace_dcc_timeout = (timeout != 0) ? timeout : TRACE_DCC_DEFAULT_TIMEOUT;
+  trace_dcc_seq = 0;
+  trace_dcc_is_ready = 1;
+  return 0;
+}
+
+int trace_dcc_ready(void)
+{
+  return trace_dcc_is_ready;
+}
+
+int trace_dcc_send(const void *buf, u32 nbytes)
+{
+  const u8 *p = (const u8 *) buf;
+  u32 n, left = nbytes;
+
+  if (!trace_dcc_is_ready) {
+    return -1;
+  }
+  while (left > 0) {
+    n = (left < UART_TRACE_MAX_PAYLOAD) ? left : UART_TRACE_MAX_PAYLOAD;
+    if (dcc_frame(p, n) != 0) {
+      return -1;
+    }
+    p += n;
+    left -= n;
+  }
+  return (int) nbytes;
+}
+
+int trace_dcc_end(void)
+{
+  int rc;
+
+  if (!trace_dcc_is_ready) {
+    return -1;
+  }
+  rc = dcc_frame(NULL, 0);
+  trace_dcc_seq = 0;
+  return rc;
+}
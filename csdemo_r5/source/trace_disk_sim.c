@@ -0,0 +1,72 @@
+/*
+ * trace_disk_sim.c
+ *
+ * Disk image block device for trace_fat.c in the CS_SIM build.
+ */
+#ifdef CS_SIM
+
+#include <stdio.h>
+#include "trace_disk_sim.h"
+
+static FILE *disk_image;
+static unsigned int disk_writes, disk_multi_writes;
+
+static int disk_seek(u32 lba)
+{
+  return fseek(disk_image, (long) lba * TRACE_FAT_SECTOR, SEEK_SET);
+}
+
+static int disk_read(void *ctx, u32 lba, u32 count, void *buf)
+{
+  (void) ctx;
+  if (disk_seek(lba) != 0
+      || fread(buf, TRACE_FAT_SECTOR, count, disk_image) != count) {
+    return -1;
+  }
+  return 0;
+}
+
+static int disk_write(void *ctx, u32 lba, u32 count, const void *buf)
+{
+  (void) ctx;
+  if (disk_seek(lba) != 0
+      || fwrite(buf, TRACE_FAT_SECTOR, count, disk_image) != count
+      || fflush(disk_image) != 0) {
+    return -1;
+  }
+  disk_writes++;
+  if (count > 1) {
+    disk_multi_writes++;
+  }
+  return 0;
+}
+
+static const trace_fat_blkdev_t disk_blkdev = {
+  NULL, disk_read, disk_write
+};
+
+const trace_fat_blkdev_t *trace_disk_sim_init(const char *image)
+{
+  if (disk_image != NULL) {
+    fclose(disk_image);
+  }
+  disk_image = fopen(image, "r+b");
+  if (disk_image == NULL) {
+    return NULL;
+  }
+  disk_writes = 0;
+  disk_multi_writes = 0;
+  return &disk_blkdev;
+}
+
+unsigned int trace_disk_sim_writes(void)
+{
+  return disk_writes;
+}
+
+unsigned int trace_disk_sim_multi_writes(void)
+{
+  return disk_multi_writes;
+}
+
+#endif /* CS_SIM */
@@ -0,0 +1,246 @@
+/*
+ * trace_dma.c
+ *
+ * Moving trace and memory dumps with a ZDMA channel in linked-list mode,
+ * with the CPU copying when no channel is set up.
+ */
+#include <string.h>
+#include "xparameters.h"
+#include "xzdma.h"
+#include "xil_cache.h"
+#include "trace_dma.h"
+
+/* Largest transfer a descriptor can describe, kept cache line aligned */
+#define TRACE_DMA_MAX_XFER	0x3FFFFFC0U
+
+/* Errors that end a transfer; the counter overflows do not */
+#define TRACE_DMA_ERRORS	(XZDMA_IXR_AXI_WR_DATA_MASK | XZDMA_IXR_AXI_RD_DATA_MASK | \
+				 XZDMA_IXR_AXI_RD_DST_DSCR_MASK | XZDMA_IXR_AXI_RD_SRC_DSCR_MASK)
+
+static XZDma trace_zdma;
+static int trace_dma_is_ready;
+static int trace_dma_irq;		/* completions are handled under interrupts */
+
+/* The driver puts the source descriptors in the first half and the
+   destination descriptors in the second */
+static XZDma_LlDscr trace_dma_dscr[2 * TRACE_DMA_MAX_DSCR] __attribute__ ((aligned(64)));
+static XZDma_Transfer trace_dma_xfer[TRACE_DMA_MAX_DSCR];
+static u32 trace_dma_n_xfer;		/* transfers in the running batch */
+
+/* The running job */
+static const trace_dma_seg_t *job_segs;
+static u32 job_n_segs;
+static u32 job_seg;			/* next segment to queue */
+static u32 job_offset;			/* bytes of it already queued */
+static trace_dma_done_t job_done;
+static void *job_ref;
+static volatile int job_busy;
+static volatile int job_status;
+
+static void trace_dma_cpu_copy(const trace_dma_seg_t *segs, u32 n_segs)
+{
+  u32 i;
+
+  for (i = 0; i < n_segs; i++) {
+    memcpy(segs[i].dst, segs[i].src, segs[i].size);
+  }
+}
+
+static void trace_dma_finish(int status)
+{
+  job_status = status;
+  job_busy = 0;
+  if (job_done != NULL) {
+    job_done(job_ref, status);
+  }
+}
+
+/* Queue up to TRACE_DMA_MAX_DSCR transfers from where the job got to, and
+   start them.  Returns 0 when there is nothing left to copy. */
+static int trace_dma_next_batch(void)
+{
+  XZDma_Transfer *x;
+  u32 size;
+
+  trace_dma_n_xfer = 0;
+  while (job_seg < job_n_segs && trace_dma_n_xfer < TRACE_DMA_MAX_DSCR) {
+    size = job_segs[job_seg].size - job_offset;
+    if (size > TRACE_DMA_MAX_XFER) {
+      size = TRACE_DMA_MAX_XFER;
+    }
+    if (size > 0) {
+      x = &trace_dma_xfer[trace_dma_n_xfer++];
+      x->SrcAddr = (UINTPTR) job_segs[job_seg].src + job_offset;
+      x->DstAddr = (UINTPTR) job_segs[job_seg].dst + job_offset;
+      x->Size = size;
+      x->SrcCoherent = 0;
+      x->DstCoherent = 0;
+      x->Pause = 0;
+      /* Write back what the CPU has written to the source, and drop any
+         destination lines so none are written back over the copy */
+      Xil_DCacheFlushRange(x->SrcAddr, size);
+      Xil_DCacheFlushRange(x->DstAddr, size);
+    }
+    job_offset += size;
+    if (job_offset >= job_segs[job_seg].size) {
+      job_seg++;
+      job_offset = 0;
+    }
+  }
+  if (trace_dma_n_xfer == 0) {
+    return 0;
+  }
+  if (XZDma_Start(&trace_zdma, trace_dma_xfer, trace_dma_n_xfer) != XST_SUCCESS) {
+    return -1;
+  }
+  return 1;
+}
+
+/* A batch has completed: drop stale destination lines the CPU may have
+   fetched meanwhile, then start the next batch or finish the job */
+static void trace_dma_batch_done(void)
+{
+  u32 i;
+  int rc;
+
+  for (i = 0; i < trace_dma_n_xfer; i++) {
+    Xil_DCacheInvalidateRange(trace_dma_xfer[i].DstAddr, trace_dma_xfer[i].Size);
+  }
+  rc = trace_dma_next_batch();
+  if (rc <= 0) {
+    trace_dma_finish(rc);
+  }
+}
+
+/* Put the channel in linked-list mode, interrupting on completion and
+   errors when interrupts are used */
+static int trace_dma_setup(void)
+{
+  if (XZDma_SetMode(&trace_zdma, TRUE, XZDMA_NORMAL_MODE) != XST_SUCCESS) {
+    return -1;
+  }
+  if (trace_dma_irq) {
+    XZDma_EnableIntr(&trace_zdma, XZDMA_IXR_DMA_DONE_MASK | TRACE_DMA_ERRORS);
+  }
+  return 0;
+}
+
+/* Act on the channel's status, once it has been cleared.  This clears it
+   before the next batch starts, so that batch's completion is not lost,
+   which is why the driver's own interrupt handler is not used. */
+static void trace_dma_service(u32 status)
+{
+  if (status & TRACE_DMA_ERRORS) {
+    trace_zdma.ChannelState = XZDMA_IDLE;
+    XZDma_Reset(&trace_zdma);
+    if (trace_dma_setup() != 0) {
+      trace_dma_is_ready = 0;
+    }
+    trace_dma_finish(-1);
+  } else if (status & XZDMA_IXR_DMA_DONE_MASK) {
+    trace_zdma.ChannelState = XZDMA_IDLE;
+    trace_dma_batch_done();
+  }
+}
+
+static void trace_dma_irq_handler(void *ref)
+{
+  u32 status;
+
+  (void) ref;
+  status = XZDma_IntrGetStatus(&trace_zdma);
+  XZDma_IntrClear(&trace_zdma, status);
+  if (job_busy) {
+    trace_dma_service(status);
+  }
+}
+
+int trace_dma_init(u16 device_id, XScuGic *gic, u32 irq_id)
+{
+  XZDma_Config *config;
+
+  if (job_busy) {
+    return -1;
+  }
+  trace_dma_is_ready = 0;
+  config = XZDma_LookupConfig(device_id);
+  trace_dma_irq = (gic != NULL);
+  if (config == NULL
+      || XZDma_CfgInitialize(&trace_zdma, config, config->BaseAddress) != XST_SUCCESS
+      || trace_dma_setup() != 0) {
+    return -1;
+  }
+  if (XZDma_CreateBDList(&trace_zdma, XZDMA_LINKEDLIST, (UINTPTR) trace_dma_dscr,
+                         sizeof trace_dma_dscr) < TRACE_DMA_MAX_DSCR) {
+    return -1;
+  }
+  if (gic != NULL) {
+    if (XScuGic_Connect(gic, irq_id, (Xil_InterruptHandler) trace_dma_irq_handler,
+                        &trace_zdma) != XST_SUCCESS) {
+      return -1;
+    }
+    XScuGic_Enable(gic, irq_id);
+  }
+  trace_dma_is_ready = 1;
+  return 0;
+}
+
+int trace_dma_available(void)
+{
+  return trace_dma_is_ready;
+}
+
+int trace_dma_copy(const trace_dma_seg_t *segs, u32 n_segs,
+                   trace_dma_done_t done, void *ref)
+{
+  int rc;
+
+  if (job_busy) {
+    return -1;
+  }
+  job_done = done;
+  job_ref = ref;
+  if (!trace_dma_is_ready) {
+    trace_dma_cpu_copy(segs, n_segs);
+    trace_dma_finish(0);
+    return 0;
+  }
+  job_segs = segs;
+  job_n_segs = n_segs;
+  job_seg = 0;
+  job_offset = 0;
+  job_status = 0;
+  job_busy = 1;
+  rc = trace_dma_next_batch();
+  if (rc <= 0) {
+    trace_dma_finish(rc);
+  }
+  return 0;
+}
+
+int trace_dma_busy(void)
+{
+  return job_busy;
+}
+
+int trace_dma_poll(void)
+{
+  u32 status;
+
+  if (!job_busy || trace_dma_irq) {
+    return job_busy;
+  }
+  status = XZDma_IntrGetStatus(&trace_zdma);
+  if (status & (XZDMA_IXR_DMA_DONE_MASK | TRACE_DMA_ERRORS)) {
+    XZDma_IntrClear(&trace_zdma, status);
+    trace_dma_service(status);
+  }
+  return job_busy;
+}
+
+int trace_dma_wait(void)
+{
+  while (trace_dma_poll()) {
+  }
+  return job_status;
+}
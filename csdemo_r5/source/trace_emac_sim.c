@@ -0,0 +1,237 @@
+/*
+ * trace_emac_sim.c
+ *
+ * Software EMAC model for trace_udp.c in the CS_SIM build.  It stands in
+ * for the wire and the host's network stack: ARP requests for the host
+ * are answered here, IPv4 UDP frames for the host are passed to a socket
+ * on the loopback interface, and what comes back on the socket is made
+ * into frames for the sender to receive.
+ */
+#ifdef CS_SIM
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "trace_emac_sim.h"
+
+#define SIM_FRAME	1536U
+#define SIM_RX_FRAMES	64U
+#define SIM_ETH_HEADER	14U
+#define SIM_IP_HEADER	20U
+#define SIM_UDP_HEADER	8U
+
+static const u8 sim_host_mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+
+static trace_udp_addr_t sim_addr;
+static int sim_sock = -1;
+static struct sockaddr_in sim_host;
+static unsigned int sim_loss;
+static unsigned int sim_lost;
+static u32 sim_rand = 1U;
+static u32 sim_sent;
+static u8 sim_rx[SIM_RX_FRAMES][SIM_FRAME];
+static u32 sim_rx_len[SIM_RX_FRAMES];
+static u32 sim_rx_head, sim_rx_tail;
+
+static u32 sim_be16(const u8 *p)
+{
+  return ((u32) p[0] << 8) | p[1];
+}
+
+static void sim_put_be16(u8 *p, u32 v)
+{
+  p[0] = (u8) (v >> 8);
+  p[1] = (u8) v;
+}
+
+static void sim_put_be32(u8 *p, u32 v)
+{
+  sim_put_be16(p, v >> 16);
+  sim_put_be16(p + 2, v);
+}
+
+/* A repeatable pattern of losses */
+static int sim_lose(void)
+{
+  if (sim_loss == 0) {
+    return 0;
+  }
+  sim_rand = sim_rand * 1103515245U + 12345U;
+  if ((sim_rand >> 16) % 1000U < sim_loss) {
+    sim_lost++;
+    return 1;
+  }
+  return 0;
+}
+
+static u8 *sim_rx_slot(void)
+{
+  if (sim_rx_head - sim_rx_tail >= SIM_RX_FRAMES) {
+    return NULL;
+  }
+  return sim_rx[sim_rx_head % SIM_RX_FRAMES];
+}
+
+static void sim_rx_push(u32 len)
+{
+  sim_rx_len[sim_rx_head++ % SIM_RX_FRAMES] = len;
+}
+
+/* The host answering an ARP request for its address */
+static void sim_arp(const u8 *f)
+{
+  const u8 *arp = f + SIM_ETH_HEADER;
+  u8 *r = sim_rx_slot(), *ra;
+
+  if (r == NULL || sim_be16(arp + 6) != 1U
+      || ((u32) arp[24] << 24 | (u32) arp[25] << 16 | (u32) arp[26] << 8 | arp[27]) != sim_addr.host_ip) {
+    return;
+  }
+  ra = r + SIM_ETH_HEADER;
+  memcpy(r, f + 6, 6);
+  memcpy(r + 6, sim_host_mac, 6);
+  sim_put_be16(r + 12, 0x0806U);
+  memcpy(ra, arp, 6);
+  sim_put_be16(ra + 6, 2U);
+  memcpy(ra + 8, sim_host_mac, 6);
+  sim_put_be32(ra + 14, sim_addr.host_ip);
+  memcpy(ra + 18, arp + 8, 10);
+  sim_rx_push(SIM_ETH_HEADER + 28U);
+}
+
+static int sim_tx(void *ctx, const void *hdr, u32 hdr_len, const void *data, u32 len)
+{
+  static u8 f[SIM_FRAME];
+  const u8 *ip = f + SIM_ETH_HEADER;
+  u32 ihl;
+
+  (void) ctx;
+  if (hdr_len + len > sizeof f) {
+    return -1;
+  }
+  memcpy(f, hdr, hdr_len);
+  if (len > 0) {
+    memcpy(f + hdr_len, data, len);
+  }
+  sim_sent++;
+  if (sim_be16(f + 12) == 0x0806U) {
+    sim_arp(f);
+    return 0;
+  }
+  if (sim_be16(f + 12) != 0x0800U || ip[9] != 17U || sim_lose()) {
+    return 0;
+  }
+  ihl = (ip[0] & 0xFU) * 4U;
+  (void) sendto(sim_sock, ip + ihl + SIM_UDP_HEADER,
+                sim_be16(ip + ihl + 4) - SIM_UDP_HEADER, 0,
+                (struct sockaddr *) &sim_host, sizeof sim_host);
+  return 0;
+}
+
+static u32 sim_tx_done(void *ctx)
+{
+  u32 n = sim_sent;
+
+  (void) ctx;
+  sim_sent = 0;
+  return n;
+}
+
+/* Make what the host has sent into frames to the target */
+static void sim_poll_socket(void)
+{
+  u8 *f, *ip, *udp;
+  ssize_t n;
+
+  while ((f = sim_rx_slot()) != NULL) {
+    ip = f + SIM_ETH_HEADER;
+    udp = ip + SIM_IP_HEADER;
+    n = recv(sim_sock, udp + SIM_UDP_HEADER,
+             SIM_FRAME - SIM_ETH_HEADER - SIM_IP_HEADER - SIM_UDP_HEADER, 0);
+    if (n < 0) {
+      return;
+    }
+    if (sim_lose()) {
+      continue;
+    }
+    memcpy(f, sim_addr.mac, 6);
+    memcpy(f + 6, sim_host_mac, 6);
+    sim_put_be16(f + 12, 0x0800U);
+    memset(ip, 0, SIM_IP_HEADER);
+    ip[0] = 0x45U;
+    sim_put_be16(ip + 2, SIM_IP_HEADER + SIM_UDP_HEADER + (u32) n);
+    ip[8] = 64U;
+    ip[9] = 17U;
+    sim_put_be32(ip + 12, sim_addr.host_ip);
+    sim_put_be32(ip + 16, sim_addr.ip);
+    sim_put_be16(udp, sim_addr.port);
+    sim_put_be16(udp + 2, sim_addr.port);
+    sim_put_be16(udp + 4, SIM_UDP_HEADER + (u32) n);
+    sim_put_be16(udp + 6, 0);
+    sim_rx_push(SIM_ETH_HEADER + SIM_IP_HEADER + SIM_UDP_HEADER + (u32) n);
+  }
+}
+
+static u32 sim_rx_frame(void *ctx, void *buf, u32 size)
+{
+  u32 len;
+
+  (void) ctx;
+  sim_poll_socket();
+  if (sim_rx_tail == sim_rx_head) {
+    return 0;
+  }
+  len = sim_rx_len[sim_rx_tail % SIM_RX_FRAMES];
+  if (len > size) {
+    len = size;
+  }
+  memcpy(buf, sim_rx[sim_rx_tail++ % SIM_RX_FRAMES], len);
+  return len;
+}
+
+static u32 sim_ms(void *ctx)
+{
+  struct timespec ts;
+
+  (void) ctx;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u32) ts.tv_sec * 1000U + (u32) (ts.tv_nsec / 1000000);
+}
+
+static const trace_udp_netif_t sim_netif = {
+  NULL, sim_tx, sim_tx_done, sim_rx_frame, sim_ms
+};
+
+const trace_udp_netif_t *trace_emac_sim_init(const trace_udp_addr_t *addr,
+                                             unsigned int loss_per_mille)
+{
+  if (sim_sock < 0) {
+    sim_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sim_sock < 0) {
+      return NULL;
+    }
+    (void) fcntl(sim_sock, F_SETFL, O_NONBLOCK);
+  }
+  sim_addr = *addr;
+  memset(&sim_host, 0, sizeof sim_host);
+  sim_host.sin_family = AF_INET;
+  sim_host.sin_port = htons(addr->port);
+  sim_host.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  sim_loss = loss_per_mille;
+  sim_lost = 0;
+  sim_sent = 0;
+  sim_rx_head = 0;
+  sim_rx_tail = 0;
+  return &sim_netif;
+}
+
+unsigned int trace_emac_sim_lost(void)
+{
+  return sim_lost;
+}
+
+#endif /* CS_SIM */
@@ -0,0 +1,796 @@
+/*
+ * trace_fat.c
+ *
+ * Write-only FAT16/FAT32 for snapshots.  One sector of directory and one
+ * of FAT are cached; file data goes to the card a buffer of clusters at
+ * a time, or straight from the caller's data when there is enough of it.
+ * Clusters are taken in order from the first free one, so on a card that
+ * is not fragmented each file is one run of sectors.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "trace_fat.h"
+
+#define FAT_ENTRY	32U
+#define FAT_ENTRIES	(TRACE_FAT_SECTOR / FAT_ENTRY)
+#define FAT_ATTR_DIR	0x10U
+#define FAT_ATTR_ARCHIVE 0x20U
+#define FAT_ATTR_LFN	0x0FU
+#define FAT_ATTR_VOLUME	0x08U
+#define FAT_NT_LOWER_BASE 0x08U
+#define FAT_NT_LOWER_EXT 0x10U
+#define FAT_LFN_CHARS	13U
+#define FAT_NAME_MAX	64U
+#define FAT_DATE	0x0021U	/* 1 Jan 1980, with no clock to go by */
+#define FAT16_EOC	0xFFFFU
+#define FAT32_EOC	0x0FFFFFFFU
+#define FSINFO_LEAD	0x41615252U
+#define FSINFO_STRUCT	0x61417272U
+
+typedef struct fat_volume {
+  const trace_fat_blkdev_t *dev;
+  u32 fat32;
+  u32 spc;			/* sectors per cluster */
+  u32 nfats;
+  u32 fat_size;			/* sectors in each FAT */
+  u32 fat_lba;
+  u32 root_lba;			/* FAT16 */
+  u32 root_sectors;		/* FAT16 */
+  u32 root_cluster;		/* FAT32 */
+  u32 data_lba;
+  u32 clusters;			/* data clusters, numbered from 2 */
+  u32 fsinfo_lba;		/* 0 if none */
+  u32 free_count;
+  u32 next_free;
+} fat_volume_t;
+
+static fat_volume_t fat;
+static int fat_mounted;
+
+static u8 fat_sec[TRACE_FAT_SECTOR] __attribute__ ((aligned(64)));
+static u32 fat_sec_lba;
+static int fat_sec_valid, fat_sec_dirty;
+
+static u8 fat_tab[TRACE_FAT_SECTOR] __attribute__ ((aligned(64)));
+static u32 fat_tab_lba;			/* relative to the first FAT */
+static int fat_tab_valid, fat_tab_dirty;
+
+static u8 fat_buf[TRACE_FAT_BUF_SIZE] __attribute__ ((aligned(64)));
+static u32 fat_fill;
+
+/* The directory made by trace_fat_mkdir() */
+static u32 fat_dir_cluster;		/* 0 if none */
+static u32 fat_dir_last;		/* its last cluster */
+static u32 fat_dir_used;		/* entries used in its last cluster */
+static u32 fat_alias;			/* for the short names of long names */
+
+/* The file open */
+static int fat_file_open;
+static u32 fat_file_first, fat_file_last;
+static u32 fat_file_size;
+static u32 fat_file_entry_lba, fat_file_entry_off;
+
+static u32 get_le16(const u8 *p)
+{
+  return p[0] | ((u32) p[1] << 8);
+}
+
+static u32 get_le32(const u8 *p)
+{
+  return get_le16(p) | (get_le16(p + 2) << 16);
+}
+
+static void put_le16(u8 *p, u32 v)
+{
+  p[0] = (u8) v;
+  p[1] = (u8) (v >> 8);
+}
+
+static void put_le32(u8 *p, u32 v)
+{
+  put_le16(p, v);
+  put_le16(p + 2, v >> 16);
+}
+
+static u32 cluster_bytes(void)
+{
+  return fat.spc * TRACE_FAT_SECTOR;
+}
+
+static u32 cluster_lba(u32 c)
+{
+  return fat.data_lba + (c - 2U) * fat.spc;
+}
+
+/* The cached directory sector */
+static int sec_flush(void)
+{
+  if (fat_sec_valid && fat_sec_dirty) {
+    if (fat.dev->write(fat.dev->ctx, fat_sec_lba, 1, fat_sec) != 0) {
+      return -1;
+    }
+    fat_sec_dirty = 0;
+  }
+  return 0;
+}
+
+static u8 *sec_get(u32 lba)
+{
+  if (fat_sec_valid && fat_sec_lba == lba) {
+    return fat_sec;
+  }
+  if (sec_flush() != 0) {
+    return NULL;
+  }
+  fat_sec_valid = 0;
+  if (fat.dev->read(fat.dev->ctx, lba, 1, fat_sec) != 0) {
+    return NULL;
+  }
+  fat_sec_lba = lba;
+  fat_sec_valid = 1;
+  return fat_sec;
+}
+
+/* The cached FAT sector, written to each copy of the FAT */
+static int tab_flush(void)
+{
+  u32 i;
+
+  if (fat_tab_valid && fat_tab_dirty) {
+    for (i = 0; i < fat.nfats; i++) {
+      if (fat.dev->write(fat.dev->ctx, fat.fat_lba + i * fat.fat_size + fat_tab_lba,
+                         1, fat_tab) != 0) {
+        return -1;
+      }
+    }
+    fat_tab_dirty = 0;
+  }
+  return 0;
+}
+
+static u8 *tab_entry(u32 c)
+{
+  u32 off = c * (fat.fat32 ? 4U : 2U);
+  u32 lba = off / TRACE_FAT_SECTOR;
+
+  if (!fat_tab_valid || fat_tab_lba != lba) {
+    if (tab_flush() != 0) {
+      return NULL;
+    }
+    fat_tab_valid = 0;
+    if (fat.dev->read(fat.dev->ctx, fat.fat_lba + lba, 1, fat_tab) != 0) {
+      return NULL;
+    }
+    fat_tab_lba = lba;
+    fat_tab_valid = 1;
+  }
+  return fat_tab + off % TRACE_FAT_SECTOR;
+}
+
+/* The next cluster, or 0 at the end of the chain or on error */
+static u32 fat_next(u32 c)
+{
+  u8 *e = tab_entry(c);
+  u32 next;
+
+  if (e == NULL) {
+    return 0;
+  }
+  next = fat.fat32 ? get_le32(e) & 0x0FFFFFFFU : get_le16(e);
+  return (next >= 2U && next < fat.clusters + 2U) ? next : 0;
+}
+
+static int fat_set(u32 c, u32 v)
+{
+  u8 *e = tab_entry(c);
+
+  if (e == NULL) {
+    return -1;
+  }
+  if (fat.fat32) {
+    put_le32(e, (get_le32(e) & 0xF0000000U) | (v & 0x0FFFFFFFU));
+  } else {
+    put_le16(e, v);
+  }
+  fat_tab_dirty = 1;
+  return 0;
+}
+
+/* Take the first free cluster from the last one taken, and chain it after
+   prev.  Returns it, or 0 if the volume is full. */
+static u32 fat_alloc(u32 prev)
+{
+  u32 c = fat.next_free, i;
+  u8 *e;
+
+  for (i = 0; i < fat.clusters; i++, c++) {
+    if (c < 2U || c >= fat.clusters + 2U) {
+      c = 2U;
+    }
+    if ((e = tab_entry(c)) == NULL) {
+      return 0;
+    }
+    if ((fat.fat32 ? get_le32(e) & 0x0FFFFFFFU : get_le16(e)) != 0) {
+      continue;
+    }
+    if (fat_set(c, fat.fat32 ? FAT32_EOC : FAT16_EOC) != 0
+        || (prev != 0 && fat_set(prev, c) != 0)) {
+      return 0;
+    }
+    fat.next_free = c + 1U;
+    if (fat.free_count != 0xFFFFFFFFU && fat.free_count != 0) {
+      fat.free_count--;
+    }
+    return c;
+  }
+  return 0;
+}
+
+/* A cluster for a directory, cleared to end-of-directory entries */
+static u32 fat_alloc_dir(u32 prev)
+{
+  static const u8 zero[TRACE_FAT_SECTOR] __attribute__ ((aligned(64)));
+  u32 c = fat_alloc(prev), i;
+
+  if (c == 0) {
+    return 0;
+  }
+  if (fat_sec_valid && fat_sec_lba - cluster_lba(c) < fat.spc) {
+    fat_sec_valid = 0;
+  }
+  for (i = 0; i < fat.spc; i++) {
+    if (fat.dev->write(fat.dev->ctx, cluster_lba(c) + i, 1, zero) != 0) {
+      return 0;
+    }
+  }
+  return c;
+}
+
+static int fat_sync(void)
+{
+  u8 *p;
+
+  if (sec_flush() != 0 || tab_flush() != 0) {
+    return -1;
+  }
+  if (fat.fsinfo_lba != 0) {
+    if ((p = sec_get(fat.fsinfo_lba)) == NULL) {
+      return -1;
+    }
+    put_le32(p + 488, fat.free_count);
+    put_le32(p + 492, fat.next_free);
+    fat_sec_dirty = 1;
+    if (sec_flush() != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* A character allowed in a short name, upper case */
+static int short_char(char c)
+{
+  return (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+    || (c != '\0' && strchr("_-~!#$%&'()@^{}", c) != NULL);
+}
+
+static char upper(char c)
+{
+  return (c >= 'a' && c <= 'z') ? (char) (c - 'a' + 'A') : c;
+}
+
+/* Put name as a short name, each part in one case, with the flags for a
+   lower case part.  Returns 0, or -1 if it needs a long name. */
+static int short_name(const char *name, u8 out[11], u8 *nt)
+{
+  const char *dot = strrchr(name, '.');
+  u32 base = dot ? (u32) (dot - name) : strlen(name);
+  u32 ext = dot ? strlen(dot + 1) : 0, i;
+  int lower[2] = { 0, 0 }, upper_seen[2] = { 0, 0 };
+  const char *p;
+  char c;
+
+  if (base == 0 || base > 8U || ext > 3U || (dot && ext == 0)) {
+    return -1;
+  }
+  memset(out, ' ', 11);
+  for (i = 0, p = name; *p != '\0'; p++) {
+    if (p == dot) {
+      i = 8;
+      continue;
+    }
+    c = upper(*p);
+    if (!short_char(c)) {
+      return -1;
+    }
+    lower[i >= 8U] |= (*p >= 'a' && *p <= 'z');
+    upper_seen[i >= 8U] |= (*p >= 'A' && *p <= 'Z');
+    out[i++] = (u8) c;
+  }
+  if ((lower[0] && upper_seen[0]) || (lower[1] && upper_seen[1])) {
+    return -1;
+  }
+  *nt = (lower[0] ? FAT_NT_LOWER_BASE : 0U) | (lower[1] ? FAT_NT_LOWER_EXT : 0U);
+  return 0;
+}
+
+/* The short name for a long name: as much of it as fits, then ~N */
+static void alias_name(const char *name, u8 out[11])
+{
+  const char *dot = strrchr(name, '.');
+  char num[12];
+  u32 i, n = 0, len, max;
+  const char *p;
+  char c;
+
+  sprintf(num, "~%u", (unsigned int) ++fat_alias);
+  len = strlen(num);
+  max = 8U - len;
+  memset(out, ' ', 11);
+  for (p = name; *p != '\0' && p != dot && n < max; p++) {
+    if (short_char(c = upper(*p))) {
+      out[n++] = (u8) c;
+    }
+  }
+  memcpy(out + n, num, len);
+  if (dot != NULL) {
+    for (i = 0, p = dot + 1; *p != '\0' && i < 3U; p++) {
+      if (short_char(c = upper(*p))) {
+        out[8U + i++] = (u8) c;
+      }
+    }
+  }
+}
+
+static u8 lfn_checksum(const u8 name[11])
+{
+  u8 sum = 0;
+  u32 i;
+
+  for (i = 0; i < 11U; i++) {
+    sum = (u8) (((sum & 1U) << 7) + (sum >> 1) + name[i]);
+  }
+  return sum;
+}
+
+static void make_entry(u8 *e, const u8 name[11], u8 attr, u8 nt, u32 c, u32 size)
+{
+  memset(e, 0, FAT_ENTRY);
+  memcpy(e, name, 11);
+  e[11] = attr;
+  e[12] = nt;
+  put_le16(e + 16, FAT_DATE);
+  put_le16(e + 18, FAT_DATE);
+  put_le16(e + 20, c >> 16);
+  put_le16(e + 24, FAT_DATE);
+  put_le16(e + 26, c);
+  put_le32(e + 28, size);
+}
+
+/* Append an entry to the directory, growing it as needed, and say where
+   it went */
+static int dir_append(const u8 *entry, u32 *lba, u32 *off)
+{
+  u32 c;
+  u8 *p;
+
+  if (fat_dir_used == fat.spc * FAT_ENTRIES) {
+    if ((c = fat_alloc_dir(fat_dir_last)) == 0) {
+      return -1;
+    }
+    fat_dir_last = c;
+    fat_dir_used = 0;
+  }
+  *lba = cluster_lba(fat_dir_last) + fat_dir_used / FAT_ENTRIES;
+  *off = (fat_dir_used % FAT_ENTRIES) * FAT_ENTRY;
+  if ((p = sec_get(*lba)) == NULL) {
+    return -1;
+  }
+  memcpy(p + *off, entry, FAT_ENTRY);
+  fat_sec_dirty = 1;
+  fat_dir_used++;
+  return 0;
+}
+
+/* Look for name in the directory, as a short name, or as a long name in
+   any case.  Returns 0 if it is not there, TRACE_FAT_EXISTS, or -1. */
+static int dir_find(const char *name)
+{
+  u8 sname[11], nt, *p = NULL, *e, sum = 0;
+  u16 lfn[FAT_NAME_MAX + FAT_LFN_CHARS];
+  u32 c = fat_dir_cluster, len = strlen(name), n, i, j, k, ord;
+  int is_short = (short_name(name, sname, &nt) == 0), have_lfn = 0;
+
+  for (;;) {
+    n = (c == fat_dir_last) ? fat_dir_used : fat.spc * FAT_ENTRIES;
+    for (i = 0; i < n; i++) {
+      if (i % FAT_ENTRIES == 0U
+          && (p = sec_get(cluster_lba(c) + i / FAT_ENTRIES)) == NULL) {
+        return -1;
+      }
+      e = p + (i % FAT_ENTRIES) * FAT_ENTRY;
+      if (e[0] == 0xE5U) {
+        have_lfn = 0;
+      } else if (e[11] == FAT_ATTR_LFN) {
+        /* The pieces of a long name come last first */
+        ord = e[0] & 0x3FU;
+        if (ord == 0U || ord * FAT_LFN_CHARS > sizeof lfn / sizeof lfn[0]) {
+          have_lfn = 0;
+          continue;
+        }
+        if (e[0] & 0x40U) {
+          memset(lfn, 0, sizeof lfn);
+          have_lfn = 1;
+          sum = e[13];
+        }
+        for (j = 0; j < FAT_LFN_CHARS; j++) {
+          k = (j < 5U) ? 1U + 2U * j : (j < 11U) ? 14U + 2U * (j - 5U) : 28U + 2U * (j - 11U);
+          lfn[(ord - 1U) * FAT_LFN_CHARS + j] = (u16) get_le16(e + k);
+        }
+      } else {
+        if ((e[11] & FAT_ATTR_VOLUME) == 0) {
+          if (is_short && memcmp(e, sname, 11) == 0) {
+            return TRACE_FAT_EXISTS;
+          }
+          if (have_lfn && sum == lfn_checksum(e)) {
+            for (j = 0; j < len && lfn[j] < 0x80U
+                 && upper((char) lfn[j]) == upper(name[j]); j++) {
+              ;
+            }
+            if (j == len && (lfn[len] == 0x0000U || lfn[len] == 0xFFFFU)) {
+              return TRACE_FAT_EXISTS;
+            }
+          }
+        }
+        have_lfn = 0;
+      }
+    }
+    if (c == fat_dir_last) {
+      return 0;
+    }
+    if ((c = fat_next(c)) == 0) {
+      return -1;
+    }
+  }
+}
+
+/* Find a free entry in the root for name, growing a FAT32 root if it is
+   full */
+static int root_slot(const u8 name[11], u32 *slot_lba, u32 *slot_off)
+{
+  u32 c = fat.root_cluster, last = 0, lba, n, i, off;
+  int found = 0;
+  u8 *e;
+
+  for (;;) {
+    lba = fat.fat32 ? cluster_lba(c) : fat.root_lba;
+    n = fat.fat32 ? fat.spc : fat.root_sectors;
+    for (i = 0; i < n; i++) {
+      if ((e = sec_get(lba + i)) == NULL) {
+        return -1;
+      }
+      for (off = 0; off < TRACE_FAT_SECTOR; off += FAT_ENTRY) {
+        if (e[off] == 0x00U || e[off] == 0xE5U) {
+          if (!found) {
+            found = 1;
+            *slot_lba = lba + i;
+            *slot_off = off;
+          }
+          if (e[off] == 0x00U) {
+            return 0;
+          }
+        } else if ((e[off + 11] & FAT_ATTR_VOLUME) == 0
+                   && memcmp(e + off, name, 11) == 0) {
+          return TRACE_FAT_EXISTS;
+        }
+      }
+    }
+    if (!fat.fat32) {
+      break;
+    }
+    last = c;
+    if ((c = fat_next(c)) == 0) {
+      break;
+    }
+  }
+  if (found) {
+    return 0;
+  }
+  if (!fat.fat32 || (c = fat_alloc_dir(last)) == 0) {
+    return -1;
+  }
+  *slot_lba = cluster_lba(c);
+  *slot_off = 0;
+  return 0;
+}
+
+/* Write sectors of file data from data, taking clusters as they are
+   needed, with one write for each run of consecutive clusters.  If the
+   volume fills up, what fits is still written.  Returns 0, or -1 with
+   *done set to the sectors written, which the file's clusters hold. */
+static int file_write_run(const u8 *data, u32 sectors, u32 *done)
+{
+  u32 run_lba = 0, run = 0, c, n;
+  int rc = 0;
+
+  *done = 0;
+  while (sectors > 0) {
+    if ((c = fat_alloc(fat_file_last)) == 0) {
+      rc = -1;
+      break;
+    }
+    if (fat_file_first == 0) {
+      fat_file_first = c;
+    }
+    fat_file_last = c;
+    n = (sectors < fat.spc) ? sectors : fat.spc;
+    if (run > 0 && cluster_lba(c) != run_lba + run) {
+      if (fat.dev->write(fat.dev->ctx, run_lba, run, data) != 0) {
+        return -1;
+      }
+      data += run * TRACE_FAT_SECTOR;
+      *done += run;
+      run = 0;
+    }
+    if (run == 0) {
+      run_lba = cluster_lba(c);
+    }
+    run += n;
+    sectors -= n;
+  }
+  if (run > 0) {
+    if (fat.dev->write(fat.dev->ctx, run_lba, run, data) != 0) {
+      return -1;
+    }
+    *done += run;
+  }
+  return rc;
+}
+
+static int mount_volume(u32 part_lba, const u8 *b)
+{
+  u32 rsvd, root_entries, total, data_sectors, spc;
+
+  spc = b[13];
+  if (get_le16(b + 11) != TRACE_FAT_SECTOR || spc == 0 || (spc & (spc - 1U)) != 0
+      || spc * TRACE_FAT_SECTOR > TRACE_FAT_BUF_SIZE || b[16] == 0) {
+    return -1;
+  }
+  memset(&fat, 0, sizeof fat);
+  fat.spc = spc;
+  rsvd = get_le16(b + 14);
+  fat.nfats = b[16];
+  root_entries = get_le16(b + 17);
+  total = get_le16(b + 19) ? get_le16(b + 19) : get_le32(b + 32);
+  fat.fat_size = get_le16(b + 22) ? get_le16(b + 22) : get_le32(b + 36);
+  fat.root_sectors = (root_entries * FAT_ENTRY + TRACE_FAT_SECTOR - 1U) / TRACE_FAT_SECTOR;
+  fat.fat_lba = part_lba + rsvd;
+  fat.root_lba = fat.fat_lba + fat.nfats * fat.fat_size;
+  fat.data_lba = fat.root_lba + fat.root_sectors;
+  data_sectors = total - (rsvd + fat.nfats * fat.fat_size + fat.root_sectors);
+  if (fat.fat_size == 0 || data_sectors >= total) {
+    return -1;
+  }
+  fat.clusters = data_sectors / spc;
+  if (fat.clusters < 4085U) {
+    return -1;			/* FAT12 */
+  }
+  fat.fat32 = (fat.clusters >= 65525U);
+  fat.free_count = 0xFFFFFFFFU;
+  fat.next_free = 2U;
+  if (fat.fat32) {
+    fat.root_cluster = get_le32(b + 44);
+    if (get_le16(b + 48) != 0 && get_le16(b + 48) != 0xFFFFU) {
+      fat.fsinfo_lba = part_lba + get_le16(b + 48);
+    }
+  }
+  return 0;
+}
+
+int trace_fat_mount(const trace_fat_blkdev_t *dev)
+{
+  u32 part_lba = 0, i;
+  u8 *b, *pe;
+
+  fat_mounted = 0;
+  fat_sec_valid = 0;
+  fat_sec_dirty = 0;
+  fat_tab_valid = 0;
+  fat_tab_dirty = 0;
+  fat_dir_cluster = 0;
+  fat_file_open = 0;
+  fat.dev = dev;
+  if ((b = sec_get(0)) == NULL || b[510] != 0x55U || b[511] != 0xAAU) {
+    return -1;
+  }
+  /* A boot sector has a jump first, a partition table does not */
+  if (!((b[0] == 0xEBU || b[0] == 0xE9U) && get_le16(b + 11) == TRACE_FAT_SECTOR)) {
+    for (i = 0; i < 4U; i++) {
+      pe = b + 446 + 16U * i;
+      if (pe[4] == 0x04U || pe[4] == 0x06U || pe[4] == 0x0EU
+          || pe[4] == 0x0BU || pe[4] == 0x0CU) {
+        part_lba = get_le32(pe + 8);
+        break;
+      }
+    }
+    if (i == 4U || (b = sec_get(part_lba)) == NULL) {
+      return -1;
+    }
+  }
+  if (mount_volume(part_lba, b) != 0) {
+    return -1;
+  }
+  fat.dev = dev;
+  if (fat.fsinfo_lba != 0) {
+    if ((b = sec_get(fat.fsinfo_lba)) == NULL) {
+      return -1;
+    }
+    if (get_le32(b) == FSINFO_LEAD && get_le32(b + 484) == FSINFO_STRUCT) {
+      fat.free_count = get_le32(b + 488);
+      if (get_le32(b + 492) >= 2U && get_le32(b + 492) < fat.clusters + 2U) {
+        fat.next_free = get_le32(b + 492);
+      }
+    } else {
+      fat.fsinfo_lba = 0;
+    }
+  }
+  fat_mounted = 1;
+  return 0;
+}
+
+int trace_fat_mkdir(const char *name)
+{
+  u8 sname[11], nt, *p;
+  u32 lba, off, c;
+  int rc;
+
+  if (!fat_mounted || fat_file_open || short_name(name, sname, &nt) != 0) {
+    return -1;
+  }
+  if ((rc = root_slot(sname, &lba, &off)) != 0) {
+    return rc;
+  }
+  if ((c = fat_alloc_dir(0)) == 0 || (p = sec_get(cluster_lba(c))) == NULL) {
+    return -1;
+  }
+  make_entry(p, (const u8 *) ".          ", FAT_ATTR_DIR, 0, c, 0);
+  make_entry(p + FAT_ENTRY, (const u8 *) "..         ", FAT_ATTR_DIR, 0, 0, 0);
+  fat_sec_dirty = 1;
+  if ((p = sec_get(lba)) == NULL) {
+    return -1;
+  }
+  make_entry(p + off, sname, FAT_ATTR_DIR, nt, c, 0);
+  fat_sec_dirty = 1;
+  fat_dir_cluster = c;
+  fat_dir_last = c;
+  fat_dir_used = 2;
+  fat_alias = 0;
+  return fat_sync();
+}
+
+int trace_fat_create(const char *name)
+{
+  u8 sname[11], nt = 0, e[FAT_ENTRY], sum;
+  u32 len = strlen(name), n, i, j, k, lba, off;
+  u16 ch;
+  int rc;
+
+  if (!fat_mounted || fat_dir_cluster == 0 || fat_file_open
+      || len == 0 || len > FAT_NAME_MAX) {
+    return -1;
+  }
+  if ((rc = dir_find(name)) != 0) {
+    return rc;
+  }
+  if (short_name(name, sname, &nt) != 0) {
+    /* A long name, in entries of 13 characters, the last first */
+    alias_name(name, sname);
+    sum = lfn_checksum(sname);
+    n = (len + FAT_LFN_CHARS - 1U) / FAT_LFN_CHARS;
+    for (i = n; i > 0; i--) {
+      memset(e, 0, sizeof e);
+      e[0] = (u8) (i | ((i == n) ? 0x40U : 0U));
+      e[11] = FAT_ATTR_LFN;
+      e[13] = sum;
+      for (j = 0; j < FAT_LFN_CHARS; j++) {
+        k = (i - 1U) * FAT_LFN_CHARS + j;
+        ch = (k < len) ? (u8) name[k] : (k == len) ? 0x0000U : 0xFFFFU;
+        /* Characters at 1, 14 and 28, in runs of 5, 6 and 2 */
+        off = (j < 5U) ? 1U + 2U * j : (j < 11U) ? 14U + 2U * (j - 5U) : 28U + 2U * (j - 11U);
+        put_le16(e + off, ch);
+      }
+      if (dir_append(e, &lba, &off) != 0) {
+        return -1;
+      }
+    }
+  }
+  make_entry(e, sname, FAT_ATTR_ARCHIVE, nt, 0, 0);
+  if (dir_append(e, &fat_file_entry_lba, &fat_file_entry_off) != 0
+      || sec_flush() != 0) {
+    return -1;
+  }
+  fat_file_open = 1;
+  fat_file_first = 0;
+  fat_file_last = 0;
+  fat_file_size = 0;
+  fat_fill = 0;
+  return 0;
+}
+
+int trace_fat_write(const void *data, u32 nbytes)
+{
+  const u8 *p = (const u8 *) data;
+  u32 left = nbytes, n, done;
+
+  if (!fat_file_open) {
+    return -1;
+  }
+  while (left > 0) {
+    /* Whole clusters of word aligned data go to the card as they are */
+    if (fat_fill == 0 && left >= cluster_bytes() && ((UINTPTR) p & 3U) == 0) {
+      n = (left < TRACE_FAT_MAX_RUN) ? left : TRACE_FAT_MAX_RUN;
+      n -= n % cluster_bytes();
+      if (file_write_run(p, n / TRACE_FAT_SECTOR, &done) != 0) {
+        fat_file_size += done * TRACE_FAT_SECTOR;
+        return -1;
+      }
+    } else {
+      n = TRACE_FAT_BUF_SIZE - fat_fill;
+      if (n > left) {
+        n = left;
+      }
+      memcpy(fat_buf + fat_fill, p, n);
+      fat_fill += n;
+      if (fat_fill == TRACE_FAT_BUF_SIZE) {
+        if (file_write_run(fat_buf, TRACE_FAT_BUF_SIZE / TRACE_FAT_SECTOR, &done) != 0) {
+          /* The file ends with what reached the card */
+          fat_file_size += n + done * TRACE_FAT_SECTOR - TRACE_FAT_BUF_SIZE;
+          fat_fill = 0;
+          return -1;
+        }
+        fat_fill = 0;
+      }
+    }
+    p += n;
+    left -= n;
+    fat_file_size += n;
+  }
+  return (int) nbytes;
+}
+
+int trace_fat_close(void)
+{
+  u32 pad, done;
+  u8 *e;
+  int rc = 0;
+
+  if (!fat_file_open) {
+    return -1;
+  }
+  fat_file_open = 0;
+  if (fat_fill > 0) {
+    pad = (TRACE_FAT_SECTOR - fat_fill % TRACE_FAT_SECTOR) % TRACE_FAT_SECTOR;
+    memset(fat_buf + fat_fill, 0, pad);
+    if (file_write_run(fat_buf, (fat_fill + pad) / TRACE_FAT_SECTOR, &done) != 0) {
+      if (done * TRACE_FAT_SECTOR < fat_fill) {
+        fat_file_size -= fat_fill - done * TRACE_FAT_SECTOR;
+      }
+      rc = -1;
+    }
+    fat_fill = 0;
+  }
+  if ((e = sec_get(fat_file_entry_lba)) == NULL) {
+    return -1;
+  }
+  e += fat_file_entry_off;
+  put_le16(e + 20, fat_file_first >> 16);
+  put_le16(e + 26, fat_file_first);
+  put_le32(e + 28, fat_file_size);
+  fat_sec_dirty = 1;
+  return (fat_sync() != 0) ? -1 : rc;
+}
+
+u32 trace_fat_size(void)
+{
+  return fat_file_size;
+}
@@ -0,0 +1,240 @@
+/*
+ * trace_gem.c
+ *
+ * Polled GEM for trace_udp.c.  The driver sets the controller up; the
+ * buffer descriptor rings are kept here, each frame being a descriptor
+ * for its headers and one for the trace, both sent in place.
+ */
+#include <string.h>
+#include "xparameters.h"
+#include "xemacps.h"
+#include "xil_cache.h"
+#include "xil_mpu.h"
+#include "xreg_cortexr5.h"
+#include "xtime_l.h"
+#include "trace_gem.h"
+
+#define GEM_TX_BDS	128U
+#define GEM_RX_BDS	32U
+#define GEM_RX_BUF	XEMACPS_RX_BUF_SIZE
+
+/* The rings, with a descriptor each to park the second queues on, in a
+   region the MPU makes uncached, so the CPU and the GEM see the same
+   descriptors */
+#define GEM_BD_REGION	2048U
+
+typedef struct gem_bds {
+  XEmacPs_Bd tx[GEM_TX_BDS];
+  XEmacPs_Bd rx[GEM_RX_BDS];
+  XEmacPs_Bd tx_q1;
+  XEmacPs_Bd rx_q1;
+} gem_bds_t;
+
+static union {
+  gem_bds_t bds;
+  u8 region[GEM_BD_REGION];
+} gem_bd_mem __attribute__ ((aligned(GEM_BD_REGION)));
+
+static u8 gem_rx_buf[GEM_RX_BDS][GEM_RX_BUF] __attribute__ ((aligned(64)));
+
+static XEmacPs gem;
+static u32 gem_tx_head;			/* next descriptor to fill */
+static u32 gem_tx_tail;			/* first descriptor of the oldest frame */
+static u8 gem_tx_frame_bds[GEM_TX_BDS];	/* descriptors in the frame starting here */
+static u32 gem_rx_head;
+static u32 gem_ms_count, gem_ms_frac;
+static XTime gem_ms_last;
+
+static XEmacPs_Bd *gem_tx_bd(u32 i)
+{
+  return &gem_bd_mem.bds.tx[i % GEM_TX_BDS];
+}
+
+/* The driver's descriptor accessors are not volatile, and these are
+   polled while the GEM updates them */
+static u32 gem_bd_read(XEmacPs_Bd *bd, u32 offset)
+{
+  return *(volatile u32 *) ((UINTPTR) bd + offset);
+}
+
+static void gem_bd_write(XEmacPs_Bd *bd, u32 offset, u32 value)
+{
+  *(volatile u32 *) ((UINTPTR) bd + offset) = value;
+}
+
+/* Fill a descriptor, leaving the used bit to hand it to the GEM */
+static void gem_tx_fill(u32 i, const void *buf, u32 len, u32 last)
+{
+  u32 status = (len & XEMACPS_TXBUF_LEN_MASK) | XEMACPS_TXBUF_USED_MASK;
+
+  if (last) {
+    status |= XEMACPS_TXBUF_LAST_MASK;
+  }
+  if ((i % GEM_TX_BDS) == GEM_TX_BDS - 1U) {
+    status |= XEMACPS_TXBUF_WRAP_MASK;
+  }
+  gem_bd_write(gem_tx_bd(i), XEMACPS_BD_ADDR_OFFSET, (u32) (UINTPTR) buf);
+  gem_bd_write(gem_tx_bd(i), XEMACPS_BD_STAT_OFFSET, status);
+  Xil_DCacheFlushRange((UINTPTR) buf, len);
+}
+
+static void gem_tx_give(u32 i)
+{
+  XEmacPs_Bd *bd = gem_tx_bd(i);
+
+  gem_bd_write(bd, XEMACPS_BD_STAT_OFFSET,
+               gem_bd_read(bd, XEMACPS_BD_STAT_OFFSET) & ~XEMACPS_TXBUF_USED_MASK);
+}
+
+static int gem_tx(void *ctx, const void *hdr, u32 hdr_len, const void *data, u32 len)
+{
+  u32 n = (len > 0) ? 2U : 1U, i = gem_tx_head;
+
+  (void) ctx;
+  if (gem_tx_head - gem_tx_tail + n > GEM_TX_BDS) {
+    return -1;
+  }
+  gem_tx_fill(i, hdr, hdr_len, len == 0);
+  if (len > 0) {
+    gem_tx_fill(i + 1U, data, len, 1);
+    gem_tx_give(i + 1U);
+  }
+  gem_tx_frame_bds[i % GEM_TX_BDS] = (u8) n;
+  /* The first descriptor last, so the GEM never sees half a frame */
+  __asm__ __volatile__("dsb" : : : "memory");
+  gem_tx_give(i);
+  __asm__ __volatile__("dsb" : : : "memory");
+  gem_tx_head += n;
+  XEmacPs_Transmit(&gem);
+  return 0;
+}
+
+/* The GEM sets the used bit of the first descriptor of each frame it has
+   sent; set it on the rest, so they stay with the CPU */
+static u32 gem_tx_done(void *ctx)
+{
+  u32 done = 0, n, j;
+
+  (void) ctx;
+  while (gem_tx_tail != gem_tx_head
+         && (gem_bd_read(gem_tx_bd(gem_tx_tail), XEMACPS_BD_STAT_OFFSET) &
+             XEMACPS_TXBUF_USED_MASK)) {
+    n = gem_tx_frame_bds[gem_tx_tail % GEM_TX_BDS];
+    for (j = 1; j < n; j++) {
+      gem_bd_write(gem_tx_bd(gem_tx_tail + j), XEMACPS_BD_STAT_OFFSET,
+                   gem_bd_read(gem_tx_bd(gem_tx_tail + j), XEMACPS_BD_STAT_OFFSET) |
+                   XEMACPS_TXBUF_USED_MASK);
+    }
+    gem_tx_tail += n;
+    done++;
+  }
+  XEmacPs_WriteReg(gem.Config.BaseAddress, XEMACPS_TXSR_OFFSET, XEMACPS_TXSR_ERROR_MASK |
+                   XEMACPS_TXSR_TXCOMPL_MASK);
+  return done;
+}
+
+static u32 gem_rx(void *ctx, void *buf, u32 size)
+{
+  XEmacPs_Bd *bd = &gem_bd_mem.bds.rx[gem_rx_head];
+  u8 *data = gem_rx_buf[gem_rx_head];
+  u32 len;
+
+  (void) ctx;
+  if (!(gem_bd_read(bd, XEMACPS_BD_ADDR_OFFSET) & XEMACPS_RXBUF_NEW_MASK)) {
+    return 0;
+  }
+  len = gem_bd_read(bd, XEMACPS_BD_STAT_OFFSET) & XEMACPS_RXBUF_LEN_MASK;
+  if (len > size) {
+    len = size;
+  }
+  Xil_DCacheInvalidateRange((UINTPTR) data, GEM_RX_BUF);
+  memcpy(buf, data, len);
+  gem_bd_write(bd, XEMACPS_BD_STAT_OFFSET, 0);
+  gem_bd_write(bd, XEMACPS_BD_ADDR_OFFSET,
+               gem_bd_read(bd, XEMACPS_BD_ADDR_OFFSET) & ~XEMACPS_RXBUF_NEW_MASK);
+  gem_rx_head = (gem_rx_head + 1U) % GEM_RX_BDS;
+  XEmacPs_WriteReg(gem.Config.BaseAddress, XEMACPS_RXSR_OFFSET, XEMACPS_RXSR_ERROR_MASK |
+                   XEMACPS_RXSR_FRAMERX_MASK);
+  return len;
+}
+
+/* XTime is 32 bits on the R5, so count milliseconds from its differences */
+static u32 gem_ms(void *ctx)
+{
+  const u32 per_ms = COUNTS_PER_SECOND / 1000U;
+  XTime t;
+
+  (void) ctx;
+  XTime_GetTime(&t);
+  gem_ms_frac += (u32) (t - gem_ms_last);
+  gem_ms_last = t;
+  gem_ms_count += gem_ms_frac / per_ms;
+  gem_ms_frac %= per_ms;
+  return gem_ms_count;
+}
+
+static const trace_udp_netif_t gem_netif = {
+  NULL, gem_tx, gem_tx_done, gem_rx, gem_ms
+};
+
+static void gem_rings_init(void)
+{
+  u32 i, addr;
+
+  memset(&gem_bd_mem, 0, sizeof gem_bd_mem);
+  for (i = 0; i < GEM_TX_BDS; i++) {
+    gem_bd_write(&gem_bd_mem.bds.tx[i], XEMACPS_BD_STAT_OFFSET, XEMACPS_TXBUF_USED_MASK |
+                 ((i == GEM_TX_BDS - 1U) ? XEMACPS_TXBUF_WRAP_MASK : 0U));
+  }
+  Xil_DCacheInvalidateRange((UINTPTR) gem_rx_buf, sizeof gem_rx_buf);
+  for (i = 0; i < GEM_RX_BDS; i++) {
+    addr = (u32) (UINTPTR) gem_rx_buf[i];
+    if (i == GEM_RX_BDS - 1U) {
+      addr |= XEMACPS_RXBUF_WRAP_MASK;
+    }
+    gem_bd_write(&gem_bd_mem.bds.rx[i], XEMACPS_BD_ADDR_OFFSET, addr);
+  }
+  /* The second queues are not used: give them a descriptor the GEM
+     does not own */
+  gem_bd_write(&gem_bd_mem.bds.tx_q1, XEMACPS_BD_STAT_OFFSET,
+               XEMACPS_TXBUF_USED_MASK | XEMACPS_TXBUF_WRAP_MASK);
+  gem_bd_write(&gem_bd_mem.bds.rx_q1, XEMACPS_BD_ADDR_OFFSET,
+               XEMACPS_RXBUF_NEW_MASK | XEMACPS_RXBUF_WRAP_MASK);
+  gem_tx_head = 0;
+  gem_tx_tail = 0;
+  gem_rx_head = 0;
+}
+
+const trace_udp_netif_t *trace_gem_init(u16 device_id, const u8 mac[6], u16 speed)
+{
+  XEmacPs_Config *config;
+  u8 addr[6];
+
+  config = XEmacPs_LookupConfig(device_id);
+  if (config == NULL
+      || XEmacPs_CfgInitialize(&gem, config, config->BaseAddress) != XST_SUCCESS) {
+    return NULL;
+  }
+  memcpy(addr, mac, sizeof addr);
+  if (XEmacPs_SetMacAddress(&gem, addr, 1) != XST_SUCCESS) {
+    return NULL;
+  }
+  XEmacPs_SetMdioDivisor(&gem, MDC_DIV_224);
+  XEmacPs_SetOperatingSpeed(&gem, speed);
+  /* No dirty lines may be left to be written back over the descriptors */
+  Xil_DCacheFlushRange((UINTPTR) &gem_bd_mem, GEM_BD_REGION);
+  Xil_SetMPURegion((INTPTR) &gem_bd_mem, GEM_BD_REGION,
+                   NORM_NSHARED_NCACHE | PRIV_RW_USER_RW);
+  gem_rings_init();
+  XEmacPs_SetQueuePtr(&gem, (UINTPTR) gem_bd_mem.bds.tx, 0, XEMACPS_SEND);
+  XEmacPs_SetQueuePtr(&gem, (UINTPTR) gem_bd_mem.bds.rx, 0, XEMACPS_RECV);
+  XEmacPs_SetQueuePtr(&gem, (UINTPTR) &gem_bd_mem.bds.tx_q1, 1, XEMACPS_SEND);
+  XEmacPs_WriteReg(config->BaseAddress, XEMACPS_RXQ1BASE_OFFSET,
+                   (u32) (UINTPTR) &gem_bd_mem.bds.rx_q1);
+  XEmacPs_Start(&gem);
+  /* Run polled */
+  XEmacPs_IntDisable(&gem, XEMACPS_IXR_ALL_MASK);
+  XEmacPs_IntQ1Disable(&gem, XEMACPS_INTQ1_IXR_ALL_MASK);
+  XTime_GetTime(&gem_ms_last);
+  return &gem_netif;
+}
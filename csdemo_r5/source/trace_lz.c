@@ -0,0 +1,206 @@
+/*
+ * trace_lz.c
+ *
+ * Streaming LZ compression of trace, with a filter for formatter frames.
+ * The format is described in trace_lz.h.
+ */
+#include <string.h>
+#include "trace_lz.h"
+
+static u32 read32(const u8 *p)
+{
+  u32 v;
+
+  memcpy(&v, p, sizeof v);
+  return v;
+}
+
+static u32 lz_hash(u32 v)
+{
+  return (v * 2654435761U) >> (32U - TRACE_LZ_HASH_BITS);
+}
+
+/* Put the part of a length from 15 up, in bytes of 255 and a last byte
+   of less than 255.  Returns NULL if it does not fit. */
+static u8 *put_length(u8 *op, const u8 *oend, u32 len)
+{
+  while (len >= 255U) {
+    if (op >= oend) {
+      return NULL;
+    }
+    *op++ = 255U;
+    len -= 255U;
+  }
+  if (op >= oend) {
+    return NULL;
+  }
+  *op++ = (u8) len;
+  return op;
+}
+
+/* Put a sequence: the literals from anchor, then a match unless len is 0 */
+static u8 *put_sequence(u8 *op, const u8 *oend, const u8 *anchor, u32 lit,
+                        u32 off, u32 len)
+{
+  u8 *token;
+
+  if (op >= oend) {
+    return NULL;
+  }
+  token = op++;
+  *token = (u8) (((lit < 15U) ? lit : 15U) << 4);
+  if (lit >= 15U && (op = put_length(op, oend, lit - 15U)) == NULL) {
+    return NULL;
+  }
+  if ((u32) (oend - op) < lit) {
+    return NULL;
+  }
+  memcpy(op, anchor, lit);
+  op += lit;
+  if (len == 0) {
+    return op;
+  }
+  if (oend - op < 2) {
+    return NULL;
+  }
+  *op++ = (u8) off;
+  *op++ = (u8) (off >> 8);
+  len -= TRACE_LZ_MIN_MATCH;
+  *token |= (u8) ((len < 15U) ? len : 15U);
+  if (len >= 15U) {
+    op = put_length(op, oend, len - 15U);
+  }
+  return op;
+}
+
+u32 trace_lz_compress(u16 *hash, const u8 *src, u32 n, u8 *dst)
+{
+  const u8 *ip = src, *anchor = src, *ref;
+  const u8 *const end = src + n;
+  const u8 *const oend = dst + n;
+  u8 *op = dst;
+  u32 h, off, len;
+
+  memset(hash, 0, sizeof(u16) << TRACE_LZ_HASH_BITS);
+  while (n >= TRACE_LZ_MIN_MATCH && ip <= end - TRACE_LZ_MIN_MATCH) {
+    h = lz_hash(read32(ip));
+    ref = src + hash[h];
+    hash[h] = (u16) (ip - src);
+    off = (u32) (ip - ref);
+    if (off == 0 || read32(ref) != read32(ip)) {
+      ip++;
+      continue;
+    }
+    len = TRACE_LZ_MIN_MATCH;
+    while (ip + len < end && ref[len] == ip[len]) {
+      len++;
+    }
+    op = put_sequence(op, oend, anchor, (u32) (ip - anchor), off, len);
+    if (op == NULL) {
+      return 0;
+    }
+    ip += len;
+    anchor = ip;
+  }
+  op = put_sequence(op, oend, anchor, (u32) (end - anchor), 0, 0);
+  if (op == NULL || op >= oend) {
+    return 0;
+  }
+  return (u32) (op - dst);
+}
+
+/* Move the data bytes of each frame to the start, and the flag bytes to
+   the end */
+static void frame_filter(const u8 *src, u32 n, u8 *dst)
+{
+  const u32 n_frames = n / TRACE_LZ_FRAME;
+  u8 *flags = dst + n_frames * (TRACE_LZ_FRAME - 1U);
+  u32 i;
+
+  for (i = 0; i < n_frames; i++) {
+    memcpy(dst, src, TRACE_LZ_FRAME - 1U);
+    dst += TRACE_LZ_FRAME - 1U;
+    flags[i] = src[TRACE_LZ_FRAME - 1U];
+    src += TRACE_LZ_FRAME;
+  }
+}
+
+static void put_le16(u8 *p, u32 v)
+{
+  p[0] = (u8) v;
+  p[1] = (u8) (v >> 8);
+}
+
+static void trace_lz_block(trace_lz_t *z)
+{
+  const u8 *src = z->block;
+  u32 n = z->fill, stored;
+  u8 flags = 0;
+  u8 magic[4];
+
+  if (n == 0) {
+    return;
+  }
+  if (!z->started) {
+    put_le16(magic, TRACE_LZ_MAGIC);
+    put_le16(magic + 2, TRACE_LZ_MAGIC >> 16);
+    z->emit(z->ref, magic, sizeof magic);
+    z->out_bytes += sizeof magic;
+    z->started = 1;
+  }
+  if (z->frames && (n % TRACE_LZ_FRAME) == 0) {
+    frame_filter(z->block, n, z->filtered);
+    src = z->filtered;
+    flags |= TRACE_LZ_FLAG_FRAMES;
+  }
+  stored = trace_lz_compress(z->hash, src, n, z->out + TRACE_LZ_HEADER);
+  if (stored != 0) {
+    flags |= TRACE_LZ_FLAG_LZ;
+  } else {
+    memcpy(z->out + TRACE_LZ_HEADER, src, n);
+    stored = n;
+  }
+  z->out[0] = flags;
+  put_le16(z->out + 1, n);
+  put_le16(z->out + 3, stored);
+  z->emit(z->ref, z->out, TRACE_LZ_HEADER + stored);
+  z->in_bytes += n;
+  z->out_bytes += TRACE_LZ_HEADER + stored;
+  z->fill = 0;
+}
+
+void trace_lz_init(trace_lz_t *z, int frames, trace_lz_emit_t emit, void *ref)
+{
+  z->frames = frames;
+  z->emit = emit;
+  z->ref = ref;
+  z->fill = 0;
+  z->started = 0;
+  z->in_bytes = 0;
+  z->out_bytes = 0;
+}
+
+void trace_lz_write(trace_lz_t *z, const void *data, u32 nbytes)
+{
+  const u8 *p = (const u8 *) data;
+  u32 n;
+
+  while (nbytes > 0) {
+    n = TRACE_LZ_BLOCK - z->fill;
+    if (n > nbytes) {
+      n = nbytes;
+    }
+    memcpy(z->block + z->fill, p, n);
+    z->fill += n;
+    p += n;
+    nbytes -= n;
+    if (z->fill == TRACE_LZ_BLOCK) {
+      trace_lz_block(z);
+    }
+  }
+}
+
+void trace_lz_flush(trace_lz_t *z)
+{
+  trace_lz_block(z);
+}
@@ -0,0 +1,74 @@
+/*
+ * trace_sd.c
+ *
+ * SD card block device for trace_fat.c.  Each transfer is one command of
+ * many blocks, through the controller's ADMA2, which the driver sets up
+ * and keeps the caches coherent for.
+ */
+#include "xparameters.h"
+#include "xsdps.h"
+#include "trace_sd.h"
+
+/* The driver's 32 ADMA2 descriptors of 64KB each */
+#define SD_MAX_BLOCKS	(32U * 65536U / TRACE_FAT_SECTOR)
+
+static XSdPs sd;
+
+/* Standard capacity cards are addressed in bytes, the rest in blocks */
+static u32 sd_arg(u32 lba)
+{
+  return sd.HCS ? lba : lba * TRACE_FAT_SECTOR;
+}
+
+static int sd_read(void *ctx, u32 lba, u32 count, void *buf)
+{
+  u8 *p = (u8 *) buf;
+  u32 n;
+
+  (void) ctx;
+  while (count > 0) {
+    n = (count < SD_MAX_BLOCKS) ? count : SD_MAX_BLOCKS;
+    if (XSdPs_ReadPolled(&sd, sd_arg(lba), n, p) != XST_SUCCESS) {
+      return -1;
+    }
+    lba += n;
+    p += n * TRACE_FAT_SECTOR;
+    count -= n;
+  }
+  return 0;
+}
+
+static int sd_write(void *ctx, u32 lba, u32 count, const void *buf)
+{
+  const u8 *p = (const u8 *) buf;
+  u32 n;
+
+  (void) ctx;
+  while (count > 0) {
+    n = (count < SD_MAX_BLOCKS) ? count : SD_MAX_BLOCKS;
+    if (XSdPs_WritePolled(&sd, sd_arg(lba), n, p) != XST_SUCCESS) {
+      return -1;
+    }
+    lba += n;
+    p += n * TRACE_FAT_SECTOR;
+    count -= n;
+  }
+  return 0;
+}
+
+static const trace_fat_blkdev_t sd_blkdev = {
+  NULL, sd_read, sd_write
+};
+
+const trace_fat_blkdev_t *trace_sd_init(u16 device_id)
+{
+  XSdPs_Config *config;
+
+  config = XSdPs_LookupConfig(device_id);
+  if (config == NULL
+      || XSdPs_CfgInitialize(&sd, config, config->BaseAddress) != XST_SUCCESS
+      || XSdPs_CardInitialize(&sd) != XST_SUCCESS) {
+    return NULL;
+  }
+  return &sd_blkdev;
+}
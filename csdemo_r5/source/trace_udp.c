@@ -0,0 +1,473 @@
+/*
+ * trace_udp.c
+ *
+ * Trace over UDP with a window of datagrams sent in place, resent when
+ * the host reports them missing.  The format is described in trace_udp.h.
+ */
+#include <string.h>
+#include "trace_udp.h"
+
+#define ETH_HEADER	14U
+#define IP_HEADER	20U
+#define UDP_HEADER	8U
+#define ETHERTYPE_IP	0x0800U
+#define ETHERTYPE_ARP	0x0806U
+#define ARP_FRAME	(ETH_HEADER + 28U)
+#define ARP_RETRY_MS	100U
+#define ARP_TRIES	30U
+#define RX_FRAME	1536U
+
+/* Datagrams queued to the interface and not yet sent, for each of which
+   the slot holding its header must stay as it is */
+#define TX_QUEUE	(2U * TRACE_UDP_WINDOW)
+#define ARP_SLOT	TRACE_UDP_WINDOW
+
+typedef struct udp_slot {
+  u8 hdr[TRACE_UDP_FRAME_HEADER];
+  const u8 *data;
+  u32 len;
+  u8 type;
+  u32 queued;			/* times queued to the interface and not yet sent */
+  u32 sent_ms;
+} udp_slot_t;
+
+static const trace_udp_netif_t *udp_netif;
+static trace_udp_addr_t udp_addr;
+static u8 udp_host_mac[6];
+static int udp_is_ready;
+static int udp_failed;
+static udp_slot_t udp_slots[TRACE_UDP_WINDOW];
+static u32 udp_base;			/* oldest datagram not acknowledged */
+static u32 udp_next;			/* next datagram to queue */
+static u32 udp_acked_bytes;
+static u32 udp_progress_ms;		/* last acknowledgement, or timeout */
+static u32 udp_timeouts;		/* since the last acknowledgement */
+static u32 udp_bytes;
+static u32 udp_resent;
+static u32 udp_tx_slot[TX_QUEUE];
+static u32 udp_tx_head, udp_tx_tail;
+static u8 udp_arp[ARP_FRAME];
+static u32 udp_arp_queued;
+static u8 udp_rx[RX_FRAME] __attribute__ ((aligned(4)));
+
+static void put_be16(u8 *p, u32 v)
+{
+  p[0] = (u8) (v >> 8);
+  p[1] = (u8) v;
+}
+
+static void put_be32(u8 *p, u32 v)
+{
+  put_be16(p, v >> 16);
+  put_be16(p + 2, v);
+}
+
+static void put_le16(u8 *p, u32 v)
+{
+  p[0] = (u8) v;
+  p[1] = (u8) (v >> 8);
+}
+
+static void put_le32(u8 *p, u32 v)
+{
+  put_le16(p, v);
+  put_le16(p + 2, v >> 16);
+}
+
+static u32 get_be16(const u8 *p)
+{
+  return ((u32) p[0] << 8) | p[1];
+}
+
+static u32 get_be32(const u8 *p)
+{
+  return (get_be16(p) << 16) | get_be16(p + 2);
+}
+
+static u32 get_le32(const u8 *p)
+{
+  return (u32) p[0] | ((u32) p[1] << 8) | ((u32) p[2] << 16) | ((u32) p[3] << 24);
+}
+
+static u32 udp_ms(void)
+{
+  return udp_netif->ms(udp_netif->ctx);
+}
+
+/* Release the slots of datagrams the interface has sent */
+static void udp_reap(void)
+{
+  u32 n = udp_netif->tx_done(udp_netif->ctx);
+  u32 slot;
+
+  while (n-- > 0 && udp_tx_tail != udp_tx_head) {
+    slot = udp_tx_slot[udp_tx_tail++ % TX_QUEUE];
+    if (slot == ARP_SLOT) {
+      udp_arp_queued--;
+    } else {
+      udp_slots[slot].queued--;
+    }
+  }
+}
+
+/* Give up on the session if the interface has made the caller wait
+   since t0 for longer than the retransmit timeout allows */
+static int udp_stalled(u32 t0)
+{
+  if (udp_ms() - t0 > TRACE_UDP_RTO_MS * TRACE_UDP_RETRIES) {
+    udp_failed = 1;
+  }
+  return udp_failed;
+}
+
+/* Queue a frame, waiting for room.  Returns -1 if the interface stays
+   full for longer than the retransmit timeout allows. */
+static int udp_queue(u32 slot, const void *hdr, u32 hdr_len, const void *data, u32 len)
+{
+  u32 t0 = udp_ms();
+
+  while (udp_tx_head - udp_tx_tail >= TX_QUEUE
+         || udp_netif->tx(udp_netif->ctx, hdr, hdr_len, data, len) != 0) {
+    udp_reap();
+    if (udp_stalled(t0)) {
+      return -1;
+    }
+  }
+  udp_tx_slot[udp_tx_head++ % TX_QUEUE] = slot;
+  if (slot == ARP_SLOT) {
+    udp_arp_queued++;
+  } else {
+    udp_slots[slot].queued++;
+  }
+  return 0;
+}
+
+static u32 ip_checksum(const u8 *p, u32 n)
+{
+  u32 sum = 0;
+
+  for (; n > 1U; n -= 2U, p += 2) {
+    sum += get_be16(p);
+  }
+  while (sum >> 16) {
+    sum = (sum & 0xFFFFU) + (sum >> 16);
+  }
+  return ~sum & 0xFFFFU;
+}
+
+static void udp_build_header(udp_slot_t *s, u32 seq, u8 file)
+{
+  u8 *eth = s->hdr, *ip = eth + ETH_HEADER, *udp = ip + IP_HEADER;
+  u8 *trace = udp + UDP_HEADER;
+
+  memcpy(eth, udp_host_mac, 6);
+  memcpy(eth + 6, udp_addr.mac, 6);
+  put_be16(eth + 12, ETHERTYPE_IP);
+  ip[0] = 0x45U;
+  ip[1] = 0;
+  put_be16(ip + 2, IP_HEADER + UDP_HEADER + TRACE_UDP_HEADER + s->len);
+  put_be16(ip + 4, seq);
+  put_be16(ip + 6, 0x4000U);		/* don't fragment */
+  ip[8] = 64U;
+  ip[9] = 17U;				/* UDP */
+  put_be16(ip + 10, 0);
+  put_be32(ip + 12, udp_addr.ip);
+  put_be32(ip + 16, udp_addr.host_ip);
+  put_be16(ip + 10, ip_checksum(ip, IP_HEADER));
+  put_be16(udp, udp_addr.port);
+  put_be16(udp + 2, udp_addr.port);
+  put_be16(udp + 4, UDP_HEADER + TRACE_UDP_HEADER + s->len);
+  put_be16(udp + 6, 0);			/* no checksum */
+  put_le32(trace, TRACE_UDP_MAGIC);
+  put_le32(trace + 4, seq);
+  trace[8] = s->type;
+  trace[9] = file;
+  put_le16(trace + 10, s->len);
+}
+
+static int udp_send_slot(u32 seq)
+{
+  udp_slot_t *s = &udp_slots[seq % TRACE_UDP_WINDOW];
+
+  s->sent_ms = udp_ms();
+  return udp_queue(seq % TRACE_UDP_WINDOW, s->hdr, TRACE_UDP_FRAME_HEADER, s->data, s->len);
+}
+
+static void udp_send_arp(u32 op, const u8 *to_mac, u32 to_ip)
+{
+  static const u8 broadcast[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+  u8 *arp = udp_arp + ETH_HEADER;
+
+  if (udp_arp_queued != 0) {
+    return;		/* the host asks again */
+  }
+  memcpy(udp_arp, (op == 1U) ? broadcast : to_mac, 6);
+  memcpy(udp_arp + 6, udp_addr.mac, 6);
+  put_be16(udp_arp + 12, ETHERTYPE_ARP);
+  put_be16(arp, 1U);			/* Ethernet */
+  put_be16(arp + 2, ETHERTYPE_IP);
+  arp[4] = 6U;
+  arp[5] = 4U;
+  put_be16(arp + 6, op);
+  memcpy(arp + 8, udp_addr.mac, 6);
+  put_be32(arp + 14, udp_addr.ip);
+  memcpy(arp + 18, (op == 1U) ? broadcast : to_mac, 6);
+  put_be32(arp + 24, to_ip);
+  (void) udp_queue(ARP_SLOT, udp_arp, ARP_FRAME, NULL, 0);
+}
+
+/* A status from the host: release what it has, resend what it lacks */
+static void udp_status(const u8 *p, u32 len)
+{
+  u32 next, n, i, seq, now = udp_ms();
+  udp_slot_t *s;
+
+  if (len < 12U || get_le32(p) != TRACE_UDP_STATUS_MAGIC) {
+    return;
+  }
+  next = get_le32(p + 4);
+  n = (u32) p[8] | ((u32) p[9] << 8);
+  if (next - udp_base <= udp_next - udp_base && next != udp_base) {
+    while (udp_base != next) {
+      s = &udp_slots[udp_base % TRACE_UDP_WINDOW];
+      if (s->type == TRACE_UDP_DATA) {
+        udp_acked_bytes += s->len;
+      }
+      udp_base++;
+    }
+    udp_progress_ms = now;
+    udp_timeouts = 0;
+  }
+  if (n > TRACE_UDP_MAX_NACK || len < 12U + 4U * n) {
+    return;
+  }
+  for (i = 0; i < n; i++) {
+    seq = get_le32(p + 12 + 4 * i);
+    if (seq - udp_base >= udp_next - udp_base) {
+      continue;
+    }
+    /* Statuses that follow may report it missing again before the
+       resend arrives */
+    s = &udp_slots[seq % TRACE_UDP_WINDOW];
+    if (now - s->sent_ms >= TRACE_UDP_RTO_MS / 4U) {
+      udp_resent++;
+      (void) udp_send_slot(seq);
+    }
+  }
+}
+
+static void udp_input(const u8 *f, u32 len)
+{
+  const u8 *ip = f + ETH_HEADER, *udp;
+  u32 ihl;
+
+  if (len < ETH_HEADER + 28U) {
+    return;
+  }
+  if (get_be16(f + 12) == ETHERTYPE_ARP) {
+    if (get_be16(ip + 6) == 1U && get_be32(ip + 24) == udp_addr.ip) {
+      udp_send_arp(2U, ip + 8, get_be32(ip + 14));
+    }
+    if (get_be16(ip + 6) == 2U && get_be32(ip + 14) == udp_addr.host_ip) {
+      memcpy(udp_host_mac, ip + 8, 6);
+    }
+    return;
+  }
+  if (get_be16(f + 12) != ETHERTYPE_IP || (ip[0] >> 4) != 4U || ip[9] != 17U
+      || get_be32(ip + 16) != udp_addr.ip) {
+    return;
+  }
+  ihl = (ip[0] & 0xFU) * 4U;
+  udp = ip + ihl;
+  if (len < ETH_HEADER + ihl + UDP_HEADER || get_be16(udp + 2) != udp_addr.port) {
+    return;
+  }
+  len = get_be16(udp + 4);
+  if (len < UDP_HEADER || (u32) (udp - f) + len > RX_FRAME) {
+    return;
+  }
+  udp_status(udp + UDP_HEADER, len - UDP_HEADER);
+}
+
+/* Take in what the host has sent, and resend the oldest datagram if the
+   host has gone quiet */
+static void udp_service(void)
+{
+  u32 len, now;
+
+  udp_reap();
+  while ((len = udp_netif->rx(udp_netif->ctx, udp_rx, sizeof udp_rx)) > 0) {
+    udp_input(udp_rx, len);
+  }
+  now = udp_ms();
+  if (udp_base != udp_next && now - udp_progress_ms >= TRACE_UDP_RTO_MS) {
+    if (++udp_timeouts > TRACE_UDP_RETRIES) {
+      udp_failed = 1;
+      return;
+    }
+    udp_progress_ms = now;
+    udp_resent++;
+    (void) udp_send_slot(udp_base);
+  }
+}
+
+/* Queue a datagram, waiting for room in the window */
+static int udp_datagram(u8 type, u8 file, const void *data, u32 len)
+{
+  udp_slot_t *s;
+  u32 t0;
+
+  if (!udp_is_ready) {
+    return -1;
+  }
+  while (udp_next - udp_base >= TRACE_UDP_WINDOW && !udp_failed) {
+    udp_service();
+  }
+  if (udp_failed) {
+    return -1;
+  }
+  if (udp_base == udp_next) {
+    udp_progress_ms = udp_ms();
+  }
+  s = &udp_slots[udp_next % TRACE_UDP_WINDOW];
+  /* A resend of the datagram the slot last held may still be queued */
+  t0 = udp_ms();
+  while (s->queued != 0) {
+    udp_reap();
+    if (udp_stalled(t0)) {
+      return -1;
+    }
+  }
+  s->data = (const u8 *) data;
+  s->len = len;
+  s->type = type;
+  udp_build_header(s, udp_next, file);
+  udp_next++;
+  return udp_send_slot(udp_next - 1U);
+}
+
+int trace_udp_init(const trace_udp_netif_t *netif, const trace_udp_addr_t *addr)
+{
+  u32 i, t0;
+
+  udp_netif = netif;
+  udp_addr = *addr;
+  udp_is_ready = 0;
+  udp_failed = 0;
+  udp_base = 0;
+  udp_next = 0;
+  udp_acked_bytes = 0;
+  udp_bytes = 0;
+  udp_resent = 0;
+  udp_timeouts = 0;
+  udp_tx_head = 0;
+  udp_tx_tail = 0;
+  udp_arp_queued = 0;
+  memset(udp_slots, 0, sizeof udp_slots);
+  memset(udp_host_mac, 0, sizeof udp_host_mac);
+  for (i = 0; i < ARP_TRIES; i++) {
+    udp_send_arp(1U, NULL, udp_addr.host_ip);
+    t0 = udp_ms();
+    while (udp_ms() - t0 < ARP_RETRY_MS) {
+      udp_service();
+      if (udp_host_mac[0] | udp_host_mac[1] | udp_host_mac[2] |
+          udp_host_mac[3] | udp_host_mac[4] | udp_host_mac[5]) {
+        udp_is_ready = 1;
+        return 0;
+      }
+    }
+  }
+  return -1;
+}
+
+int trace_udp_ready(void)
+{
+  return udp_is_ready && !udp_failed;
+}
+
+int trace_udp_open(u8 file, const char *name)
+{
+  static char names[TRACE_UDP_WINDOW][32];
+  char *copy = names[udp_next % TRACE_UDP_WINDOW];
+  u32 len = strlen(name);
+
+  /* Names are copied, since the caller's may not last */
+  if (len >= sizeof names[0]) {
+    return -1;
+  }
+  memcpy(copy, name, len);
+  return udp_datagram(TRACE_UDP_OPEN, file, copy, len);
+}
+
+int trace_udp_write(u8 file, const void *data, u32 nbytes)
+{
+  const u8 *p = (const u8 *) data;
+  u32 n, left = nbytes;
+
+  while (left > 0) {
+    n = (left < TRACE_UDP_MAX_PAYLOAD) ? left : TRACE_UDP_MAX_PAYLOAD;
+    if (udp_datagram(TRACE_UDP_DATA, file, p, n) != 0) {
+      return -1;
+    }
+    udp_bytes += n;
+    p += n;
+    left -= n;
+  }
+  return (int) nbytes;
+}
+
+int trace_udp_acked(void)
+{
+  u32 n;
+
+  if (!udp_is_ready || udp_failed) {
+    return -1;
+  }
+  udp_service();
+  n = udp_acked_bytes;
+  udp_acked_bytes = 0;
+  return (int) n;
+}
+
+int trace_udp_flush(void)
+{
+  u32 t0;
+
+  if (!udp_is_ready) {
+    return -1;
+  }
+  while (udp_base != udp_next && !udp_failed) {
+    udp_service();
+  }
+  /* The data may be reused once no resend of it is still queued */
+  t0 = udp_ms();
+  while (udp_tx_head != udp_tx_tail && !udp_failed) {
+    udp_reap();
+    (void) udp_stalled(t0);
+  }
+  udp_acked_bytes = 0;
+  return udp_failed ? -1 : 0;
+}
+
+int trace_udp_end(void)
+{
+  int rc;
+
+  if (udp_datagram(TRACE_UDP_END, 0, NULL, 0) != 0) {
+    rc = -1;
+  } else {
+    rc = trace_udp_flush();
+  }
+  udp_is_ready = 0;
+  return rc;
+}
+
+u32 trace_udp_bytes(void)
+{
+  return udp_bytes;
+}
+
+u32 trace_udp_resent(void)
+{
+  return udp_resent;
+}
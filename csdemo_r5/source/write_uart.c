@@ -4,35 +4,222 @@
  *  Created on: 17.01.2018
  *      Author: ujexq
  */
+#include <string.h>
 #include "xil_printf.h"
 #include "xparameters.h"
+#include "xuartps.h"
+#include "write_uart.h"
 
 /*
  * write_uchar8 -- write bytes to the serial port. Ignore fd, since
  *          stdout and stderr are the same. Since we have no filesystem,
- *          open will only return an error.
+ *          open will only return an error.  The bytes are sent as they
+ *          are, as trace is binary.
  */
 
 int write_uchar8 (int32_t fd, unsigned char* buf, int32_t nbytes) {
 #ifdef STDOUT_BASEADDRESS // UART BASE ADDRESS
   s32 i;
-  unsigned char* LocalBuf = buf;
 
   (void)fd;
+  if (buf == NULL) {
+    return -1;
+  }
   for (i = 0; i < nbytes; i++) {
-	if(LocalBuf != NULL) {
-		LocalBuf += i;
-	}
-	if(LocalBuf != NULL) {
-	    if (*LocalBuf == '\n') {
-	      outbyte ('\r');
-	    }
-	    outbyte (*LocalBuf);
-	}
-	if(LocalBuf != NULL) {
-		LocalBuf -= i;
-	}
+    outbyte (buf[i]);
   }
   return (nbytes);
+#else
+  (void)fd;
+  (void)buf;
+  (void)nbytes;
+  return -1;
 #endif
 }
+
+/* ---------- Framed trace transport ------------- */
+
+static XUartPs trace_uart;
+static int trace_uart_is_ready;
+static int trace_uart_irq;		/* frames are sent under interrupts */
+static volatile int trace_uart_busy;	/* a frame is still being sent */
+static u32 trace_seq;
+static int trace_frame_next;
+static u8 trace_frames[2][UART_TRACE_MAX_PAYLOAD + UART_TRACE_OVERHEAD];
+static u8 trace_rx_discard[16];
+static u32 crc_table[256];
+static int crc_table_ready;
+
+static void crc_table_init(void);
+
+u32 uart_crc32(u32 crc, const void *buf, u32 nbytes)
+{
+  const u8 *p = (const u8 *) buf;
+
+  if (!crc_table_ready) {
+    crc_table_init();
+  }
+  crc = ~crc;
+  while (nbytes-- > 0) {
+    crc = crc_table[(crc ^ *p++) & 0xFFU] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+static void crc_table_init(void)
+{
+  u32 i, j, c;
+
+  for (i = 0; i < 256U; i++) {
+    c = i;
+    for (j = 0; j < 8U; j++) {
+      c = (c & 1U) ? (0xEDB88320U ^ (c >> 1)) : (c >> 1);
+    }
+    crc_table[i] = c;
+  }
+  crc_table_ready = 1;
+}
+
+static void put_le32(u8 *p, u32 v)
+{
+  p[0] = (u8) v;
+  p[1] = (u8) (v >> 8);
+  p[2] = (u8) (v >> 16);
+  p[3] = (u8) (v >> 24);
+}
+
+static void uart_trace_handler(void *ref, u32 event, u32 data)
+{
+  (void) ref;
+  (void) data;
+  if (event == XUARTPS_EVENT_SENT_DATA) {
+    trace_uart_busy = 0;
+  } else if (event == XUARTPS_EVENT_RECV_DATA) {
+    /* The host sends nothing; keep the RX FIFO drained so the receive
+       interrupt, needed for the driver to refill the TX FIFO, clears */
+    (void) XUartPs_Recv(&trace_uart, trace_rx_discard, sizeof trace_rx_discard);
+  }
+}
+
+/* Queue a frame.  Under interrupts the driver refills the TX FIFO from
+   the frame as it empties; polled, fill it whenever there is room. */
+static void uart_trace_tx(u8 *frame, u32 len)
+{
+  u32 sent = 0;
+
+  while (trace_uart_busy) {
+  }
+  if (trace_uart_irq) {
+    trace_uart_busy = 1;
+    (void) XUartPs_Send(&trace_uart, frame, len);
+    return;
+  }
+  while (sent < len) {
+    sent += XUartPs_Send(&trace_uart, frame + sent, len - sent);
+  }
+}
+
+u32 uart_trace_build_frame(u8 *frame, u32 seq, const void *data, u32 len)
+{
+  put_le32(frame, UART_TRACE_MAGIC);
+  put_le32(frame + 4, seq);
+  put_le32(frame + 8, len);
+  if (len > 0) {
+    memcpy(frame + 12, data, len);
+  }
+  put_le32(frame + 12 + len, uart_crc32(0, frame + 4, len + 8));
+  return len + UART_TRACE_OVERHEAD;
+}
+
+/* Build the next frame in the buffer not being sent, then queue it */
+static void uart_trace_frame(const u8 *data, u32 len)
+{
+  u8 *frame = trace_frames[trace_frame_next];
+
+  uart_trace_tx(frame, uart_trace_build_frame(frame, trace_seq++, data, len));
+  trace_frame_next ^= 1;
+}
+
+int uart_trace_init(u16 device_id, u32 baud, XScuGic *gic, u32 irq_id)
+{
+  XUartPs_Config *config;
+
+  if (trace_uart_is_ready) {
+    uart_trace_flush();
+  }
+  trace_uart_is_ready = 0;
+  config = XUartPs_LookupConfig(device_id);
+  if (config == NULL) {
+    return -1;
+  }
+  /* Let console output go out at the old rate */
+  while (!(XUartPs_ReadReg(config->BaseAddress, XUARTPS_SR_OFFSET) & XUARTPS_SR_TXEMPTY)) {
+  }
+  if (XUartPs_CfgInitialize(&trace_uart, config, config->BaseAddress) != XST_SUCCESS) {
+    return -1;
+  }
+  if (baud != 0 && XUartPs_SetBaudRate(&trace_uart, baud) != XST_SUCCESS) {
+    return -1;
+  }
+  trace_uart_irq = 0;
+  trace_uart_busy = 0;
+  if (gic != NULL) {
+    XUartPs_SetHandler(&trace_uart, (XUartPs_Handler) uart_trace_handler, &trace_uart);
+    if (XScuGic_Connect(gic, irq_id, (Xil_InterruptHandler) XUartPs_InterruptHandler,
+                        &trace_uart) != XST_SUCCESS) {
+      return -1;
+    }
+    (void) XUartPs_Recv(&trace_uart, trace_rx_discard, sizeof trace_rx_discard);
+    XUartPs_SetInterruptMask(&trace_uart, XUARTPS_IXR_RXOVR);
+    XScuGic_Enable(gic, irq_id);
+    trace_uart_irq = 1;
+  }
+  trace_seq = 0;
+  trace_frame_next = 0;
+  trace_uart_is_ready = 1;
+  return 0;
+}
+
+int uart_trace_ready(void)
+{
+  return trace_uart_is_ready;
+}
+
+int uart_trace_send(const void *buf, u32 nbytes)
+{
+  const u8 *p = (const u8 *) buf;
+  u32 n, left = nbytes;
+
+  if (!trace_uart_is_ready) {
+    return -1;
+  }
+  while (left > 0) {
+    n = (left < UART_TRACE_MAX_PAYLOAD) ? left : UART_TRACE_MAX_PAYLOAD;
+    uart_trace_frame(p, n);
+    p += n;
+    left -= n;
+  }
+  return (int) nbytes;
+}
+
+int uart_trace_end(void)
+{
+  if (!trace_uart_is_ready) {
+    return -1;
+  }
+  uart_trace_frame(NULL, 0);
+  uart_trace_flush();
+  trace_seq = 0;
+  return 0;
+}
+
+void uart_trace_flush(void)
+{
+  if (!trace_uart_is_ready) {
+    return;
+  }
+  while (trace_uart_busy) {
+  }
+  while (!XUartPs_IsTransmitEmpty(&trace_uart)) {
+  }
+}